@@ -16,7 +16,9 @@
 #define FPL_FLATUI_H
 
 #include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 #if defined(_MSC_VER)
 #include <BaseTsd.h>
@@ -24,6 +26,8 @@ typedef SSIZE_T ssize_t;
 #endif
 
 #include "font_manager.h"
+#include "flatui/image_atlas.h"
+#include "flatui/internal/draw_list.h"
 #include "flatui/version.h"
 #include "fplbase/asset_manager.h"
 #include "fplbase/input.h"
@@ -53,6 +57,105 @@ void Run(fplbase::AssetManager &assetman, FontManager &fontman,
          fplbase::InputSystem &input,
          const std::function<void()> &gui_definition);
 
+/// @cond FLATUI_INTERNAL
+struct PersistentState;
+/// @endcond
+
+/// @class GuiContext
+///
+/// @brief State of a GUI that persists across frames, such as the element that
+/// has the input focus, the pointer captures and the text edit state.
+///
+/// Independent GUIs (e.g. split-screen HUDs, in-world panels or debug overlays)
+/// each use their own context, so that they can be built concurrently with
+/// `BuildGui()`. `Run()` uses a default context.
+class GuiContext {
+ public:
+  GuiContext();
+  ~GuiContext();
+
+ private:
+  friend class InternalState;
+  std::unique_ptr<PersistentState> persistent_;
+
+  // Disable copy constructor.
+  GuiContext(const GuiContext &);
+  GuiContext &operator=(const GuiContext &);
+};
+
+/// @brief Build a GUI into a draw list, without rendering it.
+///
+/// This runs the same passes as `Run()`, but the rendering commands are
+/// recorded into `draw_list` and the font atlas texture is not uploaded, so
+/// the function can be called from threads without an OpenGL context. GUIs
+/// with their own GuiContext and DrawList can be built concurrently, sharing
+/// the AssetManager, FontManager and InputSystem. Render the draw lists with
+/// `SubmitGui()` from the rendering thread.
+///
+/// @note Call `FontManager::StartLayoutPass()` before building the GUIs of a
+/// frame. Shaders and textures need to be loaded beforehand. The text locale
+/// and direction are shared by the GUIs using the FontManager, and only one of
+/// them should have a focused `Edit()` element at a time.
+/// `CustomElement()` renderers are called by `SubmitGui()`.
+///
+/// @param[in,out] context The state of the GUI kept across frames.
+/// @param[in] assetman The AssetManager you want to use textures from.
+/// @param[in] fontman The FontManager to be used by the GUI.
+/// @param[in] input The InputSystem to be used by the GUI.
+/// @param[in] gui_definition A function that defines all GUI elements using the
+/// GUI element construction functions.
+/// @param[out] draw_list The DrawList receiving the rendering commands. It is
+/// cleared first.
+void BuildGui(GuiContext &context, fplbase::AssetManager &assetman,
+              FontManager &fontman, fplbase::InputSystem &input,
+              const std::function<void()> &gui_definition,
+              DrawList *draw_list);
+
+/// @struct GuiBuild
+///
+/// @brief A GUI to build with `BuildGuis()`.
+struct GuiBuild {
+  /// @var context
+  /// @brief The state of the GUI kept across frames.
+  GuiContext *context;
+
+  /// @var gui_definition
+  /// @brief A function that defines all GUI elements of the GUI.
+  std::function<void()> gui_definition;
+
+  /// @var draw_list
+  /// @brief The DrawList receiving the rendering commands of the GUI.
+  DrawList *draw_list;
+};
+
+/// @brief Build several GUIs into draw lists in parallel.
+///
+/// Each GUI is built like with `BuildGui()`, in a task of the scheduler of
+/// the FontManager (see `FontManager::SetTaskScheduler()`). The function
+/// returns once all of them have been built. Without a scheduler, the GUIs
+/// are built one after the other on the calling thread.
+///
+/// @param[in] assetman The AssetManager you want to use textures from.
+/// @param[in] fontman The FontManager to be used by the GUIs.
+/// @param[in] input The InputSystem to be used by the GUIs.
+/// @param[in] builds The GUIs to build. Each needs its own GuiContext and
+/// DrawList.
+void BuildGuis(fplbase::AssetManager &assetman, FontManager &fontman,
+               fplbase::InputSystem &input,
+               const std::vector<GuiBuild> &builds);
+
+/// @brief Render draw lists built with `BuildGui()`.
+///
+/// The draw lists are rendered in the order of the vector, so later ones are
+/// rendered on top of earlier ones. Uploads the glyphs cached while building
+/// the draw lists to the font atlas texture first.
+///
+/// @param[in,out] assetman The AssetManager the shaders are loaded with.
+/// @param[in] fontman The FontManager the GUIs have been built with.
+/// @param[in] draw_lists The draw lists to render.
+void SubmitGui(fplbase::AssetManager &assetman, FontManager &fontman,
+               const std::vector<const DrawList *> &draw_lists);
+
 /// @enum Event
 ///
 /// @brief Event types are returned by most interactive elements. These are
@@ -304,18 +407,72 @@ void Label(const char *text, float ysize);
 /// the label in this case.
 void Label(const char *text, float ysize, const mathfu::vec2 &size);
 
+/// @brief Render a label of a UTF-16 text as a GUI element.
+///
+/// The text is laid out without converting it to UTF-8, e.g. for strings
+/// from Java or Windows.
+///
+/// @param[in] text A UTF-16 text to be displayed as the label.
+/// @param[in] length The length of the text in UTF-16 code units.
+/// @param[in] ysize A float containing the vertical size in virtual resolution.
+///
+/// @note The x-size will be derived automatically based on the text length.
+void Label(const uint16_t *text, size_t length, float ysize);
+
+/// @brief Render a multi-line label of a UTF-16 text as a GUI element.
+///
+/// @param[in] text A UTF-16 text to be displayed as the label.
+/// @param[in] length The length of the text in UTF-16 code units.
+/// @param[in] ysize A float containing the vertical size in virtual resolution.
+/// @param[in] size The max size of the label in virtual resolution. A `0` for
+/// `size.y` indicates no height restriction. The API renders the whole text in
+/// the label in this case.
+void Label(const uint16_t *text, size_t length, float ysize,
+           const mathfu::vec2 &size);
+
+/// @brief Render the textures packed in an image atlas from its pages.
+///
+/// Affects `Image()`, `ImageBackground()` and `RenderTexture()` calls that
+/// follow in the GUI definition. Textures that are not in the atlas are
+/// rendered from their own texture.
+///
+/// @param[in] atlas The ImageAtlas to use, or `nullptr` to stop using it.
+void UseImageAtlas(const ImageAtlas *atlas);
+
 /// @brief Set the Label's text color.
 ///
 /// @param[in] color A vec4 representing the RGBA values that the text color
 /// should be set to.
 void SetTextColor(const mathfu::vec4 &color);
 
+/// @brief Set an outline or a shadow rendered around the Label's glyphs.
+///
+/// The effect is baked into the glyph images in the glyph cache. A Label with
+/// an outline renders with a single draw call, like a plain Label, and a
+/// Label with a shadow draws the shadow and then the plain Label.
+///
+/// @param[in] effect The GlyphEffectType to render. `kGlyphEffectNone` turns
+/// the effect off.
+/// @param[in] size The outline width or the shadow blur and offset, in virtual
+/// resolution.
+/// @param[in] color A vec4 representing the RGBA values of the effect.
+void SetTextEffect(GlyphEffectType effect, float size,
+                   const mathfu::vec4 &color);
+
 /// @brief Set the Label's font.
 ///
 /// @param[in] font_name A C-string corresponding to the name of the font
 /// that should be set.
 void SetTextFont(const char *font_name);
 
+/// @brief Set the Label's font with its handle (see `FontManager::Open()`).
+///
+/// Switching fonts with handles doesn't hash the font names, which is cheaper
+/// for GUIs switching fonts per label.
+///
+/// @param[in] handle The handle of the font that should be set.
+void SetTextFont(FontHandle handle);
+
 /// @brief Set a locale used for the text rendering.
 ///
 /// @param[in] locale A C-string corresponding to the of the
@@ -481,6 +638,57 @@ void SetScrollSpeed(float scroll_speed_drag, float scroll_speed_wheel,
 /// `StartGroup()` and before any elements.
 void SetDragStartThreshold(int drag_start_threshold);
 
+/// @struct PointerSample
+///
+/// @brief A position of the primary pointer, sampled at a given time.
+///
+/// Touch panels often report positions several times per rendered frame.
+/// Passing them to `SetPointerSamples()` lets drags follow the pointer more
+/// closely than the single position per frame of the InputSystem.
+struct PointerSample {
+  /// @var position
+  ///
+  /// @brief The position of the pointer in physical pixels.
+  mathfu::vec2i position;
+
+  /// @var time
+  ///
+  /// @brief The time of the sample in seconds. Any clock can be used, as long
+  /// as the display times given to `SetPointerSamples()` use the same one.
+  double time;
+};
+
+/// @brief Predict the position of the pointer at a given time.
+///
+/// The velocity of the pointer is fitted to the samples received in the last
+/// 50ms, and the latest sample is extrapolated by up to 50ms.
+///
+/// @param[in] samples The pointer samples, ordered by time.
+/// @param[in] count The number of samples. Needs to be at least 1.
+/// @param[in] time The time to predict the position at.
+///
+/// @return Returns the predicted position in physical pixels.
+mathfu::vec2 PredictPointerPosition(const PointerSample *samples,
+                                    size_t count, double time);
+
+/// @brief Set the pointer samples received since the previous frame.
+///
+/// Drags of scrolling areas and sliders then follow the position predicted
+/// for the time the frame is displayed, instead of the position of the
+/// InputSystem. Drag deltas integrate all the samples, so samples in between
+/// frames aren't dropped. Frames without samples use the InputSystem.
+///
+/// @param[in] samples The pointer samples, ordered by time. They are only
+/// used during the call.
+/// @param[in] count The number of samples.
+/// @param[in] display_time The time the frame is expected to be displayed,
+/// on the clock of the samples.
+///
+/// @note Call `SetPointerSamples()` at the start of the GUI definition,
+/// before any groups.
+void SetPointerSamples(const PointerSample *samples, size_t count,
+                       double display_time);
+
 /// @brief Set the background color for the group.
 ///
 /// @param[in] color A vec4 representing the background color that should be
@@ -0,0 +1,86 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FONT_DECODER_H
+#define FPL_FONT_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+namespace flatui {
+
+/// @file
+/// @addtogroup flatui_font_manager
+/// @{
+
+/// @class FontDecoder
+///
+/// @brief FontDecoder decodes compressed font assets (e.g. zstd compressed
+/// OTF files) when they are opened (see `FontManager::SetFontDecoder()`).
+///
+/// Decoders pass the decoded font to a writer in chunks, so that the font can
+/// be written to the cache of decoded fonts (see
+/// `FontManager::SetFontCacheDirectory()`) without keeping a decompressed copy
+/// on the heap.
+class FontDecoder {
+ public:
+  /// @typedef Writer
+  /// @brief Receives the decoded font, chunk by chunk and in order. Returns
+  /// `false` if the chunk can't be written, which aborts the decoding.
+  typedef std::function<bool(const uint8_t *data, size_t size)> Writer;
+
+  virtual ~FontDecoder() {}
+
+  /// @brief Check if an asset is in a format of the decoder, typically by
+  /// looking at its signature.
+  ///
+  /// @param[in] data The asset.
+  /// @param[in] size The size of the asset, in bytes.
+  ///
+  /// @return Returns `true` if the asset needs to be decoded by the decoder.
+  /// Other assets are opened as they are.
+  virtual bool CanDecode(const uint8_t *data, size_t size) const = 0;
+
+  /// @brief Decode an asset.
+  ///
+  /// @param[in] data The asset.
+  /// @param[in] size The size of the asset, in bytes.
+  /// @param[in] writer The writer receiving the decoded font.
+  ///
+  /// @return Returns `true` if the whole asset has been decoded and written.
+  virtual bool Decode(const uint8_t *data, size_t size,
+                      const Writer &writer) = 0;
+};
+
+#if defined(FLATUI_USE_ZSTD)
+/// @class ZstdFontDecoder
+///
+/// @brief ZstdFontDecoder decodes fonts compressed with zstd (e.g.
+/// `zstd -19 font.otf`), streaming the decoded font to the writer.
+///
+/// It's available when FlatUI is built with `FLATUI_USE_ZSTD` (see the
+/// `flatui_use_zstd` CMake option).
+class ZstdFontDecoder : public FontDecoder {
+ public:
+  virtual bool CanDecode(const uint8_t *data, size_t size) const;
+  virtual bool Decode(const uint8_t *data, size_t size, const Writer &writer);
+};
+#endif  // defined(FLATUI_USE_ZSTD)
+
+/// @}
+
+}  // namespace flatui
+
+#endif  // FPL_FONT_DECODER_H
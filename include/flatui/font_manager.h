@@ -15,6 +15,7 @@
 #ifndef FONT_MANAGER_H
 #define FONT_MANAGER_H
 
+#include <mutex>
 #include <set>
 
 /// @cond FLATUI_INTERNAL
@@ -26,7 +27,13 @@
 
 #include "fplbase/renderer.h"
 #include "flatui/internal/glyph_cache.h"
+#include "flatui/internal/flatui_config.h"
 #include "flatui/internal/flatui_util.h"
+#include "flatui/internal/font_buffer_arena.h"
+#include "flatui/internal/mapped_file.h"
+#include "flatui/font_decoder.h"
+#include "flatui/task_scheduler.h"
+#include "flatui/text_mesh.h"
 
 // Forward decls for FreeType & Harfbuzz
 typedef struct FT_LibraryRec_ *FT_Library;
@@ -50,7 +57,19 @@ class FontBuffer;
 class FontMetrics;
 class WordEnumerator;
 class FaceData;
+class GlyphRasterizer;
+struct GlyphBatch;
+class GlyphStore;
+struct AppendState;
+struct CachedFontHeader;
+struct LayoutCursor;
+struct LayoutResumePoint;
+struct LayoutSettings;
+struct ParallelLayout;
 struct ScriptInfo;
+struct ShapedText;
+struct ShapedTextTable;
+struct ShapedRun;
 /// @endcond
 
 /// @var kFreeTypeUnit
@@ -65,12 +84,16 @@ const int32_t kFreeTypeUnit = 64;
 /// @var kGlyphCacheWidth
 ///
 /// @brief The Default size of the glyph cache width.
-const int32_t kGlyphCacheWidth = 1024;
+///
+/// Set with `FLATUI_GLYPH_CACHE_WIDTH` at build time.
+const int32_t kGlyphCacheWidth = FLATUI_GLYPH_CACHE_WIDTH;
 
 /// @var kGlyphCacheHeight
 ///
 /// @brief The default size of the glyph cache height.
-const int32_t kGlyphCacheHeight = 1024;
+///
+/// Set with `FLATUI_GLYPH_CACHE_HEIGHT` at build time.
+const int32_t kGlyphCacheHeight = FLATUI_GLYPH_CACHE_HEIGHT;
 
 /// @var kLineHeightDefault
 ///
@@ -90,6 +113,17 @@ const mathfu::vec2i kCaretPositionInvalid = mathfu::vec2i(-1, -1);
 /// @brief The default language used for a line break.
 const char *const kDefaultLanguage = "en";
 
+/// @typedef FontHandle
+///
+/// @brief A handle of a font face opened by a FontManager (see
+/// `FontManager::Open()`).
+typedef int32_t FontHandle;
+
+/// @var kInvalidFontHandle
+///
+/// @brief A sentinel value representing no font face.
+const FontHandle kInvalidFontHandle = -1;
+
 /// @enum TextLayoutDirection
 ///
 /// @brief Specify how to layout texts.
@@ -101,6 +135,79 @@ enum TextLayoutDirection {
   TextLayoutDirectionTTB = 2,
 };
 
+/// @enum GlyphEffectType
+///
+/// @brief Effect rendered around glyphs.
+///
+/// The effect is baked into the glyph images in the glyph cache.
+enum GlyphEffectType {
+  kGlyphEffectNone = 0,
+  /// Outline dilated from the glyphs by the effect size. The glyph images
+  /// hold the glyphs together with their outline, so that a text with an
+  /// outline renders with one draw call, using the `font_effect` shader.
+  kGlyphEffectOutline = 1,
+  /// Shadow blurred by the effect size and offset to the bottom right by the
+  /// effect size. The glyph images only hold the shadow, which is drawn with
+  /// the `font` shader before the text without an effect.
+  kGlyphEffectShadow = 2,
+};
+
+/// @enum CacheScopePolicy
+///
+/// @brief What happens to the FontBuffers of a cache scope once it's popped.
+/// See `FontManager::PushCacheScope()`.
+enum CacheScopePolicy {
+  /// The buffers are kept until the scope is discarded or the cache flushed.
+  kCacheScopeRetain = 0,
+  /// The buffers are kept while the buffers of all the demoted scopes fit the
+  /// budget set with `FontManager::SetDemotedScopeBudget()`. The scopes
+  /// demoted the longest ago are discarded first.
+  kCacheScopeDemote = 1,
+  /// The buffers are discarded by the next `FontManager::StartLayoutPass()`.
+  kCacheScopeDiscard = 2,
+};
+
+/// @struct FontVertex
+///
+/// @brief This struct holds all the font vertex data.
+struct FontVertex {
+  /// @brief The constructor for a FontVertex.
+  ///
+  /// @param[in] x A float representing the `x` position of the vertex.
+  /// @param[in] y A float representing the `y` position of the vertex.
+  /// @param[in] z A float representing the `z` position of the vertex.
+  /// @param[in] u A float representing the `u` value in the UV mapping.
+  /// @param[in] v A float representing the `v` value in the UV mapping.
+  FontVertex(const float x, const float y, const float z, const float u,
+             const float v) {
+    position_.data[0] = x;
+    position_.data[1] = y;
+    position_.data[2] = z;
+    uv_.data[0] = u;
+    uv_.data[1] = v;
+  }
+
+  /// @cond FONT_MANAGER_INTERNAL
+  mathfu::vec3_packed position_;
+  mathfu::vec2_packed uv_;
+  /// @endcond
+};
+
+/// @struct FontCaretCluster
+///
+/// @brief Caret positions of a glyph cluster in a FontBuffer.
+///
+/// A cluster holds a caret per character it covers, so a ligature glyph
+/// (e.g. 'ff') has several carets. Caret `i` (from 1 to `count`) is at
+/// `origin + (step * i, 0)`.
+struct FontCaretCluster {
+  /// @cond FONT_MANAGER_INTERNAL
+  mathfu::vec2_packed origin;
+  float step;
+  int32_t count;
+  /// @endcond
+};
+
 /// @class FontBufferParameters
 ///
 /// @brief This class that includes font buffer parameters. It is used as a key
@@ -113,7 +220,8 @@ class FontBufferParameters {
         text_id_(kNullHash),
         font_size_(0),
         size_(mathfu::kZeros2i),
-        caret_info_(false) {}
+        glyph_effect_(kGlyphEffectNone),
+        glyph_effect_size_(0) {}
 
   /// @brief Constructor for a FontBufferParameters.
   ///
@@ -121,16 +229,19 @@ class FontBufferParameters {
   /// @param[in] text_id The HashedID for the text.
   /// @param[in] font_size A float representing the size of the font.
   /// @param[in] size The size of the FontBuffer.
-  /// @param[in] caret_info A bool determining if the font buffer contains caret
-  /// info.
+  /// @param[in] glyph_effect The effect rendered around the glyphs.
+  /// @param[in] glyph_effect_size The size of the effect in pixels.
   FontBufferParameters(const HashedId font_id, const HashedId text_id,
                        float font_size, const mathfu::vec2i &size,
-                       bool caret_info) {
+                       GlyphEffectType glyph_effect = kGlyphEffectNone,
+                       int32_t glyph_effect_size = 0) {
     font_id_ = font_id;
     text_id_ = text_id;
     font_size_ = font_size;
     size_ = size;
-    caret_info_ = caret_info;
+    glyph_effect_ = glyph_effect;
+    glyph_effect_size_ =
+        glyph_effect != kGlyphEffectNone ? glyph_effect_size : 0;
   }
 
   /// @brief The equal-to operator for comparing FontBufferParameters for
@@ -144,7 +255,9 @@ class FontBufferParameters {
   bool operator==(const FontBufferParameters &other) const {
     return (font_id_ == other.font_id_ && text_id_ == other.text_id_ &&
             font_size_ == other.font_size_ && size_.x() == other.size_.x() &&
-            size_.y() == other.size_.y() && caret_info_ == other.caret_info_);
+            size_.y() == other.size_.y() &&
+            glyph_effect_ == other.glyph_effect_ &&
+            glyph_effect_size_ == other.glyph_effect_size_);
   }
 
   /// @brief The hash function for FontBufferParameters.
@@ -157,12 +270,16 @@ class FontBufferParameters {
     // Note that font_id_ and text_id_ are already hashed values.
     size_t value = (font_id_ ^ (text_id_ << 1)) >> 1;
     value = value ^ (std::hash<float>()(key.font_size_) << 1) >> 1;
-    value = value ^ (std::hash<bool>()(key.caret_info_) << 1) >> 1;
     value = value ^ (std::hash<int32_t>()(key.size_.x()) << 1) >> 1;
     value = value ^ (std::hash<int32_t>()(key.size_.y()) << 1) >> 1;
+    value =
+        value ^ (std::hash<uint32_t>()(key.get_glyph_effect_id()) << 1) >> 1;
     return value;
   }
 
+  /// @return Returns a hash value of the font.
+  HashedId get_font_id() const { return font_id_; }
+
   /// @return Returns a hash value of the text.
   HashedId get_text_id() const { return text_id_; }
 
@@ -172,15 +289,74 @@ class FontBufferParameters {
   /// @return Returns the font size.
   float get_font_size() const { return font_size_; }
 
-  /// @return Returns a flag to indicate if the buffer has caret info.
-  bool get_caret_info_flag() const { return caret_info_; }
+  /// @return Returns the effect rendered around the glyphs.
+  GlyphEffectType get_glyph_effect() const { return glyph_effect_; }
+
+  /// @return Returns the size of the glyph effect in pixels.
+  int32_t get_glyph_effect_size() const { return glyph_effect_size_; }
+
+  /// @return Returns an id of the glyph effect and its size, 0 for no effect.
+  uint32_t get_glyph_effect_id() const {
+    return (static_cast<uint32_t>(glyph_effect_) << 16) |
+           static_cast<uint32_t>(glyph_effect_size_);
+  }
 
  private:
   HashedId font_id_;
   HashedId text_id_;
   float font_size_;
   mathfu::vec2i size_;
-  bool caret_info_;
+  GlyphEffectType glyph_effect_;
+  int32_t glyph_effect_size_;
+};
+
+/// @struct TextCost
+///
+/// @brief Layout costs attributed to a text by the FontManager cost report
+/// (see `FontManager::EnableCostReport()`).
+struct TextCost {
+  TextCost()
+      : requests(0),
+        layouts(0),
+        glyphs_rasterized(0),
+        uv_refreshes(0),
+        layout_time(0.0),
+        uv_time(0.0) {}
+
+  /// @var parameters
+  /// @brief Parameters of the text. The text id is also the element hash of a
+  /// Label showing the text.
+  FontBufferParameters parameters;
+
+  /// @var text
+  /// @brief Leading part of the text, for display.
+  std::string text;
+
+  /// @var requests
+  /// @brief Number of `GetBuffer()` calls for the text.
+  uint32_t requests;
+
+  /// @var layouts
+  /// @brief Number of times the text has been laid out, i.e. `GetBuffer()`
+  /// calls that missed the FontBuffer cache.
+  uint32_t layouts;
+
+  /// @var glyphs_rasterized
+  /// @brief Number of glyphs rasterized for the text.
+  uint32_t glyphs_rasterized;
+
+  /// @var uv_refreshes
+  /// @brief Number of times the UVs of the cached FontBuffer have been
+  /// refreshed after the glyph cache revision changed.
+  uint32_t uv_refreshes;
+
+  /// @var layout_time
+  /// @brief Seconds spent laying out the text, including the rasterization.
+  double layout_time;
+
+  /// @var uv_time
+  /// @brief Seconds spent refreshing the UVs, including the rasterization.
+  double uv_time;
 };
 
 /// @class FontManager
@@ -191,8 +367,11 @@ class FontBufferParameters {
 /// It opens speficied OpenType/TrueType font and rasterize to OpenGL texture.
 /// An application can use the generated texture for a text rendering.
 ///
-/// @warning The class is not threadsafe, it's expected to be only used from
-/// within OpenGL rendering thread.
+/// @note `GetBuffer()`, `GetTexture()`, `Open()`/`Close()` and the pass and
+/// text setting APIs are serialized with an internal mutex, so that GUIs can
+/// be built from multiple threads (see `BuildGui()`). The APIs that upload the
+/// atlas texture (`StartRenderPass()`, `FlushAndUpdate()`) are expected to be
+/// used only from within OpenGL rendering thread.
 class FontManager {
  public:
   /// @brief The default constructor for FontManager.
@@ -213,6 +392,10 @@ class FontManager {
   ///
   /// In this version it supports only single face at a time.
   ///
+  /// Compressed assets are decoded with the font decoder (see
+  /// `SetFontDecoder()`), into the cache of decoded fonts when there is one
+  /// (see `SetFontCacheDirectory()`).
+  ///
   /// @param[in] font_name A C-string in UTF-8 format representing
   /// the name of the font.
   ///
@@ -221,6 +404,23 @@ class FontManager {
   /// if the font is opened successfully.
   bool Open(const char *font_name);
 
+  /// @brief Open a font face, TTF, OT font, and retrieve its handle.
+  ///
+  /// Selecting a font face with its handle is an array lookup, which is
+  /// cheaper than with its name. Apps switching fonts per label keep the
+  /// handles of their fonts.
+  ///
+  /// @param[in] font_name A C-string in UTF-8 format representing
+  /// the name of the font.
+  /// @param[out] handle Set to the handle of the face, or to
+  /// `kInvalidFontHandle` if it couldn't be opened. When the font has already
+  /// been opened, it's set to the handle of the opened face. Handles are valid
+  /// until the face is closed, and aren't reused.
+  ///
+  /// @return Returns `false` when failing to open font, or when the font has
+  /// already been opened. Returns `true` if the font is opened successfully.
+  bool Open(const char *font_name, FontHandle *handle);
+
   /// @brief Discard a font face that has been opened via `Open()`.
   ///
   /// @param[in] font_name A C-string in UTF-8 format representing
@@ -242,6 +442,31 @@ class FontManager {
   /// returns false.
   bool SelectFont(const char *font_name);
 
+  /// @brief Select the current font face with its handle.
+  ///
+  /// @param[in] handle The handle of the face, returned by `Open()`.
+  ///
+  /// @return Returns `true` if the font was selected successfully. Otherwise it
+  /// returns false.
+  bool SelectFont(FontHandle handle);
+
+  /// @brief Look up the handle of an opened font face.
+  ///
+  /// @param[in] font_name A C-string in UTF-8 format representing
+  /// the name of the font.
+  ///
+  /// @return Returns the handle, or `kInvalidFontHandle` if the font isn't
+  /// opened.
+  FontHandle GetFontHandle(const char *font_name);
+
+  /// @brief Look up an opened font face with its handle.
+  ///
+  /// @param[in] handle The handle of the face.
+  ///
+  /// @return Returns the face, or `nullptr` if the handle is invalid or the
+  /// face has been closed.
+  FaceData *GetFace(FontHandle handle);
+
   /// @brief Retrieve a texture with the given text.
   ///
   /// @note This API doesn't use the glyph cache, instead it writes the string
@@ -269,7 +494,109 @@ class FontManager {
   ///  When this happens, caller may flush the glyph cache with
   /// `FlushAndUpdate()` call and re-try the `GetBuffer()` call.
   FontBuffer *GetBuffer(const char *text, const size_t length,
-                        const FontBufferParameters &parameters);
+                        const FontBufferParameters &parameters) {
+    return GetBuffer(text, length, parameters, true);
+  }
+
+  /// @brief Retrieve a vertex buffer for a font rendering using glyph cache.
+  ///
+  /// The text is laid out with the font face specified in the parameters,
+  /// regardless of the current font face.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text for the
+  /// FontBuffer.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  /// @param[in] flush_when_full `true` to flush the glyph cache and upload the
+  /// atlas texture when the text doesn't fit in the cache. Specify `false`
+  /// when calling the API from a thread without an OpenGL context.
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  ///
+  /// @note When other threads use the FontManager, hold the mutex returned by
+  /// `get_mutex()` while accessing the returned FontBuffer.
+  FontBuffer *GetBuffer(const char *text, const size_t length,
+                        const FontBufferParameters &parameters,
+                        bool flush_when_full) {
+    return GetBuffer(text, length, parameters, flush_when_full, false);
+  }
+
+  /// @brief Retrieve a vertex buffer for a font rendering using glyph cache.
+  ///
+  /// Multi-line texts are laid out down to the bottom of their box, the lines
+  /// below it aren't laid out (see `FontBuffer::get_partial()`), so that long
+  /// texts clipped by a small box are cheap. Texts scrolled through, e.g. the
+  /// text of an edit box, set `all_lines`. A buffer laid out without the
+  /// lines below the box is laid out again the first time they're needed.
+  ///
+  /// @param[in] text A C-string in UTF-8 format with the text for the
+  /// FontBuffer.
+  /// @param[in] length The length of the text string.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  /// @param[in] flush_when_full `true` to flush the glyph cache and upload the
+  /// atlas texture when the text doesn't fit in the cache. Specify `false`
+  /// when calling the API from a thread without an OpenGL context.
+  /// @param[in] all_lines `true` to lay out the lines below the box too.
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  FontBuffer *GetBuffer(const char *text, const size_t length,
+                        const FontBufferParameters &parameters,
+                        bool flush_when_full, bool all_lines);
+
+  /// @brief Retrieve a vertex buffer for a font rendering of a UTF-16 text.
+  ///
+  /// UTF-16 texts are laid out without converting them to UTF-8, e.g. for
+  /// strings from Java or Windows. Caret positions are per character, like
+  /// the ones of UTF-8 texts.
+  ///
+  /// @param[in] text A UTF-16 text for the FontBuffer.
+  /// @param[in] length The length of the text in UTF-16 code units.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer. Hash the text with `HashId(text, length)` for its
+  /// text ID.
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  ///  When this happens, caller may flush the glyph cache with
+  /// `FlushAndUpdate()` call and re-try the `GetBuffer()` call.
+  FontBuffer *GetBuffer(const uint16_t *text, const size_t length,
+                        const FontBufferParameters &parameters) {
+    return GetBuffer(text, length, parameters, true);
+  }
+
+  /// @brief Retrieve a vertex buffer for a font rendering of a UTF-16 text.
+  ///
+  /// @param[in] text A UTF-16 text for the FontBuffer.
+  /// @param[in] length The length of the text in UTF-16 code units.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  /// @param[in] flush_when_full `true` to flush the glyph cache and upload the
+  /// atlas texture when the text doesn't fit in the cache. Specify `false`
+  /// when calling the API from a thread without an OpenGL context.
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  FontBuffer *GetBuffer(const uint16_t *text, const size_t length,
+                        const FontBufferParameters &parameters,
+                        bool flush_when_full) {
+    return GetBuffer(text, length, parameters, flush_when_full, false);
+  }
+
+  /// @brief Retrieve a vertex buffer for a font rendering of a UTF-16 text.
+  ///
+  /// @param[in] text A UTF-16 text for the FontBuffer.
+  /// @param[in] length The length of the text in UTF-16 code units.
+  /// @param[in] parameters The FontBufferParameters specifying the parameters
+  /// for the FontBuffer.
+  /// @param[in] flush_when_full `true` to flush the glyph cache and upload the
+  /// atlas texture when the text doesn't fit in the cache.
+  /// @param[in] all_lines `true` to lay out the lines below the box too (see
+  /// the UTF-8 version).
+  ///
+  /// @return Returns `nullptr` if the string does not fit in the glyph cache.
+  FontBuffer *GetBuffer(const uint16_t *text, const size_t length,
+                        const FontBufferParameters &parameters,
+                        bool flush_when_full, bool all_lines);
 
   /// @brief Set the renderer to be used to create texture instances.
   ///
@@ -305,7 +632,60 @@ class FontManager {
   /// @brief Flush the existing FontBuffer in the cache.
   ///
   /// Call this API when FontBuffers are not used anymore.
-  void FlushLayout() { map_buffers_.clear(); }
+  void FlushLayout() {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    ClearBuffers();
+  }
+
+  /// @brief Start a cache scope, e.g. a screen of the app.
+  ///
+  /// FontBuffers created while the scope is the innermost one belong to it,
+  /// and are retained, demoted or discarded together when it's popped.
+  /// Buffers created outside of any scope stay until the cache is flushed.
+  /// Pushing a scope again, e.g. when returning to a screen, reactivates it,
+  /// so that its buffers are hit again if they have been kept.
+  ///
+  /// @param[in] name The name of the scope.
+  ///
+  /// @note Scopes are shared by the threads using the FontManager, push them
+  /// around GUIs that are built one at a time.
+  void PushCacheScope(const char *name);
+
+  /// @brief End the innermost cache scope, retaining its FontBuffers.
+  void PopCacheScope() { PopCacheScope(kCacheScopeRetain); }
+
+  /// @brief End the innermost cache scope.
+  ///
+  /// @param[in] policy What to do with the FontBuffers of the scope.
+  void PopCacheScope(CacheScopePolicy policy);
+
+  /// @brief Discard the FontBuffers of a cache scope that isn't active, at
+  /// the next `StartLayoutPass()`.
+  ///
+  /// @param[in] name The name of the scope.
+  void DiscardCacheScope(const char *name) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    SetCacheScopePolicy(HashId(name), kCacheScopeDiscard);
+  }
+
+  /// @brief Set the storage the FontBuffers of demoted scopes can use.
+  ///
+  /// @param[in] bytes The budget in bytes. The default is
+  /// `FLATUI_DEMOTED_SCOPE_BUDGET`.
+  void SetDemotedScopeBudget(size_t bytes) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    demoted_scope_budget_ = bytes;
+  }
+
+  /// @return Returns the storage used by the FontBuffers of a cache scope, in
+  /// bytes.
+  ///
+  /// @param[in] name The name of the scope.
+  size_t GetCacheScopeStorage(const char *name) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
+    auto it = cache_scopes_.find(HashId(name));
+    return it != cache_scopes_.end() ? it->second.storage : 0;
+  }
 
   /// @brief Indicates a start of new render pass.
   ///
@@ -353,6 +733,7 @@ class FontManager {
   ///            TextLayoutDirectionLTR & TextLayoutDirectionRTL are supported.
   ///
   void SetLayoutDirection(const TextLayoutDirection direction) {
+    std::lock_guard<std::recursive_mutex> lock(mutex_);
     if (direction == TextLayoutDirectionTTB) {
       fplbase::LogError("TextLayoutDirectionTTB is not supported yet.");
       return;
@@ -377,10 +758,242 @@ class FontManager {
   /// @return Returns the current font face.
   FaceData *GetCurrentFace() { return current_face_; }
 
+  /// @return Returns the mutex serializing accesses to the FontManager.
+  /// Hold it while accessing FontBuffers when multiple threads use the
+  /// FontManager.
+  std::recursive_mutex &get_mutex() { return mutex_; }
+
+  /// @brief Specify if FontBuffers keep code points of their glyphs.
+  ///
+  /// Code points are used to update UVs of a cached FontBuffer after the glyph
+  /// cache evicted some of its glyphs. When the atlas contents are stable (e.g.
+  /// the glyph cache is large enough for the whole UI), not keeping them saves
+  /// 4 bytes per glyph. A FontBuffer without code points is laid out again if
+  /// the glyph cache revision changes.
+  ///
+  /// @param[in] retain `true` to keep code points (default).
+  void SetRetainCodePoints(bool retain) { retain_code_points_ = retain; }
+
+  /// @return Returns the arena the FontBuffers are allocated from. Use it to
+  /// retrieve memory statistics of FontBuffers.
+  const FontBufferArena &GetBufferArena() const { return *buffer_arena_; }
+
+  /// @brief Compact FontBuffer storage.
+  ///
+  /// Moves all cached FontBuffers into newly allocated pages and releases the
+  /// old ones. This is done automatically in `StartLayoutPass()` when the arena
+  /// gets fragmented.
+  void CompactBufferArena();
+
+  /// @brief Load a table of pre-shaped texts.
+  ///
+  /// A table is generated offline with `ExportShapedTexts()` (see
+  /// schemas/shaped_text.fbs). When `GetBuffer()` is called with parameters
+  /// matching an entry of a loaded table, the FontBuffer is constructed from
+  /// the entry, skipping line breaking and shaping. Only the glyphs are
+  /// looked up in the glyph cache.
+  ///
+  /// A table is only used while the locale, the layout direction and the
+  /// script are the ones it was exported with. Texts are laid out as usual
+  /// otherwise.
+  ///
+  /// @note The table is accessed in place, it's not unpacked on loading.
+  ///
+  /// @param[in] file_name A C-string in UTF-8 format representing the name of
+  /// the table file.
+  ///
+  /// @return Returns `false` if the file couldn't be loaded or is not a valid
+  /// table. Otherwise it returns `true`.
+  bool LoadShapedTexts(const char *file_name);
+
+  /// @brief Discard all tables loaded via `LoadShapedTexts()`.
+  void UnloadShapedTexts();
+
+  /// @brief Serialize the layout of cached FontBuffers as a pre-shaped text
+  /// table that can be loaded with `LoadShapedTexts()`.
+  ///
+  /// @note Buffers without code points (see `SetRetainCodePoints()`) are not
+  /// exported.
+  ///
+  /// @param[out] data A string the serialized table is stored to.
+  void ExportShapedTexts(std::string *data) const;
+
+  /// @brief Load a pre-baked glyph atlas and pin its glyphs in the glyph
+  /// cache.
+  ///
+  /// An atlas is generated offline by the flatui_atlas_baker tool (see
+  /// schemas/glyph_atlas.fbs). Its glyphs are copied into the glyph cache
+  /// without FreeType work and are never evicted, so the UVs of FontBuffers
+  /// using them stay valid.
+  ///
+  /// @note The glyph cache is flushed before the glyphs are stored. Call the
+  /// API at startup, before laying out texts.
+  ///
+  /// @param[in] file_name A C-string in UTF-8 format representing the name of
+  /// the atlas file.
+  ///
+  /// @return Returns `false` if the file couldn't be loaded, is not a valid
+  /// atlas, or its glyphs don't fit in the glyph cache. Otherwise it returns
+  /// `true`.
+  bool LoadGlyphAtlas(const char *file_name);
+
+  /// @brief Enable or disable the in-tree glyph rasterizer.
+  ///
+  /// When enabled, glyph outlines are loaded from FreeType without rendering
+  /// and rasterized by FlatUI's accumulation rasterizer, which uses SSE2 or
+  /// NEON when available. Glyphs that are not outlines (e.g. bitmap fonts) are
+  /// still rendered by FreeType. The images match FreeType's within the
+  /// difference of their curve approximations, which the
+  /// flatui_rasterizer_benchmark tool validates and measures.
+  ///
+  /// Unless a glyph effect or a GlyphStore needs a separate image, outlines
+  /// are rendered straight into their region of the glyph cache, without an
+  /// intermediate image to copy.
+  ///
+  /// @param[in] enable `true` to use the in-tree rasterizer.
+  void EnableGlyphRasterizer(bool enable);
+
+  /// @brief Set a GlyphStore shared with other FontManagers.
+  ///
+  /// Glyphs missing from the glyph cache are looked up in the store before
+  /// they are rasterized, and newly rasterized glyphs are added to it. With a
+  /// store shared by the FontManagers of an app (e.g. one per GL context),
+  /// each glyph is rasterized once, while each FontManager keeps its own
+  /// glyph cache texture.
+  ///
+  /// @param[in] store The store to share glyphs through, or `nullptr` not to
+  /// share them. The store needs to outlive the FontManager.
+  void SetGlyphStore(GlyphStore *store);
+
+  /// @brief Set the scheduler running the parallel work of the FontManager.
+  ///
+  /// With a scheduler running several tasks at once, the glyphs missing from
+  /// the glyph cache when a text is laid out are rasterized in parallel by the
+  /// in-tree rasterizer (see `EnableGlyphRasterizer()`), once the layout has
+  /// reserved their regions of the cache, and long multi line texts are split
+  /// at line feeds into paragraphs that are laid out in parallel.
+  /// `BuildGuis()` builds GUIs with the scheduler of their FontManager as
+  /// well.
+  ///
+  /// @param[in] scheduler The scheduler, e.g. an adapter to the app's job
+  /// system, or `nullptr` to run the work serially on the calling thread. The
+  /// scheduler needs to outlive the FontManager.
+  void SetTaskScheduler(TaskScheduler *scheduler);
+
+  /// @return Returns the scheduler running the parallel work of the
+  /// FontManager.
+  TaskScheduler *get_task_scheduler() const { return task_scheduler_; }
+
+  /// @brief Set the factory creating the meshes FontBuffers are rendered with.
+  ///
+  /// Each FontBuffer rendered by FlatUI keeps its glyph quads in a mesh (see
+  /// `FontBuffer::GetMesh()`), uploaded when it's first rendered and when its
+  /// UVs are refreshed. By default, the meshes are fplbase meshes.
+  ///
+  /// @param[in] factory The factory, or `nullptr` to create fplbase meshes.
+  /// The factory needs to outlive the FontManager.
+  void SetTextMeshFactory(TextMeshFactory *factory);
+
+  /// @return Returns the factory creating the meshes of the FontBuffers.
+  TextMeshFactory *get_text_mesh_factory() const { return text_mesh_factory_; }
+
+  /// @brief Set the decoder of compressed font assets.
+  ///
+  /// Fonts are opened from compressed assets (e.g. zstd compressed OTF files)
+  /// when the decoder recognizes them. By default, zstd compressed fonts are
+  /// decoded when FlatUI is built with `FLATUI_USE_ZSTD`, and assets are
+  /// opened as they are otherwise.
+  ///
+  /// @param[in] decoder The decoder, or `nullptr` to restore the default one.
+  /// The decoder needs to outlive the FontManager.
+  void SetFontDecoder(FontDecoder *decoder);
+
+  /// @return Returns the decoder of compressed font assets, or `nullptr` if
+  /// there is none.
+  FontDecoder *get_font_decoder() const { return font_decoder_; }
+
+  /// @brief Set the directory of the cache of decoded fonts.
+  ///
+  /// A compressed font is decoded into the cache the first time it's opened,
+  /// streaming it to a file, and the file is mapped in memory. Later opens
+  /// (e.g. on the next launches of the app) map the decoded font instead of
+  /// decoding the asset again. Without a cache, decoded fonts are kept on the
+  /// heap.
+  ///
+  /// Decoded fonts are looked up by the names of their assets, and record the
+  /// size and the modification time of the asset they were decoded from, so
+  /// that mapping them doesn't read the asset. Assets outside of the file
+  /// system (e.g. in an APK) are read and hashed instead, and a build can
+  /// avoid that by versioning their names. A font whose asset changed is
+  /// decoded again.
+  ///
+  /// @param[in] directory The directory, which needs to exist and be
+  /// writable (e.g. the cache directory of an Android app), or an empty
+  /// string not to cache decoded fonts.
+  void SetFontCacheDirectory(const char *directory);
+
+  /// @return Returns the directory of the cache of decoded fonts.
+  const std::string &get_font_cache_directory() const {
+    return font_cache_directory_;
+  }
+
+  /// @brief Enable or disable the per-text cost report.
+  ///
+  /// While enabled, each `GetBuffer()` call is timed and attributed to its
+  /// text, along with the layouts, glyph rasterizations and UV refreshes it
+  /// caused. Use it to find the labels that defeat the FontBuffer cache (e.g.
+  /// counters and timers). Enabling the report resets it.
+  ///
+  /// @param[in] enable `true` to record the costs.
+  void EnableCostReport(bool enable);
+
+  /// @brief Discard the recorded costs.
+  void ResetCostReport();
+
+  /// @brief Retrieve the recorded costs, the most expensive texts first.
+  ///
+  /// @param[out] report The costs of the texts requested since the report has
+  /// been reset.
+  void GetCostReport(std::vector<TextCost> *report);
+
+  /// @brief Write the recorded costs as CSV, the most expensive texts first.
+  ///
+  /// @param[out] csv The CSV text, with a header line.
+  void ExportCostReport(std::string *csv);
+
+  /// @return Returns the number of layout passes since the cost report has been
+  /// reset, to turn the counts into rates per frame.
+  int32_t get_cost_report_frames() const { return cost_report_frames_; }
+
+  /// @cond FLATUI_INTERNAL
+  // Getter of the glyph cache. Used by offline tools to retrieve the glyphs
+  // rasterized by the layouts.
+  const GlyphCache<uint8_t> *GetGlyphCache() const {
+    return glyph_cache_.get();
+  }
+  /// @endcond
+
  private:
   // Pass indicating rendering pass.
   static const int32_t kRenderPass = -1;
 
+  typedef std::unordered_map<FontBufferParameters, std::unique_ptr<FontBuffer>,
+                             FontBufferParameters> BufferMap;
+
+  // Key of a FontBuffer in map_buffers_, and the range of box widths its
+  // layout is valid for.
+  struct BufferLayout {
+    FontBufferParameters parameters;
+    int32_t min_width;
+    int32_t max_width;
+  };
+
+  // An entry of a pre-shaped text table, and the table holding it.
+  struct ShapedTextEntry {
+    const ShapedTextTable *table;
+    const ShapedText *text;
+  };
+
   // Initialize static data associated with the class.
   void Initialize();
 
@@ -396,17 +1009,106 @@ class FontManager {
                            const FontMetrics &new_metrics,
                            std::unique_ptr<uint8_t[]> *image);
 
+  // Texts are laid out in UTF-8 (`T` is char) or in UTF-16 (`T` is
+  // uint16_t). Lengths and offsets are in code units of the encoding.
+
   // Layout text and update harfbuzz_buf_.
   // Returns the width of the text layout in pixels.
-  uint32_t LayoutText(const char *text, const size_t length);
+  template <typename T>
+  uint32_t LayoutText(const T *text, const size_t length);
+
+  // Look up the shaping result of a text, shaping it at the reference size if
+  // it's not cached. The shaping result doesn't depend on the size the text
+  // is rendered at. `ysize` is the size the face is restored to after shaping.
+  template <typename T>
+  const ShapedRun *ShapeText(const T *text, const size_t length,
+                             const int32_t ysize);
+
+  // Key of the shaping result of a text in `shaped_runs_`.
+  template <typename T>
+  std::string GetShapedRunKey(const T *text, const size_t length) const;
+
+  // Lay out the words of a text from the state of `cursor`, appending the
+  // glyphs, carets and lines to its arrays. `shape` returns the shaping
+  // result of a word from its index and length, and `glyph` the glyph cache
+  // entry of a code point. Returns false if a glyph couldn't be cached.
+  template <typename T, typename ShapeFunction, typename GlyphFunction>
+  bool LayoutWords(const T *text, WordEnumerator *word_enum,
+                   const LayoutSettings &settings, ShapeFunction shape,
+                   GlyphFunction glyph, LayoutCursor *cursor);
+
+  // Split a long multi line text into paragraphs at line feeds, to be laid
+  // out in parallel. Returns false if the text is too short or the scheduler
+  // runs a task at a time.
+  template <typename T>
+  bool SplitParagraphs(const T *text, size_t length);
+
+  // Lay out the paragraphs found by SplitParagraphs() in parallel, and
+  // append them to `cursor`. Returns false if a glyph couldn't be cached.
+  template <typename T>
+  bool LayoutParagraphs(const T *text, const LayoutSettings &settings,
+                        LayoutCursor *cursor);
+
+  // Make sure there is a shaping context of the current face for each of
+  // `count` tasks. Returns false if one couldn't be created.
+  bool PrepareShapingContexts(size_t count);
+
+  // Load the font file of a face, decoding compressed assets. The decoded
+  // font is mapped from the cache of decoded fonts when there is one.
+  bool LoadFontData(const char *font_name, FaceData *face);
+
+  // Path of the decoded font in the cache of decoded fonts.
+  std::string GetCachedFontPath(const char *font_name) const;
+
+  // Map a decoded font from the cache, if it was decoded from an asset with
+  // the given header.
+  bool MapCachedFont(const std::string &cached_path,
+                     const CachedFontHeader &header, FaceData *face);
 
   // Calculate internal/external leading value and expand a buffer if
-  // necessary.
+  // necessary, from the top bearing and the height of a glyph image.
   // Returns true if the size of metrics has been changed.
-  bool UpdateMetrics(const FT_GlyphSlot glyph,
+  bool UpdateMetrics(int32_t top, int32_t height,
                      const FontMetrics &current_metrics,
                      FontMetrics *new_metrics);
 
+  // Load a glyph of the current face as an outline for the in-tree rasterizer,
+  // and compute the size and offset of its image. Returns false if the
+  // rasterizer is disabled or the glyph isn't an outline.
+  bool LoadGlyphOutline(const uint32_t code_point, mathfu::vec2i *size,
+                        mathfu::vec2i *offset);
+
+  // Rasterize a glyph of the current face at the current size, with FreeType
+  // or the in-tree rasterizer. The image has a pitch of its width and is
+  // valid until the next call. `offset` is set to the left and top bearing.
+  // Returns false if the glyph can't be loaded.
+  bool RasterizeGlyph(const uint32_t code_point, const uint8_t **image,
+                      mathfu::vec2i *size, mathfu::vec2i *offset);
+
+  // Look for the layout of a text sharing its lines up to a mandatory line
+  // break with `text`, laid out with the same parameters otherwise. Sets
+  // `buffer` to the FontBuffer of that layout. Returns nullptr if there is
+  // none, or if its glyphs have been evicted from the glyph cache.
+  template <typename T>
+  AppendState *FindAppendState(const T *text, size_t length,
+                               const FontBufferParameters &parameters,
+                               const FontBuffer **buffer);
+
+  // Keep the resume point of a layout for texts appending to it. `state` is
+  // the state the layout resumed from, if any.
+  template <typename T>
+  void RecordAppendState(const T *text, const FontBufferParameters &parameters,
+                         const LayoutResumePoint &resume, AppendState *state);
+
+  // Queue the outline loaded by LoadGlyphOutline() to be rasterized into
+  // `image`, a region of the glyph cache.
+  void QueueGlyphOutline(uint8_t *image);
+
+  // Rasterize the queued outlines in parallel, or discard them when the
+  // cache is about to be flushed. Outlines of glyphs that stay in the cache
+  // are always rasterized, even when the layout that reserved them failed.
+  void FinishGlyphBatch(bool rasterize);
+
   // Retrieve cached entry from the glyph cache.
   // If an entry is not found in the glyph cache, the API tries to create new
   // cache entry and returns it if succeeded.
@@ -415,8 +1117,10 @@ class FontManager {
   // - The glyph doesn't fit into the cache (even after trying to evict some
   // glyphs in cache based on LRU rule).
   // (e.g. Requested glyph size too large or the cache is highly fragmented.)
-  const GlyphCacheEntry *GetCachedEntry(const uint32_t code_point,
-                                        const int32_t y_size);
+  // `parameters` specifies the effect applied to the glyph image.
+  const GlyphCacheEntry *GetCachedEntry(
+      const uint32_t code_point, const int32_t y_size,
+      const FontBufferParameters &parameters);
 
   // Update font manager, check glyph cache if the texture atlas needs to be
   // updated.
@@ -426,9 +1130,25 @@ class FontManager {
   // flushed during a rendering pass.
   void UpdatePass(const bool start_subpass);
 
+  // Remove all the FontBuffers.
+  void ClearBuffers();
+
+  // Set what happens to the buffers of an inactive cache scope.
+  void SetCacheScopePolicy(HashedId scope, CacheScopePolicy policy);
+
+  // Discard the buffers of the scopes to discard, and of the scopes demoted
+  // the longest ago while demoted scopes exceed their budget.
+  void TrimCacheScopes();
+
+  // Look up an opened face with the font id. Returns nullptr if the face
+  // isn't opened.
+  FaceData *FindFace(HashedId font_id);
+
   // Update UV value in the FontBuffer.
   // Returns nullptr if one of UV values couldn't be updated.
-  FontBuffer *UpdateUV(const int32_t ysize, FontBuffer *buffer);
+  FontBuffer *UpdateUV(const int32_t ysize,
+                       const FontBufferParameters &parameters,
+                       FontBuffer *buffer);
 
   // Convert requested glyph size using SizeSelector if it's set.
   int32_t ConvertSize(const int32_t size);
@@ -439,10 +1159,62 @@ class FontManager {
                            const hb_glyph_info_t *info, int32_t glyph_count,
                            int32_t index);
 
-  // Create FontBuffer with requested parameters.
+  // Add a caret cluster of `count` carets to an array.
+  static void AddCaretCluster(const mathfu::vec2 &origin, float step,
+                              int32_t count,
+                              std::vector<FontCaretCluster> *clusters);
+
+  // Look up or create a FontBuffer, the implementation of GetBuffer().
+  template <typename T>
+  FontBuffer *RequestBuffer(const T *text, const size_t length,
+                            const FontBufferParameters &parameters,
+                            bool flush_when_full, bool all_lines);
+
+  // Create FontBuffer with requested parameters. Multi-line layouts stop at
+  // the bottom of the box unless `all_lines` is set.
+  // The function may return nullptr if the glyph cache is full.
+  template <typename T>
+  FontBuffer *CreateBuffer(const T *text, const uint32_t length,
+                           const FontBufferParameters &parameters,
+                           bool all_lines);
+
+  // Check if the texts of a pre-shaped text table have been laid out with the
+  // current locale, layout direction and script.
+  bool IsShapedTextTableCurrent(const ShapedTextTable &table) const;
+
+  // Create FontBuffer from a pre-shaped text.
   // The function may return nullptr if the glyph cache is full.
-  FontBuffer *CreateBuffer(const char *text, const uint32_t length,
-                           const FontBufferParameters &parameters);
+  FontBuffer *CreateBufferFromShapedText(
+      const ShapedText &shaped_text, const int32_t ysize,
+      const FontBufferParameters &parameters);
+
+  // Allocate a FontBuffer from the working arrays and insert it to the cache.
+  // The layout is reused for boxes from `min_width` to `max_width` wide,
+  // unless it's `partial` and depends on the height of the box.
+  FontBuffer *InsertBuffer(const FontBufferParameters &parameters,
+                           const mathfu::vec2i &size,
+                           const FontMetrics &metrics, uint32_t revision,
+                           int32_t min_width, int32_t max_width,
+                           bool partial);
+
+  // Get the parameters with the box size reduced to what a layout in
+  // `direction` depends on besides the line breaks: whether the text is
+  // multi-line, and the box width in RTL layouts, which start at the right
+  // edge of the box.
+  FontBufferParameters GetLayoutParameters(
+      const FontBufferParameters &parameters,
+      TextLayoutDirection direction) const;
+
+  // Look up a cached FontBuffer laid out for the parameters, or for a box that
+  // leads to the same layout. Returns map_buffers_.end() if there is none.
+  BufferMap::iterator FindBuffer(const FontBufferParameters &parameters);
+
+  // Remove a FontBuffer from the cache.
+  void EraseBuffer(BufferMap::iterator it);
+
+  // Keep the mesh of a buffer about to be destroyed until the next render
+  // pass.
+  void ReleaseMesh(FontBuffer *buffer);
 
   // Update language related settings.
   void SetLanguageSettings();
@@ -463,9 +1235,25 @@ class FontManager {
   // Map that keeps opened face data instances.
   std::unordered_map<std::string, std::unique_ptr<FaceData>> map_faces_;
 
+  // Opened faces indexed by their handle. Closed faces leave a nullptr, so
+  // that the other handles stay valid.
+  std::vector<FaceData *> faces_;
+
   // Pointer for current face.
   FaceData *current_face_;
 
+  // Mutex serializing the APIs used while building GUIs from multiple
+  // threads. Recursive since the APIs call each other.
+  std::recursive_mutex mutex_;
+
+  // Arena that FontBuffer storage is allocated from.
+  // Note that the arena needs to be declared before map_buffers_ so that it
+  // outlives FontBuffers.
+  std::unique_ptr<FontBufferArena> buffer_arena_;
+
+  // Flag indicating if FontBuffers keep code points.
+  bool retain_code_points_;
+
   // Texture cache for a rendered string image.
   // Using the FontBufferParameters as keys.
   // The map is used for GetTexture() API.
@@ -475,14 +1263,30 @@ class FontManager {
   // Cache for a texture atlas + vertex array rendering.
   // Using the FontBufferParameters as keys.
   // The map is used for GetBuffer() API.
-  std::unordered_map<FontBufferParameters, std::unique_ptr<FontBuffer>,
-                     FontBufferParameters> map_buffers_;
+  BufferMap map_buffers_;
+
+  // The FontBuffers of map_buffers_, keyed by their layout parameters (see
+  // GetLayoutParameters()). Boxes of other sizes share a FontBuffer when
+  // they lead to the same line breaks.
+  std::unordered_multimap<FontBufferParameters, BufferLayout,
+                          FontBufferParameters> map_buffer_layouts_;
+
+  // Pre-shaped text tables loaded via LoadShapedTexts() and the lookup map of
+  // their entries. The entries point into the table data.
+  std::vector<std::unique_ptr<std::string>> shaped_text_tables_;
+  std::unordered_map<FontBufferParameters, ShapedTextEntry,
+                     FontBufferParameters> map_shaped_texts_;
+
+  // Shaping results of texts, shared by all sizes of a text. Keyed by the
+  // font, script, direction and the text.
+  std::unordered_map<std::string, std::unique_ptr<ShapedRun>> shaped_runs_;
 
   // Singleton instance of Freetype library.
   static FT_Library *ft_;
 
-  // Harfbuzz buffer
-  static hb_buffer_t *harfbuzz_buf_;
+  // Harfbuzz buffer. Each FontManager has its own buffer so that instances can
+  // be used from different threads.
+  hb_buffer_t *harfbuzz_buf_;
 
   // Unique pointer to a glyph cache.
   std::unique_ptr<GlyphCache<uint8_t>> glyph_cache_;
@@ -497,6 +1301,16 @@ class FontManager {
   // Current implementation only supports up to 2 passes in a rendering cycle.
   int32_t current_pass_;
 
+  // Per-text cost report, see EnableCostReport().
+  bool cost_report_enabled_;
+  int32_t cost_report_frames_;
+  std::unordered_map<FontBufferParameters, TextCost, FontBufferParameters>
+      cost_report_;
+
+  // Entry of the text being processed by GetBuffer(), nullptr when the report
+  // is disabled.
+  TextCost *current_cost_;
+
   // Size selector function object used to adjust a glyph size.
   std::function<int32_t(const int32_t)> size_selector_;
 
@@ -514,6 +1328,74 @@ class FontManager {
 
   // Line break info buffer used in libunibreak.
   std::vector<char> wordbreak_info_;
+
+  // Working buffer of a glyph image with an effect.
+  std::vector<uint8_t> glyph_effect_image_;
+
+  // In-tree glyph rasterizer, nullptr to rasterize glyphs with FreeType.
+  std::unique_ptr<GlyphRasterizer> glyph_rasterizer_;
+
+  // Glyph images shared with other FontManagers, nullptr if not shared.
+  GlyphStore *glyph_store_;
+
+  // Scheduler running the parallel work, `serial_scheduler_` by default.
+  TaskScheduler *task_scheduler_;
+  SerialScheduler serial_scheduler_;
+
+  // Factory of the meshes of FontBuffers, `mesh_factory_` by default.
+  TextMeshFactory *text_mesh_factory_;
+  MeshFactory mesh_factory_;
+
+  // Decoder of compressed fonts, `zstd_decoder_` by default when available.
+  FontDecoder *font_decoder_;
+#if defined(FLATUI_USE_ZSTD)
+  ZstdFontDecoder zstd_decoder_;
+#endif  // defined(FLATUI_USE_ZSTD)
+
+  // Directory of the cache of decoded fonts, empty if there is none.
+  std::string font_cache_directory_;
+
+  // Outlines waiting to be rasterized in parallel.
+  std::unique_ptr<GlyphBatch> glyph_batch_;
+
+  // Paragraphs of the text being laid out in parallel, and the shaping
+  // contexts of the tasks.
+  std::unique_ptr<ParallelLayout> parallel_layout_;
+
+  // Layouts of long texts that appended texts resume from, the most recently
+  // used first.
+  std::vector<std::unique_ptr<AppendState>> append_states_;
+
+  // Buffers replaced by the texts appending to them, dropped by the next
+  // StartLayoutPass().
+  std::vector<FontBufferParameters> superseded_buffers_;
+
+  // Meshes of the erased buffers, destroyed by the next StartRenderPass() or
+  // FlushAndUpdate() on the rendering thread.
+  std::vector<std::unique_ptr<TextMesh>> released_meshes_;
+
+  // Cache scopes FontBuffers belong to. Only the scopes that aren't active
+  // have a policy.
+  struct CacheScope {
+    CacheScope() : policy(kCacheScopeRetain), storage(0), demotion(0) {}
+    CacheScopePolicy policy;
+    // Storage of the buffers of the scope.
+    size_t storage;
+    // Order in which the demoted scopes have been demoted.
+    uint32_t demotion;
+  };
+  std::unordered_map<HashedId, CacheScope> cache_scopes_;
+  std::vector<HashedId> cache_scope_stack_;
+  uint32_t demotion_counter_;
+  size_t demoted_scope_budget_;
+
+  // Working arrays used while a FontBuffer is laid out. The final contents are
+  // copied to the arena once the glyph count is known. The capacity is kept
+  // between layouts, so that a layout doesn't allocate in a steady state.
+  std::vector<FontVertex> layout_vertices_;
+  std::vector<uint32_t> layout_code_points_;
+  std::vector<FontCaretCluster> layout_caret_clusters_;
+  std::vector<uint32_t> layout_line_starts_;
 };
 
 /// @class FontMetrics
@@ -663,35 +1545,12 @@ class FontTexture : public fplbase::Texture {
   FontMetrics metrics_;
 };
 
-/// @struct FontVertex
-///
-/// @brief This struct holds all the font vertex data.
-struct FontVertex {
-  /// @brief The constructor for a FontVertex.
-  ///
-  /// @param[in] x A float representing the `x` position of the vertex.
-  /// @param[in] y A float representing the `y` position of the vertex.
-  /// @param[in] z A float representing the `z` position of the vertex.
-  /// @param[in] u A float representing the `u` value in the UV mapping.
-  /// @param[in] v A float representing the `v` value in the UV mapping.
-  FontVertex(const float x, const float y, const float z, const float u,
-             const float v) {
-    position_.data[0] = x;
-    position_.data[1] = y;
-    position_.data[2] = z;
-    uv_.data[0] = u;
-    uv_.data[1] = v;
-  }
-
-  /// @cond FONT_MANAGER_INTERNAL
-  mathfu::vec3_packed position_;
-  mathfu::vec2_packed uv_;
-  /// @endcond
-};
-
 /// @class FontBuffer
 ///
 /// @brief this is used with the texture atlas rendering.
+///
+/// The arrays of a FontBuffer are stored in a single block carved from the
+/// FontManager's FontBufferArena, sized from the glyph count of the layout.
 class FontBuffer {
  public:
   /// @var kIndiciesPerCodePoint
@@ -704,32 +1563,78 @@ class FontBuffer {
   /// @brief The number of vertices per code point.
   static const int32_t kVerticesPerCodePoint = 4;
 
+  /// @var kMaxGlyphsPerBatch
+  ///
+  /// @brief The maximum number of glyphs rendered with one draw call.
+  ///
+  /// 16 bit indices address 65536 vertices, longer texts are rendered in
+  /// batches. Batch `n` starts at the vertex
+  /// `n * kMaxGlyphsPerBatch * kVerticesPerCodePoint`, and its indices are
+  /// relative to that vertex.
+  static const int32_t kMaxGlyphsPerBatch = 0x10000 / kVerticesPerCodePoint;
+
   /// @brief The default constructor for a FontBuffer.
-  FontBuffer() : revision_(0) {}
+  FontBuffer()
+      : vertices_(nullptr),
+        code_points_(nullptr),
+        caret_clusters_(nullptr),
+        line_starts_(nullptr),
+        glyph_count_(0),
+        caret_cluster_count_(0),
+        line_count_(0),
+        arena_(nullptr),
+        block_(nullptr),
+        block_size_(0),
+        revision_(0),
+        pass_(0),
+        cache_scope_(kNullHash),
+        layout_direction_(TextLayoutDirectionLTR),
+        partial_(false),
+        mesh_factory_(nullptr),
+        mesh_dirty_(false) {}
 
-  /// @brief The constructor for FontBuffer with a given buffer size.
+  /// The destructor for FontBuffer.
   ///
-  /// @param[in] size A size of the FontBuffer in a number of glyphs.
-  /// @param[in] caret_info Indicates if the FontBuffer also maintains a caret
-  /// position buffer.
+  /// @note Releases the storage to the arena it was allocated from.
+  ~FontBuffer() { Release(); }
+
+  /// @brief Allocate storage of the buffer and copy the given layout to it.
+  ///
+  /// @param[in] arena The arena the storage is carved from. The arena needs to
+  /// outlive the buffer.
+  /// @param[in] vertices The array of vertices, `kVerticesPerCodePoint` per
+  /// glyph.
+  /// @param[in] code_points The array of code points of glyphs. They are
+  /// required to update UVs after the glyph cache evicted some of the glyphs.
+  /// Can be `nullptr` not to keep them.
+  /// @param[in] glyph_count The number of glyphs in the buffer.
+  /// @param[in] caret_clusters The array of caret clusters the caret
+  /// positions are derived from.
+  /// @param[in] caret_cluster_count The number of caret clusters.
+  /// @param[in] line_starts The array of the index of the first glyph of each
+  /// line.
+  /// @param[in] line_count The number of lines in the buffer.
   ///
   /// @note Caret position does not match to glpyh position 1 to 1, because a
   /// glyph can have multiple caret positions (e.g. Single 'ff' glyph can have 2
   /// caret positions).
   ///
   /// Since it has a strong relationship to rendering positions, we store the
-  /// caret position information in the FontBuffer.
-  FontBuffer(uint32_t size, bool caret_info) : revision_(0) {
-    indices_.reserve(size * kIndiciesPerCodePoint);
-    vertices_.reserve(size * kVerticesPerCodePoint);
-    code_points_.reserve(size);
-    if (caret_info) {
-      caret_positions_.reserve(size + 1);
-    }
-  }
+  /// caret cluster information in the FontBuffer. Caret positions are only
+  /// built from it the first time they are requested, most buffers are never
+  /// edited.
+  void Allocate(FontBufferArena *arena, const FontVertex *vertices,
+                const uint32_t *code_points, size_t glyph_count,
+                const FontCaretCluster *caret_clusters,
+                size_t caret_cluster_count, const uint32_t *line_starts,
+                size_t line_count);
 
-  /// The destructor for FontBuffer.
-  ~FontBuffer() {}
+  /// @brief Move the storage of the buffer to another arena.
+  ///
+  /// Used to compact a fragmented arena.
+  ///
+  /// @param[in] arena The new arena.
+  void Relocate(FontBufferArena *arena);
 
   /// @return Returns the FontMetrics metrics parameters for the font
   /// texture.
@@ -741,23 +1646,78 @@ class FontBuffer {
   /// @param[in] metrics The FontMetrics to set for the font texture.
   void set_metrics(const FontMetrics &metrics) { metrics_ = metrics; }
 
-  /// @return Returns the indices array as a std::vector<uint16_t>.
-  std::vector<uint16_t> *get_indices() { return &indices_; }
+  /// @return Returns the indices array.
+  ///
+  /// @note The array is shared between FontBuffers and covers the indices of
+  /// the largest batch of the buffer (see `get_batch_index_count()`), every
+  /// batch is rendered with it. Don't keep the pointer across GetBuffer()
+  /// calls.
+  const uint16_t *get_indices() const;
+
+  /// @return Returns the number of indices in the buffer, in all batches.
+  size_t get_index_count() const {
+    return glyph_count_ * kIndiciesPerCodePoint;
+  }
+
+  /// @return Returns the number of draw calls the buffer is rendered with
+  /// (see `kMaxGlyphsPerBatch`).
+  size_t get_batch_count() const {
+    return (glyph_count_ + kMaxGlyphsPerBatch - 1) / kMaxGlyphsPerBatch;
+  }
+
+  /// @param[in] batch The index of the batch.
+  ///
+  /// @return Returns the number of indices of a batch.
+  size_t get_batch_index_count(size_t batch) const {
+    return GetBatchGlyphCount(batch) * kIndiciesPerCodePoint;
+  }
+
+  /// @param[in] batch The index of the batch.
+  ///
+  /// @return Returns the index of the first vertex of a batch.
+  size_t get_batch_vertex_offset(size_t batch) const {
+    return batch * kMaxGlyphsPerBatch * kVerticesPerCodePoint;
+  }
+
+  /// @param[in] batch The index of the batch.
+  ///
+  /// @return Returns the number of vertices of a batch.
+  size_t get_batch_vertex_count(size_t batch) const {
+    return GetBatchGlyphCount(batch) * kVerticesPerCodePoint;
+  }
+
+  /// @return Returns the vertices array.
+  FontVertex *get_vertices() { return vertices_; }
+
+  /// @return Returns the vertices array as a const array.
+  const FontVertex *get_vertices() const { return vertices_; }
+
+  /// @return Returns the number of vertices in the buffer.
+  size_t get_vertex_count() const {
+    return glyph_count_ * kVerticesPerCodePoint;
+  }
+
+  /// @return Returns the array of code points, or `nullptr` if the buffer
+  /// doesn't keep them.
+  const uint32_t *get_code_points() const { return code_points_; }
+
+  /// @return Returns the number of glyphs in the buffer.
+  size_t get_glyph_count() const { return glyph_count_; }
 
-  /// @return Returns the indices array as a const std::vector<uint16_t>.
-  const std::vector<uint16_t> *get_indices() const { return &indices_; }
+  /// @return Returns the array of caret clusters of the glyphs.
+  const FontCaretCluster *get_caret_clusters() const { return caret_clusters_; }
 
-  /// @return Returns the vertices array as a std::vector<FontVertex>.
-  std::vector<FontVertex> *get_vertices() { return &vertices_; }
+  /// @return Returns the number of caret clusters in the buffer.
+  size_t get_caret_cluster_count() const { return caret_cluster_count_; }
 
-  /// @return Returns the vertices array as a const std::vector<FontVertex>.
-  const std::vector<FontVertex> *get_vertices() const { return &vertices_; }
+  /// @return Returns the array of the index of the first glyph of each line.
+  const uint32_t *get_line_starts() const { return line_starts_; }
 
-  /// @return Returns the array of code points as a std::vector<uint32_t>.
-  std::vector<uint32_t> *get_code_points() { return &code_points_; }
+  /// @return Returns the number of lines in the buffer.
+  size_t get_line_count() const { return line_count_; }
 
-  /// @return Returns the array of code points as a const std::vector<uint32_t>.
-  const std::vector<uint32_t> *get_code_points() const { return &code_points_; }
+  /// @return Returns the size of the storage allocated for the buffer in bytes.
+  size_t get_storage_size() const { return block_size_; }
 
   /// @return Returns the size of the string as a const vec2i reference.
   const mathfu::vec2i &get_size() const { return size_; }
@@ -799,27 +1759,35 @@ class FontBuffer {
   /// needs to call `StartRenderPass()` to upload the atlas texture.
   void set_pass(const int32_t pass) { pass_ = pass; }
 
-  /// @brief Adds 4 vertices to be used for a glyph rendering to the
-  /// vertex array.
+  /// @return Returns `true` if the layout stopped at the bottom of the box,
+  /// without the lines below it (see `FontManager::GetBuffer()`).
+  bool get_partial() const { return partial_; }
+
+  /// @brief Set if the layout stopped at the bottom of the box.
   ///
-  /// @param[in] pos A vec2 containing the `x` and `y` position of the first,
-  /// unscaled vertex.
-  /// @param[in] base_line A const int32_t representing the baseline for the
-  /// vertices.
-  /// @param[in] scale A float used to scale the size and offset.
-  /// @param[in] entry A const GlyphCacheEntry reference whose offset and size
-  /// are used in the scaling.
-  void AddVertices(const mathfu::vec2 &pos, const int32_t base_line,
-                   const float scale, const GlyphCacheEntry &entry);
+  /// @param[in] partial `true` if the lines below the box are missing.
+  void set_partial(bool partial) { partial_ = partial; }
+
+  /// @return Returns the id of the cache scope the buffer belongs to, or
+  /// `kNullHash` if it doesn't belong to a scope.
+  HashedId get_cache_scope() const { return cache_scope_; }
 
-  /// @brief Add the given caret position to the buffer.
+  /// @brief Set the cache scope the buffer belongs to.
   ///
-  /// @param[in] x The `x` position of the caret.
-  /// @param[in] y The `y` position of the caret.
-  void AddCaretPosition(int32_t x, int32_t y);
+  /// @param[in] scope The id of the scope.
+  void set_cache_scope(HashedId scope) { cache_scope_ = scope; }
+
+  /// @return Returns the direction the buffer was laid out in.
+  TextLayoutDirection get_layout_direction() const {
+    return layout_direction_;
+  }
+
+  /// @brief Set the direction the buffer was laid out in.
   ///
-  /// @param[in] pos The position of the caret.
-  void AddCaretPosition(const mathfu::vec2 &pos);
+  /// @param[in] direction The layout direction.
+  void set_layout_direction(TextLayoutDirection direction) {
+    layout_direction_ = direction;
+  }
 
   /// @brief Update UV information of a glyph entry.
   ///
@@ -829,6 +1797,30 @@ class FontBuffer {
   /// components of the vector.
   void UpdateUV(const int32_t index, const mathfu::vec4 &uv);
 
+  /// @brief Retrieve the mesh the buffer is rendered with.
+  ///
+  /// The mesh is created the first time it's requested, and its vertices are
+  /// uploaded again only after their UVs have been updated. Texts that don't
+  /// change aren't sent to the driver again.
+  ///
+  /// @param[in] factory The factory creating the mesh.
+  ///
+  /// @return Returns the mesh, or `nullptr` if the buffer is empty or the
+  /// factory couldn't create one.
+  TextMesh *GetMesh(TextMeshFactory *factory) const;
+
+  /// @brief Take the mesh of the buffer away from it.
+  ///
+  /// Buffers can be erased from threads without a graphics context (see
+  /// `BuildGui()`). Their meshes are taken away and destroyed on the
+  /// rendering thread.
+  ///
+  /// @return Returns the mesh, or `nullptr` if the buffer doesn't have one.
+  std::unique_ptr<TextMesh> ReleaseMesh() {
+    mesh_factory_ = nullptr;
+    return std::move(mesh_);
+  }
+
   /// @brief Verifies that the sizes of the arrays used in the buffer are
   /// correct.
   ///
@@ -836,8 +1828,9 @@ class FontBuffer {
   ///
   /// @return Returns `true`.
   bool Verify() {
-    assert(vertices_.size() == code_points_.size() * kVerticesPerCodePoint);
-    assert(indices_.size() == code_points_.size() * kIndiciesPerCodePoint);
+    assert(!glyph_count_ || vertices_ != nullptr);
+    assert(arena_ == nullptr ||
+           arena_->get_quad_index_capacity() >= GetBatchGlyphCount(0));
     return true;
   }
 
@@ -849,42 +1842,79 @@ class FontBuffer {
   /// returns `kCaretPositionInvalid` if the buffer does not contain
   /// caret information at the given index, or if the index is out of range.
   mathfu::vec2i GetCaretPosition(size_t index) const {
-    if (!caret_positions_.capacity() || index > caret_positions_.size())
-      return kCaretPositionInvalid;
-    return caret_positions_[index];
+    auto &carets = GetCarets();
+    if (index >= carets.size()) return kCaretPositionInvalid;
+    return carets[index];
   }
 
-  /// @return Returns a const reference to the caret positions buffer.
-  const std::vector<mathfu::vec2i> &GetCaretPositions() const {
-    return caret_positions_;
+  /// @return Returns the caret positions array, or `nullptr` if the buffer
+  /// doesn't have caret positions.
+  const mathfu::vec2i *GetCaretPositions() const {
+    auto &carets = GetCarets();
+    return carets.size() ? carets.data() : nullptr;
   }
 
+  /// @return Returns the number of caret positions in the buffer.
+  size_t GetCaretPositionCount() const { return GetCarets().size(); }
+
   /// @return Returns `true` if the FontBuffer contains any caret positions.
   /// If the caret positions array has 0 elements, it will return `false`.
-  bool HasCaretPositions() const { return caret_positions_.capacity() != 0; }
+  bool HasCaretPositions() const { return caret_cluster_count_ != 0; }
 
  private:
+  // Return the storage to the arena.
+  void Release();
+
+  // Make sure the shared index array of an arena covers a batch.
+  void ReserveQuadIndices(FontBufferArena *arena) const;
+
+  // Number of glyphs in a batch, `kMaxGlyphsPerBatch` except for the last one.
+  size_t GetBatchGlyphCount(size_t batch) const {
+    const size_t batch_size = kMaxGlyphsPerBatch;
+    auto first = batch * batch_size;
+    if (first >= glyph_count_) return 0;
+    return std::min(glyph_count_ - first, batch_size);
+  }
+
+  // Return caret positions, building them from the caret clusters on the
+  // first call.
+  const std::vector<mathfu::vec2i> &GetCarets() const;
+
   // Font metrics information.
   FontMetrics metrics_;
 
-  // Arrays for font indices, vertices and code points.
-  // They are hold as a separate vector because OpenGL draw call needs them to
-  // be a separate array.
-
-  // Indices of the font buffer.
-  std::vector<uint16_t> indices_;
+  // Arrays for vertices, code points, caret clusters and lines. They all point
+  // into a single block allocated from the arena. Indices are not stored per
+  // buffer since every glyph quad uses the same index pattern.
 
   // Vertices data of the font buffer.
-  std::vector<FontVertex> vertices_;
+  FontVertex *vertices_;
 
   // Code points used in the buffer. This array is used to fetch and update UV
-  // entries when the glyph cache is flushed.
-  std::vector<uint32_t> code_points_;
+  // entries when the glyph cache is flushed. Can be nullptr when the
+  // FontManager is set not to keep them.
+  uint32_t *code_points_;
 
-  // Caret positions in the buffer. We need to track them differently than a
+  // Caret clusters in the buffer. We need to track them differently than a
   // vertices information because we support ligatures so that single glyph
   // can include multiple caret positions.
-  std::vector<mathfu::vec2i> caret_positions_;
+  FontCaretCluster *caret_clusters_;
+
+  // Index of the first glyph of each line.
+  uint32_t *line_starts_;
+
+  // Number of glyphs, caret clusters and lines in the buffer.
+  size_t glyph_count_;
+  size_t caret_cluster_count_;
+  size_t line_count_;
+
+  // Caret positions built from the caret clusters, empty until requested.
+  mutable std::vector<mathfu::vec2i> caret_positions_;
+
+  // The arena and the block the storage is allocated from.
+  FontBufferArena *arena_;
+  uint8_t *block_;
+  size_t block_size_;
 
   // Size of the string in pixels.
   mathfu::vec2i size_;
@@ -896,6 +1926,26 @@ class FontBuffer {
 
   // Pass id. Each pass should have it's own texture atlas contents.
   int32_t pass_;
+
+  // Cache scope of the buffer, see FontManager::PushCacheScope().
+  HashedId cache_scope_;
+
+  // Direction of the layout, which its key in the layout index depends on.
+  TextLayoutDirection layout_direction_;
+
+  // Set when the lines below the box haven't been laid out.
+  bool partial_;
+
+  // Mesh of the buffer, created on the first render by `mesh_factory_`.
+  // `mesh_dirty_` is set when the vertices have changed since it was
+  // uploaded.
+  mutable std::unique_ptr<TextMesh> mesh_;
+  mutable TextMeshFactory *mesh_factory_;
+  mutable bool mesh_dirty_;
+
+  // Disable copy constructor.
+  FontBuffer(const FontBuffer &);
+  FontBuffer &operator=(const FontBuffer &);
 };
 
 /// @class FaceData
@@ -907,7 +1957,12 @@ class FontBuffer {
 class FaceData {
  public:
   /// @brief The default constructor for FaceData.
-  FaceData() : face_(nullptr), harfbuzz_font_(nullptr), font_id_(kNullHash) {}
+  FaceData()
+      : face_(nullptr),
+        harfbuzz_font_(nullptr),
+        font_file_offset_(0),
+        font_id_(kNullHash),
+        handle_(kInvalidFontHandle) {}
 
   /// @brief The destructor for FaceData.
   ///
@@ -917,6 +1972,20 @@ class FaceData {
   /// @brief Close the fontface.
   void Close();
 
+  /// @return Returns the font file data, mapped or on the heap.
+  const uint8_t *GetFontData() const {
+    return font_file_.get_data() != nullptr
+               ? font_file_.get_data() + font_file_offset_
+               : reinterpret_cast<const uint8_t *>(font_data_.data());
+  }
+
+  /// @return Returns the size of the font file data, in bytes.
+  size_t GetFontDataSize() const {
+    return font_file_.get_data() != nullptr
+               ? font_file_.get_size() - font_file_offset_
+               : font_data_.size();
+  }
+
   /// @var face_
   ///
   /// @brief freetype's fontface instance.
@@ -934,9 +2003,25 @@ class FaceData {
   /// The file needs to be kept open until FreeType finishes using the file.
   std::string font_data_;
 
+  /// @var font_file_
+  ///
+  /// @brief Decoded font file mapped from the cache of decoded fonts, used
+  /// instead of `font_data_` when mapped.
+  MappedFile font_file_;
+
+  /// @var font_file_offset_
+  ///
+  /// @brief Offset of the font in `font_file_`, past the header identifying
+  /// the asset it was decoded from.
+  size_t font_file_offset_;
+
   /// @var font_id_
   /// @brief Hashed value of the font face.
   HashedId font_id_;
+
+  /// @var handle_
+  /// @brief Handle of the font face in the FontManager that opened it.
+  FontHandle handle_;
 };
 
 /// @struct ScriptInfo
@@ -0,0 +1,129 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_GLYPH_STORE_H
+#define FPL_GLYPH_STORE_H
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "flatui/internal/glyph_cache.h"
+#include "mathfu/constants.h"
+
+namespace flatui {
+
+/// @file
+/// @addtogroup flatui_glyph_store
+/// @{
+
+/// @var kGlyphStoreDefaultCapacity
+/// @brief The default number of bytes of glyph images a GlyphStore keeps.
+const size_t kGlyphStoreDefaultCapacity = 4 * 1024 * 1024;
+
+/// @struct GlyphStoreEntry
+///
+/// @brief A rasterized glyph kept in a GlyphStore.
+struct GlyphStoreEntry {
+  /// @var image
+  /// @brief 8 bit coverage image of the glyph, with a pitch of its width.
+  std::vector<uint8_t> image;
+
+  /// @var size
+  /// @brief Size of the image in pixels.
+  mathfu::vec2i size;
+
+  /// @var offset
+  /// @brief Left and top bearing of the image, like the offset of a
+  /// GlyphCacheEntry.
+  mathfu::vec2i offset;
+};
+
+/// @class GlyphStore
+///
+/// @brief GlyphStore keeps rasterized glyph images, so that several
+/// FontManagers rasterize each glyph once.
+///
+/// Apps with several windows or GL contexts (e.g. a main UI and an in-world
+/// UI) have a FontManager per context. Each FontManager keeps its own glyph
+/// cache texture and packing, but with a shared GlyphStore (see
+/// `FontManager::SetGlyphStore()`) they fill them from the same images.
+///
+/// The store is thread-safe, FontManagers used from different threads can
+/// share it. When its images exceed the capacity, the store is emptied and
+/// refilled by the following lookups.
+class GlyphStore {
+ public:
+  /// @brief The default constructor for GlyphStore.
+  GlyphStore();
+
+  /// @brief Constructor for GlyphStore with a given capacity.
+  ///
+  /// @param[in] capacity The number of bytes of glyph images to keep.
+  explicit GlyphStore(size_t capacity);
+
+  ~GlyphStore();
+
+  /// @brief Look up a glyph.
+  ///
+  /// @param[in] key The font, code point, size and effect of the glyph.
+  ///
+  /// @return Returns the glyph, or `nullptr` if it isn't in the store. The
+  /// entry stays valid while it's referenced, even if the store is emptied.
+  std::shared_ptr<const GlyphStoreEntry> Find(const GlyphKey &key);
+
+  /// @brief Add a glyph to the store.
+  ///
+  /// @param[in] key The font, code point, size and effect of the glyph.
+  /// @param[in] image The glyph image, with a pitch of its width.
+  /// @param[in] size The size of the image in pixels.
+  /// @param[in] offset The left and top bearing of the image.
+  ///
+  /// @return Returns the stored glyph. If another FontManager has added the
+  /// glyph in the meantime, its entry is returned.
+  std::shared_ptr<const GlyphStoreEntry> Insert(const GlyphKey &key,
+                                                const uint8_t *image,
+                                                const mathfu::vec2i &size,
+                                                const mathfu::vec2i &offset);
+
+  /// @brief Remove all glyphs from the store.
+  void Clear();
+
+  /// @return Returns the number of bytes of glyph images in the store.
+  size_t get_size() const;
+
+  /// @return Returns the number of glyphs in the store.
+  size_t get_glyph_count() const;
+
+  /// @return Returns the number of bytes of glyph images the store keeps.
+  size_t get_capacity() const { return capacity_; }
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<GlyphKey, std::shared_ptr<const GlyphStoreEntry>,
+                     GlyphKey> entries_;
+  size_t size_;
+  size_t capacity_;
+
+  // Disable copy constructor.
+  GlyphStore(const GlyphStore &);
+  GlyphStore &operator=(const GlyphStore &);
+};
+
+/// @}
+
+}  // namespace flatui
+
+#endif  // FPL_GLYPH_STORE_H
@@ -0,0 +1,138 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_IMAGE_ATLAS_H
+#define FPL_IMAGE_ATLAS_H
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "fplbase/renderer.h"
+#include "mathfu/constants.h"
+
+namespace flatui {
+
+/// @file
+/// @addtogroup flatui_image_atlas
+/// @{
+
+/// @var kImageAtlasDefaultPageSize
+/// @brief The default width and height of an ImageAtlas page, in pixels.
+const int32_t kImageAtlasDefaultPageSize = 1024;
+
+/// @var kImageAtlasPadding
+/// @brief Pixels around each image in a page. The edges of the images are
+/// extruded into the padding so that filtering doesn't bleed neighbors in.
+const int32_t kImageAtlasPadding = 1;
+
+/// @struct ImageAtlasEntry
+///
+/// @brief Location of an image packed into an ImageAtlas.
+struct ImageAtlasEntry {
+  /// @var page
+  /// @brief The page texture holding the image.
+  const fplbase::Texture *page;
+
+  /// @var uv
+  /// @brief Top-left and bottom-right texture coordinates of the image in the
+  /// page.
+  mathfu::vec4_packed uv;
+};
+
+/// @class ImageAtlas
+///
+/// @brief ImageAtlas packs small UI images (icons, check boxes, knobs) into
+/// shared texture pages, so that GUIs showing many of them render from a few
+/// textures instead of binding a texture per image.
+///
+/// The application registers textures it has loaded with `Add()`, then calls
+/// `Pack()` once all of them have been added. Within a GUI definition,
+/// `UseImageAtlas()` makes `Image()`, `ImageBackground()` and
+/// `RenderTexture()` render the registered textures from the atlas pages.
+/// Textures that are not in the atlas, and nine patch textures, are rendered
+/// from their own texture as before.
+class ImageAtlas {
+ public:
+  /// @brief The default constructor for ImageAtlas.
+  ImageAtlas();
+
+  /// @brief Constructor for ImageAtlas with a given page size.
+  ///
+  /// @param[in] page_size The size of the page textures, in pixels.
+  explicit ImageAtlas(const mathfu::vec2i &page_size);
+
+  ~ImageAtlas();
+
+  /// @brief Register an image to be packed into the atlas.
+  ///
+  /// @param[in] texture The texture the application renders the image with.
+  /// It is used as the key to look up the image.
+  /// @param[in] file_name The name of the image file the texture was loaded
+  /// from. The image is decoded again to get its pixels.
+  ///
+  /// @return Returns `false` if the image can't be loaded or doesn't fit in a
+  /// page.
+  bool Add(const fplbase::Texture &texture, const char *file_name);
+
+  /// @brief Pack the images registered since the last call into new pages
+  /// and create the page textures.
+  ///
+  /// Call the API from the OpenGL rendering thread, typically at load time.
+  void Pack();
+
+  /// @brief Remove all images and pages.
+  void Clear();
+
+  /// @brief Look up the atlas location of a texture.
+  ///
+  /// @return Returns `nullptr` if the texture is not packed in the atlas.
+  const ImageAtlasEntry *Find(const fplbase::Texture &texture) const;
+
+  /// @return Returns the number of page textures.
+  size_t get_page_count() const { return pages_.size(); }
+
+  /// @return Returns the size of the page textures.
+  const mathfu::vec2i &get_page_size() const { return page_size_; }
+
+ private:
+  // An image waiting to be packed.
+  struct PendingImage {
+    const fplbase::Texture *texture;
+    mathfu::vec2i size;
+    std::vector<uint8_t> pixels;  // RGBA.
+  };
+
+  // Copy an image into a page, extruding its edges into the padding.
+  void Blit(const PendingImage &image, const mathfu::vec2i &pos,
+            uint8_t *page) const;
+
+  // Create a page texture from its pixels.
+  void AddPage(const std::vector<uint8_t> &pixels);
+
+  mathfu::vec2i page_size_;
+  std::vector<PendingImage> pending_images_;
+  std::vector<std::unique_ptr<fplbase::Texture>> pages_;
+  std::unordered_map<const fplbase::Texture *, ImageAtlasEntry> entries_;
+
+  // Disable copy constructor.
+  ImageAtlas(const ImageAtlas &);
+  ImageAtlas &operator=(const ImageAtlas &);
+};
+
+/// @}
+
+}  // namespace flatui
+
+#endif  // FPL_IMAGE_ATLAS_H
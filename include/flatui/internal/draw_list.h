@@ -0,0 +1,150 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_DRAW_LIST_H
+#define FPL_DRAW_LIST_H
+
+#include <functional>
+#include <vector>
+
+#include "fplbase/renderer.h"
+#include "flatui/font_manager.h"
+#include "mathfu/constants.h"
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Shaders used by draw commands. They are resolved when the commands are
+// executed, so that draw lists can be recorded without accessing the
+// AssetManager.
+enum DrawShader {
+  kDrawShaderImage,
+  kDrawShaderFont,
+  kDrawShaderFontClipping,
+  kDrawShaderFontEffect,
+  kDrawShaderColor,
+  kDrawShaderCount
+};
+
+// A rendering command of a GUI.
+struct DrawCommand {
+  enum Type {
+    kQuad,       // Quad with an optional texture, uv in `rect`.
+    kNinePatch,  // Nine patch quad, patch info in `rect`.
+    kText,       // Vertices of a FontBuffer, clipping window in `rect`.
+                 // Texts with a glyph effect always have a clipping window.
+    kScissorOn,  // Scissor rectangle.
+    kScissorOff,
+    kCustom  // User supplied renderer of a CustomElement.
+  };
+
+  DrawCommand(Type _type)
+      : type(_type),
+        shader(kDrawShaderImage),
+        texture(nullptr),
+        pos(mathfu::kZeros2i),
+        size(mathfu::kZeros2i),
+        vertex_offset(0),
+        index_count(0),
+        mesh(nullptr) {
+    color = mathfu::kOnes4f;
+    effect_color = mathfu::kZeros4f;
+    rect = mathfu::vec4(0, 0, 1, 1);
+  }
+
+  Type type;
+  DrawShader shader;
+  const fplbase::Texture *texture;
+  mathfu::vec4_packed color;
+  mathfu::vec4_packed effect_color;  // Color of the glyph effect of a text.
+  mathfu::vec2i pos;
+  mathfu::vec2i size;
+  mathfu::vec4_packed rect;
+
+  // Range of text vertices in the vertex array the command is executed with.
+  // Texts of more than FontBuffer::kMaxGlyphsPerBatch glyphs are rendered in
+  // several draw calls.
+  size_t vertex_offset;
+  size_t index_count;
+
+  // Retained mesh of a text, rendered instead of its vertices when set. Only
+  // set when the command is executed right away, draw lists keep copies of
+  // the vertices.
+  TextMesh *mesh;
+
+  std::function<void(const mathfu::vec2i &pos, const mathfu::vec2i &size)>
+      renderer;
+};
+
+/// @endcond
+
+/// @class DrawList
+///
+/// @brief Rendering commands of a GUI, recorded by `BuildGui()` and rendered
+/// by `SubmitGui()`.
+///
+/// A draw list owns copies of the text vertices it renders, so it stays valid
+/// while other GUIs lay out text with the same FontManager.
+class DrawList {
+ public:
+  DrawList() : canvas_size_(mathfu::kZeros2i), default_projection_(true) {}
+
+  /// @brief Remove all recorded commands.
+  void Clear() {
+    commands_.clear();
+    vertices_.clear();
+  }
+
+  /// @return Returns `true` if no command has been recorded.
+  bool empty() const { return commands_.empty(); }
+
+  /// @cond FLATUI_INTERNAL
+  // Record a command. Vertices of a text command are copied into the list.
+  void Add(const DrawCommand &command, const FontVertex *vertices,
+           size_t vertex_count);
+
+  // Set the canvas the commands are rendered to. With the default projection,
+  // an ortho camera covering the canvas is set up before the commands.
+  void SetCanvas(const mathfu::vec2i &canvas_size, bool default_projection) {
+    canvas_size_ = canvas_size;
+    default_projection_ = default_projection;
+  }
+
+  // Execute the recorded commands.
+  void Render(fplbase::Renderer &renderer, fplbase::Shader *const *shaders,
+              const uint16_t *quad_indices) const;
+
+  // Execute a command. `vertices` is the vertex array text commands refer to.
+  static void Execute(const DrawCommand &command, const FontVertex *vertices,
+                      fplbase::Renderer &renderer,
+                      fplbase::Shader *const *shaders,
+                      const uint16_t *quad_indices);
+
+  // Set up an ortho camera for all 2D elements, with (0, 0) in the top left,
+  // and the bottom right the canvas size in pixels.
+  static void SetOrtho(fplbase::Renderer &renderer,
+                       const mathfu::vec2i &canvas_size);
+  /// @endcond
+
+ private:
+  std::vector<DrawCommand> commands_;
+  std::vector<FontVertex> vertices_;
+  mathfu::vec2i canvas_size_;
+  bool default_projection_;
+};
+
+}  // namespace flatui
+
+#endif  // FPL_DRAW_LIST_H
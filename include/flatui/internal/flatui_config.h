@@ -0,0 +1,78 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FLATUI_CONFIG_H
+#define FPL_FLATUI_CONFIG_H
+
+/// @cond FLATUI_INTERNAL
+
+// Build time capacities of FlatUI.
+//
+// Each of them can be overridden with a compiler flag (e.g.
+// -DFLATUI_MAX_ELEMENTS=512) when building FlatUI and its users. A capacity
+// of 0 leaves the storage unbounded.
+//
+// FLATUI_MAX_ELEMENTS is a hard limit: the element list is reserved up front
+// and never grows past it. Elements beyond it are laid out, but not rendered.
+// The first overflow of a GuiContext is logged.
+//
+// The FLATUI_SOFT_MAX_* capacities are soft caps. They reserve storage and
+// bound how much of it is kept across frames, but they don't make it fixed:
+// the hash maps still allocate a node per entry, and the storage can grow
+// past the cap until the overflow is handled:
+// - Groups nested deeper than FLATUI_SOFT_MAX_GROUPS grow the group stack,
+//   which is logged once as well.
+// - When a FontManager holds more than FLATUI_SOFT_MAX_CACHED_BUFFERS
+//   FontBuffers, its buffer cache is flushed at the start of the next layout
+//   pass.
+// - Glyphs beyond FLATUI_SOFT_MAX_GLYPH_ENTRIES make the glyph cache report
+//   that it's full, which flushes it like an atlas that ran out of space.
+
+// Maximum number of elements in a GUI, per frame.
+#if !defined(FLATUI_MAX_ELEMENTS)
+#define FLATUI_MAX_ELEMENTS 0
+#endif  // !defined(FLATUI_MAX_ELEMENTS)
+
+// Nesting depth of groups in a GUI the group stack is reserved for.
+#if !defined(FLATUI_SOFT_MAX_GROUPS)
+#define FLATUI_SOFT_MAX_GROUPS 0
+#endif  // !defined(FLATUI_SOFT_MAX_GROUPS)
+
+// Number of FontBuffers a FontManager keeps across frames.
+#if !defined(FLATUI_SOFT_MAX_CACHED_BUFFERS)
+#define FLATUI_SOFT_MAX_CACHED_BUFFERS 0
+#endif  // !defined(FLATUI_SOFT_MAX_CACHED_BUFFERS)
+
+// Number of glyphs a glyph cache holds before it's flushed.
+#if !defined(FLATUI_SOFT_MAX_GLYPH_ENTRIES)
+#define FLATUI_SOFT_MAX_GLYPH_ENTRIES 0
+#endif  // !defined(FLATUI_SOFT_MAX_GLYPH_ENTRIES)
+
+// Storage FontBuffers of demoted cache scopes can use, in bytes (see
+// FontManager::PushCacheScope()).
+#if !defined(FLATUI_DEMOTED_SCOPE_BUDGET)
+#define FLATUI_DEMOTED_SCOPE_BUDGET (1024 * 1024)
+#endif  // !defined(FLATUI_DEMOTED_SCOPE_BUDGET)
+
+// Size of the glyph cache atlas of FontManagers, in pixels.
+#if !defined(FLATUI_GLYPH_CACHE_WIDTH)
+#define FLATUI_GLYPH_CACHE_WIDTH 1024
+#endif  // !defined(FLATUI_GLYPH_CACHE_WIDTH)
+#if !defined(FLATUI_GLYPH_CACHE_HEIGHT)
+#define FLATUI_GLYPH_CACHE_HEIGHT 1024
+#endif  // !defined(FLATUI_GLYPH_CACHE_HEIGHT)
+
+/// @endcond
+
+#endif  // FPL_FLATUI_CONFIG_H
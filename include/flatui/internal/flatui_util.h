@@ -50,6 +50,23 @@ inline HashedId HashId(const char *id) {
   return hash;
 }
 
+/// @brief Hash a UTF-16 text into a `HashId`.
+///
+/// @param[in] text The UTF-16 text to hash.
+/// @param[in] length The length of the text in UTF-16 code units.
+///
+/// @return Returns the HashId corresponding to the `text`.
+inline HashedId HashId(const uint16_t *text, size_t length) {
+  // The same hash as above, over the bytes of the code units.
+  HashedId hash = 0x84222325;
+  for (size_t i = 0; i < length; ++i) {
+    hash = (hash ^ static_cast<uint8_t>(text[i])) * 0x000001b3;
+    hash = (hash ^ static_cast<uint8_t>(text[i] >> 8)) * 0x000001b3;
+  }
+  assert(hash != kNullHash);
+  return hash;
+}
+
 /// @brief Hash a pointer to an object, of which there is guaranteed to be only
 /// one (e.g. a texture).
 ///
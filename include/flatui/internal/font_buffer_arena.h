@@ -0,0 +1,136 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_FONT_BUFFER_ARENA_H
+#define FPL_FONT_BUFFER_ARENA_H
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Default size of a page in the arena, in bytes.
+const size_t kFontBufferArenaPageSize = 64 * 1024;
+
+// Alignment of blocks allocated from the arena.
+const size_t kFontBufferArenaAlignment = 8;
+
+// Storage for FontBuffer arrays.
+//
+// Each FontBuffer carves a single contiguous block out of the arena, sized from
+// the final glyph count of its layout. Blocks are bump allocated from large
+// pages, so that creating a FontBuffer doesn't hit the heap in the common case
+// and buffers created together (e.g. a screen) are adjacent in memory.
+//
+// Freed blocks are not reused individually. A page is recycled once all of its
+// blocks have been freed. When freed blocks pile up in partially used pages,
+// IsFragmented() returns true and the owner is expected to compact by moving
+// live blocks into a new arena (see FontBuffer::Relocate()).
+//
+// The arena also owns the index array shared by all FontBuffers. Every glyph
+// is a quad with the same index pattern, so the indices of a buffer only
+// depend on its glyph count and don't need to be stored per buffer.
+class FontBufferArena {
+ public:
+  FontBufferArena(size_t page_size = kFontBufferArenaPageSize)
+      : page_size_(page_size),
+        current_page_(0),
+        live_bytes_(0),
+        used_bytes_(0),
+        reserved_bytes_(0),
+        live_blocks_(0),
+        total_allocations_(0) {}
+  ~FontBufferArena() {}
+
+  // Allocate a block of `size` bytes. The returned block is aligned to
+  // kFontBufferArenaAlignment.
+  uint8_t *Allocate(size_t size);
+
+  // Return a block allocated via Allocate() to the arena.
+  void Free(const uint8_t *block, size_t size);
+
+  // Returns true if enough space is wasted by freed blocks that compacting the
+  // arena would release at least one page.
+  bool IsFragmented() const;
+
+  // Make sure the shared index array covers at least `glyph_count` glyphs.
+  // Returns false if `glyph_count` is more than 16 bit indices can address,
+  // FontBuffers reserve the indices of their largest batch.
+  bool ReserveQuadIndices(size_t glyph_count);
+
+  // Getter of the shared index array.
+  const uint16_t *get_quad_indices() const { return quad_indices_.data(); }
+
+  // Getter of the number of glyphs the shared index array covers.
+  size_t get_quad_index_capacity() const;
+
+  // Stats getters.
+  // Bytes in live blocks.
+  size_t get_live_bytes() const { return live_bytes_; }
+  // Bytes allocated from pages, including freed blocks not recycled yet.
+  size_t get_used_bytes() const { return used_bytes_; }
+  // Bytes held by the pages (and the shared index array).
+  size_t get_reserved_bytes() const {
+    return reserved_bytes_ + quad_indices_.capacity() * sizeof(uint16_t);
+  }
+  // Number of live blocks.
+  size_t get_live_blocks() const { return live_blocks_; }
+  // Number of pages.
+  size_t get_page_count() const { return pages_.size(); }
+  // Total number of blocks allocated since the creation of the arena.
+  size_t get_total_allocations() const { return total_allocations_; }
+
+ private:
+  struct Page {
+    Page() : size(0), used(0), live(0) {}
+    std::unique_ptr<uint8_t[]> data;
+    size_t size;
+    size_t used;
+    size_t live;
+  };
+
+  static size_t Align(size_t size) {
+    return (size + kFontBufferArenaAlignment - 1) &
+           ~(kFontBufferArenaAlignment - 1);
+  }
+
+  // Size of a regular page.
+  size_t page_size_;
+
+  // Pages of the arena. Blocks are allocated from the current page first.
+  std::vector<Page> pages_;
+  size_t current_page_;
+
+  // Stats.
+  size_t live_bytes_;
+  size_t used_bytes_;
+  size_t reserved_bytes_;
+  size_t live_blocks_;
+  size_t total_allocations_;
+
+  // Index array shared by all FontBuffers.
+  std::vector<uint16_t> quad_indices_;
+
+  // Disable copy constructor.
+  FontBufferArena(const FontBufferArena &);
+  FontBufferArena &operator=(const FontBufferArena &);
+};
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // FPL_FONT_BUFFER_ARENA_H
@@ -15,10 +15,12 @@
 #ifndef GLYPH_CACH_H
 #define GLYPH_CACH_H
 
+#include <functional>
 #include <list>
 #include <map>
 #include <unordered_map>
 
+#include "flatui_config.h"
 #include "flatui_util.h"
 #include "fplbase/utilities.h"
 #include "mathfu/constants.h"
@@ -77,31 +79,44 @@ static inline int32_t RoundUpToPowerOf2(int32_t x) {
 class GlyphKey {
  public:
   // Constructors.
-  GlyphKey() : font_id_(kNullHash), code_point_(0), glyph_size_(0) {}
-  GlyphKey(const HashedId font_id, uint32_t code_point, uint32_t glyph_size) {
+  GlyphKey()
+      : font_id_(kNullHash), code_point_(0), glyph_size_(0), glyph_effect_(0) {}
+  GlyphKey(const HashedId font_id, uint32_t code_point, uint32_t glyph_size,
+           uint32_t glyph_effect = 0) {
     font_id_ = font_id;
     code_point_ = code_point;
     glyph_size_ = glyph_size;
+    glyph_effect_ = glyph_effect;
   }
 
   // Compare operator.
   bool operator==(const GlyphKey& other) const {
     return (code_point_ == other.code_point_ && font_id_ == other.font_id_ &&
-            glyph_size_ == other.glyph_size_);
+            glyph_size_ == other.glyph_size_ &&
+            glyph_effect_ == other.glyph_effect_);
   }
 
+  // Getters of the glyph parameters.
+  HashedId get_font_id() const { return font_id_; }
+  uint32_t get_code_point() const { return code_point_; }
+  uint32_t get_glyph_size() const { return glyph_size_; }
+  uint32_t get_glyph_effect() const { return glyph_effect_; }
+
   // Hash function.
   size_t operator()(const GlyphKey& key) const {
     // Note that font_id_ is an already hashed value.
     return ((std::hash<uint32_t>()(key.code_point_) ^ (key.font_id_ << 1)) >>
             1) ^
-           (std::hash<uint32_t>()(key.glyph_size_) << 1);
+           (std::hash<uint32_t>()(key.glyph_size_ ^ (key.glyph_effect_ << 8))
+            << 1);
   }
 
  private:
   HashedId font_id_;
   uint32_t code_point_;
   uint32_t glyph_size_;
+  // Id of the effect baked into the glyph image, 0 for none.
+  uint32_t glyph_effect_;
 };
 
 // Cache entry for a glyph.
@@ -179,6 +194,7 @@ class GlyphCacheRow {
   // Initialize the row width and height.
   void Initialize(const int32_t y_pos, const mathfu::vec2i& size) {
     last_used_counter_ = 0;
+    pinned_ = false;
     y_pos_ = y_pos;
     remaining_width_ = size.x();
     size_ = size;
@@ -219,6 +235,10 @@ class GlyphCacheRow {
   // Getter of cached glyphs.
   size_t get_num_glyphs() const { return cached_entries_.size(); }
 
+  // Setter/Getter of pinned state. A pinned row is never evicted nor flushed.
+  bool get_pinned() const { return pinned_; }
+  void set_pinned(const bool pinned) { pinned_ = pinned; }
+
   // Setter/Getter of iterator to row LRU.
   const std::list<GlyphCacheEntry::iterator_row>::iterator get_it_lru_row()
       const {
@@ -244,6 +264,9 @@ class GlyphCacheRow {
   std::vector<GlyphCacheEntry::iterator>& get_cached_entries() {
     return cached_entries_;
   }
+  const std::vector<GlyphCacheEntry::iterator>& get_cached_entries() const {
+    return cached_entries_;
+  }
 
  private:
   // Last used counter value of the entry. The value is used to determine
@@ -254,6 +277,9 @@ class GlyphCacheRow {
   // As new contents are added to the row, remaining width decreases.
   int32_t remaining_width_;
 
+  // Flag indicating if the row is pinned.
+  bool pinned_;
+
   // Size of the row.
   mathfu::vec2i size_;
 
@@ -279,7 +305,7 @@ class GlyphCache {
   // width: width of the glyph cache texture. Rounded up to power of 2.
   // height: height of the glyph cache texture. Rounded up to power of 2.
   GlyphCache(const mathfu::vec2i& size)
-      : counter_(0), revision_(0), dirty_(false) {
+      : counter_(0), revision_(0), dirty_(false), pinned_height_(0) {
     // Round up cache sizes to power of 2.
     size_.x() = RoundUpToPowerOf2(size.x());
     size_.y() = RoundUpToPowerOf2(size.y());
@@ -292,6 +318,11 @@ class GlyphCache {
     const int32_t kCacheClearValue = 0x0;
     memset(buffer_.get(), kCacheClearValue, size_.x() * size_.y() * sizeof(T));
 
+    // Reserve the entries up front when their number is bounded.
+    if (FLATUI_SOFT_MAX_GLYPH_ENTRIES) {
+      map_entries_.reserve(FLATUI_SOFT_MAX_GLYPH_ENTRIES);
+    }
+
     // Create first (empty) row entry.
     InsertNewRow(0, size_, list_row_.end());
 
@@ -337,6 +368,28 @@ class GlyphCache {
   // Returns a pointer to inserted entry.
   const GlyphCacheEntry* Set(const T* const image, const GlyphKey& key,
                              const GlyphCacheEntry& entry) {
+    T* dest;
+    auto ret = Reserve(key, entry, &dest);
+    if (ret != nullptr && dest != nullptr) {
+      // Store given image into the buffer.
+      auto size = entry.get_size().x() * sizeof(T);
+      for (int32_t y = 0; y < entry.get_size().y(); ++y) {
+        memcpy(dest + y * size_.x(), image + y * entry.get_size().x(), size);
+      }
+    }
+    return ret;
+  }
+
+  // Reserve a region for an entry, so that a caller renders its image straight
+  // into the buffer instead of passing a copy to Set().
+  // image: receives the top-left pixel of the region, rows are get_size().x()
+  // pixels apart. nullptr if the entry was already in the cache.
+  // Returns a pointer to inserted entry, nullptr if there is no room in the
+  // cache for a requested entry.
+  const GlyphCacheEntry* Reserve(const GlyphKey& key,
+                                 const GlyphCacheEntry& entry, T** image) {
+    *image = nullptr;
+
     // Lookup entries if the entry is already stored in the cache.
     auto p = Find(key);
 #ifdef GLYPH_CACHE_STATS
@@ -355,6 +408,16 @@ class GlyphCache {
       return p;
     }
 
+    // Report the cache as full when it holds as many entries as it may.
+#if FLATUI_SOFT_MAX_GLYPH_ENTRIES
+    if (map_entries_.size() >= FLATUI_SOFT_MAX_GLYPH_ENTRIES) {
+#ifdef GLYPH_CACHE_STATS
+      stats_set_fail_++;
+#endif
+      return nullptr;
+    }
+#endif  // FLATUI_SOFT_MAX_GLYPH_ENTRIES
+
     // Adjust requested height & width.
     // Height is rounded up to multiple of kGlyphCacheHeightRound.
     // Expecting kGlyphCacheHeightRound is base 2.
@@ -413,8 +476,9 @@ class GlyphCache {
           it_row->Reserve(it_entry, mathfu::vec2i(req_width, req_height)),
           it_row->get_y_pos());
 
-      // Store given image into the buffer.
-      CopyImage(pos, image, it_entry->second.get());
+      // Hand the region to the caller.
+      *image = buffer_.get() + pos.x() + pos.y() * size_.x();
+      UpdateDirtyRect(mathfu::vec4i(pos, pos + entry.get_size()));
 
       // Update UV of the entry.
       mathfu::vec4 uv(
@@ -436,6 +500,10 @@ class GlyphCache {
       // height from LRU list.
       for (auto row_it = lru_row_.begin(); row_it != lru_row_.end(); ++row_it) {
         auto& row = *row_it;
+        if (row->get_pinned()) {
+          // Pinned rows are never evicted.
+          continue;
+        }
         if (row->get_last_used_counter() == counter_) {
           // The row is being used in current rendering cycle.
           // We can not evict the row.
@@ -447,7 +515,7 @@ class GlyphCache {
           row->Initialize(row->get_y_pos(), row->get_size());
 
           // Call the function recursively.
-          return Set(image, key, entry);
+          return Reserve(key, entry, image);
         }
       }
 #ifdef GLYPH_CACHE_STATS
@@ -467,27 +535,77 @@ class GlyphCache {
     return ret;
   }
 
-  // Flush all cache entries.
+  // Flush all cache entries except the ones in pinned rows.
   bool Flush() {
 #ifdef GLYPH_CACHE_STATS
     ResetStats();
 #endif
-    map_entries_.clear();
-    lru_row_.clear();
-    list_row_.clear();
-    map_row_.clear();
+    if (pinned_height_ == 0) {
+      map_entries_.clear();
+      lru_row_.clear();
+      list_row_.clear();
+      map_row_.clear();
+    } else {
+      // Pinned rows occupy the top of the buffer, remove all rows below them.
+      for (auto it = list_row_.begin(); it != list_row_.end();) {
+        if (it->get_pinned()) {
+          ++it;
+          continue;
+        }
+        FlushRow(it);
+        lru_row_.erase(it->get_it_lru_row());
+        map_row_.erase(it->get_it_row_height_map());
+        it = list_row_.erase(it);
+      }
+    }
 
     // Update cache revision.
     revision_ = counter_;
 
-    // Create first (empty) row entry.
-    InsertNewRow(0, size_, list_row_.end());
+    // Create first (empty) row entry below pinned rows.
+    if (pinned_height_ < size_.y()) {
+      InsertNewRow(pinned_height_,
+                   mathfu::vec2i(size_.x(), size_.y() - pinned_height_),
+                   list_row_.end());
+    }
 
     dirty_ = false;
 
     return true;
   }
 
+  // Pin all rows that currently hold glyphs, so that their entries stay in the
+  // cache across Flush() calls and row evictions.
+  // Glyphs added later to the remaining space of a pinned row are pinned too.
+  // Intended to be called after storing a pre-baked glyph set into a flushed
+  // cache, so that pinned rows occupy the top of the buffer.
+  void PinRows() {
+    for (auto it = list_row_.begin(); it != list_row_.end(); ++it) {
+      if (it->get_num_glyphs()) {
+        it->set_pinned(true);
+        pinned_height_ =
+            std::max(pinned_height_, it->get_y_pos() + it->get_size().y());
+      }
+    }
+  }
+
+  // Enumerate cached entries, row by row from the top of the buffer.
+  // callback: receives the key of an entry, the entry and the position of its
+  // image in the buffer.
+  void Enumerate(const std::function<void(const GlyphKey&,
+                                          const GlyphCacheEntry&,
+                                          const mathfu::vec2i&)>& callback)
+      const {
+    for (auto row = list_row_.begin(); row != list_row_.end(); ++row) {
+      auto& entries = row->get_cached_entries();
+      for (auto it = entries.begin(); it != entries.end(); ++it) {
+        auto& entry = *(*it)->second;
+        auto pos = mathfu::vec2i(entry.get_uv().xy() * mathfu::vec2(size_));
+        callback((*it)->first, entry, pos);
+      }
+    }
+  }
+
   // Increment a cycle counter of the cache.
   // Invoke this API for each rendering cycle.
   // The counter is used to determine which cache entries can be evicted when
@@ -530,6 +648,9 @@ class GlyphCache {
   // Getter of the cache size.
   const mathfu::vec2i& get_size() const { return size_; }
 
+  // Getter of the height of the area occupied by pinned rows.
+  int32_t get_pinned_height() const { return pinned_height_; }
+
  private:
   // Insert new row to the row list with a given size.
   // It tries to merge 2 rows if next row is also empty one.
@@ -581,18 +702,6 @@ class GlyphCache {
 #endif
   }
 
-  // Copy glyph image into the buffer.
-  void CopyImage(const mathfu::vec2i& pos, const T* const image,
-                 const GlyphCacheEntry* entry) {
-    auto buffer = buffer_.get();
-    auto size = entry->get_size().x() * sizeof(T);
-    for (int32_t y = 0; y < entry->get_size().y(); ++y) {
-      memcpy(buffer + pos.x() + (pos.y() + y) * size_.x(),
-             image + y * entry->get_size().x(), size);
-    }
-    UpdateDirtyRect(mathfu::vec4i(pos, pos + entry->get_size()));
-  }
-
   // Update dirty rect.
   void UpdateDirtyRect(const mathfu::vec4i& rect) {
     if (!dirty_) {
@@ -666,6 +775,9 @@ class GlyphCache {
   // Dirty region in the buffer.
   mathfu::vec4i dirty_rect_;
 
+  // Height of the area at the top of the buffer occupied by pinned rows.
+  int32_t pinned_height_;
+
 #ifdef GLYPH_CACHE_STATS
   // Variables to track usage stats.
   int32_t stats_lookup_;
@@ -0,0 +1,96 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_GLYPH_RASTERIZER_H
+#define FPL_GLYPH_RASTERIZER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "mathfu/constants.h"
+
+// Forward decls for FreeType.
+struct FT_Outline_;
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// Rasterizer rendering glyph outlines into 8 bit coverage images.
+//
+// Outline edges add their signed area to an accumulation buffer, and a prefix
+// sum over the buffer turns it into coverage. The prefix sum uses SSE2 or NEON
+// when available. Curves are flattened into lines.
+//
+// Images are placed the way FreeType's renderer places glyph bitmaps, so they
+// can be used in place of FT_LOAD_RENDER output. They can be rendered into the
+// rasterizer's own buffer, or straight into a caller's buffer such as a glyph
+// cache.
+class GlyphRasterizer {
+ public:
+  GlyphRasterizer() : size_(mathfu::kZeros2i) {}
+  ~GlyphRasterizer() {}
+
+  // Rasterize an outline in 26.6 pixel coordinates (e.g. a glyph loaded with
+  // FT_LOAD_NO_BITMAP). `offset` is set to the left and top bearing of the
+  // image, like bitmap_left and bitmap_top of FreeType glyph slots.
+  // Returns the image with a pitch of its width, valid until the next call.
+  const uint8_t *Rasterize(const FT_Outline_ &outline, mathfu::vec2i *size,
+                           mathfu::vec2i *offset);
+
+  // Rasterize an outline into `image`, whose rows are `pitch` bytes apart. The
+  // image needs to be as large as the size returned by GetBounds(), all of its
+  // pixels are written.
+  void Rasterize(const FT_Outline_ &outline, uint8_t *image, int32_t pitch);
+
+  // Compute the size and the offset of the image of an outline, without
+  // rasterizing it.
+  static void GetBounds(const FT_Outline_ &outline, mathfu::vec2i *size,
+                        mathfu::vec2i *offset);
+
+  // Start a new image of `size` pixels. Coordinates of the following edges are
+  // in pixels, with y going down.
+  void Reset(const mathfu::vec2i &size);
+
+  // Add edges of a contour.
+  void MoveTo(const mathfu::vec2 &point);
+  void LineTo(const mathfu::vec2 &point);
+  void QuadTo(const mathfu::vec2 &control, const mathfu::vec2 &point);
+  void CubicTo(const mathfu::vec2 &control1, const mathfu::vec2 &control2,
+               const mathfu::vec2 &point);
+
+  // Resolve the accumulated edges into coverage, and return the image.
+  const uint8_t *Accumulate();
+
+  // Resolve the accumulated edges into coverage in `image`, whose rows are
+  // `pitch` bytes apart.
+  void Accumulate(uint8_t *image, int32_t pitch);
+
+ private:
+  void AddLine(const mathfu::vec2 &p0, const mathfu::vec2 &p1);
+
+  // Add the edges of an outline whose image is at `offset`.
+  void AddOutline(const FT_Outline_ &outline, const mathfu::vec2i &offset);
+
+  mathfu::vec2i size_;
+  mathfu::vec2 current_;
+  std::vector<float> accumulation_;
+  std::vector<uint8_t> image_;
+};
+
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // FPL_GLYPH_RASTERIZER_H
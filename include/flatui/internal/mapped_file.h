@@ -0,0 +1,62 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_MAPPED_FILE_H
+#define FPL_MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace flatui {
+
+/// @cond FLATUI_INTERNAL
+
+// A file mapped read-only in memory.
+//
+// Pages of the file are read on demand by the OS, and can be dropped under
+// memory pressure without being written to swap, which makes it cheaper to
+// keep large fonts open than a copy of them on the heap.
+class MappedFile {
+ public:
+  MappedFile();
+  ~MappedFile() { Close(); }
+
+  // Map a file. Returns false if the file doesn't exist or can't be mapped.
+  bool Open(const char *path);
+
+  // Unmap the file.
+  void Close();
+
+  const uint8_t *get_data() const { return data_; }
+  size_t get_size() const { return size_; }
+
+ private:
+  const uint8_t *data_;
+  size_t size_;
+#if defined(_WIN32)
+  // Handles of the file and of its mapping.
+  void *file_;
+  void *mapping_;
+#endif  // defined(_WIN32)
+
+  // Disable copy constructor.
+  MappedFile(const MappedFile &);
+  MappedFile &operator=(const MappedFile &);
+};
+
+/// @endcond
+
+}  // namespace flatui
+
+#endif  // FPL_MAPPED_FILE_H
@@ -166,11 +166,10 @@ class MicroEdit {
 
   // Helper for Pick() API.
   int32_t PickColumn(const mathfu::vec2i &pointer_position,
-                     std::vector<mathfu::vec2i>::const_iterator start_it,
-                     std::vector<mathfu::vec2i>::const_iterator end_it);
+                     const mathfu::vec2i *start_it,
+                     const mathfu::vec2i *end_it);
   void PickRow(const mathfu::vec2i &pointer_position,
-               std::vector<mathfu::vec2i>::const_iterator *start_it,
-               std::vector<mathfu::vec2i>::const_iterator *end_it);
+               const mathfu::vec2i **start_it, const mathfu::vec2i **end_it);
 
   int32_t caret_pos_;
   int32_t wordbreak_index_;
@@ -0,0 +1,162 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_TASK_SCHEDULER_H
+#define FPL_TASK_SCHEDULER_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace flatui {
+
+/// @file
+/// @addtogroup flatui_task_scheduler
+/// @{
+
+/// @class TaskCounter
+///
+/// @brief TaskCounter counts the tasks of a batch that haven't completed yet.
+///
+/// A counter is incremented when tasks are submitted with it, and decremented
+/// by the scheduler as each of them completes. A counter can be reused once it
+/// has been waited on.
+class TaskCounter {
+ public:
+  TaskCounter() : pending_(0) {}
+
+  /// @brief Add tasks to the batch. Called by `TaskScheduler::Submit()`.
+  ///
+  /// @param[in] count The number of tasks added.
+  void Add(int32_t count) { pending_.fetch_add(count); }
+
+  /// @brief Mark a task of the batch as completed. Called by schedulers once
+  /// a task has returned.
+  ///
+  /// @return Returns `true` if it was the last pending task.
+  bool Complete() { return pending_.fetch_sub(1) == 1; }
+
+  /// @return Returns `true` when all the tasks of the batch have completed.
+  bool IsDone() const { return pending_.load() == 0; }
+
+ private:
+  std::atomic<int32_t> pending_;
+
+  // Disable copy constructor.
+  TaskCounter(const TaskCounter &);
+  TaskCounter &operator=(const TaskCounter &);
+};
+
+/// @class TaskScheduler
+///
+/// @brief TaskScheduler runs FlatUI's parallel work, such as glyph
+/// rasterization and GUIs built with `BuildGuis()`.
+///
+/// FlatUI doesn't start threads of its own. Apps with a job system implement
+/// the interface on top of it, so that FlatUI's work runs on their worker
+/// threads, and pass it to `FontManager::SetTaskScheduler()`. FlatUI ships
+/// with a work-stealing `ThreadPoolScheduler`, and a `SerialScheduler` running
+/// tasks on the calling thread, which is used when no scheduler is set.
+///
+/// Tasks can submit batches of their own and wait on them, e.g. a GUI built
+/// by a task rasterizes glyphs in parallel. `Wait()` needs to make progress
+/// in that case, typically by running tasks of the batch on the waiting
+/// thread. Waiting threads shouldn't run tasks of other batches: the waiting
+/// task may hold locks that those tasks need.
+class TaskScheduler {
+ public:
+  /// @typedef Task
+  /// @brief A unit of work. Tasks of a batch may run concurrently.
+  typedef std::function<void()> Task;
+
+  virtual ~TaskScheduler() {}
+
+  /// @brief Submit a batch of tasks.
+  ///
+  /// The counter is incremented by `count` before the function returns, and
+  /// decremented with `TaskCounter::Complete()` as each task completes.
+  ///
+  /// @param[in] tasks The tasks to run. They are copied.
+  /// @param[in] count The number of tasks.
+  /// @param[in,out] counter The counter tracking the batch.
+  virtual void Submit(const Task *tasks, size_t count,
+                      TaskCounter *counter) = 0;
+
+  /// @brief Wait until all the tasks counted by a counter have completed.
+  ///
+  /// @param[in] counter The counter tracking the batch.
+  virtual void Wait(TaskCounter *counter) = 0;
+
+  /// @return Returns the number of tasks that can run at once, including the
+  /// waiting thread. Work is split into about as many tasks, and isn't
+  /// deferred when it's 1.
+  virtual int32_t GetConcurrency() const = 0;
+};
+
+/// @class SerialScheduler
+///
+/// @brief SerialScheduler runs tasks on the submitting thread, one after the
+/// other, before `Submit()` returns.
+///
+/// It's used by FontManagers without a scheduler, and keeps the order of the
+/// work deterministic in tests.
+class SerialScheduler : public TaskScheduler {
+ public:
+  virtual void Submit(const Task *tasks, size_t count, TaskCounter *counter);
+  virtual void Wait(TaskCounter *counter);
+  virtual int32_t GetConcurrency() const { return 1; }
+};
+
+/// @cond FLATUI_INTERNAL
+struct ThreadPoolState;
+/// @endcond
+
+/// @class ThreadPoolScheduler
+///
+/// @brief ThreadPoolScheduler runs tasks on a pool of worker threads.
+///
+/// Each worker has a queue of tasks. Workers run the latest task of their own
+/// queue first, and steal the oldest tasks of the other queues when theirs is
+/// empty. Batches submitted by a worker go to its own queue, other batches are
+/// spread over the queues. Threads waiting on a batch run its tasks too.
+class ThreadPoolScheduler : public TaskScheduler {
+ public:
+  /// @brief Constructor for ThreadPoolScheduler.
+  ///
+  /// @param[in] num_threads The number of worker threads. With 0, a worker is
+  /// started for each hardware thread but one, which is left to the thread
+  /// waiting on the work.
+  explicit ThreadPoolScheduler(int32_t num_threads);
+
+  /// @brief Stops the workers once their queued tasks have run.
+  virtual ~ThreadPoolScheduler();
+
+  virtual void Submit(const Task *tasks, size_t count, TaskCounter *counter);
+  virtual void Wait(TaskCounter *counter);
+  virtual int32_t GetConcurrency() const;
+
+ private:
+  std::unique_ptr<ThreadPoolState> state_;
+
+  // Disable copy constructor.
+  ThreadPoolScheduler(const ThreadPoolScheduler &);
+  ThreadPoolScheduler &operator=(const ThreadPoolScheduler &);
+};
+
+/// @}
+
+}  // namespace flatui
+
+#endif  // FPL_TASK_SCHEDULER_H
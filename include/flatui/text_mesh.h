@@ -0,0 +1,115 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FPL_TEXT_MESH_H
+#define FPL_TEXT_MESH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace fplbase {
+class Renderer;
+}  // namespace fplbase
+
+namespace flatui {
+
+struct FontVertex;
+
+/// @file
+/// @addtogroup flatui_font_manager
+/// @{
+
+/// @class TextMesh
+///
+/// @brief TextMesh keeps the glyph quads of a FontBuffer in buffers of the
+/// graphics API (e.g. a VBO and an IBO), so that a text that doesn't change
+/// isn't sent to the driver again each frame.
+class TextMesh {
+ public:
+  virtual ~TextMesh() {}
+
+  /// @brief Render the glyph quads with the current shader and texture.
+  ///
+  /// @param[in] renderer The renderer to render with.
+  virtual void Render(fplbase::Renderer &renderer) = 0;
+
+  /// @brief Replace the vertices of the mesh, after the UVs of its FontBuffer
+  /// have been refreshed. The number of vertices doesn't change.
+  ///
+  /// @param[in] vertices The vertices.
+  /// @param[in] vertex_count The number of vertices.
+  ///
+  /// @return Returns `false` if the mesh can't be updated. A new mesh is
+  /// created in that case.
+  virtual bool UpdateVertices(const FontVertex *vertices,
+                              size_t vertex_count) {
+    (void)vertices;
+    (void)vertex_count;
+    return false;
+  }
+};
+
+/// @class TextMeshFactory
+///
+/// @brief TextMeshFactory creates the TextMeshes FontBuffers are rendered
+/// with.
+///
+/// The default factory (see `FontManager::SetTextMeshFactory()`) creates
+/// fplbase meshes. Apps with a renderer of their own implement the interface
+/// on top of it, and the layout benchmark counts the uploaded bytes with a
+/// stand-in (`CountingMeshFactory`).
+///
+/// Meshes are only destroyed on the rendering thread, by
+/// `FontManager::StartRenderPass()` and `FontManager::FlushAndUpdate()`.
+class TextMeshFactory {
+ public:
+  virtual ~TextMeshFactory() {}
+
+  /// @brief Create a mesh, uploading the vertices and the indices.
+  ///
+  /// FontBuffers of more than `FontBuffer::kMaxGlyphsPerBatch` glyphs create
+  /// a mesh per batch, the vertices of a mesh are always addressable with 16
+  /// bit indices.
+  ///
+  /// @param[in] vertices The vertices, 4 per glyph.
+  /// @param[in] vertex_count The number of vertices.
+  /// @param[in] indices The indices, 6 per glyph.
+  /// @param[in] index_count The number of indices.
+  ///
+  /// @return Returns the mesh, or `nullptr` if it can't be created. The text
+  /// is rendered from its vertex array then.
+  virtual std::unique_ptr<TextMesh> CreateMesh(const FontVertex *vertices,
+                                               size_t vertex_count,
+                                               const uint16_t *indices,
+                                               size_t index_count) = 0;
+};
+
+/// @class MeshFactory
+///
+/// @brief MeshFactory creates TextMeshes backed by `fplbase::Mesh`, with a
+/// vertex buffer and an index buffer per mesh.
+class MeshFactory : public TextMeshFactory {
+ public:
+  virtual std::unique_ptr<TextMesh> CreateMesh(const FontVertex *vertices,
+                                               size_t vertex_count,
+                                               const uint16_t *indices,
+                                               size_t index_count);
+};
+
+/// @}
+
+}  // namespace flatui
+
+#endif  // FPL_TEXT_MESH_H
@@ -30,8 +30,16 @@ LOCAL_ARM_MODE := arm
 
 LOCAL_EXPORT_C_INCLUDES := $(FLATUI_DIR)/include
 
+FLATUI_SCHEMA_DIR := $(FLATUI_DIR)/schemas
+FLATUI_SCHEMA_FILES := \
+  $(FLATUI_SCHEMA_DIR)/glyph_atlas.fbs \
+  $(FLATUI_SCHEMA_DIR)/shaped_text.fbs
+FLATUI_GENERATED_OUTPUT_DIR := $(FLATUI_DIR)/gen/include
+
 LOCAL_C_INCLUDES := \
   $(LOCAL_EXPORT_C_INCLUDES) \
+  $(FLATUI_GENERATED_OUTPUT_DIR) \
+  $(DEPENDENCIES_FLATBUFFERS_DIR)/include \
   $(DEPENDENCIES_FREETYPE_DIR)/include \
   $(DEPENDENCIES_HARFBUZZ_DIR)/src \
   $(DEPENDENCIES_LIBUNIBREAK_DIR)/src \
@@ -43,11 +51,20 @@ LOCAL_C_INCLUDES := \
 LOCAL_CPPFLAGS := -std=c++11
 
 LOCAL_SRC_FILES := \
+  src/draw_list.cpp \
   src/flatui.cpp \
   src/flatui_common.cpp \
+  src/font_buffer_arena.cpp \
+  src/font_decoder.cpp \
   src/font_manager.cpp \
+  src/glyph_rasterizer.cpp \
+  src/glyph_store.cpp \
+  src/image_atlas.cpp \
+  src/mapped_file.cpp \
   src/micro_edit.cpp \
   src/script_table.cpp \
+  src/task_scheduler.cpp \
+  src/text_mesh.cpp \
   src/version.cpp
 
 LOCAL_STATIC_LIBRARIES := \
@@ -57,6 +74,16 @@ LOCAL_STATIC_LIBRARIES := \
   libharfbuzz \
   libunibreak
 
+ifeq (,$(FLATUI_RUN_ONCE))
+FLATUI_RUN_ONCE := 1
+$(call flatbuffers_header_build_rules,\
+  $(FLATUI_SCHEMA_FILES),\
+  $(FLATUI_SCHEMA_DIR),\
+  $(FLATUI_GENERATED_OUTPUT_DIR),\
+  ,\
+  $(LOCAL_SRC_FILES))
+endif
+
 include $(BUILD_STATIC_LIBRARY)
 
 $(call import-add-path,$(DEPENDENCIES_MATHFU_DIR)/..)
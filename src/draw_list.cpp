@@ -0,0 +1,126 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/draw_list.h"
+
+using fplbase::Mesh;
+using fplbase::Renderer;
+using fplbase::Shader;
+using mathfu::vec2;
+using mathfu::vec2i;
+using mathfu::vec3;
+using mathfu::vec4;
+
+namespace flatui {
+
+void DrawList::Add(const DrawCommand &command, const FontVertex *vertices,
+                   size_t vertex_count) {
+  commands_.push_back(command);
+  if (command.type == DrawCommand::kText) {
+    commands_.back().vertex_offset = vertices_.size();
+    vertices_.insert(vertices_.end(), vertices, vertices + vertex_count);
+  }
+}
+
+void DrawList::Render(Renderer &renderer, Shader *const *shaders,
+                      const uint16_t *quad_indices) const {
+  if (commands_.empty()) return;
+  if (default_projection_) SetOrtho(renderer, canvas_size_);
+  for (auto it = commands_.begin(); it != commands_.end(); ++it) {
+    Execute(*it, vertices_.data(), renderer, shaders, quad_indices);
+  }
+}
+
+void DrawList::Execute(const DrawCommand &command, const FontVertex *vertices,
+                       Renderer &renderer, Shader *const *shaders,
+                       const uint16_t *quad_indices) {
+  auto shader = shaders[command.shader];
+  switch (command.type) {
+    case DrawCommand::kQuad: {
+      if (command.texture) command.texture->Set(0);
+      renderer.set_color(vec4(command.color));
+      shader->Set(renderer);
+      auto uv = vec4(command.rect);
+      Mesh::RenderAAQuadAlongX(vec3(vec2(command.pos), 0),
+                               vec3(vec2(command.pos + command.size), 0),
+                               uv.xy(), uv.zw());
+      break;
+    }
+    case DrawCommand::kNinePatch:
+      command.texture->Set(0);
+      renderer.set_color(vec4(command.color));
+      shader->Set(renderer);
+      Mesh::RenderAAQuadAlongXNinePatch(
+          vec3(vec2(command.pos), 0), vec3(vec2(command.pos + command.size), 0),
+          command.texture->size(), vec4(command.rect));
+      break;
+    case DrawCommand::kText: {
+      renderer.set_color(vec4(command.color));
+      command.texture->Set(0);
+      shader->Set(renderer);
+      shader->SetUniform("pos_offset",
+                         vec3(static_cast<float>(command.pos.x()),
+                              static_cast<float>(command.pos.y()), 0.0f));
+      if (command.shader == kDrawShaderFontClipping ||
+          command.shader == kDrawShaderFontEffect) {
+        shader->SetUniform("clipping", vec4(command.rect));
+      }
+      if (command.shader == kDrawShaderFontEffect) {
+        shader->SetUniform("effect_color", vec4(command.effect_color));
+      }
+      if (command.mesh != nullptr) {
+        command.mesh->Render(renderer);
+        break;
+      }
+      const fplbase::Attribute kFormat[] = {
+          fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
+      // The shared indices cover a batch of glyphs, longer texts are rendered
+      // a batch at a time.
+      const size_t kBatchIndices =
+          FontBuffer::kMaxGlyphsPerBatch * FontBuffer::kIndiciesPerCodePoint;
+      const size_t kBatchVertices =
+          FontBuffer::kMaxGlyphsPerBatch * FontBuffer::kVerticesPerCodePoint;
+      auto batch_vertices = vertices + command.vertex_offset;
+      for (size_t index = 0; index < command.index_count;
+           index += kBatchIndices) {
+        auto count = std::min(command.index_count - index, kBatchIndices);
+        Mesh::RenderArray(Mesh::kTriangles, static_cast<int>(count), kFormat,
+                          sizeof(FontVertex),
+                          reinterpret_cast<const char *>(batch_vertices),
+                          quad_indices);
+        batch_vertices += kBatchVertices;
+      }
+      break;
+    }
+    case DrawCommand::kScissorOn:
+      renderer.ScissorOn(command.pos, command.size);
+      break;
+    case DrawCommand::kScissorOff:
+      renderer.ScissorOff();
+      break;
+    case DrawCommand::kCustom:
+      command.renderer(command.pos, command.size);
+      break;
+  }
+}
+
+void DrawList::SetOrtho(Renderer &renderer, const vec2i &canvas_size) {
+  auto ortho_mat = mathfu::OrthoHelper<float>(
+      0.0f, static_cast<float>(canvas_size.x()),
+      static_cast<float>(canvas_size.y()), 0.0f, -1.0f, 1.0f);
+  renderer.set_model_view_projection(ortho_mat);
+}
+
+}  // namespace flatui
@@ -14,6 +14,7 @@
 
 #include <cstring>
 #include "flatui/flatui.h"
+#include "flatui/internal/flatui_config.h"
 #include "flatui/internal/flatui_util.h"
 #include "flatui/internal/micro_edit.h"
 #include "fplbase/utilities.h"
@@ -22,12 +23,10 @@ using fplbase::Button;
 using fplbase::InputSystem;
 using fplbase::LogError;
 using fplbase::LogInfo;
-using fplbase::Mesh;
 using fplbase::Shader;
 using fplbase::Texture;
 using mathfu::vec2;
 using mathfu::vec2i;
-using mathfu::vec3;
 using mathfu::vec3i;
 using mathfu::vec4;
 using mathfu::vec4i;
@@ -49,6 +48,14 @@ static const int32_t kDragStartThresholdDefault = 8;
 static const int32_t kPointerIndexInvalid = -1;
 static const int32_t kElementIndexInvalid = -1;
 static const vec2i kDragStartPoisitionInvalid = vec2i(-1, -1);
+// Pointer samples used to estimate the pointer velocity, and the maximum
+// extrapolation of pointer positions, in seconds.
+static const double kPointerVelocityWindow = 0.05;
+static const double kPointerPredictionMax = 0.05;
+// Clipping window of texts that are not clipped, within the range of mediump
+// floats in shaders.
+static const vec4 kNoClippingWindow =
+    vec4(-16384.0f, -16384.0f, 16384.0f, 16384.0f);
 #if !defined(NDEBUG)
 static const uint32_t kDefaultGroupHashedId = HashId(kDefaultGroupID);
 #endif
@@ -95,33 +102,119 @@ class Group {
   vec4i margin_;
 };
 
+// We create one of these per GUI element, so new fields should only be
+// added when absolutely necessary.
+struct Element {
+  Element(const vec2i &_size, HashedId _hash)
+      : size(_size),
+        extra_size(mathfu::kZeros2i),
+        hash(_hash),
+        interactive(false) {}
+  vec2i size;        // Minimum on-screen size computed by layout pass.
+  vec2i extra_size;  // Additional size in a scrolling area (TODO: remove?)
+  HashedId hash;     // From id specified by the user.
+  bool interactive;  // Wants to respond to user input.
+};
+
+// Intra-frame persistent state of a GUI, owned by its GuiContext.
+struct PersistentState {
+  PersistentState() : is_last_event_pointer_type(true) {
+    for (int i = 0; i < InputSystem::kMaxSimultanuousPointers; i++) {
+      pointer_element[i] = kNullHash;
+    }
+    input_focus_ = input_capture_ = mouse_capture_ = kNullHash;
+    dragging_pointer_ = kPointerIndexInvalid;
+    elements_overflowed_ = groups_overflowed_ = false;
+    has_pointer_prediction_ = false;
+    pointer_prediction_ = mathfu::kZeros2i;
+
+    // Reserve the storage of bounded GUIs, including the overflow and the
+    // sentinel elements.
+    if (FLATUI_MAX_ELEMENTS) elements_.reserve(FLATUI_MAX_ELEMENTS + 2);
+    if (FLATUI_SOFT_MAX_GROUPS) group_stack_.reserve(FLATUI_SOFT_MAX_GROUPS);
+  }
+
+  // For each pointer, the element id that last received a down event.
+  HashedId pointer_element[InputSystem::kMaxSimultanuousPointers];
+  // The element the gamepad is currently "over", simulates the mouse
+  // hovering over an element.
+  HashedId input_focus_;
+
+  // The element that capturing the keyboard.
+  HashedId input_capture_;
+
+  // The element that capturing the pointer.
+  // The element continues to recieve mouse events until it releases the
+  // capture.
+  HashedId mouse_capture_;
+
+  // Simple text edit handler for an edit box.
+  MicroEdit text_edit_;
+
+  // Keep tracking a pointer position of a drag start.
+  vec2i drag_start_position_;
+  int32_t dragging_pointer_;
+
+  // If yes, then touch/mouse, else gamepad/keyboard.
+  bool is_last_event_pointer_type;
+
+  // Pointer position predicted from the pointer samples of the last frame, if
+  // it had samples.
+  bool has_pointer_prediction_;
+  vec2i pointer_prediction_;
+
+  // Storage of the elements and the group stack of each frame, kept across
+  // frames so that it's allocated once.
+  std::vector<Element> elements_;
+  std::vector<Group> group_stack_;
+
+  // Whether the capacities were exceeded and logged.
+  bool elements_overflowed_;
+  bool groups_overflowed_;
+};
+
+GuiContext::GuiContext() : persistent_(new PersistentState()) {}
+
+GuiContext::~GuiContext() {}
+
+// Load the shaders used by draw commands.
+static void LoadShaders(fplbase::AssetManager &assetman, Shader **shaders) {
+  shaders[kDrawShaderImage] = assetman.LoadShader("shaders/textured");
+  shaders[kDrawShaderFont] = assetman.LoadShader("shaders/font");
+  shaders[kDrawShaderFontClipping] =
+      assetman.LoadShader("shaders/font_clipping");
+  shaders[kDrawShaderFontEffect] = assetman.LoadShader("shaders/font_effect");
+  shaders[kDrawShaderColor] = assetman.LoadShader("shaders/color");
+  for (int i = 0; i < kDrawShaderCount; i++) {
+    assert(shaders[i]);
+  }
+}
+
 // This holds transient state used while a GUI is being laid out / rendered.
 // It is intentionally hidden from the interface.
-// It is implemented as a singleton that the GUI element functions can access.
+// Each thread has a current instance that the GUI element functions can
+// access, so that GUIs can be built on multiple threads at once.
+
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define FLATUI_THREAD_LOCAL __declspec(thread)
+#else
+#define FLATUI_THREAD_LOCAL thread_local
+#endif
 
 class InternalState;
-InternalState *state = nullptr;
+static FLATUI_THREAD_LOCAL InternalState *state = nullptr;
 
 class InternalState : public Group {
  public:
-  // We create one of these per GUI element, so new fields should only be
-  // added when absolutely necessary.
-  struct Element {
-    Element(const vec2i &_size, HashedId _hash)
-        : size(_size),
-          extra_size(mathfu::kZeros2i),
-          hash(_hash),
-          interactive(false) {}
-    vec2i size;        // Minimum on-screen size computed by layout pass.
-    vec2i extra_size;  // Additional size in a scrolling area (TODO: remove?)
-    HashedId hash;     // From id specified by the user.
-    bool interactive;  // Wants to respond to user input.
-  };
-
+  // When `draw_list` is given, rendering commands are recorded into it instead
+  // of being executed.
   InternalState(fplbase::AssetManager &assetman, FontManager &fontman,
-                fplbase::InputSystem &input)
+                fplbase::InputSystem &input, GuiContext &context,
+                DrawList *draw_list)
       : Group(kDirVertical, kAlignLeft, 0, 0),
         layout_pass_(true),
+        elements_(context.persistent_->elements_),
+        group_stack_(context.persistent_->group_stack_),
         canvas_size_(assetman.renderer().window_size()),
         default_projection_(true),
         virtual_resolution_(FLATUI_DEFAULT_VIRTUAL_RESOLUTION),
@@ -129,6 +222,8 @@ class InternalState : public Group {
         renderer_(assetman.renderer()),
         input_(input),
         fontman_(fontman),
+        draw_list_(draw_list),
+        persistent_(*context.persistent_),
         clip_position_(mathfu::kZeros2i),
         clip_size_(mathfu::kZeros2i),
         clip_inside_(false),
@@ -141,6 +236,10 @@ class InternalState : public Group {
         version_(&Version()) {
     SetScale();
 
+    // Reuse the storage of the previous frame.
+    elements_.clear();
+    group_stack_.clear();
+
     bool flush_pointer_capture = true;
     // Cache the state of multiple pointers, so we have to do less work per
     // interactive element.
@@ -171,17 +270,25 @@ class InternalState : public Group {
 
     state = this;
 
-    // Load shaders ahead.
-    image_shader_ = matman_.LoadShader("shaders/textured");
-    assert(image_shader_);
-    font_shader_ = matman_.LoadShader("shaders/font");
-    assert(font_shader_);
-    font_clipping_shader_ = matman_.LoadShader("shaders/font_clipping");
-    assert(font_clipping_shader_);
-    color_shader_ = matman_.LoadShader("shaders/color");
-    assert(color_shader_);
+    // Load shaders ahead. Recorded commands get them when they are submitted.
+    if (draw_list_) {
+      for (int i = 0; i < kDrawShaderCount; i++) {
+        shaders_[i] = nullptr;
+      }
+    } else {
+      LoadShaders(matman_, shaders_);
+    }
 
     text_color_ = mathfu::kOnes4f;
+    text_effect_ = kGlyphEffectNone;
+    text_effect_size_ = 0;
+    text_effect_color_ = mathfu::kZeros4f;
+    image_atlas_ = nullptr;
+    {
+      std::lock_guard<std::recursive_mutex> lock(fontman_.get_mutex());
+      auto face = fontman_.GetCurrentFace();
+      font_id_ = face ? face->font_id_ : kNullHash;
+    }
 
     scroll_speed_drag_ = kScrollSpeedDragDefault;
     scroll_speed_wheel_ = kScrollSpeedWheelDefault;
@@ -189,11 +296,19 @@ class InternalState : public Group {
     drag_start_threshold_ =
         vec2i(kDragStartThresholdDefault, kDragStartThresholdDefault);
     current_pointer_ = kPointerIndexInvalid;
+    has_pointer_samples_ = false;
+    pointer_prediction_ = mathfu::kZeros2i;
 
-    fontman_.StartLayoutPass();
+    // GUIs built into draw lists share a layout pass started by the caller.
+    if (!draw_list_) fontman_.StartLayoutPass();
   }
 
-  ~InternalState() { state = nullptr; }
+  ~InternalState() {
+    // Drag deltas of the next frame are relative to this prediction.
+    persistent_.has_pointer_prediction_ = has_pointer_samples_;
+    persistent_.pointer_prediction_ = pointer_prediction_;
+    state = nullptr;
+  }
 
   template <int D>
   mathfu::Vector<int, D> VirtualToPhysical(const mathfu::Vector<float, D> &v) {
@@ -220,17 +335,6 @@ class InternalState : public Group {
     default_projection_ = false;
   }
 
-  // Set up an ortho camera for all 2D elements, with (0, 0) in the top left,
-  // and the bottom right the windows size in pixels.
-  // This is currently hardcoded to use overlay on top of the entire GL window.
-  // If that ever changes, we also need to change our use of glScissor below.
-  void SetOrtho() {
-    auto ortho_mat = mathfu::OrthoHelper<float>(
-        0.0f, static_cast<float>(canvas_size_.x()),
-        static_cast<float>(canvas_size_.y()), 0.0f, -1.0f, 1.0f);
-    renderer_.set_model_view_projection(ortho_mat);
-  }
-
   // Compute a space offset for a particular alignment for just the x or y
   // dimension.
   static vec2i AlignDimension(Alignment align, int dim, const vec2i &space) {
@@ -279,10 +383,11 @@ class InternalState : public Group {
 
     // Put in a sentinel element. We'll use this element to point to
     // when a group didn't exist during layout but it does during rendering.
-    NewElement(mathfu::kZeros2i, kNullHash);
+    elements_.push_back(Element(mathfu::kZeros2i, kNullHash));
 
     // Update font manager if they need to upload font atlas texture.
-    fontman_.StartRenderPass();
+    // SubmitGui() does it for recorded GUIs.
+    if (!draw_list_) fontman_.StartRenderPass();
 
     position_ = mathfu::kZeros2i;
     size_ = elements_[0].size;
@@ -292,7 +397,16 @@ class InternalState : public Group {
 
     CheckGamePadNavigation();
 
-    if (default_projection_) SetOrtho();
+    // Set up an ortho camera for all 2D elements, with (0, 0) in the top left,
+    // and the bottom right the windows size in pixels.
+    // This is currently hardcoded to use overlay on top of the entire GL
+    // window. If that ever changes, we also need to change our use of
+    // glScissor below.
+    if (draw_list_) {
+      draw_list_->SetCanvas(canvas_size_, default_projection_);
+    } else if (default_projection_) {
+      DrawList::SetOrtho(renderer_, canvas_size_);
+    }
   }
 
   // (render pass): retrieve the next corresponding cached element we
@@ -315,6 +429,23 @@ class InternalState : public Group {
 
   // (layout pass): create a new element.
   void NewElement(const vec2i &size, HashedId hash) {
+#if FLATUI_MAX_ELEMENTS
+    if (elements_.size() >= FLATUI_MAX_ELEMENTS) {
+      // Out of elements. The element still takes space in the layout, but it
+      // isn't found in the render pass, so it's skipped. A single overflow
+      // element stands in for groups that didn't get their own.
+      if (elements_.size() == FLATUI_MAX_ELEMENTS) {
+        if (!persistent_.elements_overflowed_) {
+          LogError("FlatUI: more than %d elements in a GUI, the rest of the "
+                   "GUI is not rendered. Increase FLATUI_MAX_ELEMENTS.",
+                   FLATUI_MAX_ELEMENTS);
+          persistent_.elements_overflowed_ = true;
+        }
+        elements_.push_back(Element(mathfu::kZeros2i, kNullHash));
+      }
+      return;
+    }
+#endif  // FLATUI_MAX_ELEMENTS
     elements_.push_back(Element(size, hash));
   }
 
@@ -354,17 +485,44 @@ class InternalState : public Group {
     return pos;
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
-                  const vec2i &size, const vec4 &uv) {
-    renderer_.set_color(color);
-    sh->Set(renderer_);
-    Mesh::RenderAAQuadAlongX(vec3(vec2(pos), 0), vec3(vec2(pos + size), 0),
-                             uv.xy(), uv.zw());
+  // Execute a rendering command, or record it when building into a draw list.
+  void Draw(const DrawCommand &command, const FontVertex *vertices = nullptr,
+            size_t vertex_count = 0) {
+    if (draw_list_) {
+      draw_list_->Add(command, vertices, vertex_count);
+    } else {
+      DrawList::Execute(command, vertices, renderer_, shaders_,
+                        fontman_.GetBufferArena().get_quad_indices());
+    }
   }
 
-  void RenderQuad(Shader *sh, const vec4 &color, const vec2i &pos,
-                  const vec2i &size) {
-    RenderQuad(sh, color, pos, size, vec4(0, 0, 1, 1));
+  void RenderQuad(DrawShader sh, const Texture *texture, const vec4 &color,
+                  const vec2i &pos, const vec2i &size, const vec4 &uv) {
+    DrawCommand command(DrawCommand::kQuad);
+    command.shader = sh;
+    command.texture = texture;
+    command.color = color;
+    command.pos = pos;
+    command.size = size;
+    command.rect = uv;
+    Draw(command);
+  }
+
+  void RenderQuad(DrawShader sh, const Texture *texture, const vec4 &color,
+                  const vec2i &pos, const vec2i &size) {
+    RenderQuad(sh, texture, color, pos, size, vec4(0, 0, 1, 1));
+  }
+
+  // Render an image, from the image atlas page if the texture is packed in it.
+  void RenderImage(const Texture &texture, const vec4 &color,
+                   const vec2i &pos, const vec2i &size) {
+    auto entry = image_atlas_ ? image_atlas_->Find(texture) : nullptr;
+    if (entry) {
+      RenderQuad(kDrawShaderImage, entry->page, color, pos, size,
+                 vec4(entry->uv));
+    } else {
+      RenderQuad(kDrawShaderImage, &texture, color, pos, size);
+    }
   }
 
   // An image element.
@@ -382,9 +540,8 @@ class InternalState : public Group {
     } else {
       auto element = NextElement(hash);
       if (element) {
-        texture.Set(0);
-        RenderQuad(image_shader_, mathfu::kOnes4f, Position(*element),
-                   element->size);
+        RenderImage(texture, mathfu::kOnes4f, Position(*element),
+                    element->size);
         Advance(element->size);
       }
     }
@@ -393,6 +550,8 @@ class InternalState : public Group {
   bool Edit(float ysize, const mathfu::vec2 &edit_size, const char *id,
             std::string *text) {
     auto hash = HashId(id);
+    // Hold the FontManager while using its FontBuffer.
+    std::lock_guard<std::recursive_mutex> lock(fontman_.get_mutex());
     StartGroup(GetDirection(kLayoutHorizontalBottom),
                GetAlignment(kLayoutHorizontalBottom), 0, hash);
     bool in_edit = false;
@@ -404,9 +563,6 @@ class InternalState : public Group {
     // Check event, this marks this element as an interactive element.
     auto event = CheckEvent(false);
 
-    // Set text color
-    renderer_.set_color(text_color_);
-
     auto physical_label_size = VirtualToPhysical(edit_size);
     auto size = VirtualToPhysical(vec2(0, ysize));
     auto ui_text = text;
@@ -420,12 +576,18 @@ class InternalState : public Group {
       // Get a text from the micro editor when it's editing.
       ui_text = persistent_.text_edit_.GetEditingText();
     }
-    auto parameter = FontBufferParameters(
-        fontman_.GetCurrentFace()->font_id_, HashId(ui_text->c_str()),
-        static_cast<float>(size.y()), physical_label_size, true);
-    auto buffer =
-        fontman_.GetBuffer(ui_text->c_str(), ui_text->length(), parameter);
-    assert(buffer);
+    auto parameter =
+        FontBufferParameters(font_id_, HashId(ui_text->c_str()),
+                             static_cast<float>(size.y()), physical_label_size);
+    // The editor scrolls through the lines below the box, lay them out too.
+    auto buffer = fontman_.GetBuffer(ui_text->c_str(), ui_text->length(),
+                                     parameter, draw_list_ == nullptr, true);
+    if (buffer == nullptr) {
+      // Only happens when the glyph cache can't be flushed while recording.
+      assert(draw_list_);
+      EndGroup();
+      return in_edit;
+    }
 
     // Check if the editbox is an auto expanding edit box.
     if (physical_label_size.x() == 0) {
@@ -547,7 +709,8 @@ class InternalState : public Group {
     startpos.y() += static_cast<int>(font_size * kUnderlineOffsetFactor);
     size.y() += static_cast<int>(line_width);
 
-    RenderQuad(color_shader_, mathfu::kOnes4f, pos + startpos, size);
+    RenderQuad(kDrawShaderColor, nullptr, mathfu::kOnes4f, pos + startpos,
+               size);
   }
 
   // Helper for Edit widget to render a caret.
@@ -560,7 +723,8 @@ class InternalState : public Group {
     const double kCareteBlinkDuration = 10.0;
     auto t = input_.Time();
     if (sin(t * kCareteBlinkDuration) > 0.0) {
-      RenderQuad(color_shader_, mathfu::kOnes4f, caret_pos, caret_size);
+      RenderQuad(kDrawShaderColor, nullptr, mathfu::kOnes4f, caret_pos,
+                 caret_size);
     }
   }
 
@@ -572,21 +736,67 @@ class InternalState : public Group {
 
   // Multi line Text label.
   void Label(const char *text, float ysize, const vec2 &label_size) {
-    // Set text color.
-    renderer_.set_color(text_color_);
+    Label(text, strlen(text), HashId(text), ysize, label_size);
+  }
+
+  // Text label of a UTF-16 text.
+  void Label(const uint16_t *text, size_t length, float ysize,
+             const vec2 &label_size) {
+    Label(text, length, HashId(text, length), ysize, label_size);
+  }
 
+  // Text label of a UTF-8 (`T` is char) or UTF-16 (`T` is uint16_t) text.
+  template <typename T>
+  void Label(const T *text, size_t length, HashedId text_id, float ysize,
+             const vec2 &label_size) {
     auto physical_label_size = VirtualToPhysical(label_size);
     auto size = VirtualToPhysical(vec2(0, ysize));
+    // Shadows are drawn from their own glyph images, under the text without
+    // an effect.
+    auto shadow = text_effect_ == kGlyphEffectShadow;
     auto parameter = FontBufferParameters(
-        fontman_.GetCurrentFace()->font_id_, HashId(text),
-        static_cast<float>(size.y()), physical_label_size, false);
-    auto buffer = fontman_.GetBuffer(text, strlen(text), parameter);
-    assert(buffer);
-    Label(*buffer, parameter, vec4i(vec2i(0, 0), buffer->get_size()));
+        font_id_, text_id, static_cast<float>(size.y()), physical_label_size,
+        shadow ? kGlyphEffectNone : text_effect_, text_effect_size_);
+    // Hold the FontManager while using its FontBuffer.
+    std::lock_guard<std::recursive_mutex> lock(fontman_.get_mutex());
+    // Request the shadow first, it may flush the glyph cache. Then request it
+    // again without flushing once the text's glyphs are in, and skip the
+    // shadow if both don't fit in the cache.
+    auto shadow_parameter = FontBufferParameters(
+        font_id_, text_id, static_cast<float>(size.y()), physical_label_size,
+        kGlyphEffectShadow, text_effect_size_);
+    if (shadow) {
+      fontman_.GetBuffer(text, length, shadow_parameter, draw_list_ == nullptr);
+    }
+    auto buffer =
+        fontman_.GetBuffer(text, length, parameter, draw_list_ == nullptr);
+    if (buffer == nullptr) {
+      // Only happens when the glyph cache can't be flushed while recording.
+      assert(draw_list_);
+      return;
+    }
+    FontBuffer *shadow_buffer = nullptr;
+    if (shadow) {
+      shadow_buffer = fontman_.GetBuffer(text, length, shadow_parameter, false);
+    }
+    // The layout stops at the last line starting in the label, or holds all
+    // the lines when an Edit shares the buffer. Clip what's below the label.
+    auto window = vec4i(vec2i(0, 0), buffer->get_size());
+    if (physical_label_size.y()) {
+      window.w() = std::min(window.w(), physical_label_size.y());
+    }
+    Label(*buffer, parameter, window, shadow_buffer);
   }
 
   vec2i Label(const FontBuffer &buffer, const FontBufferParameters &parameter,
               const vec4i &window) {
+    return Label(buffer, parameter, window, nullptr);
+  }
+
+  // Text label of a FontBuffer, drawn over the glyphs of `shadow` when it's
+  // not null.
+  vec2i Label(const FontBuffer &buffer, const FontBufferParameters &parameter,
+              const vec4i &window, const FontBuffer *shadow) {
     vec2i pos = mathfu::kZeros2i;
     auto hash = parameter.get_text_id();
     if (layout_pass_) {
@@ -595,13 +805,17 @@ class InternalState : public Group {
       Extend(size);
     } else {
       // Check if texture atlas needs to be updated.
-      if (buffer.get_pass() > 0) {
+      if (buffer.get_pass() > 0 && !draw_list_) {
         fontman_.StartRenderPass();
       }
 
       auto element = NextElement(hash);
       if (element) {
-        fontman_.GetAtlasTexture()->Set(0);
+        DrawCommand command(DrawCommand::kText);
+        command.shader = kDrawShaderFont;
+        command.texture = fontman_.GetAtlasTexture();
+        command.color = text_color_;
+        command.index_count = buffer.get_index_count();
 
         pos = Position(*element);
 
@@ -615,27 +829,38 @@ class InternalState : public Group {
           pos -= window.xy();
 
           // Set a window to show a part of the label.
-          font_clipping_shader_->Set(renderer_);
-          font_clipping_shader_->SetUniform(
-              "pos_offset", vec3(static_cast<float>(pos.x()),
-                                 static_cast<float>(pos.y()), 0.0f));
+          command.shader = kDrawShaderFontClipping;
           auto start = vec2(position_ - pos);
           auto end = start + vec2(window.zw());
-          font_clipping_shader_->SetUniform("clipping", vec4(start, end));
-        } else {
-          font_shader_->Set(renderer_);
-          font_shader_->SetUniform("pos_offset",
-                                   vec3(static_cast<float>(pos.x()),
-                                        static_cast<float>(pos.y()), 0.0f));
+          command.rect = vec4(start, end);
         }
-
-        const fplbase::Attribute kFormat[] = {
-            fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
-        Mesh::RenderArray(
-            Mesh::kTriangles, static_cast<int>(buffer.get_indices()->size()),
-            kFormat, sizeof(FontVertex),
-            reinterpret_cast<const char *>(buffer.get_vertices()->data()),
-            buffer.get_indices()->data());
+        if (parameter.get_glyph_effect() != kGlyphEffectNone) {
+          // The effect shader always clips, with a window large enough to
+          // show the whole label unless it's clipped.
+          command.shader = kDrawShaderFontEffect;
+          command.effect_color = text_effect_color_;
+          if (!clipping) command.rect = kNoClippingWindow;
+        }
+        command.pos = pos;
+        if (shadow) {
+          // The shadow buffer has the layout of the text, with glyph images
+          // holding only the shadow.
+          auto shadow_command = command;
+          shadow_command.color = text_effect_color_;
+          shadow_command.index_count = shadow->get_index_count();
+          if (!draw_list_) {
+            shadow_command.mesh =
+                shadow->GetMesh(fontman_.get_text_mesh_factory());
+          }
+          Draw(shadow_command, shadow->get_vertices(),
+               shadow->get_vertex_count());
+        }
+        if (!draw_list_) {
+          // Render the text from its mesh, uploaded once while it doesn't
+          // change.
+          command.mesh = buffer.GetMesh(fontman_.get_text_mesh_factory());
+        }
+        Draw(command, buffer.get_vertices(), buffer.get_vertex_count());
         Advance(element->size);
       }
     }
@@ -654,7 +879,11 @@ class InternalState : public Group {
     } else {
       auto element = NextElement(hash);
       if (element) {
-        renderer(Position(*element), element->size);
+        DrawCommand command(DrawCommand::kCustom);
+        command.pos = Position(*element);
+        command.size = element->size;
+        command.renderer = renderer;
+        Draw(command);
         Advance(element->size);
       }
     }
@@ -669,20 +898,19 @@ class InternalState : public Group {
   void RenderTexture(const Texture &tex, const vec2i &pos, const vec2i &size,
                      const vec4 &color) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, color, pos, size);
+      RenderImage(tex, color, pos, size);
     }
   }
 
   void RenderTextureNinePatch(const Texture &tex, const vec4 &patch_info,
                               const vec2i &pos, const vec2i &size) {
     if (!layout_pass_) {
-      tex.Set(0);
-      renderer_.set_color(mathfu::kOnes4f);
-      image_shader_->Set(renderer_);
-      Mesh::RenderAAQuadAlongXNinePatch(vec3(vec2(pos), 0),
-                                        vec3(vec2(pos + size), 0), tex.size(),
-                                        patch_info);
+      DrawCommand command(DrawCommand::kNinePatch);
+      command.texture = &tex;
+      command.pos = pos;
+      command.size = size;
+      command.rect = patch_info;
+      Draw(command);
     }
   }
 
@@ -691,9 +919,21 @@ class InternalState : public Group {
   void StartGroup(Direction direction, Alignment align, float spacing,
                   HashedId hash) {
     Group layout(direction, align, static_cast<int>(spacing), elements_.size());
+#if FLATUI_SOFT_MAX_GROUPS
+    if (group_stack_.size() >= FLATUI_SOFT_MAX_GROUPS &&
+        !persistent_.groups_overflowed_) {
+      // Nesting can't be dropped, so the stack grows past its capacity.
+      LogError("FlatUI: groups nested more than %d deep. Increase "
+               "FLATUI_SOFT_MAX_GROUPS.",
+               FLATUI_SOFT_MAX_GROUPS);
+      persistent_.groups_overflowed_ = true;
+    }
+#endif  // FLATUI_SOFT_MAX_GROUPS
     group_stack_.push_back(*this);
     if (layout_pass_) {
       NewElement(mathfu::kZeros2i, hash);
+      // Refer to the overflow element if this group didn't get one.
+      layout.element_idx_ = elements_.size() - 1;
     } else {
       auto element = NextElement(hash);
       if (element) {
@@ -765,9 +1005,11 @@ class InternalState : public Group {
       // placement use another technique alltogether (render to texture,
       // glClipPlane, or stencil buffer).
       assert(default_projection_);
-      renderer_.ScissorOn(
-          vec2i(position_.x(), canvas_size_.y() - position_.y() - psize.y()),
-          psize);
+      DrawCommand scissor(DrawCommand::kScissorOn);
+      scissor.pos =
+          vec2i(position_.x(), canvas_size_.y() - position_.y() - psize.y());
+      scissor.size = psize;
+      Draw(scissor);
 
       vec2i pointer_delta = mathfu::kZeros2i;
       int32_t scroll_speed = static_cast<int32_t>(scroll_speed_drag_);
@@ -792,7 +1034,7 @@ class InternalState : public Group {
           // Finish dragging and release the pointer.
           ReleasePointer();
         }
-        pointer_delta = input_.get_pointers()[0].mousedelta;
+        pointer_delta = GetPointerDelta();
       } else {
         // Wheel scroll
         if (mathfu::InRange2D(input_.get_pointers()[0].mousepos, position_,
@@ -863,7 +1105,7 @@ class InternalState : public Group {
       for (int i = 0; i <= pointer_max_active_index_; i++) {
         clip_mouse_inside_[i] = true;
       }
-      renderer_.ScissorOff();
+      Draw(DrawCommand(DrawCommand::kScissorOff));
     }
   }
 
@@ -937,6 +1179,15 @@ class InternalState : public Group {
   // Set drag start threshold.
   // The value is used to determine if the drag operation should start after a
   // pointer WENT_DOWN event happened.
+  void SetPointerSamples(const PointerSample *samples, size_t count,
+                         double display_time) {
+    has_pointer_samples_ = count != 0;
+    if (has_pointer_samples_) {
+      pointer_prediction_ = vec2i(
+          PredictPointerPosition(samples, count, display_time) + 0.5f);
+    }
+  }
+
   void SetDragStartThreshold(int drag_start_threshold) {
     drag_start_threshold_ = vec2i(drag_start_threshold, drag_start_threshold);
   }
@@ -1254,14 +1505,13 @@ class InternalState : public Group {
 
   void ColorBackground(const vec4 &color) {
     if (!layout_pass_) {
-      RenderQuad(color_shader_, color, position_, GroupSize());
+      RenderQuad(kDrawShaderColor, nullptr, color, position_, GroupSize());
     }
   }
 
   void ImageBackground(const Texture &tex) {
     if (!layout_pass_) {
-      tex.Set(0);
-      RenderQuad(image_shader_, mathfu::kOnes4f, position_, GroupSize());
+      RenderImage(tex, mathfu::kOnes4f, position_, GroupSize());
     }
   }
 
@@ -1269,11 +1519,34 @@ class InternalState : public Group {
     RenderTextureNinePatch(tex, patch_info, position_, GroupSize());
   }
 
+  // Set the atlas images are rendered from.
+  void UseImageAtlas(const ImageAtlas *atlas) { image_atlas_ = atlas; }
+
   // Set Label's text color.
   void SetTextColor(const vec4 &color) { text_color_ = color; }
 
+  // Set the effect rendered around Label's glyphs.
+  void SetTextEffect(GlyphEffectType effect, float size, const vec4 &color) {
+    text_effect_ = effect;
+    text_effect_size_ =
+        effect != kGlyphEffectNone ? VirtualToPhysical(vec2(size, 0)).x() : 0;
+    text_effect_color_ = color;
+  }
+
   // Set Label's font.
-  void SetTextFont(const char *font_name) { fontman_.SelectFont(font_name); }
+  // GUIs built into draw lists keep the FontManager's current font untouched,
+  // since other GUIs can be using it.
+  void SetTextFont(const char *font_name) {
+    font_id_ = HashId(font_name);
+    if (!draw_list_) fontman_.SelectFont(font_name);
+  }
+
+  // Set Label's font with its handle, without hashing its name.
+  void SetTextFont(FontHandle handle) {
+    auto face = fontman_.GetFace(handle);
+    font_id_ = face != nullptr ? face->font_id_ : kNullHash;
+    if (!draw_list_) fontman_.SelectFont(handle);
+  }
 
   // Set a locale used for the text rendering.
   void SetTextLocale(const char *locale) {
@@ -1289,14 +1562,26 @@ class InternalState : public Group {
   const FlatUiVersion *GetFlatUiVersion() const { return version_; }
 
  private:
-  vec2i GetPointerDelta() { return input_.get_pointers()[0].mousedelta; }
+  // Movement of the pointer since the previous frame. With pointer samples in
+  // both frames, it's the movement of the predicted position, so that the
+  // deltas add up to the movement of the pointer.
+  vec2i GetPointerDelta() {
+    if (has_pointer_samples_ && persistent_.has_pointer_prediction_) {
+      return pointer_prediction_ - persistent_.pointer_prediction_;
+    }
+    return input_.get_pointers()[0].mousedelta;
+  }
 
-  vec2i GetPointerPosition() { return input_.get_pointers()[0].mousepos; }
+  vec2i GetPointerPosition() {
+    return has_pointer_samples_ ? pointer_prediction_
+                                : input_.get_pointers()[0].mousepos;
+  }
 
   bool layout_pass_;
-  std::vector<Element> elements_;
+  // Owned by the PersistentState, emptied at the start of each frame.
+  std::vector<Element> &elements_;
   std::vector<Element>::iterator element_it_;
-  std::vector<Group> group_stack_;
+  std::vector<Group> &group_stack_;
   vec2i canvas_size_;
   bool default_projection_;
   float virtual_resolution_;
@@ -1306,10 +1591,13 @@ class InternalState : public Group {
   fplbase::Renderer &renderer_;
   InputSystem &input_;
   FontManager &fontman_;
-  Shader *image_shader_;
-  Shader *font_shader_;
-  Shader *font_clipping_shader_;
-  Shader *color_shader_;
+  Shader *shaders_[kDrawShaderCount];
+
+  // Draw list recording the rendering commands, nullptr to render immediately.
+  DrawList *draw_list_;
+
+  // State of the GUI kept across frames, owned by its GuiContext.
+  PersistentState &persistent_;
 
   // Expensive rendering commands can check if they're inside this rect to
   // cull themselves inside a scrolling group.
@@ -1320,6 +1608,11 @@ class InternalState : public Group {
 
   // Widget properties.
   mathfu::vec4 text_color_;
+  GlyphEffectType text_effect_;
+  int32_t text_effect_size_;
+  mathfu::vec4 text_effect_color_;
+  HashedId font_id_;
+  const ImageAtlas *image_atlas_;
 
   int pointer_max_active_index_;
   const Button *pointer_buttons_[InputSystem::kMaxSimultanuousPointers];
@@ -1336,47 +1629,14 @@ class InternalState : public Group {
   // The latest pointer that returned an event.
   int32_t current_pointer_;
 
+  // Pointer position predicted from the pointer samples given in this frame.
+  bool has_pointer_samples_;
+  vec2i pointer_prediction_;
+
   // Cache the latest event so that multiple call to CheckEvent() can be safe.
   Event latest_event_;
   size_t latest_event_element_idx_;
 
-  // Intra-frame persistent state.
-  static struct PersistentState {
-    PersistentState() : is_last_event_pointer_type(true) {
-      // This is effectively a global, so no memory allocation or other
-      // complex initialization here.
-      for (int i = 0; i < InputSystem::kMaxSimultanuousPointers; i++) {
-        pointer_element[i] = kNullHash;
-      }
-      input_focus_ = input_capture_ = mouse_capture_ = kNullHash;
-      dragging_pointer_ = kPointerIndexInvalid;
-    }
-
-    // For each pointer, the element id that last received a down event.
-    HashedId pointer_element[InputSystem::kMaxSimultanuousPointers];
-    // The element the gamepad is currently "over", simulates the mouse
-    // hovering over an element.
-    HashedId input_focus_;
-
-    // The element that capturing the keyboard.
-    HashedId input_capture_;
-
-    // The element that capturing the pointer.
-    // The element continues to recieve mouse events until it releases the
-    // capture.
-    HashedId mouse_capture_;
-
-    // Simple text edit handler for an edit box.
-    MicroEdit text_edit_;
-
-    // Keep tracking a pointer position of a drag start.
-    vec2i drag_start_position_;
-    int32_t dragging_pointer_;
-
-    // If yes, then touch/mouse, else gamepad/keyboard.
-    bool is_last_event_pointer_type;
-  } persistent_;
-
   const FlatUiVersion *version_;
 
   // Disable copy constructor.
@@ -1384,13 +1644,15 @@ class InternalState : public Group {
   InternalState &operator=(const InternalState &);
 };
 
-InternalState::PersistentState InternalState::persistent_;
-
 void Run(fplbase::AssetManager &assetman, FontManager &fontman,
          fplbase::InputSystem &input,
          const std::function<void()> &gui_definition) {
+  // GUIs rendered with Run() share the default context.
+  static GuiContext default_context;
+
   // Create our new temporary state.
-  InternalState internal_state(assetman, fontman, input);
+  InternalState internal_state(assetman, fontman, input, default_context,
+                               nullptr);
 
   // Run two passes, one for layout, one for rendering.
   // First pass:
@@ -1408,6 +1670,60 @@ void Run(fplbase::AssetManager &assetman, FontManager &fontman,
   internal_state.CheckGamePadFocus();
 }
 
+void BuildGui(GuiContext &context, fplbase::AssetManager &assetman,
+              FontManager &fontman, fplbase::InputSystem &input,
+              const std::function<void()> &gui_definition,
+              DrawList *draw_list) {
+  assert(draw_list);
+  draw_list->Clear();
+
+  // Create our new temporary state, current on this thread.
+  InternalState internal_state(assetman, fontman, input, context, draw_list);
+
+  // Same passes as Run(), the second one records the rendering commands.
+  gui_definition();
+  internal_state.StartRenderPass();
+  gui_definition();
+
+  internal_state.CheckGamePadFocus();
+}
+
+void BuildGuis(fplbase::AssetManager &assetman, FontManager &fontman,
+               fplbase::InputSystem &input,
+               const std::vector<GuiBuild> &builds) {
+  std::vector<TaskScheduler::Task> tasks;
+  tasks.reserve(builds.size());
+  for (auto it = builds.begin(); it != builds.end(); ++it) {
+    auto build = &*it;
+    tasks.push_back([&assetman, &fontman, &input, build]() {
+      BuildGui(*build->context, assetman, fontman, input,
+               build->gui_definition, build->draw_list);
+    });
+  }
+  auto scheduler = fontman.get_task_scheduler();
+  TaskCounter counter;
+  scheduler->Submit(tasks.data(), tasks.size(), &counter);
+  scheduler->Wait(&counter);
+}
+
+void SubmitGui(fplbase::AssetManager &assetman, FontManager &fontman,
+               const std::vector<const DrawList *> &draw_lists) {
+  // Upload the glyphs cached while building the draw lists.
+  fontman.StartRenderPass();
+
+  Shader *shaders[kDrawShaderCount];
+  LoadShaders(assetman, shaders);
+
+  auto &renderer = assetman.renderer();
+  renderer.SetBlendMode(fplbase::kBlendModeAlpha);
+  renderer.DepthTest(false);
+
+  auto quad_indices = fontman.GetBufferArena().get_quad_indices();
+  for (auto it = draw_lists.begin(); it != draw_lists.end(); ++it) {
+    (*it)->Render(renderer, shaders, quad_indices);
+  }
+}
+
 InternalState *Gui() {
   assert(state);
   return state;
@@ -1421,6 +1737,15 @@ void Label(const char *text, float font_size, const vec2 &size) {
   Gui()->Label(text, font_size, size);
 }
 
+void Label(const uint16_t *text, size_t length, float font_size) {
+  Gui()->Label(text, length, font_size, vec2(0, font_size));
+}
+
+void Label(const uint16_t *text, size_t length, float font_size,
+           const vec2 &size) {
+  Gui()->Label(text, length, font_size, size);
+}
+
 bool Edit(float ysize, const mathfu::vec2 &size, const char *id,
           std::string *string) {
   return Gui()->Edit(ysize, size, id, string);
@@ -1467,9 +1792,18 @@ void RenderTextureNinePatch(const Texture &tex, const vec4 &patch_info,
   Gui()->RenderTextureNinePatch(tex, patch_info, pos, size);
 }
 
+void UseImageAtlas(const ImageAtlas *atlas) { Gui()->UseImageAtlas(atlas); }
+
 void SetTextColor(const mathfu::vec4 &color) { Gui()->SetTextColor(color); }
 
+void SetTextEffect(GlyphEffectType effect, float size,
+                   const mathfu::vec4 &color) {
+  Gui()->SetTextEffect(effect, size, color);
+}
+
 void SetTextFont(const char *font_name) { Gui()->SetTextFont(font_name); }
+
+void SetTextFont(FontHandle handle) { Gui()->SetTextFont(handle); }
 void SetTextLocale(const char *locale) {
   Gui()->SetTextLocale(locale);
 }
@@ -1537,6 +1871,43 @@ void SetDragStartThreshold(int drag_start_threshold) {
   Gui()->SetDragStartThreshold(drag_start_threshold);
 }
 
+vec2 PredictPointerPosition(const PointerSample *samples, size_t count,
+                            double time) {
+  assert(count);
+  auto &latest = samples[count - 1];
+
+  // Fit the velocity to the recent samples with least squares. Times and
+  // positions are relative to the latest sample.
+  double n = 0.0, st = 0.0, stt = 0.0;
+  double sx = 0.0, sy = 0.0, stx = 0.0, sty = 0.0;
+  for (size_t i = count; i-- > 0;) {
+    auto t = samples[i].time - latest.time;
+    if (t < -kPointerVelocityWindow) break;
+    auto d = samples[i].position - latest.position;
+    n += 1.0;
+    st += t;
+    stt += t * t;
+    sx += d.x();
+    sy += d.y();
+    stx += t * d.x();
+    sty += t * d.y();
+  }
+  auto position = vec2(latest.position);
+  auto denominator = n * stt - st * st;
+  if (denominator <= 0.0) return position;
+  auto velocity = vec2(static_cast<float>((n * stx - st * sx) / denominator),
+                       static_cast<float>((n * sty - st * sy) / denominator));
+
+  // Extrapolate the latest sample.
+  auto interval = mathfu::Clamp(time - latest.time, 0.0, kPointerPredictionMax);
+  return position + velocity * static_cast<float>(interval);
+}
+
+void SetPointerSamples(const PointerSample *samples, size_t count,
+                       double display_time) {
+  Gui()->SetPointerSamples(samples, count, display_time);
+}
+
 vec2 GroupPosition() {
   return Gui()->PhysicalToVirtual(Gui()->GroupPosition());
 }
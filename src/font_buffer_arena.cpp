@@ -0,0 +1,131 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/internal/font_buffer_arena.h"
+#include "fplbase/fpl_common.h"
+
+namespace flatui {
+
+// Index pattern of a glyph quad.
+static const uint16_t kQuadIndices[] = {0, 1, 2, 1, 3, 2};
+static const size_t kVerticesPerQuad = 4;
+
+// Max number of glyphs addressable with 16 bit indices. Longer FontBuffers
+// are rendered in batches of this many glyphs, each batch indexing its own
+// vertices.
+static const size_t kMaxQuads = 0x10000 / kVerticesPerQuad;
+
+uint8_t *FontBufferArena::Allocate(size_t size) {
+  auto aligned_size = Align(size);
+  if (!aligned_size) return nullptr;
+
+  // Look for a page with enough room, starting from the current page.
+  auto num_pages = pages_.size();
+  for (size_t i = 0; i < num_pages; ++i) {
+    auto index = (current_page_ + i) % num_pages;
+    auto &page = pages_[index];
+    if (page.size - page.used >= aligned_size) {
+      current_page_ = index;
+      break;
+    }
+  }
+
+  if (!num_pages || pages_[current_page_].size - pages_[current_page_].used <
+                        aligned_size) {
+    // Create new page. A block larger than a regular page gets its own page.
+    Page page;
+    page.size = std::max(page_size_, aligned_size);
+    page.data.reset(new uint8_t[page.size]);
+    reserved_bytes_ += page.size;
+    pages_.push_back(std::move(page));
+    current_page_ = pages_.size() - 1;
+  }
+
+  auto &page = pages_[current_page_];
+  auto block = page.data.get() + page.used;
+  page.used += aligned_size;
+  page.live += aligned_size;
+  used_bytes_ += aligned_size;
+  live_bytes_ += aligned_size;
+  live_blocks_++;
+  total_allocations_++;
+  return block;
+}
+
+void FontBufferArena::Free(const uint8_t *block, size_t size) {
+  if (block == nullptr) return;
+  auto aligned_size = Align(size);
+
+  for (size_t i = 0; i < pages_.size(); ++i) {
+    auto &page = pages_[i];
+    if (block < page.data.get() || block >= page.data.get() + page.size) {
+      continue;
+    }
+    assert(page.live >= aligned_size);
+    page.live -= aligned_size;
+    live_bytes_ -= aligned_size;
+    live_blocks_--;
+
+    if (page.live == 0) {
+      // All blocks in the page have been freed, recycle the page.
+      used_bytes_ -= page.used;
+      page.used = 0;
+
+      // Keep one empty page around to avoid a churn, release others.
+      if (pages_.size() > 1 && i != current_page_) {
+        reserved_bytes_ -= page.size;
+        pages_.erase(pages_.begin() + i);
+        if (current_page_ > i) current_page_--;
+      }
+    }
+    return;
+  }
+
+  // The block doesn't belong to the arena.
+  assert(0);
+}
+
+bool FontBufferArena::IsFragmented() const {
+  // Compact only when we can give back at least a page worth of memory and
+  // more than half of the allocated area is wasted.
+  auto wasted = used_bytes_ - live_bytes_;
+  return wasted > page_size_ && wasted > live_bytes_;
+}
+
+bool FontBufferArena::ReserveQuadIndices(size_t glyph_count) {
+  // Don't clamp, the caller would render past the end of the array.
+  if (glyph_count > kMaxQuads) return false;
+
+  auto current = get_quad_index_capacity();
+  if (glyph_count <= current) return true;
+
+  // Grow geometrically so that a gradually growing text doesn't rebuild the
+  // array each time.
+  glyph_count = std::min(std::max(glyph_count, current * 2), kMaxQuads);
+  quad_indices_.reserve(glyph_count * FPL_ARRAYSIZE(kQuadIndices));
+  for (auto i = current; i < glyph_count; ++i) {
+    for (size_t j = 0; j < FPL_ARRAYSIZE(kQuadIndices); ++j) {
+      quad_indices_.push_back(
+          static_cast<uint16_t>(kQuadIndices[j] + i * kVerticesPerQuad));
+    }
+  }
+  return true;
+}
+
+size_t FontBufferArena::get_quad_index_capacity() const {
+  return quad_indices_.size() / FPL_ARRAYSIZE(kQuadIndices);
+}
+
+}  // namespace flatui
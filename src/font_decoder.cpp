@@ -0,0 +1,73 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/font_decoder.h"
+
+#if defined(FLATUI_USE_ZSTD)
+#include <zstd.h>
+
+#include "fplbase/utilities.h"
+
+namespace flatui {
+
+using fplbase::LogError;
+
+// Magic number starting zstd frames, in little endian.
+static const uint8_t kZstdMagic[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+bool ZstdFontDecoder::CanDecode(const uint8_t *data, size_t size) const {
+  return size >= sizeof(kZstdMagic) &&
+         std::equal(kZstdMagic, kZstdMagic + sizeof(kZstdMagic), data);
+}
+
+bool ZstdFontDecoder::Decode(const uint8_t *data, size_t size,
+                             const Writer &writer) {
+  auto stream = ZSTD_createDStream();
+  if (stream == nullptr) return false;
+  ZSTD_initDStream(stream);
+
+  // Decode a chunk at a time, the size recommended by zstd holds a block.
+  std::vector<uint8_t> chunk(ZSTD_DStreamOutSize());
+  ZSTD_inBuffer input = {data, size, 0};
+  auto succeeded = true;
+  for (;;) {
+    ZSTD_outBuffer output = {chunk.data(), chunk.size(), 0};
+    auto result = ZSTD_decompressStream(stream, &output, &input);
+    if (ZSTD_isError(result)) {
+      LogError("Can't decode a zstd font: %s\n", ZSTD_getErrorName(result));
+      succeeded = false;
+      break;
+    }
+    if (output.pos && !writer(chunk.data(), output.pos)) {
+      succeeded = false;
+      break;
+    }
+    // 0 is returned at the end of a frame, the asset may hold more frames.
+    if (input.pos == input.size) {
+      if (result == 0) break;
+      if (output.pos < output.size) {
+        LogError("Truncated zstd font.\n");
+        succeeded = false;
+        break;
+      }
+    }
+  }
+  ZSTD_freeDStream(stream);
+  return succeeded;
+}
+
+}  // namespace flatui
+
+#endif  // defined(FLATUI_USE_ZSTD)
@@ -13,10 +13,21 @@
 // limitations under the License.
 
 #include "precompiled.h"
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif  // defined(_WIN32)
 
 // Freetype2 header
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include FT_OUTLINE_H
 
 // Harfbuzz header
 #include <hb.h>
@@ -24,8 +35,12 @@
 #include <hb-ot.h>
 
 #include "font_manager.h"
+#include "flatui/glyph_store.h"
+#include "flatui/internal/glyph_rasterizer.h"
 #include "fplbase/fpl_common.h"
 #include "fplbase/utilities.h"
+#include "glyph_atlas_generated.h"
+#include "shaped_text_generated.h"
 
 #ifdef FLATUI_USE_LIBUNIBREAK
 #include "linebreak.h"
@@ -43,9 +58,429 @@ namespace flatui {
 // The default script used for a layout.
 const hb_script_t kDefaultScript = HB_SCRIPT_LATIN;
 
-// Singleton object of FreeType&Harfbuzz.
+// Number of leading bytes of a text kept in the cost report.
+const size_t kCostReportTextLength = 64;
+
+// Pixel size texts are shaped at. Shaping results are scaled to the requested
+// size, so that they are shared by all sizes of a text.
+const int32_t kShapingReferenceSize = 256;
+
+// Maximum number of shaped runs kept. The cache is cleared when it overflows.
+const size_t kShapedRunCacheSize = 4096;
+
+// Texts whose lines before a mandatory line break are at least this many code
+// units long keep a resume point for texts appending to them.
+const uint32_t kAppendMinPrefix = 256;
+
+// Maximum number of texts keeping a resume point.
+const size_t kAppendStateCount = 8;
+
+// Multi line texts are split into paragraphs of at least this many code units
+// to be laid out in parallel.
+const size_t kParagraphMinLength = 4096;
+
+// Header of the fonts in the cache of decoded fonts, identifying the asset a
+// font was decoded from. A font whose asset changed is decoded again.
+// Assets in the file system are identified by their size and modification
+// time, without reading them. Others (e.g. packaged in an APK) are read and
+// identified by their size and hash.
+struct CachedFontHeader {
+  char magic[4];
+  uint32_t asset_hash;
+  uint64_t asset_size;
+  int64_t asset_time;
+};
+
+const char kCachedFontMagic[] = {'F', 'U', 'I', 'F'};
+
+// HarfBuzz output of a run of text, shaped at kShapingReferenceSize.
+struct ShapedRun {
+  std::vector<hb_glyph_info_t> glyph_info;
+  std::vector<hb_glyph_position_t> glyph_pos;
+  uint32_t width;
+};
+
+// HarfBuzz font and buffer shaping the texts of a task, on a FreeType face of
+// its own since faces can't be used by several threads at once.
+struct ShapingContext {
+  ShapingContext() : face(nullptr), font(nullptr), buffer(nullptr) {}
+  ~ShapingContext() {
+    hb_buffer_destroy(buffer);
+    hb_font_destroy(font);
+    if (face != nullptr) FT_Done_Face(face);
+  }
+
+  FT_Face face;
+  hb_font_t *font;
+  hb_buffer_t *buffer;
+};
+
+// Encoding specific parts of the layout of UTF-8 and UTF-16 texts.
+
+// Generate line break information of a text, per code unit.
+static void SetLineBreaks(const char *text, size_t length,
+                          const std::string &language, char *breaks) {
+  set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text), length,
+                      language.c_str(), breaks);
+}
+
+static void SetLineBreaks(const uint16_t *text, size_t length,
+                          const std::string &language, char *breaks) {
+  set_linebreaks_utf16(reinterpret_cast<const utf16_t *>(text), length,
+                       language.c_str(), breaks);
+}
+
+// Add a text to a HarfBuzz buffer, along with its language.
+static void AddText(hb_buffer_t *buffer, const char *text, size_t length,
+                    const std::string &language) {
+  hb_buffer_set_language(buffer,
+                         hb_language_from_string(language.c_str(), -1));
+  hb_buffer_add_utf8(buffer, text, static_cast<int>(length), 0,
+                     static_cast<int>(length));
+}
+
+static void AddText(hb_buffer_t *buffer, const uint16_t *text, size_t length,
+                    const std::string &language) {
+  hb_buffer_set_language(buffer,
+                         hb_language_from_string(language.c_str(), -1));
+  hb_buffer_add_utf16(buffer, text, static_cast<int>(length), 0,
+                      static_cast<int>(length));
+}
+
+// Convert up to `max_length` bytes of whole characters of a text to UTF-8,
+// for logs and reports.
+static std::string TextToUtf8(const char *text, size_t length,
+                              size_t max_length) {
+  auto text_length = std::min(length, max_length);
+  while (text_length < length && (text[text_length] & 0xc0) == 0x80) {
+    text_length--;
+  }
+  return std::string(text, text_length);
+}
+
+static std::string TextToUtf8(const uint16_t *text, size_t length,
+                              size_t max_length) {
+  std::string utf8;
+  for (size_t i = 0; i < length; ++i) {
+    uint32_t c = text[i];
+    if (c >= 0xd800 && c < 0xdc00 && i + 1 < length && text[i + 1] >= 0xdc00 &&
+        text[i + 1] < 0xe000) {
+      c = 0x10000 + ((c - 0xd800) << 10) + (text[++i] - 0xdc00);
+    }
+    // Encode the character, continuation bytes from the last one.
+    static const uint8_t kLeadingBits[] = {0x00, 0xc0, 0xe0, 0xf0};
+    size_t count = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+    char bytes[4];
+    for (size_t j = count - 1; j > 0; --j) {
+      bytes[j] = static_cast<char>(0x80 | (c & 0x3f));
+      c >>= 6;
+    }
+    bytes[0] = static_cast<char>(kLeadingBits[count - 1] | c);
+    if (utf8.size() + count > max_length) break;
+    utf8.append(bytes, count);
+  }
+  return utf8;
+}
+
+// Shape a text with a HarfBuzz font and buffer into `run`.
+template <typename T>
+static void ShapeRun(hb_font_t *font, hb_buffer_t *buffer, uint32_t script,
+                     TextLayoutDirection direction, const std::string &language,
+                     const T *text, size_t length, ShapedRun *run) {
+  hb_buffer_set_direction(buffer, direction == TextLayoutDirectionRTL
+                                      ? HB_DIRECTION_RTL
+                                      : HB_DIRECTION_LTR);
+  hb_buffer_set_script(buffer, static_cast<hb_script_t>(script));
+  AddText(buffer, text, length, language);
+  hb_shape(font, buffer, nullptr, 0);
+
+  uint32_t glyph_count;
+  auto glyph_info = hb_buffer_get_glyph_infos(buffer, &glyph_count);
+  auto glyph_pos = hb_buffer_get_glyph_positions(buffer, &glyph_count);
+  run->glyph_info.assign(glyph_info, glyph_info + glyph_count);
+  run->glyph_pos.assign(glyph_pos, glyph_pos + glyph_count);
+  run->width = 0;
+  for (uint32_t i = 0; i < glyph_count; ++i) {
+    run->width += glyph_pos[i].x_advance;
+  }
+  hb_buffer_clear_contents(buffer);
+}
+
+// Glyph images with an outline keep the glyph coverage above this value and
+// the outline coverage below it.
+const int32_t kGlyphEffectThreshold = 128;
+
+// Compute the maximum (dilate == true) or the average of each `radius`
+// neighborhood of a plane, horizontally and then vertically. The vertical
+// pass runs over whole rows so that compilers vectorize it.
+static void FilterPlane(const vec2i &size, int32_t radius, bool dilate,
+                        std::vector<uint16_t> *plane) {
+  std::vector<uint16_t> temp(plane->size());
+  auto src = plane->data();
+  auto dest = temp.data();
+  for (int32_t y = 0; y < size.y(); ++y) {
+    auto row = src + y * size.x();
+    for (int32_t x = 0; x < size.x(); ++x) {
+      uint32_t value = 0;
+      for (int32_t i = std::max(x - radius, 0);
+           i <= std::min(x + radius, size.x() - 1); ++i) {
+        value = dilate ? std::max<uint32_t>(value, row[i]) : value + row[i];
+      }
+      dest[y * size.x() + x] = static_cast<uint16_t>(
+          dilate ? value : value / (radius * 2 + 1));
+    }
+  }
+  std::vector<uint32_t> sum(size.x());
+  for (int32_t y = 0; y < size.y(); ++y) {
+    std::fill(sum.begin(), sum.end(), 0);
+    for (int32_t i = std::max(y - radius, 0);
+         i <= std::min(y + radius, size.y() - 1); ++i) {
+      auto row = dest + i * size.x();
+      for (int32_t x = 0; x < size.x(); ++x) {
+        sum[x] = dilate ? std::max<uint32_t>(sum[x], row[x]) : sum[x] + row[x];
+      }
+    }
+    auto out = src + y * size.x();
+    for (int32_t x = 0; x < size.x(); ++x) {
+      out[x] = static_cast<uint16_t>(dilate ? sum[x]
+                                            : sum[x] / (radius * 2 + 1));
+    }
+  }
+}
+
+// Padding added around glyph images for an effect.
+static int32_t GlyphEffectPadding(GlyphEffectType effect, int32_t effect_size) {
+  // Shadows are offset by the effect size in addition to the blur.
+  return effect == kGlyphEffectShadow ? effect_size * 2 : effect_size;
+}
+
+// Build a glyph image with an effect into `image`, and return the padding
+// added around the glyph for the effect.
+// An outline is opaque under the glyph, so the glyph and the outline
+// coverages are packed into one channel: the glyph coverage is mapped above
+// kGlyphEffectThreshold and, where the glyph is empty, the outline coverage
+// below it. The font_effect shader decodes them.
+// A shadow is offset and shows through the antialiased glyph edges, so its
+// image only holds the shadow coverage and is drawn under the glyphs.
+static int32_t BakeGlyphEffect(const uint8_t *glyph, const vec2i &glyph_size,
+                               GlyphEffectType effect, int32_t effect_size,
+                               std::vector<uint8_t> *image) {
+  auto padding = GlyphEffectPadding(effect, effect_size);
+  auto size = glyph_size + padding * 2;
+  std::vector<uint16_t> coverage(size.x() * size.y(), 0);
+  for (int32_t y = 0; y < glyph_size.y(); ++y) {
+    std::copy(glyph + y * glyph_size.x(), glyph + (y + 1) * glyph_size.x(),
+              &coverage[(y + padding) * size.x() + padding]);
+  }
+  std::vector<uint16_t> effect_coverage(coverage);
+  FilterPlane(size, effect_size, effect == kGlyphEffectOutline,
+              &effect_coverage);
+
+  image->resize(coverage.size());
+  if (effect == kGlyphEffectShadow) {
+    auto offset = effect_size;
+    for (int32_t y = 0; y < size.y(); ++y) {
+      for (int32_t x = 0; x < size.x(); ++x) {
+        auto value = x >= offset && y >= offset
+                         ? effect_coverage[(y - offset) * size.x() + x - offset]
+                         : 0;
+        (*image)[y * size.x() + x] = static_cast<uint8_t>(value);
+      }
+    }
+    return padding;
+  }
+
+  const int32_t kMax = 255;
+  const int32_t kRange = kGlyphEffectThreshold - 1;
+  for (int32_t y = 0; y < size.y(); ++y) {
+    for (int32_t x = 0; x < size.x(); ++x) {
+      int32_t fill = coverage[y * size.x() + x];
+      int32_t value;
+      if (fill) {
+        value = kGlyphEffectThreshold + (fill * kRange + kMax - 1) / kMax;
+      } else {
+        value = effect_coverage[y * size.x() + x] * kRange / kMax;
+      }
+      (*image)[y * size.x() + x] = static_cast<uint8_t>(value);
+    }
+  }
+  return padding;
+}
+
+// Singleton object of FreeType.
 FT_Library *FontManager::ft_;
-hb_buffer_t *FontManager::harfbuzz_buf_;
+
+// State of a multi line layout at the start of a line following a mandatory
+// line break. The lines before it only depend on the text before it, so the
+// layout of a text starting with the same lines can resume from there.
+struct LayoutResumePoint {
+  LayoutResumePoint()
+      : offset(0),
+        glyph_count(0),
+        caret_cluster_count(0),
+        line_count(0),
+        pos_y(0.0f),
+        total_height(0),
+        max_line_width(0),
+        min_width(0),
+        max_width(0) {}
+
+  // Code units of the text before the line.
+  uint32_t offset;
+
+  // Sizes of the layout arrays before the line.
+  uint32_t glyph_count;
+  uint32_t caret_cluster_count;
+  uint32_t line_count;
+
+  float pos_y;
+  uint32_t total_height;
+  uint32_t max_line_width;
+  int32_t min_width;
+  int32_t max_width;
+  FontMetrics metrics;
+};
+
+// A laid out text that appended texts can resume the layout of.
+struct AppendState {
+  // Parameters of the FontBuffer of the layout.
+  FontBufferParameters parameters;
+
+  // The text before the resume point, compared with the texts looking for a
+  // layout to resume.
+  std::string prefix;
+  size_t code_unit_size;
+
+  LayoutResumePoint resume;
+};
+
+// Glyph outlines waiting to be rasterized into their regions of the glyph
+// cache. The outlines are copies, since the glyph slot of the face is reused
+// by the following glyphs.
+struct GlyphBatch {
+  struct Glyph {
+    FT_Outline outline;
+    uint8_t *image;
+  };
+  std::vector<Glyph> glyphs;
+
+  // A rasterizer per task, kept between batches with their working buffers.
+  std::vector<std::unique_ptr<GlyphRasterizer>> rasterizers;
+  std::vector<TaskScheduler::Task> tasks;
+};
+
+// Settings of the layout of a text, shared by its paragraphs.
+struct LayoutSettings {
+  const FontBufferParameters *parameters;
+  vec2i size;
+  int32_t converted_ysize;
+  float scale;
+  float shaping_scale;
+  bool multi_line;
+  int32_t base_line;
+  int32_t effect_padding;
+  float line_height;
+  // Multi-line layouts stop at the first line starting below this height, 0
+  // to lay out all lines.
+  int32_t max_height;
+  float pos_start;
+  FontMetrics initial_metrics;
+};
+
+// State of a layout as it goes over the words of a text, and the arrays it
+// fills.
+struct LayoutCursor {
+  // Keep the state at the start of the line following a mandatory line
+  // break, `resume_offset` code units into the text.
+  void SetResumePoint(uint32_t resume_offset) {
+    resume.offset = resume_offset;
+    resume.glyph_count = total_glyph_count;
+    resume.caret_cluster_count = static_cast<uint32_t>(caret_clusters->size());
+    resume.line_count = static_cast<uint32_t>(line_starts->size());
+    resume.pos_y = pos.y();
+    resume.total_height = total_height;
+    resume.max_line_width = max_line_width;
+    resume.min_width = min_width;
+    resume.max_width = max_width;
+    resume.metrics = metrics;
+  }
+
+  std::vector<FontVertex> *vertices;
+  std::vector<uint32_t> *code_points;
+  std::vector<FontCaretCluster> *caret_clusters;
+  std::vector<uint32_t> *line_starts;
+
+  // Code units of the text before the laid out one.
+  uint32_t offset;
+
+  vec2 pos;
+  uint32_t line_width;
+  uint32_t max_line_width;
+  uint32_t total_glyph_count;
+  uint32_t total_height;
+  int32_t min_width;
+  int32_t max_width;
+  FontMetrics metrics;
+  uint32_t revision;
+  bool lastline_must_break;
+  bool first_character;
+
+  // Set when the layout stopped at the bottom of the box.
+  bool partial;
+
+  // The last resume point the layout went past.
+  LayoutResumePoint resume;
+};
+
+// A paragraph of a text laid out in parallel. Paragraphs but the first one
+// start after a line feed, so they are laid out on their own from a line
+// break, then stitched to the layout of the paragraphs before them.
+struct LayoutParagraph {
+  uint32_t offset;
+  uint32_t length;
+  std::vector<char> wordbreaks;
+
+  // Shaping results of the words, in order. The ones missing from the cache
+  // are shaped by the task of the paragraph, and kept here until they're
+  // added to the cache.
+  std::vector<const ShapedRun *> runs;
+  std::unordered_map<std::string, const ShapedRun *> shaped_runs;
+  std::vector<std::pair<std::string, std::unique_ptr<ShapedRun>>> new_runs;
+
+  std::vector<FontVertex> vertices;
+  std::vector<uint32_t> code_points;
+  std::vector<FontCaretCluster> caret_clusters;
+  std::vector<uint32_t> line_starts;
+  LayoutCursor cursor;
+};
+
+struct ParallelLayout {
+  ParallelLayout() : face(nullptr), paragraph_count(0) {}
+
+  // Shaping contexts of `face`, one per task.
+  const FaceData *face;
+  std::vector<std::unique_ptr<ShapingContext>> contexts;
+
+  std::vector<LayoutParagraph> paragraphs;
+  size_t paragraph_count;
+
+  // Glyph cache entries of the code points of the paragraphs, looked up
+  // before the paragraphs are laid out since the cache isn't thread-safe.
+  std::unordered_map<uint32_t, GlyphCacheEntry> glyphs;
+  std::vector<TaskScheduler::Task> tasks;
+};
+
+// Combine the metrics of two parts of a layout, expanded from the same font
+// metrics.
+static FontMetrics MergeMetrics(const FontMetrics &a, const FontMetrics &b) {
+  FontMetrics metrics = a;
+  metrics.set_internal_leading(
+      std::max(a.internal_leading(), b.internal_leading()));
+  metrics.set_external_leading(
+      std::min(a.external_leading(), b.external_leading()));
+  metrics.set_base_line(metrics.internal_leading() + metrics.ascender());
+  return metrics;
+}
 
 // Enumerate words in a specified buffer using line break information generated
 // by libunibreak.
@@ -129,6 +564,41 @@ class WordEnumerator {
   bool single_line_;
 };
 
+// Add 4 vertices to be used for a glyph rendering to the vertex array.
+// pos: position of the first, unscaled vertex.
+// base_line: baseline for the vertices.
+// scale: scale of the size and offset.
+// entry: glyph cache entry whose offset and size are used in the scaling.
+static void AddVertices(const vec2 &pos, const int32_t base_line,
+                        const float scale, const GlyphCacheEntry &entry,
+                        std::vector<FontVertex> *vertices) {
+  mathfu::vec2i rounded_pos = mathfu::vec2i(pos);
+  auto scaled_offset = mathfu::vec2(entry.get_offset()) * scale;
+  auto scaled_size = mathfu::vec2(entry.get_size()) * scale;
+  float scaled_base_line = base_line * scale;
+
+  auto x = rounded_pos.x() + scaled_offset.x();
+  auto y = rounded_pos.y() + scaled_base_line - scaled_offset.y();
+  vertices->push_back(FontVertex(x, y, 0.0f, 0.0f, 0.0f));
+
+  vertices->push_back(FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+
+  vertices->push_back(FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f, 0.0f));
+
+  vertices->push_back(
+      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+}
+
+// Update UV information of 4 vertices of a glyph.
+// uv: top-left corner of UV value as `x` and `y`, and the bottom-right of UV
+// value as the `w` and `z`.
+static void UpdateQuadUV(const vec4 &uv, FontVertex *vertices) {
+  vertices[0].uv_ = uv.xy();
+  vertices[1].uv_ = mathfu::vec2(uv.x(), uv.w());
+  vertices[2].uv_ = mathfu::vec2(uv.z(), uv.y());
+  vertices[3].uv_ = uv.zw();
+}
+
 FontManager::FontManager() {
   // Initialize variables and libraries.
   Initialize();
@@ -146,7 +616,10 @@ FontManager::FontManager(const mathfu::vec2i &cache_size) {
   glyph_cache_.reset(new GlyphCache<uint8_t>(cache_size));
 }
 
-FontManager::~FontManager() {}
+FontManager::~FontManager() {
+  FinishGlyphBatch(false);
+  hb_buffer_destroy(harfbuzz_buf_);
+}
 
 void FontManager::Initialize() {
   // Initialize variables.
@@ -158,6 +631,22 @@ void FontManager::Initialize() {
   language_ = kDefaultLanguage;
   layout_direction_ = TextLayoutDirectionLTR;
   line_height_ = kLineHeightDefault;
+  retain_code_points_ = true;
+  buffer_arena_.reset(new FontBufferArena());
+  cost_report_enabled_ = false;
+  cost_report_frames_ = 0;
+  current_cost_ = nullptr;
+  glyph_store_ = nullptr;
+  task_scheduler_ = &serial_scheduler_;
+  text_mesh_factory_ = &mesh_factory_;
+  SetFontDecoder(nullptr);
+  demotion_counter_ = 0;
+  demoted_scope_budget_ = FLATUI_DEMOTED_SCOPE_BUDGET;
+  glyph_batch_.reset(new GlyphBatch());
+  parallel_layout_.reset(new ParallelLayout());
+  if (FLATUI_SOFT_MAX_CACHED_BUFFERS) {
+    map_buffers_.reserve(FLATUI_SOFT_MAX_CACHED_BUFFERS);
+  }
 
   if (ft_ == nullptr) {
     ft_ = new FT_Library;
@@ -169,10 +658,8 @@ void FontManager::Initialize() {
     }
   }
 
-  if (harfbuzz_buf_ == nullptr) {
-    // Create a buffer for harfbuzz.
-    harfbuzz_buf_ = hb_buffer_create();
-  }
+  // Create a buffer for harfbuzz.
+  harfbuzz_buf_ = hb_buffer_create();
 
 #ifdef FLATUI_USE_LIBUNIBREAK
   // Initialize libunibreak
@@ -184,9 +671,6 @@ void FontManager::Initialize() {
 
 void FontManager::Terminate() {
   assert(ft_ != nullptr);
-  hb_buffer_destroy(harfbuzz_buf_);
-  harfbuzz_buf_ = nullptr;
-
   FT_Done_FreeType(*ft_);
   ft_ = nullptr;
 }
@@ -202,45 +686,140 @@ void FontManager::SetRenderer(fplbase::Renderer &renderer) {
 }
 
 FontBuffer *FontManager::GetBuffer(const char *text, const size_t length,
-                                   const FontBufferParameters &parameter) {
-  auto buffer = CreateBuffer(text, length, parameter);
-  if (buffer == nullptr) {
+                                   const FontBufferParameters &parameter,
+                                   bool flush_when_full, bool all_lines) {
+  return RequestBuffer(text, length, parameter, flush_when_full, all_lines);
+}
+
+FontBuffer *FontManager::GetBuffer(const uint16_t *text, const size_t length,
+                                   const FontBufferParameters &parameter,
+                                   bool flush_when_full, bool all_lines) {
+  return RequestBuffer(text, length, parameter, flush_when_full, all_lines);
+}
+
+template <typename T>
+FontBuffer *FontManager::RequestBuffer(const T *text, const size_t length,
+                                       const FontBufferParameters &parameter,
+                                       bool flush_when_full, bool all_lines) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+
+  // Lay out the text with the face the parameters refer to. GUIs built in
+  // parallel select their fonts without changing the current face.
+  auto face = FindFace(parameter.get_font_id());
+  if (face == nullptr) {
+    LogError("The font of the text '%s' is not opened.\n",
+             TextToUtf8(text, length, length * 3).c_str());
+    return nullptr;
+  }
+  auto current_face = current_face_;
+  current_face_ = face;
+
+  // Attribute the work below to the text.
+  std::chrono::steady_clock::time_point start;
+  uint32_t layouts = 0;
+  uint32_t uv_refreshes = 0;
+  if (cost_report_enabled_) {
+    current_cost_ = &cost_report_[parameter];
+    if (!current_cost_->requests) {
+      current_cost_->parameters = parameter;
+      current_cost_->text = TextToUtf8(text, length, kCostReportTextLength);
+    }
+    current_cost_->requests++;
+    layouts = current_cost_->layouts;
+    uv_refreshes = current_cost_->uv_refreshes;
+    start = std::chrono::steady_clock::now();
+  }
+
+  // The glyphs reserved by a failed layout stay in the cache unless it's
+  // flushed right away, later layouts find them and need their pixels.
+  auto buffer = CreateBuffer(text, length, parameter, all_lines);
+  FinishGlyphBatch(buffer != nullptr || !flush_when_full);
+  if (buffer == nullptr && flush_when_full) {
     // Flush glyph cache & Upload a texture
     FlushAndUpdate();
 
     // Try to create buffer again.
-    buffer = CreateBuffer(text, length, parameter);
-    if (buffer == nullptr) {
-      LogError("The given text '%s' with ",
-               "size:%d does not fit a glyph cache. Try to "
-               "increase a cache size or use GetTexture() API ",
-               "instead.\n", text, parameter.get_size().y());
+    buffer = CreateBuffer(text, length, parameter, all_lines);
+    FinishGlyphBatch(true);
+  }
+
+  if (current_cost_) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (current_cost_->layouts != layouts) {
+      current_cost_->layout_time += elapsed.count();
+    } else if (current_cost_->uv_refreshes != uv_refreshes) {
+      current_cost_->uv_time += elapsed.count();
     }
+    current_cost_ = nullptr;
+  }
+  if (buffer == nullptr) {
+    LogError("The given text '%s' with ",
+             "size:%d does not fit a glyph cache. Try to "
+             "increase a cache size or use GetTexture() API ",
+             "instead.\n", TextToUtf8(text, length, length * 3).c_str(),
+             parameter.get_size().y());
   }
+  current_face_ = current_face;
   return buffer;
 }
 
-FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
-                                      const FontBufferParameters &parameters) {
+FaceData *FontManager::FindFace(HashedId font_id) {
+  if (current_face_ != nullptr && current_face_->font_id_ == font_id) {
+    return current_face_;
+  }
+  for (auto it = faces_.begin(); it != faces_.end(); ++it) {
+    if (*it != nullptr && (*it)->font_id_ == font_id) {
+      return *it;
+    }
+  }
+  return nullptr;
+}
+
+template <typename T>
+FontBuffer *FontManager::CreateBuffer(const T *text, const uint32_t length,
+                                      const FontBufferParameters &parameters,
+                                      bool all_lines) {
   // Adjust y size if the size selector is set.
   auto ysize = static_cast<int32_t>(parameters.get_font_size());
   auto size = parameters.get_size();
-  auto caret_info = parameters.get_caret_info_flag();
   int32_t converted_ysize = ConvertSize(ysize);
   float scale = ysize / static_cast<float>(converted_ysize);
+  float shaping_scale = ysize / static_cast<float>(kShapingReferenceSize);
   bool multi_line = size.y() == 0 || size.y() > ysize;
 
   // Check cache if we already have a FontBuffer generated.
-  auto it = map_buffers_.find(parameters);
+  auto it = FindBuffer(parameters);
+  if (it != map_buffers_.end() && all_lines && it->second->get_partial()) {
+    // The lines below the box are needed now (e.g. the text is edited), lay
+    // the text out again with them.
+    EraseBuffer(it);
+    it = map_buffers_.end();
+  }
   if (it != map_buffers_.end()) {
-    // Update current pass.
-    if (current_pass_ != kRenderPass) {
-      it->second->set_pass(current_pass_);
-    }
+    if (it->second->get_code_points() != nullptr ||
+        !it->second->get_glyph_count() ||
+        it->second->get_revision() == current_atlas_revision_) {
+      // Update current pass.
+      if (current_pass_ != kRenderPass) {
+        it->second->set_pass(current_pass_);
+      }
 
-    // Update UV of the buffer
-    auto ret = UpdateUV(converted_ysize, it->second.get());
-    return ret;
+      // Update UV of the buffer
+      auto ret = UpdateUV(converted_ysize, parameters, it->second.get());
+      return ret;
+    }
+    // The buffer doesn't keep code points to update UVs, lay it out again.
+    EraseBuffer(it);
+  }
+  if (current_cost_) current_cost_->layouts++;
+
+  // Construct the buffer from a pre-shaped text if we have one.
+  auto shaped_text = map_shaped_texts_.find(parameters);
+  if (shaped_text != map_shaped_texts_.end() &&
+      IsShapedTextTableCurrent(*shaped_text->second.table)) {
+    return CreateBufferFromShapedText(*shaped_text->second.text,
+                                      converted_ysize, parameters);
   }
 
   // Otherwise, create new FontBuffer.
@@ -248,16 +827,12 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
   // Set freetype settings.
   FT_Set_Pixel_Sizes(current_face_->face_, 0, converted_ysize);
 
-  // Create FontBuffer with derived string length.
-  std::unique_ptr<FontBuffer> buffer(new FontBuffer(length, caret_info));
-
-  // Retrieve word breaking information using libunibreak.
-  if (length) {
-    wordbreak_info_.resize(length);
-    set_linebreaks_utf8(reinterpret_cast<const utf8_t *>(text), length,
-                        language_.c_str(), &wordbreak_info_[0]);
-  }
-  WordEnumerator word_enum(wordbreak_info_, !multi_line);
+  // Reset working arrays.
+  layout_vertices_.clear();
+  layout_code_points_.clear();
+  layout_caret_clusters_.clear();
+  layout_line_starts_.clear();
+  layout_line_starts_.push_back(0);
 
   // Initialize font metrics parameters.
   int32_t base_line = ysize * current_face_->face_->ascender /
@@ -265,32 +840,192 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
   if (base_line > ysize) {
     base_line = ysize;
   }
-  FontMetrics initial_metrics(base_line, 0, base_line, base_line - ysize, 0);
 
-  float pos_start = 0;
+  LayoutSettings settings;
+  settings.parameters = &parameters;
+  settings.size = size;
+  settings.converted_ysize = converted_ysize;
+  settings.scale = scale;
+  settings.shaping_scale = shaping_scale;
+  settings.multi_line = multi_line;
+  settings.base_line = base_line;
+  settings.effect_padding = GlyphEffectPadding(
+      parameters.get_glyph_effect(), parameters.get_glyph_effect_size());
+  settings.line_height = ysize * line_height_;
+  settings.max_height = all_lines ? 0 : size.y();
+  settings.initial_metrics =
+      FontMetrics(base_line, 0, base_line, base_line - ysize, 0);
+  settings.pos_start = 0;
   if (layout_direction_ == TextLayoutDirectionRTL) {
     // In RTL layout, the glyph position start from right.
-    pos_start = static_cast<float>(size.x());
+    settings.pos_start = static_cast<float>(size.x());
+  }
+
+  LayoutCursor cursor;
+  cursor.vertices = &layout_vertices_;
+  cursor.code_points = &layout_code_points_;
+  cursor.caret_clusters = &layout_caret_clusters_;
+  cursor.line_starts = &layout_line_starts_;
+  cursor.pos = vec2(settings.pos_start, 0);
+  cursor.line_width = 0;
+  cursor.max_line_width = 0;
+  cursor.total_glyph_count = 0;
+  cursor.total_height = ysize;
+  cursor.metrics = settings.initial_metrics;
+  cursor.revision = glyph_cache_->get_revision();
+  cursor.lastline_must_break = false;
+  cursor.first_character = true;
+  cursor.partial = false;
+
+  // Range of box widths that lead to the same layout, narrowed down by the
+  // line break decisions. RTL layouts depend on the exact width.
+  cursor.min_width = 0;
+  cursor.max_width = std::numeric_limits<int32_t>::max();
+  if (layout_direction_ == TextLayoutDirectionRTL) {
+    cursor.min_width = cursor.max_width = size.x();
+  }
+
+  // When the text appends to a text laid out before (e.g. a log), copy the
+  // lines before the last mandatory line break they share, and lay out the
+  // text from there.
+  const FontBuffer *prefix_buffer = nullptr;
+  auto append_state =
+      multi_line ? FindAppendState(text, length, parameters, &prefix_buffer)
+                 : nullptr;
+  if (append_state != nullptr) {
+    auto &resume = append_state->resume;
+    auto vertices = prefix_buffer->get_vertices();
+    layout_vertices_.assign(
+        vertices,
+        vertices + resume.glyph_count * FontBuffer::kVerticesPerCodePoint);
+    auto code_points = prefix_buffer->get_code_points();
+    layout_code_points_.assign(code_points, code_points + resume.glyph_count);
+    auto caret_clusters = prefix_buffer->get_caret_clusters();
+    layout_caret_clusters_.assign(caret_clusters,
+                                  caret_clusters + resume.caret_cluster_count);
+    auto line_starts = prefix_buffer->get_line_starts();
+    layout_line_starts_.assign(line_starts, line_starts + resume.line_count);
+    cursor.pos.y() = resume.pos_y;
+    cursor.total_height = resume.total_height;
+    cursor.max_line_width = resume.max_line_width;
+    cursor.min_width = resume.min_width;
+    cursor.max_width = resume.max_width;
+    cursor.metrics = resume.metrics;
+    cursor.total_glyph_count = resume.glyph_count;
+    cursor.lastline_must_break = true;
+    cursor.first_character = false;
+    cursor.resume = resume;
+  }
+  auto offset = cursor.resume.offset;
+  auto prefix_glyph_count = cursor.resume.glyph_count;
+  auto layout_text = text + offset;
+  auto layout_length = length - offset;
+  cursor.offset = offset;
+
+  // Paragraphs are laid out in parallel to the end of the text, lay out the
+  // lines of a box from the start instead.
+  if (multi_line && !settings.max_height &&
+      SplitParagraphs(layout_text, layout_length)) {
+    if (!LayoutParagraphs(layout_text, settings, &cursor)) {
+      return nullptr;
+    }
+  } else {
+    // Retrieve word breaking information using libunibreak. Line breaking
+    // starts over after a mandatory line break.
+    wordbreak_info_.resize(layout_length);
+    if (layout_length) {
+      SetLineBreaks(layout_text, layout_length, language_,
+                    &wordbreak_info_[0]);
+    }
+    WordEnumerator word_enum(wordbreak_info_, !multi_line);
+    if (!LayoutWords(layout_text, &word_enum, settings,
+                     [&](size_t index, size_t word_length) {
+                       return ShapeText(layout_text + index, word_length,
+                                        converted_ysize);
+                     },
+                     [&](uint32_t code_point) {
+                       return GetCachedEntry(code_point, converted_ysize,
+                                             parameters);
+                     },
+                     &cursor)) {
+      return nullptr;
+    }
+  }
+
+  // Glyphs of the copied lines may have been evicted from the glyph cache to
+  // make room for the new ones. Look them up again, like UpdateUV() does.
+  if (append_state != nullptr &&
+      glyph_cache_->get_revision() != prefix_buffer->get_revision()) {
+    for (uint32_t i = 0; i < prefix_glyph_count; ++i) {
+      auto cache =
+          GetCachedEntry(layout_code_points_[i], converted_ysize, parameters);
+      if (cache == nullptr) return nullptr;
+      UpdateQuadUV(cache->get_uv(),
+                   &layout_vertices_[i * FontBuffer::kVerticesPerCodePoint]);
+    }
   }
-  mathfu::vec2 pos(pos_start, 0);
-  FT_GlyphSlot glyph = current_face_->face_->glyph;
 
-  uint32_t line_width = 0;
-  uint32_t max_line_width = 0;
-  uint32_t total_glyph_count = 0;
-  uint32_t total_height = ysize;
-  bool lastline_must_break = false;
-  bool first_character = true;
-  auto line_height = ysize * line_height_;
+  // A text ending with a line break is resumed from its end. The break at
+  // the end of other texts depends on the text appended to them. Partial
+  // layouts resume from a line they laid out.
+  if (multi_line && !cursor.partial && cursor.lastline_must_break && length &&
+      text[length - 1] == '\n') {
+    cursor.SetResumePoint(length);
+  }
+
+  // Add the last caret.
+  AddCaretCluster(cursor.pos + vec2(0, base_line * scale), 0.0f, 1,
+                  &layout_caret_clusters_);
+
+  auto buffer = InsertBuffer(
+      parameters, vec2i(cursor.max_line_width / kFreeTypeUnit,
+                        cursor.total_height),
+      cursor.metrics, cursor.revision, cursor.min_width, cursor.max_width,
+      cursor.partial);
+  if (append_state != nullptr) {
+    // The text the layout resumed from has usually been replaced by this one
+    // (e.g. the previous version of a log). Its buffer is dropped at the start
+    // of the next frame, when it's not in use anymore.
+    superseded_buffers_.push_back(append_state->parameters);
+  }
+  if (append_state != nullptr && cursor.resume.offset == offset) {
+    // No new mandatory line break, the prefix is the same.
+    append_state->parameters = parameters;
+  } else if (cursor.resume.offset >= kAppendMinPrefix) {
+    RecordAppendState(text, parameters, cursor.resume, append_state);
+  }
+  return buffer;
+}
+
+template <typename T, typename ShapeFunction, typename GlyphFunction>
+bool FontManager::LayoutWords(const T *text, WordEnumerator *word_enum,
+                              const LayoutSettings &settings,
+                              ShapeFunction shape, GlyphFunction glyph,
+                              LayoutCursor *cursor) {
+  auto size = settings.size;
+  auto scale = settings.scale;
+  auto shaping_scale = settings.shaping_scale;
+  auto base_line = settings.base_line;
+  auto effect_padding = settings.effect_padding;
+  auto &pos = cursor->pos;
 
   // Find words and layout them.
-  while (word_enum.Advance()) {
-    if (!multi_line) {
+  while (word_enum->Advance()) {
+    if (settings.multi_line && cursor->lastline_must_break) {
+      // Layouts of texts sharing the text before the word can resume here.
+      cursor->SetResumePoint(
+          cursor->offset +
+          static_cast<uint32_t>(word_enum->GetCurrentWordIndex()));
+    }
+    const ShapedRun *run = shape(word_enum->GetCurrentWordIndex(),
+                                 word_enum->GetCurrentWordLength());
+    if (!settings.multi_line) {
       // Single line text.
       // In this mode, it layouts all string into single line.
-      max_line_width = static_cast<uint32_t>(LayoutText(text, length) * scale);
+      cursor->max_line_width =
+          static_cast<uint32_t>(run->width * shaping_scale);
       if (layout_direction_ == TextLayoutDirectionRTL && size.x() == 0) {
-        pos.x() = static_cast<float>(max_line_width / kFreeTypeUnit);
+        pos.x() = static_cast<float>(cursor->max_line_width / kFreeTypeUnit);
       }
     } else {
       // Multi line text.
@@ -298,52 +1033,65 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       // performs a line break if either current word exceeds the max line
       // width or indicated a line break must happen due to a line break
       // character etc.
-      uint32_t word_width = static_cast<uint32_t>(
-          LayoutText(text + word_enum.GetCurrentWordIndex(),
-                     word_enum.GetCurrentWordLength()) *
-          scale);
-      if (lastline_must_break || (line_width + word_width) / kFreeTypeUnit >
-                                     static_cast<uint32_t>(size.x())) {
-        // Line break.
-        pos = vec2(pos_start, pos.y() + line_height);
-        total_height += static_cast<int32_t>(line_height);
-        first_character = lastline_must_break;
-        if (size.y() && total_height > static_cast<uint32_t>(size.y()) &&
-            !caret_info) {
-          // The text size exceeds given size.
-          // For now, we just don't render the rest of strings.
-
-          // Cleanup buffer contents.
-          hb_buffer_clear_contents(harfbuzz_buf_);
+      uint32_t word_width = static_cast<uint32_t>(run->width * shaping_scale);
+      auto extent = static_cast<int32_t>((cursor->line_width + word_width) /
+                                         kFreeTypeUnit);
+      bool fits = extent <= size.x();
+      if (!cursor->lastline_must_break) {
+        // Boxes at least as wide as the line keep the word on it, narrower
+        // ones break the line as well.
+        if (fits) {
+          cursor->min_width = std::max(cursor->min_width, extent);
+        } else {
+          cursor->max_width = std::min(cursor->max_width, extent - 1);
+        }
+      }
+      if (cursor->lastline_must_break || !fits) {
+        if (settings.max_height &&
+            pos.y() + settings.line_height >= settings.max_height) {
+          // The next line starts below the box, leave it and the ones after
+          // it out.
+          cursor->partial = true;
           break;
         }
 
-        line_width = word_width;
-        if (line_width > static_cast<uint32_t>(size.x()) * kFreeTypeUnit) {
-          std::string s = std::string(&text[word_enum.GetCurrentWordIndex()],
-                                      word_enum.GetCurrentWordLength());
+        // Line break.
+        pos = vec2(settings.pos_start, pos.y() + settings.line_height);
+        cursor->total_height += static_cast<int32_t>(settings.line_height);
+        cursor->first_character = cursor->lastline_must_break;
+        cursor->line_starts->push_back(
+            static_cast<uint32_t>(cursor->code_points->size()));
+
+        cursor->line_width = word_width;
+        if (cursor->line_width >
+            static_cast<uint32_t>(size.x()) * kFreeTypeUnit) {
+          auto word_length = word_enum->GetCurrentWordLength();
+          auto s = TextToUtf8(text + word_enum->GetCurrentWordIndex(),
+                              word_length, word_length * 3);
           LogInfo(
               "A single word '%s' exceeded the given line width setting.\n"
               "Currently multiline label doesn't support a hyphenation",
               s.c_str());
         }
       } else {
-        line_width += word_width;
+        cursor->line_width += word_width;
       }
-      max_line_width = std::max(max_line_width, line_width);
-      lastline_must_break = word_enum.CurrentWordMustBreak();
+      cursor->max_line_width =
+          std::max(cursor->max_line_width, cursor->line_width);
+      cursor->lastline_must_break = word_enum->CurrentWordMustBreak();
     }
 
     // Update the first caret position.
-    if (caret_info && first_character) {
-      buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
-      first_character = false;
+    if (cursor->first_character) {
+      AddCaretCluster(pos + vec2(0, base_line * scale), 0.0f, 1,
+                      cursor->caret_clusters);
+      cursor->first_character = false;
     }
 
     // Retrieve layout info.
-    uint32_t glyph_count;
-    auto glyph_info = hb_buffer_get_glyph_infos(harfbuzz_buf_, &glyph_count);
-    auto glyph_pos = hb_buffer_get_glyph_positions(harfbuzz_buf_, &glyph_count);
+    auto glyph_count = static_cast<uint32_t>(run->glyph_info.size());
+    auto glyph_info = run->glyph_info.data();
+    auto glyph_pos = run->glyph_pos.data();
 
     auto idx = 0;
     auto idx_advance = 1;
@@ -355,20 +1103,18 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
     for (size_t i = 0; i < glyph_count; ++i, idx += idx_advance) {
       auto code_point = glyph_info[idx].codepoint;
       if (!code_point) {
-        total_glyph_count--;
+        cursor->total_glyph_count--;
         continue;
       }
-      auto cache = GetCachedEntry(code_point, converted_ysize);
+      const GlyphCacheEntry *cache = glyph(code_point);
       if (cache == nullptr) {
-        // Cleanup buffer contents.
-        hb_buffer_clear_contents(harfbuzz_buf_);
-        return nullptr;
+        return false;
       }
 
       auto pos_advance =
           mathfu::vec2(static_cast<float>(glyph_pos[idx].x_advance),
                        static_cast<float>(-glyph_pos[idx].y_advance)) *
-          scale / static_cast<float>(kFreeTypeUnit);
+          shaping_scale / static_cast<float>(kFreeTypeUnit);
       // Advance positions before rendering in RTL.
       if (layout_direction_ == TextLayoutDirectionRTL) {
         pos -= pos_advance;
@@ -378,35 +1124,34 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
       if (cache->get_size().x() && cache->get_size().y()) {
         // Add the code point to the buffer. This information is used when
         // re-fetching UV information when the texture atlas is updated.
-        buffer->get_code_points()->push_back(code_point);
+        cursor->code_points->push_back(code_point);
 
         // Calculate internal/external leading value and expand a buffer if
         // necessary.
+        // The metrics are the ones of the glyph without an effect.
         FontMetrics new_metrics;
-        if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
-          initial_metrics = new_metrics;
+        if (UpdateMetrics(cache->get_offset().y() - effect_padding,
+                          cache->get_size().y() - effect_padding * 2,
+                          cursor->metrics, &new_metrics)) {
+          cursor->metrics = new_metrics;
         }
 
-        // Construct indices array.
-        const uint16_t kIndices[] = {0, 1, 2, 1, 3, 2};
-        for (size_t j = 0; j < FPL_ARRAYSIZE(kIndices); ++j) {
-          auto index = kIndices[j];
-          buffer->get_indices()->push_back(
-              static_cast<unsigned short>(index + (total_glyph_count + i) * 4));
-        }
+        // Indices are not constructed here, they are shared between buffers
+        // since every glyph quad has the same index pattern.
 
         // Construct intermediate vertices array.
         // The vertices array is update in the render pass with correct
         // glyph size & glyph cache entry information.
 
         // Update vertices.
-        buffer->AddVertices(pos, base_line, scale, *cache);
+        AddVertices(pos, base_line, scale, *cache, cursor->vertices);
 
         // Update UV.
-        buffer->UpdateUV(static_cast<int32_t>(total_glyph_count + i),
-                         cache->get_uv());
+        UpdateQuadUV(cache->get_uv(),
+                     &(*cursor->vertices)[(cursor->total_glyph_count + i) *
+                                          FontBuffer::kVerticesPerCodePoint]);
       } else {
-        total_glyph_count--;
+        cursor->total_glyph_count--;
       }
 
       // Advance positions after rendering in LTR.
@@ -414,50 +1159,391 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
         pos += pos_advance;
       }
 
-      // Update caret information if it has been requested.
-      bool end_of_line = lastline_must_break == true && i == glyph_count - 1;
-      if (caret_info && end_of_line == false) {
+      // Update caret information. Only a cluster per glyph is recorded here,
+      // caret positions are built from them when they are requested.
+      bool end_of_line =
+          cursor->lastline_must_break == true && i == glyph_count - 1;
+      if (end_of_line == false) {
         // Is the current glyph a ligature?
         // We are not using hb_ot_layout_get_ligature_carets() as the API barely
         // work with existing fonts.
         // https://bugs.freedesktop.org/show_bug.cgi?id=90962 tracks a request
         // for the issue.
-        auto carets = GetCaretPosCount(word_enum, glyph_info,
+        auto carets = GetCaretPosCount(*word_enum, glyph_info,
                                        static_cast<int32_t>(glyph_count),
                                        static_cast<int32_t>(idx));
 
-        auto scaled_offset = cache->get_offset().x() * scale;
+        auto scaled_offset =
+            (cache->get_offset().x() + effect_padding) * scale;
         float scaled_base_line = base_line * scale;
         // Add caret points
-        for (auto caret = 1; caret <= carets; ++caret) {
-          buffer->AddCaretPosition(
-              pos + vec2(idx_advance * (scaled_offset - pos_advance.x() +
-                                        caret * pos_advance.x() / carets),
-                         scaled_base_line));
+        if (carets) {
+          AddCaretCluster(
+              pos + vec2(idx_advance * (scaled_offset - pos_advance.x()),
+                         scaled_base_line),
+              idx_advance * pos_advance.x() / carets, carets,
+              cursor->caret_clusters);
         }
       }
     }
 
     // Set buffer revision using glyph cache revision.
-    buffer->set_revision(glyph_cache_->get_revision());
+    cursor->revision = glyph_cache_->get_revision();
 
     // Update total number of glyphs.
-    total_glyph_count += glyph_count;
+    cursor->total_glyph_count += glyph_count;
+  }
+  return true;
+}
 
-    // Cleanup buffer contents.
-    hb_buffer_clear_contents(harfbuzz_buf_);
+template <typename T>
+bool FontManager::SplitParagraphs(const T *text, size_t length) {
+  auto count = std::min(
+      static_cast<size_t>(task_scheduler_->GetConcurrency()),
+      length / kParagraphMinLength);
+  if (count < 2) return false;
+
+  // Split the text after the first line feed following each 1/count of it.
+  // Texts without line feeds aren't split, the layout of their lines depends
+  // on the lines before them.
+  auto &paragraphs = parallel_layout_->paragraphs;
+  if (paragraphs.size() < count) paragraphs.resize(count);
+  size_t paragraph_count = 0;
+  size_t start = 0;
+  while (start < length) {
+    size_t end = length;
+    if (paragraph_count + 1 < count) {
+      end = std::max(length * (paragraph_count + 1) / count, start + 1);
+      while (end < length && text[end - 1] != '\n') end++;
+    }
+    paragraphs[paragraph_count].offset = static_cast<uint32_t>(start);
+    paragraphs[paragraph_count].length = static_cast<uint32_t>(end - start);
+    paragraph_count++;
+    start = end;
+  }
+  if (paragraph_count < 2 || !PrepareShapingContexts(paragraph_count)) {
+    return false;
   }
+  parallel_layout_->paragraph_count = paragraph_count;
+  return true;
+}
 
-  // Add the last caret.
-  if (caret_info) {
-    buffer->AddCaretPosition(pos + vec2(0, base_line * scale));
+template <typename T>
+bool FontManager::LayoutParagraphs(const T *text,
+                                   const LayoutSettings &settings,
+                                   LayoutCursor *cursor) {
+  auto layout = parallel_layout_.get();
+  auto count = layout->paragraph_count;
+  auto &paragraphs = layout->paragraphs;
+  auto &tasks = layout->tasks;
+  tasks.resize(count);
+
+  // Break the lines of the paragraphs and shape their words. Each task reads
+  // the shaping results cached before, and keeps the new ones.
+  for (size_t i = 0; i < count; ++i) {
+    auto paragraph = &paragraphs[i];
+    auto context = layout->contexts[i].get();
+    tasks[i] = [this, text, paragraph, context]() {
+      auto paragraph_text = text + paragraph->offset;
+      paragraph->wordbreaks.resize(paragraph->length);
+      SetLineBreaks(paragraph_text, paragraph->length, language_,
+                    &paragraph->wordbreaks[0]);
+      paragraph->runs.clear();
+      paragraph->shaped_runs.clear();
+      paragraph->new_runs.clear();
+      WordEnumerator word_enum(paragraph->wordbreaks, false);
+      while (word_enum.Advance()) {
+        auto word = paragraph_text + word_enum.GetCurrentWordIndex();
+        auto word_length = word_enum.GetCurrentWordLength();
+        auto key = GetShapedRunKey(word, word_length);
+        auto cached = shaped_runs_.find(key);
+        if (cached != shaped_runs_.end()) {
+          paragraph->runs.push_back(cached->second.get());
+          continue;
+        }
+        auto shaped = paragraph->shaped_runs.find(key);
+        if (shaped != paragraph->shaped_runs.end()) {
+          paragraph->runs.push_back(shaped->second);
+          continue;
+        }
+        std::unique_ptr<ShapedRun> run(new ShapedRun());
+        ShapeRun(context->font, context->buffer, script_, layout_direction_,
+                 language_, word, word_length, run.get());
+        paragraph->runs.push_back(run.get());
+        paragraph->shaped_runs[key] = run.get();
+        paragraph->new_runs.push_back(
+            std::make_pair(std::move(key), std::move(run)));
+      }
+    };
+  }
+  TaskCounter counter;
+  task_scheduler_->Submit(tasks.data(), count, &counter);
+  task_scheduler_->Wait(&counter);
+
+  // Keep the new shaping results while the cache has room. The others stay
+  // with their paragraph until the next parallel layout.
+  for (size_t i = 0; i < count; ++i) {
+    for (auto it = paragraphs[i].new_runs.begin();
+         it != paragraphs[i].new_runs.end(); ++it) {
+      if (shaped_runs_.size() >= kShapedRunCacheSize) break;
+      if (shaped_runs_.find(it->first) == shaped_runs_.end()) {
+        shaped_runs_[it->first] = std::move(it->second);
+      }
+    }
+  }
+
+  // Look the glyphs up serially, in the order of the text.
+  auto &glyphs = layout->glyphs;
+  glyphs.clear();
+  for (size_t i = 0; i < count; ++i) {
+    auto &runs = paragraphs[i].runs;
+    for (auto run = runs.begin(); run != runs.end(); ++run) {
+      auto &glyph_info = (*run)->glyph_info;
+      for (auto info = glyph_info.begin(); info != glyph_info.end(); ++info) {
+        auto code_point = info->codepoint;
+        if (!code_point || glyphs.find(code_point) != glyphs.end()) continue;
+        auto cache = GetCachedEntry(code_point, settings.converted_ysize,
+                                    *settings.parameters);
+        if (cache == nullptr) return false;
+        glyphs.insert(std::make_pair(code_point, *cache));
+      }
+    }
+  }
+
+  // Lay the paragraphs out. The first one continues the layout of `cursor`,
+  // the others start from a line break at the top of a layout of their own.
+  for (size_t i = 0; i < count; ++i) {
+    auto paragraph = &paragraphs[i];
+    auto paragraph_cursor = cursor;
+    if (i) {
+      paragraph_cursor = &paragraph->cursor;
+      paragraph->vertices.clear();
+      paragraph->code_points.clear();
+      paragraph->caret_clusters.clear();
+      paragraph->line_starts.clear();
+      paragraph_cursor->vertices = &paragraph->vertices;
+      paragraph_cursor->code_points = &paragraph->code_points;
+      paragraph_cursor->caret_clusters = &paragraph->caret_clusters;
+      paragraph_cursor->line_starts = &paragraph->line_starts;
+      paragraph_cursor->offset = cursor->offset + paragraph->offset;
+      paragraph_cursor->pos = vec2(settings.pos_start, 0);
+      paragraph_cursor->line_width = 0;
+      paragraph_cursor->max_line_width = 0;
+      paragraph_cursor->total_glyph_count = 0;
+      paragraph_cursor->total_height = 0;
+      paragraph_cursor->min_width = 0;
+      paragraph_cursor->max_width = std::numeric_limits<int32_t>::max();
+      paragraph_cursor->metrics = settings.initial_metrics;
+      paragraph_cursor->revision = glyph_cache_->get_revision();
+      paragraph_cursor->lastline_must_break = true;
+      paragraph_cursor->first_character = false;
+      paragraph_cursor->SetResumePoint(paragraph_cursor->offset);
+    }
+    tasks[i] = [this, text, &settings, paragraph, paragraph_cursor]() {
+      WordEnumerator word_enum(paragraph->wordbreaks, false);
+      size_t word = 0;
+      auto &glyphs = parallel_layout_->glyphs;
+      LayoutWords(text + paragraph->offset, &word_enum, settings,
+                  [&](size_t, size_t) { return paragraph->runs[word++]; },
+                  [&](uint32_t code_point) {
+                    return &glyphs.find(code_point)->second;
+                  },
+                  paragraph_cursor);
+    };
+  }
+  task_scheduler_->Submit(tasks.data(), count, &counter);
+  task_scheduler_->Wait(&counter);
+
+  // Stitch the paragraphs. Their lines are moved below the lines before them,
+  // with the y positions the serial layout would have given them: glyph quads
+  // are placed at whole pixels of the position of their line.
+  for (size_t i = 1; i < count; ++i) {
+    auto &paragraph = paragraphs[i];
+    auto &local = paragraph.cursor;
+    auto glyph_base = static_cast<uint32_t>(cursor->code_points->size());
+    auto caret_base = static_cast<uint32_t>(cursor->caret_clusters->size());
+    auto line_base = static_cast<uint32_t>(cursor->line_starts->size());
+    auto y_offset = cursor->pos.y();
+
+    auto local_y = 0.0f;
+    auto y = cursor->pos.y();
+    auto resume_y = y;
+    auto &line_starts = paragraph.line_starts;
+    for (size_t line = 0; line < line_starts.size(); ++line) {
+      local_y += settings.line_height;
+      y += settings.line_height;
+      auto delta = static_cast<float>(static_cast<int32_t>(y) -
+                                      static_cast<int32_t>(local_y));
+      auto end = line + 1 < line_starts.size() ? line_starts[line + 1]
+                                               : local.total_glyph_count;
+      for (auto v = line_starts[line] * FontBuffer::kVerticesPerCodePoint;
+           v < end * FontBuffer::kVerticesPerCodePoint; ++v) {
+        paragraph.vertices[v].position_.data[1] += delta;
+      }
+      if (line + 1 == local.resume.line_count) resume_y = y;
+      cursor->line_starts->push_back(line_starts[line] + glyph_base);
+    }
+    cursor->vertices->insert(cursor->vertices->end(),
+                             paragraph.vertices.begin(),
+                             paragraph.vertices.end());
+    cursor->code_points->insert(cursor->code_points->end(),
+                                paragraph.code_points.begin(),
+                                paragraph.code_points.end());
+    for (auto it = paragraph.caret_clusters.begin();
+         it != paragraph.caret_clusters.end(); ++it) {
+      auto cluster = *it;
+      cluster.origin.data[1] += y_offset;
+      cursor->caret_clusters->push_back(cluster);
+    }
+
+    // The paragraph always has a resume point, at least at its start.
+    auto resume = local.resume;
+    resume.glyph_count += glyph_base;
+    resume.caret_cluster_count += caret_base;
+    resume.line_count += line_base;
+    resume.pos_y = resume_y;
+    resume.total_height += cursor->total_height;
+    resume.max_line_width =
+        std::max(resume.max_line_width, cursor->max_line_width);
+    resume.min_width = std::max(resume.min_width, cursor->min_width);
+    resume.max_width = std::min(resume.max_width, cursor->max_width);
+    resume.metrics = MergeMetrics(cursor->metrics, resume.metrics);
+    cursor->resume = resume;
+
+    cursor->pos = vec2(local.pos.x(), y);
+    cursor->line_width = local.line_width;
+    cursor->max_line_width =
+        std::max(cursor->max_line_width, local.max_line_width);
+    cursor->total_glyph_count += local.total_glyph_count;
+    cursor->total_height += local.total_height;
+    cursor->min_width = std::max(cursor->min_width, local.min_width);
+    cursor->max_width = std::min(cursor->max_width, local.max_width);
+    cursor->metrics = MergeMetrics(cursor->metrics, local.metrics);
+    cursor->revision = local.revision;
+    cursor->lastline_must_break = local.lastline_must_break;
+    cursor->first_character = local.first_character;
+  }
+  return true;
+}
+
+bool FontManager::PrepareShapingContexts(size_t count) {
+  auto layout = parallel_layout_.get();
+  if (layout->face != current_face_) {
+    layout->contexts.clear();
+    layout->face = current_face_;
+  }
+  while (layout->contexts.size() < count) {
+    // Faces are created serially, the FreeType library isn't thread-safe.
+    std::unique_ptr<ShapingContext> context(new ShapingContext());
+    if (FT_New_Memory_Face(
+            *ft_, current_face_->GetFontData(),
+            static_cast<FT_Long>(current_face_->GetFontDataSize()), 0,
+            &context->face)) {
+      LogInfo("Can't open a face to shape paragraphs in parallel.");
+      return false;
+    }
+    // Texts are shaped at the reference size.
+    FT_Set_Pixel_Sizes(context->face, 0, kShapingReferenceSize);
+    context->font = hb_ft_font_create(context->face, nullptr);
+    hb_font_set_scale(context->font, kShapingReferenceSize * kFreeTypeUnit,
+                      kShapingReferenceSize * kFreeTypeUnit);
+    context->buffer = hb_buffer_create();
+    layout->contexts.push_back(std::move(context));
+  }
+  return true;
+}
+
+FontBuffer *FontManager::CreateBufferFromShapedText(
+    const ShapedText &shaped_text, const int32_t ysize,
+    const FontBufferParameters &parameters) {
+  // Set freetype settings.
+  FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
+
+  layout_vertices_.clear();
+  layout_code_points_.clear();
+  layout_caret_clusters_.clear();
+  layout_line_starts_.clear();
+
+  // Only UVs need to be resolved, the glyph quads are already placed.
+  auto glyphs = shaped_text.glyphs();
+  for (flatbuffers::uoffset_t i = 0; glyphs && i < glyphs->size(); ++i) {
+    auto glyph = glyphs->Get(i);
+    auto cache = GetCachedEntry(glyph->code_point(), ysize, parameters);
+    if (cache == nullptr) {
+      return nullptr;
+    }
+    layout_code_points_.push_back(glyph->code_point());
+    layout_vertices_.push_back(
+        FontVertex(glyph->left(), glyph->top(), 0.0f, 0.0f, 0.0f));
+    layout_vertices_.push_back(
+        FontVertex(glyph->left(), glyph->bottom(), 0.0f, 0.0f, 0.0f));
+    layout_vertices_.push_back(
+        FontVertex(glyph->right(), glyph->top(), 0.0f, 0.0f, 0.0f));
+    layout_vertices_.push_back(
+        FontVertex(glyph->right(), glyph->bottom(), 0.0f, 0.0f, 0.0f));
+    UpdateQuadUV(cache->get_uv(),
+                 &layout_vertices_[i * FontBuffer::kVerticesPerCodePoint]);
+  }
+
+  auto carets = shaped_text.carets();
+  for (flatbuffers::uoffset_t i = 0; carets && i < carets->size(); ++i) {
+    AddCaretCluster(vec2(static_cast<float>(carets->Get(i)->x()),
+                         static_cast<float>(carets->Get(i)->y())),
+                    0.0f, 1, &layout_caret_clusters_);
+  }
+
+  auto line_starts = shaped_text.line_starts();
+  if (line_starts) {
+    layout_line_starts_.assign(line_starts->begin(), line_starts->end());
+  }
+
+  FontMetrics metrics;
+  auto shaped_metrics = shaped_text.metrics();
+  if (shaped_metrics) {
+    metrics = FontMetrics(
+        shaped_metrics->base_line(), shaped_metrics->internal_leading(),
+        shaped_metrics->ascender(), shaped_metrics->descender(),
+        shaped_metrics->external_leading());
+  }
+
+  // The line breaks of the pre-shaped text aren't known, only reuse it for
+  // the box it was shaped for.
+  return InsertBuffer(parameters,
+                      vec2i(shaped_text.width(), shaped_text.height()),
+                      metrics, glyph_cache_->get_revision(),
+                      parameters.get_size().x(), parameters.get_size().x(),
+                      false);
+}
+
+FontBuffer *FontManager::InsertBuffer(const FontBufferParameters &parameters,
+                                      const mathfu::vec2i &size,
+                                      const FontMetrics &metrics,
+                                      uint32_t revision, int32_t min_width,
+                                      int32_t max_width, bool partial) {
+  // Now the glyph count is fixed, allocate the buffer storage from the arena
+  // and copy the layout.
+  std::unique_ptr<FontBuffer> buffer(new FontBuffer());
+  buffer->Allocate(buffer_arena_.get(), layout_vertices_.data(),
+                   retain_code_points_ ? layout_code_points_.data() : nullptr,
+                   layout_code_points_.size(), layout_caret_clusters_.data(),
+                   layout_caret_clusters_.size(), layout_line_starts_.data(),
+                   layout_line_starts_.size());
+  buffer->set_revision(revision);
+  buffer->set_partial(partial);
+  buffer->set_layout_direction(layout_direction_);
+
+  // The buffer belongs to the innermost cache scope.
+  if (!cache_scope_stack_.empty()) {
+    buffer->set_cache_scope(cache_scope_stack_.back());
+    cache_scopes_[buffer->get_cache_scope()].storage +=
+        buffer->get_storage_size();
   }
 
   // Setup size.
-  buffer->set_size(vec2i(max_line_width / kFreeTypeUnit, total_height));
+  buffer->set_size(size);
 
   // Setup font metrics.
-  buffer->set_metrics(initial_metrics);
+  buffer->set_metrics(metrics);
 
   // Set current pass.
   if (current_pass_ != kRenderPass) {
@@ -471,9 +1557,152 @@ FontBuffer *FontManager::CreateBuffer(const char *text, const uint32_t length,
   auto insert = map_buffers_.insert(
       std::pair<FontBufferParameters, std::unique_ptr<FontBuffer>>(
           parameters, std::move(buffer)));
+
+  // Index the layout for other box sizes. Partial layouts depend on the
+  // height of the box too, they are only reused for the same box.
+  if (partial) return insert.first->second.get();
+  BufferLayout layout;
+  layout.parameters = parameters;
+  layout.min_width = min_width;
+  layout.max_width = max_width;
+  map_buffer_layouts_.insert(std::pair<FontBufferParameters, BufferLayout>(
+      GetLayoutParameters(parameters, layout_direction_), layout));
   return insert.first->second.get();
 }
 
+FontBufferParameters FontManager::GetLayoutParameters(
+    const FontBufferParameters &parameters,
+    TextLayoutDirection direction) const {
+  auto size = parameters.get_size();
+  auto ysize = static_cast<int32_t>(parameters.get_font_size());
+  bool multi_line = size.y() == 0 || size.y() > ysize;
+  auto width = direction == TextLayoutDirectionRTL ? size.x() : 0;
+  return FontBufferParameters(
+      parameters.get_font_id(), parameters.get_text_id(),
+      parameters.get_font_size(), vec2i(width, multi_line ? 0 : 1),
+      parameters.get_glyph_effect(), parameters.get_glyph_effect_size());
+}
+
+FontManager::BufferMap::iterator FontManager::FindBuffer(
+    const FontBufferParameters &parameters) {
+  auto it = map_buffers_.find(parameters);
+  if (it != map_buffers_.end()) {
+    return it;
+  }
+
+  // Look for a layout of the text made for another box size.
+  auto width = parameters.get_size().x();
+  auto range = map_buffer_layouts_.equal_range(
+      GetLayoutParameters(parameters, layout_direction_));
+  for (auto layout = range.first; layout != range.second; ++layout) {
+    if (width >= layout->second.min_width &&
+        width <= layout->second.max_width) {
+      auto found = map_buffers_.find(layout->second.parameters);
+      if (found != map_buffers_.end() &&
+          found->second->get_layout_direction() == layout_direction_) {
+        return found;
+      }
+    }
+  }
+  return map_buffers_.end();
+}
+
+void FontManager::EraseBuffer(BufferMap::iterator it) {
+  auto scope = cache_scopes_.find(it->second->get_cache_scope());
+  if (scope != cache_scopes_.end()) {
+    scope->second.storage -= it->second->get_storage_size();
+  }
+  auto range = map_buffer_layouts_.equal_range(GetLayoutParameters(
+      it->first, it->second->get_layout_direction()));
+  for (auto layout = range.first; layout != range.second; ++layout) {
+    if (layout->second.parameters == it->first) {
+      map_buffer_layouts_.erase(layout);
+      break;
+    }
+  }
+  ReleaseMesh(it->second.get());
+  map_buffers_.erase(it);
+}
+
+void FontManager::ReleaseMesh(FontBuffer *buffer) {
+  auto mesh = buffer->ReleaseMesh();
+  if (mesh != nullptr) released_meshes_.push_back(std::move(mesh));
+}
+
+// Parameters identifying layouts that can be resumed by texts appending to
+// them, which are the same but for the text.
+static FontBufferParameters GetAppendParameters(
+    const FontBufferParameters &parameters) {
+  return FontBufferParameters(
+      parameters.get_font_id(), kNullHash, parameters.get_font_size(),
+      parameters.get_size(), parameters.get_glyph_effect(),
+      parameters.get_glyph_effect_size());
+}
+
+template <typename T>
+AppendState *FontManager::FindAppendState(
+    const T *text, size_t length, const FontBufferParameters &parameters,
+    const FontBuffer **buffer) {
+  auto key = GetAppendParameters(parameters);
+  for (auto it = append_states_.begin(); it != append_states_.end(); ++it) {
+    auto state = it->get();
+    if (state->code_unit_size != sizeof(T) ||
+        state->resume.offset > length ||
+        !(GetAppendParameters(state->parameters) == key) ||
+        memcmp(state->prefix.data(), text, state->prefix.size())) {
+      continue;
+    }
+
+    // The copied glyphs need to be in the glyph cache, with the UVs of the
+    // buffer.
+    auto found = map_buffers_.find(state->parameters);
+    if (found == map_buffers_.end()) continue;
+    auto candidate = found->second.get();
+    if (candidate->get_revision() != glyph_cache_->get_revision() ||
+        (candidate->get_code_points() == nullptr &&
+         candidate->get_glyph_count())) {
+      continue;
+    }
+
+    // Keep the most recently used states first.
+    std::rotate(append_states_.begin(), it, it + 1);
+    *buffer = candidate;
+    return append_states_.front().get();
+  }
+  return nullptr;
+}
+
+template <typename T>
+void FontManager::RecordAppendState(const T *text,
+                                    const FontBufferParameters &parameters,
+                                    const LayoutResumePoint &resume,
+                                    AppendState *state) {
+  if (state == nullptr) {
+    // Replace the least recently used state.
+    if (append_states_.size() < kAppendStateCount) {
+      append_states_.push_back(std::unique_ptr<AppendState>(new AppendState()));
+    }
+    std::rotate(append_states_.begin(), append_states_.end() - 1,
+                append_states_.end());
+    state = append_states_.front().get();
+  }
+  state->parameters = parameters;
+  state->prefix.assign(reinterpret_cast<const char *>(text),
+                       resume.offset * sizeof(T));
+  state->code_unit_size = sizeof(T);
+  state->resume = resume;
+}
+
+void FontManager::AddCaretCluster(const vec2 &origin, float step,
+                                  int32_t count,
+                                  std::vector<FontCaretCluster> *clusters) {
+  FontCaretCluster cluster;
+  cluster.origin = origin;
+  cluster.step = step;
+  cluster.count = count;
+  clusters->push_back(cluster);
+}
+
 int32_t FontManager::GetCaretPosCount(const WordEnumerator &word_enum,
                                       const hb_glyph_info_t *glyph_info,
                                       int32_t glyph_count, int32_t index) {
@@ -502,20 +1731,25 @@ int32_t FontManager::GetCaretPosCount(const WordEnumerator &word_enum,
   return num_characters;
 }
 
-FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
+FontBuffer *FontManager::UpdateUV(const int32_t ysize,
+                                  const FontBufferParameters &parameters,
+                                  FontBuffer *buffer) {
   if (buffer->get_revision() != current_atlas_revision_) {
     // Cache revision has been updated.
     // Some referencing glyph cache entries might have been evicted.
     // So we need to check glyph cache entries again while we can still use
     // layout information.
 
+    if (current_cost_) current_cost_->uv_refreshes++;
+
     // Set freetype settings.
     FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
 
     auto code_points = buffer->get_code_points();
-    for (size_t i = 0; i < code_points->size(); ++i) {
-      auto code_point = code_points->at(i);
-      auto cache = GetCachedEntry(code_point, ysize);
+    assert(code_points != nullptr);
+    for (size_t i = 0; i < buffer->get_glyph_count(); ++i) {
+      auto code_point = code_points[i];
+      auto cache = GetCachedEntry(code_point, ysize, parameters);
       if (cache == nullptr) {
         return nullptr;
       }
@@ -532,12 +1766,14 @@ FontBuffer *FontManager::UpdateUV(const int32_t ysize, FontBuffer *buffer) {
 
 FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
                                      const float original_ysize) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+
   // Round up y size if the size selector is set.
   int32_t ysize = ConvertSize(static_cast<int32_t>(original_ysize));
 
   auto parameter =
       FontBufferParameters(GetCurrentFace()->font_id_, flatui::HashId(text),
-                           static_cast<float>(ysize), mathfu::kZeros2i, false);
+                           static_cast<float>(ysize), mathfu::kZeros2i);
 
   // Check cache if we already have a texture.
   auto it = map_textures_.find(parameter);
@@ -580,27 +1816,28 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
   // TODO: make padding values configurable.
   float kGlyphPadding = 0.0f;
   mathfu::vec2 pos(kGlyphPadding, kGlyphPadding);
-  FT_GlyphSlot glyph = current_face_->face_->glyph;
 
   for (size_t i = 0; i < glyph_count; ++i) {
     auto code_point = glyph_info[i].codepoint;
     if (!code_point) continue;
-    FT_Error err =
-        FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
 
     // Load glyph using harfbuzz layout information.
     // Note that harfbuzz takes care of ligatures.
-    if (err) {
-      // Error. This could happen typically the loaded font does not support
-      // particular glyph.
-      LogInfo("Can't load glyph %c FT_Error:%d\n", text[i], err);
+    // Outlines for the in-tree rasterizer are rendered once the position of
+    // the glyph in the image is known.
+    const uint8_t *glyph_image = nullptr;
+    vec2i glyph_size, glyph_offset;
+    if (!LoadGlyphOutline(code_point, &glyph_size, &glyph_offset) &&
+        !RasterizeGlyph(code_point, &glyph_image, &glyph_size,
+                        &glyph_offset)) {
       return nullptr;
     }
 
     // Calculate internal/external leading value and expand a buffer if
     // necessary.
     FontMetrics new_metrics;
-    if (UpdateMetrics(glyph, initial_metrics, &new_metrics)) {
+    if (UpdateMetrics(glyph_offset.y(), glyph_size.y(), initial_metrics,
+                      &new_metrics)) {
       if (new_metrics.total() != initial_metrics.total()) {
         // Expand buffer and update height if necessary.
         if (ExpandBuffer(width, height, initial_metrics, new_metrics, &image)) {
@@ -610,18 +1847,23 @@ FontTexture *FontManager::GetTexture(const char *text, const uint32_t length,
       initial_metrics = new_metrics;
     }
 
-    if (i == 0 && glyph->bitmap_left < 0) {
+    if (i == 0 && glyph_offset.x() < 0) {
       // Slightly shift all text to right.
-      pos.x() = static_cast<float>(-glyph->bitmap_left);
+      pos.x() = static_cast<float>(-glyph_offset.x());
     }
 
     // Copy the texture
-    uint32_t y_offset = initial_metrics.base_line() - glyph->bitmap_top;
-    for (uint32_t y = 0; y < glyph->bitmap.rows; ++y) {
-      memcpy(&image[(static_cast<size_t>(pos.y()) + y + y_offset) * width +
-                    static_cast<size_t>(pos.x()) + glyph->bitmap_left],
-             &glyph->bitmap.buffer[y * glyph->bitmap.pitch],
-             glyph->bitmap.width);
+    int32_t y_offset = initial_metrics.base_line() - glyph_offset.y();
+    auto dest = &image[(static_cast<size_t>(pos.y()) + y_offset) * width +
+                       static_cast<size_t>(pos.x()) + glyph_offset.x()];
+    if (glyph_image == nullptr) {
+      glyph_rasterizer_->Rasterize(current_face_->face_->glyph->outline, dest,
+                                   width);
+    } else {
+      for (int32_t y = 0; y < glyph_size.y(); ++y) {
+        memcpy(dest + y * width, &glyph_image[y * glyph_size.x()],
+               glyph_size.x());
+      }
     }
 
     // Advance positions.
@@ -696,9 +1938,17 @@ bool FontManager::ExpandBuffer(const int32_t width, const int32_t height,
 }
 
 bool FontManager::Open(const char *font_name) {
+  FontHandle handle;
+  return Open(font_name, &handle);
+}
+
+bool FontManager::Open(const char *font_name, FontHandle *handle) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  *handle = kInvalidFontHandle;
   auto it = map_faces_.find(font_name);
   if (it != map_faces_.end()) {
     // The font has been already opened.
+    *handle = it->second->handle_;
     return false;
   }
 
@@ -709,15 +1959,27 @@ bool FontManager::Open(const char *font_name) {
   auto face = insert.first->second.get();
 
   // Load the font file of assets.
-  if (!fplbase::LoadFile(font_name, &face->font_data_)) {
-    LogInfo("Can't load font reource: %s\n", font_name);
+  if (!LoadFontData(font_name, face)) {
     return false;
   }
 
   // Open the font.
-  FT_Error err = FT_New_Memory_Face(
-      *ft_, reinterpret_cast<const unsigned char *>(&face->font_data_[0]),
-      static_cast<FT_Long>(face->font_data_.size()), 0, &face->face_);
+  FT_Error err =
+      FT_New_Memory_Face(*ft_, face->GetFontData(),
+                         static_cast<FT_Long>(face->GetFontDataSize()), 0,
+                         &face->face_);
+  if (err && face->font_file_.get_data() != nullptr) {
+    // The cached font is corrupted, decode the asset again.
+    LogInfo("Decoding the corrupted cached font of %s again.\n", font_name);
+    face->font_file_.Close();
+    remove(GetCachedFontPath(font_name).c_str());
+    if (!LoadFontData(font_name, face)) {
+      return false;
+    }
+    err = FT_New_Memory_Face(*ft_, face->GetFontData(),
+                             static_cast<FT_Long>(face->GetFontDataSize()), 0,
+                             &face->face_);
+  }
   if (err) {
     // Failed to open font.
     LogInfo("Failed to initialize font:%s FT_Error:%d\n", font_name, err);
@@ -730,11 +1992,15 @@ bool FontManager::Open(const char *font_name) {
     // Failed to open font.
     LogInfo("Failed to initialize harfbuzz layout information:%s\n", font_name);
     face->font_data_.clear();
+    face->font_file_.Close();
     FT_Done_Face(face->face_);
     return false;
   }
 
   face->font_id_ = HashId(font_name);
+  face->handle_ = static_cast<FontHandle>(faces_.size());
+  faces_.push_back(face);
+  *handle = face->handle_;
 
   // Set first opened font as a default font.
   if (!face_initialized_) {
@@ -745,17 +2011,171 @@ bool FontManager::Open(const char *font_name) {
   return true;
 }
 
+// Header of the cached font decoded from the file `font_name`, from its size
+// and modification time. Returns false if the file can't be found in the file
+// system.
+static bool GetCachedFontHeader(const char *font_name,
+                                CachedFontHeader *header) {
+#if defined(_WIN32)
+  struct _stat status;
+  if (_stat(font_name, &status) != 0) return false;
+#else
+  struct stat status;
+  if (stat(font_name, &status) != 0) return false;
+#endif  // defined(_WIN32)
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, kCachedFontMagic, sizeof(header->magic));
+  header->asset_size = static_cast<uint64_t>(status.st_size);
+  header->asset_time = static_cast<int64_t>(status.st_mtime);
+  return true;
+}
+
+// Header of the cached font decoded from the asset `asset`, from its size and
+// hash.
+static CachedFontHeader GetCachedFontHeader(const uint8_t *asset,
+                                            size_t size) {
+  CachedFontHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCachedFontMagic, sizeof(header.magic));
+  // The same hash as HashId(), over the bytes of the asset.
+  header.asset_hash = 0x84222325;
+  for (size_t i = 0; i < size; ++i) {
+    header.asset_hash = (header.asset_hash ^ asset[i]) * 0x000001b3;
+  }
+  header.asset_size = size;
+  return header;
+}
+
+bool FontManager::LoadFontData(const char *font_name, FaceData *face) {
+  // Map the font decoded by a previous open, unless the asset changed since.
+  // The asset is only read when it has to be decoded, or when it isn't in the
+  // file system and has to be hashed.
+  auto cached_path = GetCachedFontPath(font_name);
+  CachedFontHeader header;
+  auto file_asset = font_decoder_ != nullptr && !cached_path.empty() &&
+                    GetCachedFontHeader(font_name, &header);
+  if (file_asset && MapCachedFont(cached_path, header, face)) {
+    return true;
+  }
+
+  std::string asset;
+  if (!fplbase::LoadFile(font_name, &asset)) {
+    LogInfo("Can't load font reource: %s\n", font_name);
+    return false;
+  }
+  auto data = reinterpret_cast<const uint8_t *>(asset.data());
+  auto size = asset.size();
+  if (font_decoder_ == nullptr || !font_decoder_->CanDecode(data, size)) {
+    face->font_data_.swap(asset);
+    return true;
+  }
+  if (!file_asset) {
+    header = GetCachedFontHeader(data, size);
+    if (!cached_path.empty() && MapCachedFont(cached_path, header, face)) {
+      return true;
+    }
+  }
+
+  if (cached_path.empty()) {
+    // Decode the font on the heap.
+    auto &font_data = face->font_data_;
+    font_data.clear();
+    if (!font_decoder_->Decode(data, size,
+                               [&font_data](const uint8_t *chunk, size_t size) {
+                                 font_data.append(
+                                     reinterpret_cast<const char *>(chunk),
+                                     size);
+                                 return true;
+                               })) {
+      LogInfo("Can't decode font: %s\n", font_name);
+      font_data.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // Stream the decoded font to a temporary file, which is renamed once
+  // complete, so that a partially decoded font is never mapped. The name is
+  // unique to the process and the thread, FontManagers opening the same font
+  // concurrently write files of their own.
+#if defined(_WIN32)
+  auto process_id = _getpid();
+#else
+  auto process_id = getpid();
+#endif  // defined(_WIN32)
+  char suffix[48];
+  snprintf(suffix, sizeof(suffix), ".%d.%lx.tmp", static_cast<int>(process_id),
+           static_cast<unsigned long>(
+               std::hash<std::thread::id>()(std::this_thread::get_id())));
+  auto temporary_path = cached_path + suffix;
+  auto file = fopen(temporary_path.c_str(), "wb");
+  if (file == nullptr) {
+    LogInfo("Can't create the cached font: %s\n", temporary_path.c_str());
+    return false;
+  }
+  auto decoded =
+      fwrite(&header, sizeof(header), 1, file) == 1 &&
+      font_decoder_->Decode(data, size,
+                            [file](const uint8_t *chunk, size_t size) {
+                              return fwrite(chunk, 1, size, file) == size;
+                            });
+  decoded = fclose(file) == 0 && decoded;
+  // Renaming doesn't replace files on all platforms.
+  remove(cached_path.c_str());
+  if (!decoded || rename(temporary_path.c_str(), cached_path.c_str()) != 0) {
+    LogInfo("Can't decode font: %s\n", font_name);
+    remove(temporary_path.c_str());
+    return false;
+  }
+  if (!MapCachedFont(cached_path, header, face)) {
+    LogInfo("Can't map the cached font: %s\n", cached_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool FontManager::MapCachedFont(const std::string &cached_path,
+                                const CachedFontHeader &header,
+                                FaceData *face) {
+  auto &file = face->font_file_;
+  if (!file.Open(cached_path.c_str())) return false;
+  if (file.get_size() <= sizeof(header) ||
+      memcmp(file.get_data(), &header, sizeof(header))) {
+    LogInfo("The cached font %s is out of date.\n", cached_path.c_str());
+    file.Close();
+    return false;
+  }
+  face->font_file_offset_ = sizeof(header);
+  return true;
+}
+
+std::string FontManager::GetCachedFontPath(const char *font_name) const {
+  if (font_cache_directory_.empty()) return std::string();
+  char file_name[32];
+  snprintf(file_name, sizeof(file_name), "/%08x.font", HashId(font_name));
+  return font_cache_directory_ + file_name;
+}
+
 bool FontManager::Close(const char *font_name) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
   auto it = map_faces_.find(font_name);
   if (it == map_faces_.end()) {
     return false;
   }
 
-  // Clean up face instance data.
+  // Clean up face instance data, and the shaping contexts using it.
+  if (parallel_layout_->face == it->second.get()) {
+    parallel_layout_->contexts.clear();
+    parallel_layout_->face = nullptr;
+  }
   it->second->Close();
+  if (it->second->handle_ != kInvalidFontHandle) {
+    faces_[it->second->handle_] = nullptr;
+  }
 
   map_textures_.clear();
-  map_buffers_.clear();
+  ClearBuffers();
+  shaped_runs_.clear();
 
   map_faces_.erase(it);
 
@@ -767,6 +2187,7 @@ bool FontManager::Close(const char *font_name) {
 }
 
 bool FontManager::SelectFont(const char *font_name) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
   auto it = map_faces_.find(font_name);
   if (it == map_faces_.end()) {
     return false;
@@ -775,23 +2196,492 @@ bool FontManager::SelectFont(const char *font_name) {
   return true;
 }
 
+bool FontManager::SelectFont(FontHandle handle) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  auto face = GetFace(handle);
+  if (face == nullptr) {
+    return false;
+  }
+  current_face_ = face;
+  return true;
+}
+
+FontHandle FontManager::GetFontHandle(const char *font_name) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  auto it = map_faces_.find(font_name);
+  return it != map_faces_.end() ? it->second->handle_ : kInvalidFontHandle;
+}
+
+FaceData *FontManager::GetFace(FontHandle handle) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  if (handle < 0 || static_cast<size_t>(handle) >= faces_.size()) {
+    return nullptr;
+  }
+  return faces_[handle];
+}
+
 void FontManager::StartLayoutPass() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
   // Reset pass.
   current_pass_ = 0;
+  if (cost_report_enabled_) cost_report_frames_++;
+
+  // Drop the cached FontBuffers when they exceed the capacity. Buffers of the
+  // previous frame are not in use at the start of a layout pass.
+#if FLATUI_SOFT_MAX_CACHED_BUFFERS
+  if (map_buffers_.size() > FLATUI_SOFT_MAX_CACHED_BUFFERS) {
+    LogInfo("FontBuffer cache is over its capacity of %d. Flushing it.\n",
+            FLATUI_SOFT_MAX_CACHED_BUFFERS);
+    FlushLayout();
+  }
+#endif  // FLATUI_SOFT_MAX_CACHED_BUFFERS
+
+  // Drop the buffers of the cache scopes discarded or demoted beyond their
+  // budget.
+  TrimCacheScopes();
+
+  // Drop the buffers of texts that others have appended to.
+  for (auto it = superseded_buffers_.begin(); it != superseded_buffers_.end();
+       ++it) {
+    auto buffer = map_buffers_.find(*it);
+    if (buffer != map_buffers_.end()) EraseBuffer(buffer);
+  }
+  superseded_buffers_.clear();
+
+  // Compact FontBuffer storage if freed buffers wasted too much of it.
+  if (buffer_arena_->IsFragmented()) {
+    CompactBufferArena();
+  }
+}
+
+void FontManager::ClearBuffers() {
+  for (auto it = map_buffers_.begin(); it != map_buffers_.end(); ++it) {
+    ReleaseMesh(it->second.get());
+  }
+  map_buffers_.clear();
+  map_buffer_layouts_.clear();
+  for (auto it = cache_scopes_.begin(); it != cache_scopes_.end(); ++it) {
+    it->second.storage = 0;
+  }
+}
+
+void FontManager::PushCacheScope(const char *name) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  auto scope = HashId(name);
+  // An active scope keeps its buffers, even if it was to be discarded.
+  cache_scopes_[scope].policy = kCacheScopeRetain;
+  cache_scope_stack_.push_back(scope);
+}
+
+void FontManager::PopCacheScope(CacheScopePolicy policy) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  if (cache_scope_stack_.empty()) {
+    LogError("PopCacheScope() called without a cache scope.\n");
+    return;
+  }
+  auto scope = cache_scope_stack_.back();
+  cache_scope_stack_.pop_back();
+  // A scope pushed more than once stays active until its outermost pop.
+  if (std::find(cache_scope_stack_.begin(), cache_scope_stack_.end(),
+                scope) == cache_scope_stack_.end()) {
+    SetCacheScopePolicy(scope, policy);
+  }
+}
+
+void FontManager::SetCacheScopePolicy(HashedId scope,
+                                      CacheScopePolicy policy) {
+  if (std::find(cache_scope_stack_.begin(), cache_scope_stack_.end(),
+                scope) != cache_scope_stack_.end()) {
+    LogError("The cache scope 0x%x is active, pop it first.\n", scope);
+    return;
+  }
+  auto it = cache_scopes_.find(scope);
+  if (it == cache_scopes_.end()) return;
+  it->second.policy = policy;
+  if (policy == kCacheScopeDemote) {
+    it->second.demotion = demotion_counter_++;
+  }
+}
+
+void FontManager::TrimCacheScopes() {
+  // Discard the scopes demoted the longest ago until the others fit the
+  // budget.
+  size_t demoted_storage = 0;
+  for (auto it = cache_scopes_.begin(); it != cache_scopes_.end(); ++it) {
+    if (it->second.policy == kCacheScopeDemote) {
+      demoted_storage += it->second.storage;
+    }
+  }
+  while (demoted_storage > demoted_scope_budget_) {
+    CacheScope *oldest = nullptr;
+    for (auto it = cache_scopes_.begin(); it != cache_scopes_.end(); ++it) {
+      if (it->second.policy == kCacheScopeDemote &&
+          (oldest == nullptr || it->second.demotion < oldest->demotion)) {
+        oldest = &it->second;
+      }
+    }
+    oldest->policy = kCacheScopeDiscard;
+    demoted_storage -= oldest->storage;
+  }
+
+  // Discard the buffers of the scopes to discard, and forget the scopes.
+  bool discard = false;
+  for (auto it = cache_scopes_.begin(); it != cache_scopes_.end(); ++it) {
+    discard |= it->second.policy == kCacheScopeDiscard;
+  }
+  if (!discard) return;
+  for (auto it = map_buffers_.begin(); it != map_buffers_.end();) {
+    auto current = it++;
+    auto scope = cache_scopes_.find(current->second->get_cache_scope());
+    if (scope != cache_scopes_.end() &&
+        scope->second.policy == kCacheScopeDiscard) {
+      EraseBuffer(current);
+    }
+  }
+  for (auto it = cache_scopes_.begin(); it != cache_scopes_.end();) {
+    if (it->second.policy == kCacheScopeDiscard) {
+      it = cache_scopes_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void FontManager::CompactBufferArena() {
+  std::unique_ptr<FontBufferArena> arena(new FontBufferArena());
+  for (auto it = map_buffers_.begin(); it != map_buffers_.end(); ++it) {
+    it->second->Relocate(arena.get());
+  }
+  // Old pages are released here.
+  buffer_arena_.swap(arena);
+}
+
+void FontManager::EnableGlyphRasterizer(bool enable) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  glyph_rasterizer_.reset(enable ? new GlyphRasterizer() : nullptr);
+}
+
+void FontManager::SetGlyphStore(GlyphStore *store) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  glyph_store_ = store;
+}
+
+void FontManager::SetTaskScheduler(TaskScheduler *scheduler) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  task_scheduler_ = scheduler != nullptr ? scheduler : &serial_scheduler_;
+}
+
+void FontManager::SetTextMeshFactory(TextMeshFactory *factory) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  text_mesh_factory_ = factory != nullptr ? factory : &mesh_factory_;
+}
+
+void FontManager::SetFontDecoder(FontDecoder *decoder) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+#if defined(FLATUI_USE_ZSTD)
+  font_decoder_ = decoder != nullptr ? decoder : &zstd_decoder_;
+#else
+  font_decoder_ = decoder;
+#endif  // defined(FLATUI_USE_ZSTD)
+}
+
+void FontManager::SetFontCacheDirectory(const char *directory) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  font_cache_directory_ = directory;
+  // Cached fonts are named after the hashes of their assets.
+  while (!font_cache_directory_.empty() &&
+         (font_cache_directory_.back() == '/' ||
+          font_cache_directory_.back() == '\\')) {
+    font_cache_directory_.pop_back();
+  }
+}
+
+void FontManager::EnableCostReport(bool enable) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  cost_report_enabled_ = enable;
+  if (enable) ResetCostReport();
+}
+
+void FontManager::ResetCostReport() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  cost_report_.clear();
+  cost_report_frames_ = 0;
+}
+
+void FontManager::GetCostReport(std::vector<TextCost> *report) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  report->clear();
+  report->reserve(cost_report_.size());
+  for (auto it = cost_report_.begin(); it != cost_report_.end(); ++it) {
+    report->push_back(it->second);
+  }
+  std::sort(report->begin(), report->end(),
+            [](const TextCost &a, const TextCost &b) {
+              auto time_a = a.layout_time + a.uv_time;
+              auto time_b = b.layout_time + b.uv_time;
+              if (time_a != time_b) return time_a > time_b;
+              return a.layouts > b.layouts;
+            });
+}
+
+void FontManager::ExportCostReport(std::string *csv) {
+  std::vector<TextCost> report;
+  GetCostReport(&report);
+
+  *csv =
+      "text_id,font_id,font_size,width,height,requests,layouts,"
+      "glyphs_rasterized,uv_refreshes,layout_ms,uv_ms,text\n";
+  char line[256];
+  for (auto it = report.begin(); it != report.end(); ++it) {
+    auto &parameters = it->parameters;
+    snprintf(line, sizeof(line), "%08x,%08x,%g,%d,%d,%u,%u,%u,%u,%.3f,%.3f,",
+             parameters.get_text_id(), parameters.get_font_id(),
+             parameters.get_font_size(), parameters.get_size().x(),
+             parameters.get_size().y(), it->requests, it->layouts,
+             it->glyphs_rasterized, it->uv_refreshes, it->layout_time * 1000.0,
+             it->uv_time * 1000.0);
+    csv->append(line);
+
+    // Quote the text, doubling the quotes in it.
+    csv->push_back('"');
+    for (auto c = it->text.begin(); c != it->text.end(); ++c) {
+      if (*c == '"') csv->push_back('"');
+      csv->push_back(*c == '\n' ? ' ' : *c);
+    }
+    csv->append("\"\n");
+  }
+}
+
+bool FontManager::LoadShapedTexts(const char *file_name) {
+  std::unique_ptr<std::string> data(new std::string());
+  if (!fplbase::LoadFile(file_name, data.get())) {
+    LogInfo("Can't load shaped text table: %s\n", file_name);
+    return false;
+  }
+
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t *>(data->c_str()), data->size());
+  if (!VerifyShapedTextTableBuffer(verifier)) {
+    LogError("Invalid shaped text table: %s\n", file_name);
+    return false;
+  }
+
+  auto table = GetShapedTextTable(data->c_str());
+  if (!IsShapedTextTableCurrent(*table)) {
+    LogInfo(
+        "The shaped text table %s was exported with other layout settings, "
+        "it's only used once they are set.\n",
+        file_name);
+  }
+  auto texts = table->texts();
+  for (flatbuffers::uoffset_t i = 0; texts && i < texts->size(); ++i) {
+    auto text = texts->Get(i);
+    // Layouts without carets can't be shared with an Edit, lay them out again.
+    if (text->carets() == nullptr || !text->carets()->size()) continue;
+    FontBufferParameters parameters(
+        text->font_id(), text->text_id(), text->font_size(),
+        vec2i(text->box_width(), text->box_height()),
+        static_cast<GlyphEffectType>(text->glyph_effect()),
+        text->effect_size());
+    ShapedTextEntry entry;
+    entry.table = table;
+    entry.text = text;
+    map_shaped_texts_[parameters] = entry;
+  }
+  shaped_text_tables_.push_back(std::move(data));
+  return true;
+}
+
+bool FontManager::IsShapedTextTableCurrent(
+    const ShapedTextTable &table) const {
+  auto locale = table.locale();
+  return locale != nullptr && locale_ == locale->c_str() &&
+         table.layout_direction() == layout_direction_ &&
+         table.script() == script_;
+}
+
+void FontManager::UnloadShapedTexts() {
+  map_shaped_texts_.clear();
+  shaped_text_tables_.clear();
+}
+
+void FontManager::ExportShapedTexts(std::string *data) const {
+  // Sort buffers so that the output doesn't depend on the hash map order.
+  typedef std::pair<const FontBufferParameters, std::unique_ptr<FontBuffer>>
+      BufferEntry;
+  std::vector<const BufferEntry *> buffers;
+  for (auto it = map_buffers_.begin(); it != map_buffers_.end(); ++it) {
+    if (it->second->get_code_points() != nullptr ||
+        !it->second->get_glyph_count()) {
+      buffers.push_back(&*it);
+    }
+  }
+  std::sort(buffers.begin(), buffers.end(),
+            [](const BufferEntry *a, const BufferEntry *b) {
+              auto &pa = a->first;
+              auto &pb = b->first;
+              if (pa.get_text_id() != pb.get_text_id()) {
+                return pa.get_text_id() < pb.get_text_id();
+              }
+              if (pa.get_font_id() != pb.get_font_id()) {
+                return pa.get_font_id() < pb.get_font_id();
+              }
+              if (pa.get_font_size() != pb.get_font_size()) {
+                return pa.get_font_size() < pb.get_font_size();
+              }
+              if (pa.get_size().x() != pb.get_size().x()) {
+                return pa.get_size().x() < pb.get_size().x();
+              }
+              if (pa.get_size().y() != pb.get_size().y()) {
+                return pa.get_size().y() < pb.get_size().y();
+              }
+              return pa.get_glyph_effect_id() < pb.get_glyph_effect_id();
+            });
+
+  flatbuffers::FlatBufferBuilder builder;
+  std::vector<flatbuffers::Offset<ShapedText>> texts;
+  std::vector<ShapedGlyph> glyphs;
+  std::vector<ShapedCaret> carets;
+  for (auto it = buffers.begin(); it != buffers.end(); ++it) {
+    auto &parameters = (*it)->first;
+    auto buffer = (*it)->second.get();
+
+    glyphs.clear();
+    auto code_points = buffer->get_code_points();
+    for (size_t i = 0; i < buffer->get_glyph_count(); ++i) {
+      // The first and the last vertices are the top-left and bottom-right
+      // corners of the quad.
+      auto vertices =
+          buffer->get_vertices() + i * FontBuffer::kVerticesPerCodePoint;
+      glyphs.push_back(ShapedGlyph(
+          code_points[i], vertices[0].position_.data[0],
+          vertices[0].position_.data[1], vertices[3].position_.data[0],
+          vertices[3].position_.data[1]));
+    }
+
+    carets.clear();
+    for (size_t i = 0; i < buffer->GetCaretPositionCount(); ++i) {
+      auto caret = buffer->GetCaretPosition(i);
+      carets.push_back(ShapedCaret(caret.x(), caret.y()));
+    }
+
+    auto &metrics = buffer->metrics();
+    ShapedMetrics shaped_metrics(
+        metrics.base_line(), metrics.internal_leading(), metrics.ascender(),
+        metrics.descender(), metrics.external_leading());
+
+    auto glyphs_offset = builder.CreateVectorOfStructs(glyphs);
+    auto line_starts_offset = builder.CreateVector(
+        buffer->get_line_starts(), buffer->get_line_count());
+    auto carets_offset = builder.CreateVectorOfStructs(carets);
+    texts.push_back(CreateShapedText(
+        builder, parameters.get_text_id(), parameters.get_font_id(),
+        parameters.get_font_size(), parameters.get_size().x(),
+        parameters.get_size().y(), buffer->get_size().x(),
+        buffer->get_size().y(), &shaped_metrics, glyphs_offset,
+        line_starts_offset, carets_offset, parameters.get_glyph_effect(),
+        parameters.get_glyph_effect_size()));
+  }
+
+  auto locale = builder.CreateString(locale_);
+  auto texts_offset = builder.CreateVector(texts);
+  FinishShapedTextTableBuffer(
+      builder, CreateShapedTextTable(builder, locale, texts_offset,
+                                     layout_direction_, script_));
+  data->assign(reinterpret_cast<const char *>(builder.GetBufferPointer()),
+               builder.GetSize());
+}
+
+bool FontManager::LoadGlyphAtlas(const char *file_name) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  std::string data;
+  if (!fplbase::LoadFile(file_name, &data)) {
+    LogInfo("Can't load glyph atlas: %s\n", file_name);
+    return false;
+  }
+
+  flatbuffers::Verifier verifier(
+      reinterpret_cast<const uint8_t *>(data.c_str()), data.size());
+  if (!VerifyGlyphAtlasBuffer(verifier)) {
+    LogError("Invalid glyph atlas: %s\n", file_name);
+    return false;
+  }
+
+  auto atlas = GetGlyphAtlas(data.c_str());
+  auto image = atlas->image();
+  auto glyphs = atlas->glyphs();
+  auto width = atlas->cache_width();
+  auto height = atlas->image_height();
+  if (image == nullptr || glyphs == nullptr || width < 0 || height < 0 ||
+      image->size() < static_cast<size_t>(width) * height) {
+    LogError("Invalid glyph atlas image: %s\n", file_name);
+    return false;
+  }
+
+  // Store glyphs into a flushed cache so that they are packed at the top of
+  // the cache, right below glyphs pinned by previously loaded atlases.
+  glyph_cache_->Flush();
+  current_atlas_revision_ = glyph_cache_->get_revision();
+
+  std::vector<uint8_t> glyph_image;
+  bool succeeded = true;
+  for (flatbuffers::uoffset_t i = 0; i < glyphs->size(); ++i) {
+    auto glyph = glyphs->Get(i);
+    if (glyph->x() < 0 || glyph->y() < 0 || glyph->width() < 0 ||
+        glyph->height() < 0 || glyph->x() + glyph->width() > width ||
+        glyph->y() + glyph->height() > height) {
+      LogError("Invalid glyph %d in atlas: %s\n", glyph->code_point(),
+               file_name);
+      succeeded = false;
+      break;
+    }
+
+    // Extract the glyph image from the atlas image.
+    glyph_image.resize(glyph->width() * glyph->height());
+    for (int32_t y = 0; y < glyph->height(); ++y) {
+      memcpy(&glyph_image[y * glyph->width()],
+             image->Data() + (glyph->y() + y) * width + glyph->x(),
+             glyph->width());
+    }
+
+    GlyphCacheEntry entry;
+    entry.set_code_point(glyph->code_point());
+    entry.set_size(vec2i(glyph->width(), glyph->height()));
+    entry.set_offset(vec2i(glyph->offset_x(), glyph->offset_y()));
+    GlyphKey key(glyph->font_id(), glyph->code_point(), glyph->glyph_size());
+    if (glyph_cache_->Set(glyph_image.data(), key, entry) == nullptr) {
+      LogError("Glyph atlas %s doesn't fit in the glyph cache.\n", file_name);
+      succeeded = false;
+      break;
+    }
+  }
+
+  // Keep the glyphs stored so far, they are valid even on a failure.
+  glyph_cache_->PinRows();
+  return succeeded;
 }
 
 void FontManager::UpdatePass(const bool start_subpass) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
   // Increment a cycle counter in glyph cache.
   glyph_cache_->Update();
 
+  // Destroy the meshes of the buffers erased since the last pass, possibly
+  // from threads without a graphics context.
+  released_meshes_.clear();
+
   if (glyph_cache_->get_dirty_state() && current_pass_ <= 0) {
-    auto rect = glyph_cache_->get_dirty_rect();
-    atlas_texture_.get()->Set(0);
-    Texture::UpdateTexture(fplbase::kFormatLuminance, 0, rect.y(),
-                           glyph_cache_.get()->get_size().x(),
-                           rect.w() - rect.y(),
-                           glyph_cache_.get()->get_buffer() +
-                               glyph_cache_.get()->get_size().x() * rect.y());
+    // The atlas texture doesn't exist when no renderer is set (e.g. offline
+    // tools).
+    if (atlas_texture_ != nullptr) {
+      auto rect = glyph_cache_->get_dirty_rect();
+      atlas_texture_.get()->Set(0);
+      Texture::UpdateTexture(
+          fplbase::kFormatLuminance, 0, rect.y(),
+          glyph_cache_.get()->get_size().x(), rect.w() - rect.y(),
+          glyph_cache_.get()->get_buffer() +
+              glyph_cache_.get()->get_size().x() * rect.y());
+    }
     current_atlas_revision_ = glyph_cache_->get_revision();
     glyph_cache_->set_dirty_state(false);
   }
@@ -813,14 +2703,12 @@ void FontManager::UpdatePass(const bool start_subpass) {
   }
 }
 
-uint32_t FontManager::LayoutText(const char *text, const size_t length) {
+template <typename T>
+uint32_t FontManager::LayoutText(const T *text, const size_t length) {
   SetLanguageSettings();
-  hb_buffer_set_language(
-      harfbuzz_buf_, hb_language_from_string(text, static_cast<int>(length)));
 
   // Layout the text.
-  hb_buffer_add_utf8(harfbuzz_buf_, text, static_cast<unsigned int>(length), 0,
-                     static_cast<int>(length));
+  AddText(harfbuzz_buf_, text, length, language_);
   hb_shape(current_face_->harfbuzz_font_, harfbuzz_buf_, nullptr, 0);
 
   // Retrieve layout info.
@@ -836,22 +2724,70 @@ uint32_t FontManager::LayoutText(const char *text, const size_t length) {
   return string_width;
 }
 
-bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
+template <typename T>
+std::string FontManager::GetShapedRunKey(const T *text,
+                                         const size_t length) const {
+  // Runs are keyed by everything that affects shaping except the size. The
+  // encoding is part of the key since glyph clusters are code unit offsets.
+  // The language selects localized glyph forms, it's terminated by a NUL so
+  // that it can't run into the text.
+  std::string key;
+  key.reserve(sizeof(HashedId) + sizeof(script_) + 3 + language_.size() +
+              length * sizeof(T));
+  key.append(reinterpret_cast<const char *>(&current_face_->font_id_),
+             sizeof(HashedId));
+  key.append(reinterpret_cast<const char *>(&script_), sizeof(script_));
+  key.push_back(static_cast<char>(layout_direction_));
+  key.push_back(static_cast<char>(sizeof(T)));
+  key.append(language_.c_str(), language_.size() + 1);
+  key.append(reinterpret_cast<const char *>(text), length * sizeof(T));
+  return key;
+}
+
+template <typename T>
+const ShapedRun *FontManager::ShapeText(const T *text, const size_t length,
+                                        const int32_t ysize) {
+  auto key = GetShapedRunKey(text, length);
+  auto it = shaped_runs_.find(key);
+  if (it != shaped_runs_.end()) {
+    return it->second.get();
+  }
+  if (shaped_runs_.size() >= kShapedRunCacheSize) {
+    shaped_runs_.clear();
+  }
+
+  // Shape at the reference size, then restore the size glyphs are rasterized
+  // at.
+  int x_scale, y_scale;
+  hb_font_get_scale(current_face_->harfbuzz_font_, &x_scale, &y_scale);
+  FT_Set_Pixel_Sizes(current_face_->face_, 0, kShapingReferenceSize);
+  hb_font_set_scale(current_face_->harfbuzz_font_,
+                    kShapingReferenceSize * kFreeTypeUnit,
+                    kShapingReferenceSize * kFreeTypeUnit);
+  std::unique_ptr<ShapedRun> run(new ShapedRun());
+  ShapeRun(current_face_->harfbuzz_font_, harfbuzz_buf_, script_,
+           layout_direction_, language_, text, length, run.get());
+  hb_font_set_scale(current_face_->harfbuzz_font_, x_scale, y_scale);
+  FT_Set_Pixel_Sizes(current_face_->face_, 0, ysize);
+
+  auto insert = shaped_runs_.insert(
+      std::pair<std::string, std::unique_ptr<ShapedRun>>(key, std::move(run)));
+  return insert.first->second.get();
+}
+
+bool FontManager::UpdateMetrics(int32_t top, int32_t height,
                                 const FontMetrics &current_metrics,
                                 FontMetrics *new_metrics) {
   // Calculate internal/external leading value and expand a buffer if
   // necessary.
-  if (g->bitmap_top > current_metrics.ascender() ||
-      static_cast<int32_t>(g->bitmap_top - g->bitmap.rows) <
-          current_metrics.descender()) {
+  if (top > current_metrics.ascender() ||
+      top - height < current_metrics.descender()) {
     *new_metrics = current_metrics;
-    new_metrics->set_internal_leading(
-        std::max(current_metrics.internal_leading(),
-                 g->bitmap_top - current_metrics.ascender()));
+    new_metrics->set_internal_leading(std::max(
+        current_metrics.internal_leading(), top - current_metrics.ascender()));
     new_metrics->set_external_leading(
         std::min(current_metrics.external_leading(),
-                 static_cast<int32_t>(g->bitmap_top - g->bitmap.rows -
-                                      current_metrics.descender())));
+                 top - height - current_metrics.descender()));
     new_metrics->set_base_line(new_metrics->internal_leading() +
                                new_metrics->ascender());
 
@@ -861,6 +2797,7 @@ bool FontManager::UpdateMetrics(const FT_GlyphSlot g,
 }
 
 void FontManager::SetLocale(const char *locale) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
   if (locale_ == locale) {
     return;
   }
@@ -904,32 +2841,178 @@ void FontManager::SetLanguageSettings() {
   hb_buffer_set_script(harfbuzz_buf_, static_cast<hb_script_t>(script_));
 }
 
-const GlyphCacheEntry *FontManager::GetCachedEntry(const uint32_t code_point,
-                                                   const int32_t ysize) {
-  GlyphKey key(current_face_->font_id_, code_point, ysize);
+bool FontManager::LoadGlyphOutline(const uint32_t code_point, vec2i *size,
+                                   vec2i *offset) {
+  if (glyph_rasterizer_ == nullptr) return false;
+  auto face = current_face_->face_;
+  if (FT_Load_Glyph(face, code_point, FT_LOAD_NO_BITMAP) ||
+      face->glyph->format != FT_GLYPH_FORMAT_OUTLINE) {
+    return false;
+  }
+  GlyphRasterizer::GetBounds(face->glyph->outline, size, offset);
+  return true;
+}
+
+bool FontManager::RasterizeGlyph(const uint32_t code_point,
+                                 const uint8_t **image, vec2i *size,
+                                 vec2i *offset) {
+  auto face = current_face_->face_;
+  FT_Error err;
+  if (glyph_rasterizer_ != nullptr) {
+    err = FT_Load_Glyph(face, code_point, FT_LOAD_NO_BITMAP);
+    if (!err && face->glyph->format == FT_GLYPH_FORMAT_OUTLINE) {
+      *image = glyph_rasterizer_->Rasterize(face->glyph->outline, size, offset);
+      return true;
+    }
+    // Let FreeType render glyphs that are not outlines.
+    if (!err) err = FT_Render_Glyph(face->glyph, FT_RENDER_MODE_NORMAL);
+  } else {
+    err = FT_Load_Glyph(face, code_point, FT_LOAD_RENDER);
+  }
+  if (err) {
+    // Error. This could happen typically the loaded font does not support
+    // particular glyph.
+    LogInfo("Can't load glyph %c FT_Error:%d\n", code_point, err);
+    return false;
+  }
+  FT_GlyphSlot g = face->glyph;
+  *image = g->bitmap.buffer;
+  *size = vec2i(g->bitmap.width, g->bitmap.rows);
+  *offset = vec2i(g->bitmap_left, g->bitmap_top);
+  return true;
+}
+
+void FontManager::QueueGlyphOutline(uint8_t *image) {
+  auto &source = current_face_->face_->glyph->outline;
+  GlyphBatch::Glyph glyph;
+  glyph.image = image;
+  if (FT_Outline_New(*ft_, source.n_points, source.n_contours,
+                     &glyph.outline)) {
+    // Out of memory, rasterize the glyph right away.
+    glyph_rasterizer_->Rasterize(source, image, glyph_cache_->get_size().x());
+    return;
+  }
+  FT_Outline_Copy(&source, &glyph.outline);
+  glyph_batch_->glyphs.push_back(glyph);
+}
+
+void FontManager::FinishGlyphBatch(bool rasterize) {
+  auto &glyphs = glyph_batch_->glyphs;
+  if (glyphs.empty()) return;
+
+  if (rasterize) {
+    // Split the glyphs into a task per thread, interleaved so that the tasks
+    // get a similar mix of glyph sizes.
+    auto task_count = std::min(
+        static_cast<size_t>(task_scheduler_->GetConcurrency()), glyphs.size());
+    auto &rasterizers = glyph_batch_->rasterizers;
+    while (rasterizers.size() < task_count) {
+      rasterizers.push_back(
+          std::unique_ptr<GlyphRasterizer>(new GlyphRasterizer()));
+    }
+    auto pitch = glyph_cache_->get_size().x();
+    auto &tasks = glyph_batch_->tasks;
+    tasks.clear();
+    for (size_t i = 0; i < task_count; ++i) {
+      auto rasterizer = rasterizers[i].get();
+      tasks.push_back([&glyphs, rasterizer, pitch, i, task_count]() {
+        for (auto j = i; j < glyphs.size(); j += task_count) {
+          rasterizer->Rasterize(glyphs[j].outline, glyphs[j].image, pitch);
+        }
+      });
+    }
+    // The regions of the cache are disjoint, the tasks write them
+    // concurrently.
+    TaskCounter counter;
+    task_scheduler_->Submit(tasks.data(), tasks.size(), &counter);
+    task_scheduler_->Wait(&counter);
+  }
+
+  for (auto it = glyphs.begin(); it != glyphs.end(); ++it) {
+    FT_Outline_Done(*ft_, &it->outline);
+  }
+  glyphs.clear();
+}
+
+const GlyphCacheEntry *FontManager::GetCachedEntry(
+    const uint32_t code_point, const int32_t ysize,
+    const FontBufferParameters &parameters) {
+  auto effect_id = parameters.get_glyph_effect_id();
+  GlyphKey key(current_face_->font_id_, code_point, ysize, effect_id);
   auto cache = glyph_cache_->Find(key);
 
-  if (cache == nullptr) {
-    // Load glyph using harfbuzz layout information.
-    // Note that harfbuzz takes care of ligatures.
-    FT_Error err =
-        FT_Load_Glyph(current_face_->face_, code_point, FT_LOAD_RENDER);
-    if (err) {
-      // Error. This could happen typically the loaded font does not support
-      // particular glyph.
-      LogInfo("Can't load glyph %c FT_Error:%d\n", code_point, err);
-      return nullptr;
+  // Without an effect or a store needing an image of their own, the in-tree
+  // rasterizer renders outlines straight into a region of the glyph cache.
+  if (cache == nullptr && glyph_rasterizer_ != nullptr &&
+      glyph_store_ == nullptr &&
+      parameters.get_glyph_effect() == kGlyphEffectNone) {
+    vec2i size, offset;
+    if (LoadGlyphOutline(code_point, &size, &offset)) {
+      GlyphCacheEntry entry;
+      entry.set_code_point(code_point);
+      entry.set_size(size);
+      entry.set_offset(offset);
+      uint8_t *image;
+      cache = glyph_cache_->Reserve(key, entry, &image);
+      if (cache == nullptr) {
+        // Glyph cache need to be flushed.
+        // Returning nullptr here for a retry.
+        LogInfo("Glyph cache is full. Need to flush and re-create.\n");
+        return nullptr;
+      }
+      if (task_scheduler_->GetConcurrency() > 1) {
+        QueueGlyphOutline(image);
+      } else {
+        glyph_rasterizer_->Rasterize(current_face_->face_->glyph->outline,
+                                     image, glyph_cache_->get_size().x());
+      }
+      if (current_cost_) current_cost_->glyphs_rasterized++;
+      return cache;
     }
+    // Other glyphs are rendered by FreeType below.
+  }
+
+  if (cache == nullptr) {
+    // Look for the glyph in the shared store first.
+    std::shared_ptr<const GlyphStoreEntry> stored;
+    if (glyph_store_ != nullptr) stored = glyph_store_->Find(key);
 
-    // Store the glyph to cache.
-    FT_GlyphSlot g = current_face_->face_->glyph;
     GlyphCacheEntry entry;
     entry.set_code_point(code_point);
-    entry.set_size(vec2i(g->bitmap.width, g->bitmap.rows));
-    entry.set_offset(vec2i(g->bitmap_left, g->bitmap_top));
+    const uint8_t *image;
+    if (stored != nullptr) {
+      image = stored->image.data();
+      entry.set_size(stored->size);
+      entry.set_offset(stored->offset);
+    } else {
+      // Load glyph using harfbuzz layout information.
+      // Note that harfbuzz takes care of ligatures.
+      vec2i size, offset;
+      if (!RasterizeGlyph(code_point, &image, &size, &offset)) {
+        return nullptr;
+      }
+      if (current_cost_) current_cost_->glyphs_rasterized++;
+      entry.set_size(size);
+      entry.set_offset(offset);
+      if (parameters.get_glyph_effect() != kGlyphEffectNone &&
+          entry.get_size().x() && entry.get_size().y()) {
+        auto padding = BakeGlyphEffect(
+            image, entry.get_size(), parameters.get_glyph_effect(),
+            parameters.get_glyph_effect_size(), &glyph_effect_image_);
+        entry.set_size(entry.get_size() + padding * 2);
+        entry.set_offset(entry.get_offset() + vec2i(-padding, padding));
+        image = glyph_effect_image_.data();
+      }
+      if (glyph_store_ != nullptr) {
+        glyph_store_->Insert(key, image, entry.get_size(), entry.get_offset());
+      }
+    }
+
+    // Store the glyph to cache.
 
-    GlyphKey new_key(current_face_->font_id_, entry.get_code_point(), ysize);
-    cache = glyph_cache_->Set(g->bitmap.buffer, new_key, entry);
+    GlyphKey new_key(current_face_->font_id_, entry.get_code_point(), ysize,
+                     effect_id);
+    cache = glyph_cache_->Set(image, new_key, entry);
 
     if (cache == nullptr) {
       // Glyph cache need to be flushed.
@@ -949,46 +3032,192 @@ int32_t FontManager::ConvertSize(const int32_t original_ysize) {
   }
 }
 
-void FontBuffer::AddVertices(const vec2 &pos, const int32_t base_line,
-                             const float scale, const GlyphCacheEntry &entry) {
-  mathfu::vec2i rounded_pos = mathfu::vec2i(pos);
-  auto scaled_offset = mathfu::vec2(entry.get_offset()) * scale;
-  auto scaled_size = mathfu::vec2(entry.get_size()) * scale;
-  float scaled_base_line = base_line * scale;
+void FontBuffer::Allocate(FontBufferArena *arena, const FontVertex *vertices,
+                          const uint32_t *code_points, size_t glyph_count,
+                          const FontCaretCluster *caret_clusters,
+                          size_t caret_cluster_count,
+                          const uint32_t *line_starts, size_t line_count) {
+  Release();
+
+  // Lay out arrays in one block, from the largest alignment to the smallest.
+  auto vertices_size = glyph_count * kVerticesPerCodePoint * sizeof(FontVertex);
+  auto carets_size = caret_cluster_count * sizeof(FontCaretCluster);
+  auto line_starts_size = line_count * sizeof(uint32_t);
+  auto code_points_size =
+      code_points != nullptr ? glyph_count * sizeof(uint32_t) : 0;
+
+  arena_ = arena;
+  block_size_ = vertices_size + carets_size + line_starts_size +
+                code_points_size;
+  block_ = arena->Allocate(block_size_);
+  glyph_count_ = glyph_count;
+  caret_cluster_count_ = caret_cluster_count;
+  line_count_ = line_count;
+  ReserveQuadIndices(arena);
+
+  vertices_ = glyph_count ? reinterpret_cast<FontVertex *>(block_) : nullptr;
+  caret_clusters_ =
+      caret_cluster_count
+          ? reinterpret_cast<FontCaretCluster *>(block_ + vertices_size)
+          : nullptr;
+  line_starts_ = line_count ? reinterpret_cast<uint32_t *>(
+                                  block_ + vertices_size + carets_size)
+                            : nullptr;
+  code_points_ = code_points_size
+                     ? reinterpret_cast<uint32_t *>(block_ + vertices_size +
+                                                    carets_size +
+                                                    line_starts_size)
+                     : nullptr;
+
+  // Copy contents.
+  if (vertices_size) memcpy(vertices_, vertices, vertices_size);
+  if (carets_size) memcpy(caret_clusters_, caret_clusters, carets_size);
+  if (line_starts_size) memcpy(line_starts_, line_starts, line_starts_size);
+  if (code_points_size) memcpy(code_points_, code_points, code_points_size);
+}
 
-  auto x = rounded_pos.x() + scaled_offset.x();
-  auto y = rounded_pos.y() + scaled_base_line - scaled_offset.y();
-  vertices_.push_back(FontVertex(x, y, 0.0f, 0.0f, 0.0f));
+void FontBuffer::ReserveQuadIndices(FontBufferArena *arena) const {
+  // Every batch is rendered with the indices of the first, the largest one.
+  auto reserved = arena->ReserveQuadIndices(GetBatchGlyphCount(0));
+  assert(reserved);
+  (void)reserved;
+}
 
-  vertices_.push_back(FontVertex(x, y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+void FontBuffer::Relocate(FontBufferArena *arena) {
+  if (arena == arena_) return;
+  auto block = arena->Allocate(block_size_);
+  if (block_size_) {
+    memcpy(block, block_, block_size_);
+  }
+  ReserveQuadIndices(arena);
+
+  // Rebase pointers to the new block.
+  auto rebase = [this, block](void *p) {
+    return p ? block + (static_cast<uint8_t *>(p) - block_) : nullptr;
+  };
+  vertices_ = reinterpret_cast<FontVertex *>(rebase(vertices_));
+  caret_clusters_ =
+      reinterpret_cast<FontCaretCluster *>(rebase(caret_clusters_));
+  line_starts_ = reinterpret_cast<uint32_t *>(rebase(line_starts_));
+  code_points_ = reinterpret_cast<uint32_t *>(rebase(code_points_));
+
+  arena_->Free(block_, block_size_);
+  arena_ = arena;
+  block_ = block;
+}
 
-  vertices_.push_back(FontVertex(x + scaled_size.x(), y, 0.0f, 0.0f, 0.0f));
+void FontBuffer::Release() {
+  if (arena_ != nullptr) {
+    arena_->Free(block_, block_size_);
+  }
+  arena_ = nullptr;
+  block_ = nullptr;
+  block_size_ = 0;
+  vertices_ = nullptr;
+  code_points_ = nullptr;
+  caret_clusters_ = nullptr;
+  line_starts_ = nullptr;
+  glyph_count_ = 0;
+  caret_cluster_count_ = 0;
+  line_count_ = 0;
+  caret_positions_.clear();
+  mesh_.reset();
+  mesh_factory_ = nullptr;
+  mesh_dirty_ = false;
+}
 
-  vertices_.push_back(
-      FontVertex(x + scaled_size.x(), y + scaled_size.y(), 0.0f, 0.0f, 0.0f));
+const std::vector<mathfu::vec2i> &FontBuffer::GetCarets() const {
+  if (caret_positions_.empty()) {
+    for (size_t i = 0; i < caret_cluster_count_; ++i) {
+      auto &cluster = caret_clusters_[i];
+      auto origin = vec2(cluster.origin);
+      for (auto caret = 1; caret <= cluster.count; ++caret) {
+        caret_positions_.push_back(
+            vec2i(origin + vec2(caret * cluster.step, 0.0f)));
+      }
+    }
+  }
+  return caret_positions_;
 }
 
-void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
-  vertices_[index * 4].uv_ = uv.xy();
-  vertices_[index * 4 + 1].uv_ = mathfu::vec2(uv.x(), uv.w());
-  vertices_[index * 4 + 2].uv_ = mathfu::vec2(uv.z(), uv.y());
-  vertices_[index * 4 + 3].uv_ = uv.zw();
+const uint16_t *FontBuffer::get_indices() const {
+  return arena_ != nullptr ? arena_->get_quad_indices() : nullptr;
 }
 
-void FontBuffer::AddCaretPosition(const vec2 &pos) {
-  mathfu::vec2i rounded_pos = mathfu::vec2i(pos);
-  AddCaretPosition(rounded_pos.x(), rounded_pos.y());
+void FontBuffer::UpdateUV(const int32_t index, const vec4 &uv) {
+  assert(static_cast<size_t>(index) < glyph_count_);
+  UpdateQuadUV(uv, &vertices_[index * kVerticesPerCodePoint]);
+  mesh_dirty_ = true;
 }
 
-void FontBuffer::AddCaretPosition(int32_t x, int32_t y) {
-  assert(caret_positions_.capacity());
-  caret_positions_.push_back(mathfu::vec2i(x, y));
+// A TextMesh of a FontBuffer longer than a batch, with a mesh per batch.
+class BatchedTextMesh : public TextMesh {
+ public:
+  virtual void Render(fplbase::Renderer &renderer) {
+    for (auto it = batches_.begin(); it != batches_.end(); ++it) {
+      (*it)->Render(renderer);
+    }
+  }
+
+  virtual bool UpdateVertices(const FontVertex *vertices,
+                              size_t vertex_count) {
+    const size_t batch_vertices = FontBuffer::kMaxGlyphsPerBatch *
+                                  FontBuffer::kVerticesPerCodePoint;
+    for (size_t i = 0; i < batches_.size(); ++i) {
+      auto offset = i * batch_vertices;
+      if (!batches_[i]->UpdateVertices(
+              vertices + offset,
+              std::min(vertex_count - offset, batch_vertices))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  std::vector<std::unique_ptr<TextMesh>> &get_batches() { return batches_; }
+
+ private:
+  std::vector<std::unique_ptr<TextMesh>> batches_;
+};
+
+TextMesh *FontBuffer::GetMesh(TextMeshFactory *factory) const {
+  if (!glyph_count_ || factory == nullptr) return nullptr;
+  if (mesh_ != nullptr && mesh_factory_ == factory) {
+    if (!mesh_dirty_ || mesh_->UpdateVertices(vertices_, get_vertex_count())) {
+      mesh_dirty_ = false;
+      return mesh_.get();
+    }
+  }
+  mesh_factory_ = factory;
+  mesh_dirty_ = false;
+  auto batch_count = get_batch_count();
+  if (batch_count == 1) {
+    mesh_ = factory->CreateMesh(vertices_, get_vertex_count(), get_indices(),
+                                get_index_count());
+    return mesh_.get();
+  }
+
+  // 16 bit indices can't address all the vertices, create a mesh per batch.
+  std::unique_ptr<BatchedTextMesh> mesh(new BatchedTextMesh());
+  for (size_t i = 0; i < batch_count; ++i) {
+    auto batch = factory->CreateMesh(
+        vertices_ + get_batch_vertex_offset(i), get_batch_vertex_count(i),
+        get_indices(), get_batch_index_count(i));
+    if (batch == nullptr) {
+      mesh.reset();
+      break;
+    }
+    mesh->get_batches().push_back(std::move(batch));
+  }
+  mesh_ = std::move(mesh);
+  return mesh_.get();
 }
 
 void FaceData::Close() {
   hb_font_destroy(harfbuzz_font_);
   FT_Done_Face(face_);
   font_data_.clear();
+  font_file_.Close();
 }
 
 }  // namespace flatui
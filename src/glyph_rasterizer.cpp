@@ -0,0 +1,303 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <cmath>
+#include <cstring>
+
+// Freetype2 header
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#include "flatui/internal/glyph_rasterizer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FLATUI_RASTERIZER_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define FLATUI_RASTERIZER_NEON 1
+#include <arm_neon.h>
+#endif
+
+using mathfu::vec2;
+using mathfu::vec2i;
+
+namespace flatui {
+
+// Largest distance between a curve and the lines it's flattened into, in
+// pixels. The segment count of a curve is derived from the second differences
+// of its control points, which bound the distance.
+const float kCurveTolerance = 0.05f;
+
+// 26.6 fixed point unit of FreeType outlines.
+const FT_Pos kOutlineUnit = 64;
+
+// Context of FT_Outline_Decompose() callbacks.
+struct OutlineContext {
+  GlyphRasterizer *rasterizer;
+  FT_Pos left;
+  FT_Pos top;
+
+  vec2 ToPixels(const FT_Vector *v) const {
+    return vec2(static_cast<float>(v->x - left) / kOutlineUnit,
+                static_cast<float>(top - v->y) / kOutlineUnit);
+  }
+};
+
+static int OutlineMoveTo(const FT_Vector *to, void *user) {
+  auto context = static_cast<OutlineContext *>(user);
+  context->rasterizer->MoveTo(context->ToPixels(to));
+  return 0;
+}
+
+static int OutlineLineTo(const FT_Vector *to, void *user) {
+  auto context = static_cast<OutlineContext *>(user);
+  context->rasterizer->LineTo(context->ToPixels(to));
+  return 0;
+}
+
+static int OutlineConicTo(const FT_Vector *control, const FT_Vector *to,
+                          void *user) {
+  auto context = static_cast<OutlineContext *>(user);
+  context->rasterizer->QuadTo(context->ToPixels(control),
+                              context->ToPixels(to));
+  return 0;
+}
+
+static int OutlineCubicTo(const FT_Vector *control1, const FT_Vector *control2,
+                          const FT_Vector *to, void *user) {
+  auto context = static_cast<OutlineContext *>(user);
+  context->rasterizer->CubicTo(context->ToPixels(control1),
+                               context->ToPixels(control2),
+                               context->ToPixels(to));
+  return 0;
+}
+
+const uint8_t *GlyphRasterizer::Rasterize(const FT_Outline &outline,
+                                          vec2i *size, vec2i *offset) {
+  GetBounds(outline, size, offset);
+  Reset(*size);
+  AddOutline(outline, *offset);
+  image_.resize(static_cast<size_t>(size->x() * size->y()));
+  Accumulate(image_.data(), size->x());
+  return image_.data();
+}
+
+void GlyphRasterizer::Rasterize(const FT_Outline &outline, uint8_t *image,
+                                int32_t pitch) {
+  vec2i size, offset;
+  GetBounds(outline, &size, &offset);
+  Reset(size);
+  AddOutline(outline, offset);
+  Accumulate(image, pitch);
+}
+
+void GlyphRasterizer::GetBounds(const FT_Outline &outline, vec2i *size,
+                                vec2i *offset) {
+  // Same bitmap bounds as FreeType: the control box rounded out to pixels.
+  FT_BBox cbox;
+  FT_Outline_Get_CBox(&outline, &cbox);
+  auto left = cbox.xMin & ~(kOutlineUnit - 1);
+  auto top = (cbox.yMax + kOutlineUnit - 1) & ~(kOutlineUnit - 1);
+  auto right = (cbox.xMax + kOutlineUnit - 1) & ~(kOutlineUnit - 1);
+  auto bottom = cbox.yMin & ~(kOutlineUnit - 1);
+  *size = vec2i(static_cast<int>((right - left) / kOutlineUnit),
+                static_cast<int>((top - bottom) / kOutlineUnit));
+  *offset = vec2i(static_cast<int>(left / kOutlineUnit),
+                  static_cast<int>(top / kOutlineUnit));
+}
+
+void GlyphRasterizer::AddOutline(const FT_Outline &outline,
+                                 const vec2i &offset) {
+  if (!size_.x() || !size_.y()) return;
+  OutlineContext context;
+  context.rasterizer = this;
+  context.left = offset.x() * kOutlineUnit;
+  context.top = offset.y() * kOutlineUnit;
+  FT_Outline_Funcs funcs;
+  funcs.move_to = OutlineMoveTo;
+  funcs.line_to = OutlineLineTo;
+  funcs.conic_to = OutlineConicTo;
+  funcs.cubic_to = OutlineCubicTo;
+  funcs.shift = 0;
+  funcs.delta = 0;
+  FT_Outline_Decompose(const_cast<FT_Outline *>(&outline), &funcs, &context);
+}
+
+void GlyphRasterizer::Reset(const vec2i &size) {
+  size_ = size;
+  current_ = mathfu::kZeros2f;
+  // Lines ending on the right edge write one past the row.
+  accumulation_.assign(static_cast<size_t>(size.x() * size.y()) + 1, 0.0f);
+}
+
+void GlyphRasterizer::MoveTo(const vec2 &point) { current_ = point; }
+
+void GlyphRasterizer::LineTo(const vec2 &point) {
+  AddLine(current_, point);
+  current_ = point;
+}
+
+void GlyphRasterizer::QuadTo(const vec2 &control, const vec2 &point) {
+  auto deviation = (current_ - control * 2.0f + point).Length();
+  auto count = std::max(static_cast<int>(std::ceil(
+                            std::sqrt(deviation / (4.0f * kCurveTolerance)))),
+                        1);
+  auto start = current_;
+  for (int i = 1; i <= count; ++i) {
+    auto t = static_cast<float>(i) / count;
+    auto u = 1.0f - t;
+    LineTo(start * (u * u) + control * (2.0f * u * t) + point * (t * t));
+  }
+}
+
+void GlyphRasterizer::CubicTo(const vec2 &control1, const vec2 &control2,
+                              const vec2 &point) {
+  auto deviation = std::max((current_ - control1 * 2.0f + control2).Length(),
+                            (control1 - control2 * 2.0f + point).Length());
+  auto count = std::max(static_cast<int>(std::ceil(std::sqrt(
+                            3.0f * deviation / (4.0f * kCurveTolerance)))),
+                        1);
+  auto start = current_;
+  for (int i = 1; i <= count; ++i) {
+    auto t = static_cast<float>(i) / count;
+    auto u = 1.0f - t;
+    LineTo(start * (u * u * u) + control1 * (3.0f * u * u * t) +
+           control2 * (3.0f * u * t * t) + point * (t * t * t));
+  }
+}
+
+void GlyphRasterizer::AddLine(const vec2 &p0, const vec2 &p1) {
+  if (p0.y() == p1.y()) return;
+  // Walk the line downwards, keeping the winding direction in the sign.
+  float direction = p0.y() < p1.y() ? 1.0f : -1.0f;
+  auto top = p0.y() < p1.y() ? p0 : p1;
+  auto bottom = p0.y() < p1.y() ? p1 : p0;
+  auto width = static_cast<float>(size_.x());
+  auto dxdy = (bottom.x() - top.x()) / (bottom.y() - top.y());
+  auto x = top.x();
+  if (top.y() < 0.0f) x -= top.y() * dxdy;
+  auto y_end = std::min(size_.y(), static_cast<int>(std::ceil(bottom.y())));
+  auto a = accumulation_.data();
+  for (int y = std::max(static_cast<int>(top.y()), 0); y < y_end; ++y) {
+    auto row = a + y * size_.x();
+    auto dy = std::min(static_cast<float>(y + 1), bottom.y()) -
+              std::max(static_cast<float>(y), top.y());
+    auto x_next = x + dxdy * dy;
+    auto d = dy * direction;
+    auto x0 = mathfu::Clamp(std::min(x, x_next), 0.0f, width);
+    auto x1 = mathfu::Clamp(std::max(x, x_next), 0.0f, width);
+    // A vertical line on the right edge covers the last pixel, not the one
+    // past it, so that nothing is written beyond the first pixel of the next
+    // row.
+    auto x0_floor = std::min(std::floor(x0), width - 1.0f);
+    auto x0i = static_cast<int>(x0_floor);
+    auto x1i = static_cast<int>(std::ceil(x1));
+    if (x1i <= x0i + 1) {
+      // The line stays within a pixel of the row.
+      auto x_mid = 0.5f * (x0 + x1) - x0_floor;
+      row[x0i] += d - d * x_mid;
+      row[x0i + 1] += d * x_mid;
+    } else {
+      // Distribute the area over the pixels the line crosses.
+      auto s = 1.0f / (x1 - x0);
+      auto x0f = x0 - x0_floor;
+      auto a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+      auto x1f = x1 - static_cast<float>(x1i) + 1.0f;
+      auto am = 0.5f * s * x1f * x1f;
+      row[x0i] += d * a0;
+      if (x1i == x0i + 2) {
+        row[x0i + 1] += d * (1.0f - a0 - am);
+      } else {
+        auto a1 = s * (1.5f - x0f);
+        row[x0i + 1] += d * (a1 - a0);
+        for (int xi = x0i + 2; xi < x1i - 1; ++xi) {
+          row[xi] += d * s;
+        }
+        auto a2 = a1 + static_cast<float>(x1i - x0i - 3) * s;
+        row[x1i - 1] += d * (1.0f - a2 - am);
+      }
+      row[x1i] += d * am;
+    }
+    x = x_next;
+  }
+}
+
+const uint8_t *GlyphRasterizer::Accumulate() {
+  image_.resize(static_cast<size_t>(size_.x() * size_.y()));
+  Accumulate(image_.data(), size_.x());
+  return image_.data();
+}
+
+void GlyphRasterizer::Accumulate(uint8_t *image, int32_t pitch) {
+  // The coverage of a pixel is the sum of all areas up to it. Every row sums
+  // up to zero, and a line ending on the right edge adds its area to the first
+  // pixel of the next row, so the sum runs through the whole buffer.
+  auto a = accumulation_.data();
+  float sum = 0.0f;
+  for (int32_t y = 0; y < size_.y(); ++y, a += size_.x(), image += pitch) {
+    int32_t x = 0;
+#if defined(FLATUI_RASTERIZER_SSE2)
+    const __m128 kSignMask = _mm_set1_ps(-0.0f);
+    const __m128 kOne = _mm_set1_ps(1.0f);
+    const __m128 kMax = _mm_set1_ps(255.0f);
+    const __m128 kHalf = _mm_set1_ps(0.5f);
+    __m128 offset = _mm_set1_ps(sum);
+    for (; x + 4 <= size_.x(); x += 4) {
+      // Prefix sum of 4 floats in two shifted adds.
+      __m128 v = _mm_loadu_ps(a + x);
+      v = _mm_add_ps(v,
+                     _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+      v = _mm_add_ps(v, _mm_shuffle_ps(_mm_setzero_ps(), v, 0x40));
+      v = _mm_add_ps(v, offset);
+      __m128 c = _mm_min_ps(_mm_andnot_ps(kSignMask, v), kOne);
+      // Round half up like the scalar loop, not to even.
+      __m128i z = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(c, kMax), kHalf));
+      z = _mm_packus_epi16(_mm_packs_epi32(z, z), z);
+      int32_t pixels = _mm_cvtsi128_si32(z);
+      memcpy(image + x, &pixels, sizeof(pixels));
+      offset = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+    sum = _mm_cvtss_f32(offset);
+#elif defined(FLATUI_RASTERIZER_NEON)
+    const float32x4_t kZero = vdupq_n_f32(0.0f);
+    float32x4_t offset = vdupq_n_f32(sum);
+    for (; x + 4 <= size_.x(); x += 4) {
+      // Prefix sum of 4 floats in two shifted adds.
+      float32x4_t v = vld1q_f32(a + x);
+      v = vaddq_f32(v, vextq_f32(kZero, v, 3));
+      v = vaddq_f32(v, vextq_f32(kZero, v, 2));
+      v = vaddq_f32(v, offset);
+      float32x4_t c = vminq_f32(vabsq_f32(v), vdupq_n_f32(1.0f));
+      c = vmlaq_n_f32(vdupq_n_f32(0.5f), c, 255.0f);
+      uint16x4_t z = vmovn_u32(vcvtq_u32_f32(c));
+      uint32_t pixels =
+          vget_lane_u32(vreinterpret_u32_u8(vmovn_u16(vcombine_u16(z, z))), 0);
+      memcpy(image + x, &pixels, sizeof(pixels));
+      offset = vdupq_n_f32(vgetq_lane_f32(v, 3));
+    }
+    sum = vgetq_lane_f32(offset, 0);
+#endif
+    // Pixels left over by the vector loop, or all of them without SIMD.
+    for (; x < size_.x(); ++x) {
+      sum += a[x];
+      image[x] = static_cast<uint8_t>(
+          std::min(std::fabs(sum), 1.0f) * 255.0f + 0.5f);
+    }
+  }
+}
+
+}  // namespace flatui
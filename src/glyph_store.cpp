@@ -0,0 +1,73 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/glyph_store.h"
+
+using mathfu::vec2i;
+
+namespace flatui {
+
+GlyphStore::GlyphStore() : size_(0), capacity_(kGlyphStoreDefaultCapacity) {}
+
+GlyphStore::GlyphStore(size_t capacity) : size_(0), capacity_(capacity) {}
+
+GlyphStore::~GlyphStore() {}
+
+std::shared_ptr<const GlyphStoreEntry> GlyphStore::Find(const GlyphKey &key) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  return it != entries_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<const GlyphStoreEntry> GlyphStore::Insert(
+    const GlyphKey &key, const uint8_t *image, const vec2i &size,
+    const vec2i &offset) {
+  // Copy the image before taking the lock.
+  std::shared_ptr<GlyphStoreEntry> entry(new GlyphStoreEntry());
+  entry->image.assign(image, image + size.x() * size.y());
+  entry->size = size;
+  entry->offset = offset;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it != entries_.end()) return it->second;
+  if (size_ + entry->image.size() > capacity_) {
+    // Start over rather than tracking the use of each glyph. Entries still
+    // referenced by FontManagers stay alive until they're released.
+    entries_.clear();
+    size_ = 0;
+  }
+  size_ += entry->image.size();
+  entries_[key] = entry;
+  return entry;
+}
+
+void GlyphStore::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+  size_ = 0;
+}
+
+size_t GlyphStore::get_size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return size_;
+}
+
+size_t GlyphStore::get_glyph_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace flatui
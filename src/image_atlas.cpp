@@ -0,0 +1,184 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <cstdlib>
+#include <cstring>
+#include "flatui/image_atlas.h"
+#include "fplbase/utilities.h"
+
+using fplbase::LogInfo;
+using fplbase::Texture;
+using mathfu::vec2i;
+using mathfu::vec4;
+
+namespace flatui {
+
+static const int32_t kImageAtlasBytesPerPixel = 4;
+
+ImageAtlas::ImageAtlas()
+    : page_size_(vec2i(kImageAtlasDefaultPageSize,
+                       kImageAtlasDefaultPageSize)) {}
+
+ImageAtlas::ImageAtlas(const vec2i &page_size) : page_size_(page_size) {}
+
+ImageAtlas::~ImageAtlas() {}
+
+bool ImageAtlas::Add(const Texture &texture, const char *file_name) {
+  // The texture is already packed, or waiting to be.
+  if (entries_.find(&texture) != entries_.end()) return true;
+  if (std::find_if(pending_images_.begin(), pending_images_.end(),
+                   [&texture](const PendingImage &image) {
+                     return image.texture == &texture;
+                   }) != pending_images_.end()) {
+    return true;
+  }
+
+  vec2i size;
+  bool has_alpha = false;
+  auto data = Texture::LoadAndUnpackTexture(file_name, mathfu::kOnes2f, &size,
+                                            &has_alpha);
+  if (data == nullptr) {
+    LogInfo("Can't load an image for the atlas: %s\n", file_name);
+    return false;
+  }
+  if (size.x() + kImageAtlasPadding * 2 > page_size_.x() ||
+      size.y() + kImageAtlasPadding * 2 > page_size_.y()) {
+    LogInfo("The image doesn't fit in an atlas page: %s\n", file_name);
+    free(data);
+    return false;
+  }
+
+  // Expand the pixels to RGBA, the format of the pages.
+  PendingImage image;
+  image.texture = &texture;
+  image.size = size;
+  auto pixel_count = static_cast<size_t>(size.x() * size.y());
+  image.pixels.resize(pixel_count * kImageAtlasBytesPerPixel);
+  auto channels = has_alpha ? 4 : 3;
+  for (size_t i = 0; i < pixel_count; ++i) {
+    auto src = data + i * channels;
+    auto dest = &image.pixels[i * kImageAtlasBytesPerPixel];
+    dest[0] = src[0];
+    dest[1] = src[1];
+    dest[2] = src[2];
+    dest[3] = has_alpha ? src[3] : 0xff;
+  }
+  free(data);
+
+  pending_images_.push_back(std::move(image));
+  return true;
+}
+
+void ImageAtlas::Pack() {
+  if (pending_images_.empty()) return;
+
+  // Shelf packing: taller images first, so that the images on a shelf have
+  // similar heights.
+  std::stable_sort(pending_images_.begin(), pending_images_.end(),
+                   [](const PendingImage &a, const PendingImage &b) {
+                     return a.size.y() > b.size.y();
+                   });
+
+  std::vector<uint8_t> page;
+  vec2i cursor = mathfu::kZeros2i;
+  int32_t shelf_height = 0;
+  size_t first_on_page = 0;
+  std::vector<vec2i> positions(pending_images_.size());
+  for (size_t i = 0; i <= pending_images_.size(); ++i) {
+    bool last = i == pending_images_.size();
+    vec2i padded_size = mathfu::kZeros2i;
+    if (!last) {
+      padded_size = pending_images_[i].size + kImageAtlasPadding * 2;
+      if (cursor.x() + padded_size.x() > page_size_.x()) {
+        // Start a new shelf.
+        cursor = vec2i(0, cursor.y() + shelf_height);
+        shelf_height = 0;
+      }
+    }
+    if (last || cursor.y() + padded_size.y() > page_size_.y()) {
+      // Write out the images placed on the current page.
+      page.assign(page_size_.x() * page_size_.y() * kImageAtlasBytesPerPixel,
+                  0);
+      for (auto j = first_on_page; j < i; ++j) {
+        Blit(pending_images_[j], positions[j], page.data());
+        ImageAtlasEntry entry;
+        entry.page = nullptr;
+        auto pos = positions[j] + kImageAtlasPadding;
+        auto end = pos + pending_images_[j].size;
+        entry.uv = vec4(static_cast<float>(pos.x()) / page_size_.x(),
+                        static_cast<float>(pos.y()) / page_size_.y(),
+                        static_cast<float>(end.x()) / page_size_.x(),
+                        static_cast<float>(end.y()) / page_size_.y());
+        entries_[pending_images_[j].texture] = entry;
+      }
+      AddPage(page);
+      for (auto j = first_on_page; j < i; ++j) {
+        entries_[pending_images_[j].texture].page = pages_.back().get();
+      }
+      if (last) break;
+      first_on_page = i;
+      cursor = mathfu::kZeros2i;
+      shelf_height = 0;
+    }
+    positions[i] = cursor;
+    cursor.x() += padded_size.x();
+    shelf_height = std::max(shelf_height, padded_size.y());
+  }
+
+  LogInfo("Packed %d images into %d atlas pages.\n",
+          static_cast<int>(pending_images_.size()),
+          static_cast<int>(pages_.size()));
+  pending_images_.clear();
+}
+
+void ImageAtlas::Clear() {
+  pending_images_.clear();
+  entries_.clear();
+  pages_.clear();
+}
+
+const ImageAtlasEntry *ImageAtlas::Find(const Texture &texture) const {
+  auto it = entries_.find(&texture);
+  return it != entries_.end() ? &it->second : nullptr;
+}
+
+void ImageAtlas::Blit(const PendingImage &image, const vec2i &pos,
+                      uint8_t *page) const {
+  auto padded_size = image.size + kImageAtlasPadding * 2;
+  for (int32_t y = 0; y < padded_size.y(); ++y) {
+    // Rows and columns in the padding repeat the nearest edge of the image.
+    auto src_y = mathfu::Clamp(y - kImageAtlasPadding, 0, image.size.y() - 1);
+    auto dest_row = page + ((pos.y() + y) * page_size_.x() + pos.x()) *
+                               kImageAtlasBytesPerPixel;
+    for (int32_t x = 0; x < padded_size.x(); ++x) {
+      auto src_x =
+          mathfu::Clamp(x - kImageAtlasPadding, 0, image.size.x() - 1);
+      memcpy(dest_row + x * kImageAtlasBytesPerPixel,
+             &image.pixels[(src_y * image.size.x() + src_x) *
+                           kImageAtlasBytesPerPixel],
+             kImageAtlasBytesPerPixel);
+    }
+  }
+}
+
+void ImageAtlas::AddPage(const std::vector<uint8_t> &pixels) {
+  // No mipmaps, the images would bleed into each other in smaller levels.
+  std::unique_ptr<Texture> texture(
+      new Texture(nullptr, fplbase::kFormat8888, false));
+  texture->LoadFromMemory(pixels.data(), page_size_, true);
+  pages_.push_back(std::move(texture));
+}
+
+}  // namespace flatui
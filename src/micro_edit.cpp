@@ -102,16 +102,16 @@ bool MicroEdit::MoveCaretVertical(int32_t offset) {
 
 bool MicroEdit::MoveCaretInLine(CaretPosition position) {
   // Pick current row.
-  auto start_of_line = buffer_->GetCaretPositions().begin();
-  auto end_of_line = buffer_->GetCaretPositions().end();
-  auto pos = buffer_->GetCaretPositions()[GetCaretPosition()];
+  auto start_of_line = buffer_->GetCaretPositions();
+  auto end_of_line = start_of_line + buffer_->GetCaretPositionCount();
+  auto pos = buffer_->GetCaretPosition(GetCaretPosition());
   PickRow(pos, &start_of_line, &end_of_line);
 
   ptrdiff_t index = 0;
   if (position == kTailOfLine) {
-    index = std::distance(buffer_->GetCaretPositions().begin(), end_of_line);
+    index = std::distance(buffer_->GetCaretPositions(), end_of_line);
   } else if (position == kHeadOfLine) {
-    index = std::distance(buffer_->GetCaretPositions().begin(), start_of_line);
+    index = std::distance(buffer_->GetCaretPositions(), start_of_line);
   }
   return SetCaret(static_cast<int32_t>(index));
 }
@@ -318,8 +318,8 @@ int32_t MicroEdit::Pick(const vec2i &pointer_position, float offset) {
   }
 
   // Pick a row first.
-  auto start_it = buffer_->GetCaretPositions().begin();
-  auto end_it = buffer_->GetCaretPositions().end();
+  auto start_it = buffer_->GetCaretPositions();
+  auto end_it = start_it + buffer_->GetCaretPositionCount();
   auto buffer_begin = start_it;
   auto buffer_end = end_it;
   PickRow(pointer_position, &start_it, &end_it);
@@ -346,8 +346,7 @@ int32_t MicroEdit::Pick(const vec2i &pointer_position, float offset) {
 }
 
 void MicroEdit::PickRow(const vec2i &pointer_position,
-                        std::vector<vec2i>::const_iterator *start_it,
-                        std::vector<vec2i>::const_iterator *end_it) {
+                        const vec2i **start_it, const vec2i **end_it) {
   // Perform a binary search in the caret position buffer.
   auto compare = [](const vec2i &lhs,
                     const vec2i &rhs) { return lhs.y() < rhs.y(); };
@@ -357,8 +356,7 @@ void MicroEdit::PickRow(const vec2i &pointer_position,
 }
 
 int32_t MicroEdit::PickColumn(const vec2i &pointer_position,
-                              std::vector<vec2i>::const_iterator start_it,
-                              std::vector<vec2i>::const_iterator end_it) {
+                              const vec2i *start_it, const vec2i *end_it) {
   auto compare = [this](const vec2i &lhs, const vec2i &rhs) {
     if (direction_ == TextLayoutDirectionRTL) {
       return lhs.x() >= rhs.x();
@@ -369,7 +367,7 @@ int32_t MicroEdit::PickColumn(const vec2i &pointer_position,
   const auto it = std::upper_bound(start_it, end_it, pointer_position, compare);
 
   int32_t index = static_cast<int32_t>(
-      std::distance(buffer_->GetCaretPositions().begin(), it));
+      std::distance(buffer_->GetCaretPositions(), it));
   return index;
 }
 
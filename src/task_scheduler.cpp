@@ -0,0 +1,220 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "flatui/task_scheduler.h"
+
+namespace flatui {
+
+void SerialScheduler::Submit(const Task *tasks, size_t count,
+                             TaskCounter *counter) {
+  counter->Add(static_cast<int32_t>(count));
+  for (size_t i = 0; i < count; ++i) {
+    tasks[i]();
+    counter->Complete();
+  }
+}
+
+void SerialScheduler::Wait(TaskCounter *counter) {
+  // Tasks have run when they were submitted.
+  assert(counter->IsDone());
+  (void)counter;
+}
+
+// A task waiting in the queue of a worker.
+struct QueuedTask {
+  TaskScheduler::Task task;
+  TaskCounter *counter;
+};
+
+struct TaskQueue {
+  std::mutex mutex;
+  std::deque<QueuedTask> tasks;
+};
+
+struct ThreadPoolState {
+  ThreadPoolState() : next_queue(0), generation(0), quit(false) {}
+
+  // Index of the worker running on the calling thread, or -1.
+  int32_t GetWorkerIndex() const {
+    auto id = std::this_thread::get_id();
+    for (size_t i = 0; i < threads.size(); ++i) {
+      if (threads[i].get_id() == id) return static_cast<int32_t>(i);
+    }
+    return -1;
+  }
+
+  // Take a task from the back or the front of a queue. With a counter, only
+  // a task of its batch is taken.
+  static bool Take(TaskQueue *queue, bool back, TaskCounter *counter,
+                   QueuedTask *task) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (queue->tasks.empty()) return false;
+    auto &candidate = back ? queue->tasks.back() : queue->tasks.front();
+    if (counter != nullptr && candidate.counter != counter) return false;
+    *task = std::move(candidate);
+    if (back) {
+      queue->tasks.pop_back();
+    } else {
+      queue->tasks.pop_front();
+    }
+    return true;
+  }
+
+  // Find a task for the worker `index` (-1 for other threads). Workers take
+  // the latest task of their own queue, then steal the oldest tasks of the
+  // others. Threads waiting on a counter look at both ends of all the queues
+  // for the tasks of its batch.
+  bool Pop(int32_t index, TaskCounter *counter, QueuedTask *task) {
+    auto count = static_cast<int32_t>(queues.size());
+    if (index >= 0 && Take(queues[index].get(), true, counter, task)) {
+      return true;
+    }
+    for (int32_t i = 0; i < count; ++i) {
+      auto victim = (index + 1 + i) % count;
+      if (victim == index && counter == nullptr) continue;
+      auto queue = queues[victim].get();
+      if (Take(queue, false, counter, task)) return true;
+      if (counter != nullptr && Take(queue, true, counter, task)) return true;
+    }
+    return false;
+  }
+
+  void Run(QueuedTask *task) {
+    task->task();
+    if (task->counter->Complete()) {
+      // Wake up the threads waiting on the counter. Locking the mutex orders
+      // the completion with their checks of the counter.
+      { std::lock_guard<std::mutex> lock(mutex); }
+      wake.notify_all();
+    }
+  }
+
+  void WorkerMain(int32_t index) {
+    for (;;) {
+      uint64_t current_generation;
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        current_generation = generation;
+      }
+      QueuedTask task;
+      if (Pop(index, nullptr, &task)) {
+        Run(&task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex);
+      if (quit) return;
+      wake.wait(lock,
+                [&]() { return quit || generation != current_generation; });
+    }
+  }
+
+  std::vector<std::unique_ptr<TaskQueue>> queues;
+  std::vector<std::thread> threads;
+  std::atomic<size_t> next_queue;
+
+  // Guards the generation, bumped by each submission, and `quit`.
+  std::mutex mutex;
+  std::condition_variable wake;
+  uint64_t generation;
+  bool quit;
+};
+
+ThreadPoolScheduler::ThreadPoolScheduler(int32_t num_threads)
+    : state_(new ThreadPoolState()) {
+  if (num_threads <= 0) {
+    num_threads = static_cast<int32_t>(std::thread::hardware_concurrency()) - 1;
+    num_threads = std::max(num_threads, 1);
+  }
+  for (int32_t i = 0; i < num_threads; ++i) {
+    state_->queues.push_back(std::unique_ptr<TaskQueue>(new TaskQueue()));
+  }
+  // Workers look themselves up in `threads` only while running tasks, which
+  // are submitted once the constructor has returned.
+  state_->threads.reserve(num_threads);
+  for (int32_t i = 0; i < num_threads; ++i) {
+    state_->threads.push_back(
+        std::thread(&ThreadPoolState::WorkerMain, state_.get(), i));
+  }
+}
+
+ThreadPoolScheduler::~ThreadPoolScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->quit = true;
+  }
+  state_->wake.notify_all();
+  for (auto it = state_->threads.begin(); it != state_->threads.end(); ++it) {
+    it->join();
+  }
+}
+
+void ThreadPoolScheduler::Submit(const Task *tasks, size_t count,
+                                 TaskCounter *counter) {
+  if (!count) return;
+  counter->Add(static_cast<int32_t>(count));
+
+  // Keep batches of workers on their own queue, where they run first, and
+  // spread the others over the queues.
+  auto index = state_->GetWorkerIndex();
+  auto num_queues = state_->queues.size();
+  for (size_t i = 0; i < count; ++i) {
+    auto queue_index =
+        index >= 0 ? static_cast<size_t>(index)
+                   : state_->next_queue.fetch_add(1) % num_queues;
+    auto queue = state_->queues[queue_index].get();
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    QueuedTask task = {tasks[i], counter};
+    queue->tasks.push_back(std::move(task));
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(state_->mutex);
+    state_->generation++;
+  }
+  state_->wake.notify_all();
+}
+
+void ThreadPoolScheduler::Wait(TaskCounter *counter) {
+  auto index = state_->GetWorkerIndex();
+  while (!counter->IsDone()) {
+    uint64_t current_generation;
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      current_generation = state_->generation;
+    }
+    // Help with the batch, other tasks may wait on locks held by the caller.
+    QueuedTask task;
+    if (state_->Pop(index, counter, &task)) {
+      state_->Run(&task);
+      continue;
+    }
+    // The remaining tasks are running, or queued behind other tasks.
+    std::unique_lock<std::mutex> lock(state_->mutex);
+    state_->wake.wait(lock, [&]() {
+      return counter->IsDone() || state_->generation != current_generation;
+    });
+  }
+}
+
+int32_t ThreadPoolScheduler::GetConcurrency() const {
+  return static_cast<int32_t>(state_->threads.size()) + 1;
+}
+
+}  // namespace flatui
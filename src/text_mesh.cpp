@@ -0,0 +1,55 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "precompiled.h"
+#include "flatui/font_manager.h"
+#include "flatui/text_mesh.h"
+#include "fplbase/renderer.h"
+
+namespace flatui {
+
+// A TextMesh rendered with a fplbase::Mesh. fplbase meshes can't be updated,
+// the factory creates a new one when the UVs of a text change.
+class FplbaseTextMesh : public TextMesh {
+ public:
+  FplbaseTextMesh(const FontVertex *vertices, size_t vertex_count,
+                  const uint16_t *indices, size_t index_count)
+      : mesh_(vertices, static_cast<int>(vertex_count), sizeof(FontVertex),
+              kFormat) {
+    mesh_.AddIndices(indices, static_cast<int>(index_count), nullptr);
+  }
+
+  virtual void Render(fplbase::Renderer &renderer) {
+    // The shader and the texture of the text are set by the caller.
+    mesh_.Render(renderer, true);
+  }
+
+ private:
+  static const fplbase::Attribute kFormat[];
+
+  fplbase::Mesh mesh_;
+};
+
+const fplbase::Attribute FplbaseTextMesh::kFormat[] = {
+    fplbase::kPosition3f, fplbase::kTexCoord2f, fplbase::kEND};
+
+std::unique_ptr<TextMesh> MeshFactory::CreateMesh(const FontVertex *vertices,
+                                                  size_t vertex_count,
+                                                  const uint16_t *indices,
+                                                  size_t index_count) {
+  return std::unique_ptr<TextMesh>(
+      new FplbaseTextMesh(vertices, vertex_count, indices, index_count));
+}
+
+}  // namespace flatui
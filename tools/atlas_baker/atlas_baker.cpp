@@ -0,0 +1,337 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// flatui_atlas_baker bakes the glyphs used by a corpus of texts into a glyph
+// atlas. The atlas is loaded and pinned at startup with
+// FontManager::LoadGlyphAtlas(), so that the texts don't need any FreeType
+// work at runtime.
+//
+// Texts are laid out with FontManager, the same way as the runtime does, so
+// that the atlas includes the glyphs selected by the shaping (ligatures,
+// contextual forms etc.). Each (font, size) pair is laid out by a worker
+// thread with its own FontManager. The rasterized glyphs are then packed into
+// the atlas with the runtime GlyphCache.
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "flatui/font_manager.h"
+#include "flatui/internal/glyph_cache.h"
+#include "fplbase/utilities.h"
+#include "glyph_atlas_generated.h"
+
+using flatui::FontBufferParameters;
+using flatui::FontManager;
+using flatui::GlyphCache;
+using flatui::GlyphCacheEntry;
+using flatui::GlyphKey;
+using mathfu::vec2i;
+
+// Size of the glyph caches used to lay out texts in worker threads. They need
+// to hold all glyphs of a (font, size) pair without a flush.
+static const int32_t kWorkerCacheSize = 4096;
+
+// Layout job of a worker thread.
+struct Shard {
+  Shard() : size(0), succeeded(true) {}
+
+  std::string font;
+  int32_t size;
+  std::unique_ptr<FontManager> font_manager;
+  bool succeeded;
+};
+
+// A glyph rasterized by a worker.
+struct BakedGlyph {
+  GlyphKey key;
+  GlyphCacheEntry entry;
+  std::vector<uint8_t> image;
+};
+
+static void PrintUsage() {
+  printf(
+      "Usage: flatui_atlas_baker [options] -o <atlas.fuat>\n"
+      "Options:\n"
+      "  -f, --font <file>        Font file. Can be specified multiple times.\n"
+      "  -s, --size <pixels>      Glyph size. Can be specified multiple "
+      "times.\n"
+      "  -c, --corpus <file>      UTF-8 text file. Each line is laid out as a\n"
+      "                           text.\n"
+      "  -C, --charset <file>     UTF-8 text file. Each character is laid out\n"
+      "                           individually.\n"
+      "  -l, --locale <locale>    Locale of the texts (default: en).\n"
+      "  -w, --cache-size <WxH>   Glyph cache size of the runtime\n"
+      "                           (default: 1024x1024).\n"
+      "  -j, --threads <count>    Number of worker threads\n"
+      "                           (default: number of cores).\n"
+      "  -o, --output <file>      Atlas file to write.\n");
+}
+
+// Load lines of a text file.
+// When split_characters is true, each UTF-8 character is added as a text.
+static bool LoadTexts(const char *file_name, bool split_characters,
+                      std::vector<std::string> *texts) {
+  std::string data;
+  if (!fplbase::LoadFile(file_name, &data)) {
+    fprintf(stderr, "Can't load %s\n", file_name);
+    return false;
+  }
+  size_t start = 0;
+  while (start < data.size()) {
+    auto end = data.find('\n', start);
+    if (end == std::string::npos) end = data.size();
+    auto line = data.substr(start, end - start);
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (split_characters) {
+      for (size_t i = 0; i < line.size();) {
+        // Find the start of the next character.
+        size_t next = i + 1;
+        while (next < line.size() && (line[next] & 0xc0) == 0x80) next++;
+        texts->push_back(line.substr(i, next - i));
+        i = next;
+      }
+    } else if (!line.empty()) {
+      texts->push_back(line);
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+// Lay out all texts with the shard's FontManager.
+static void LayoutShard(const std::vector<std::string> &texts, Shard *shard) {
+  auto font_manager = shard->font_manager.get();
+  auto font_id = font_manager->GetCurrentFace()->font_id_;
+  for (auto it = texts.begin(); it != texts.end(); ++it) {
+    FontBufferParameters parameters(font_id, flatui::HashId(it->c_str()),
+                                    static_cast<float>(shard->size),
+                                    vec2i(0, shard->size));
+    auto buffer = font_manager->GetBuffer(
+        it->c_str(), static_cast<uint32_t>(it->size()), parameters);
+
+    // A revision change means that the cache has been flushed and glyphs have
+    // been lost.
+    if (buffer == nullptr ||
+        font_manager->GetGlyphCache()->get_revision() != 0) {
+      shard->succeeded = false;
+      return;
+    }
+  }
+  // Layouts are not needed anymore, only the glyph cache contents are.
+  font_manager->FlushLayout();
+}
+
+// Copy glyphs rasterized by a shard.
+static void CollectGlyphs(const Shard &shard, std::vector<BakedGlyph> *glyphs) {
+  auto cache = shard.font_manager->GetGlyphCache();
+  auto buffer = cache->get_buffer();
+  auto width = cache->get_size().x();
+  cache->Enumerate([buffer, width, glyphs](const GlyphKey &key,
+                                           const GlyphCacheEntry &entry,
+                                           const vec2i &pos) {
+    BakedGlyph glyph;
+    glyph.key = key;
+    glyph.entry = entry;
+    auto size = entry.get_size();
+    glyph.image.resize(size.x() * size.y());
+    for (int32_t y = 0; y < size.y(); ++y) {
+      memcpy(&glyph.image[y * size.x()],
+             buffer + (pos.y() + y) * width + pos.x(), size.x());
+    }
+    glyphs->push_back(std::move(glyph));
+  });
+}
+
+int main(int argc, char **argv) {
+  std::vector<std::string> fonts;
+  std::vector<int32_t> sizes;
+  std::vector<std::string> texts;
+  std::string locale = flatui::kDefaultLanguage;
+  std::string output;
+  vec2i cache_size(flatui::kGlyphCacheWidth, flatui::kGlyphCacheHeight);
+  auto num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-f" || arg == "--font") {
+      fonts.push_back(value);
+    } else if (arg == "-s" || arg == "--size") {
+      sizes.push_back(atoi(value));
+    } else if (arg == "-c" || arg == "--corpus") {
+      if (!LoadTexts(value, false, &texts)) return 1;
+    } else if (arg == "-C" || arg == "--charset") {
+      if (!LoadTexts(value, true, &texts)) return 1;
+    } else if (arg == "-l" || arg == "--locale") {
+      locale = value;
+    } else if (arg == "-w" || arg == "--cache-size") {
+      int width = 0, height = 0;
+      if (sscanf(value, "%dx%d", &width, &height) != 2 || width <= 0 ||
+          height <= 0) {
+        fprintf(stderr, "Invalid cache size %s\n", value);
+        return 1;
+      }
+      cache_size = vec2i(width, height);
+    } else if (arg == "-j" || arg == "--threads") {
+      num_threads = std::max(atoi(value), 1);
+    } else if (arg == "-o" || arg == "--output") {
+      output = value;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (fonts.empty() || sizes.empty() || output.empty()) {
+    PrintUsage();
+    return 1;
+  }
+
+  // Set up a FontManager per (font, size) pair. Fonts are opened here since
+  // FreeType faces must not be created concurrently.
+  std::vector<Shard> shards(fonts.size() * sizes.size());
+  for (size_t i = 0; i < shards.size(); ++i) {
+    auto &shard = shards[i];
+    shard.font = fonts[i / sizes.size()];
+    shard.size = sizes[i % sizes.size()];
+    shard.font_manager.reset(
+        new FontManager(vec2i(kWorkerCacheSize, kWorkerCacheSize)));
+    if (!shard.font_manager->Open(shard.font.c_str())) {
+      fprintf(stderr, "Can't open font %s\n", shard.font.c_str());
+      return 1;
+    }
+    shard.font_manager->SetLocale(locale.c_str());
+  }
+
+  // Lay out texts in worker threads.
+  std::atomic<size_t> next_shard(0);
+  std::vector<std::thread> workers;
+  for (unsigned int i = 0; i < std::min<size_t>(num_threads, shards.size());
+       ++i) {
+    workers.push_back(std::thread([&texts, &shards, &next_shard]() {
+      for (auto index = next_shard++; index < shards.size();
+           index = next_shard++) {
+        LayoutShard(texts, &shards[index]);
+      }
+    }));
+  }
+  for (auto it = workers.begin(); it != workers.end(); ++it) {
+    it->join();
+  }
+
+  std::vector<BakedGlyph> glyphs;
+  for (auto it = shards.begin(); it != shards.end(); ++it) {
+    if (!it->succeeded) {
+      fprintf(stderr, "Glyphs of %s at size %d don't fit in a %dx%d cache.\n",
+              it->font.c_str(), it->size, kWorkerCacheSize, kWorkerCacheSize);
+      return 1;
+    }
+    CollectGlyphs(*it, &glyphs);
+  }
+
+  // Pack taller glyphs first, so that rows are filled with glyphs of similar
+  // heights. Ties are broken by the key to make the output deterministic.
+  std::sort(glyphs.begin(), glyphs.end(),
+            [](const BakedGlyph &a, const BakedGlyph &b) {
+              if (a.entry.get_size().y() != b.entry.get_size().y()) {
+                return a.entry.get_size().y() > b.entry.get_size().y();
+              }
+              if (a.key.get_font_id() != b.key.get_font_id()) {
+                return a.key.get_font_id() < b.key.get_font_id();
+              }
+              if (a.key.get_glyph_size() != b.key.get_glyph_size()) {
+                return a.key.get_glyph_size() < b.key.get_glyph_size();
+              }
+              return a.key.get_code_point() < b.key.get_code_point();
+            });
+
+  // Pack glyphs with the runtime glyph cache. The atlas records glyphs in the
+  // packing order so that the runtime reproduces the same packing.
+  GlyphCache<uint8_t> atlas(cache_size);
+  std::vector<flatui::AtlasGlyph> atlas_glyphs;
+  int32_t image_height = 0;
+  int64_t glyph_area = 0;
+  for (auto it = glyphs.begin(); it != glyphs.end(); ++it) {
+    auto entry = atlas.Set(it->image.data(), it->key, it->entry);
+    if (entry == nullptr) {
+      fprintf(stderr,
+              "%d glyphs don't fit in a %dx%d cache, %d glyphs packed.\n",
+              static_cast<int>(glyphs.size()), atlas.get_size().x(),
+              atlas.get_size().y(), static_cast<int>(it - glyphs.begin()));
+      return 1;
+    }
+    auto pos = vec2i(entry->get_uv().xy() * mathfu::vec2(atlas.get_size()));
+    auto size = entry->get_size();
+    atlas_glyphs.push_back(flatui::AtlasGlyph(
+        it->key.get_font_id(), it->key.get_code_point(),
+        it->key.get_glyph_size(), entry->get_offset().x(),
+        entry->get_offset().y(), size.x(), size.y(), pos.x(), pos.y()));
+    image_height = std::max(image_height, pos.y() + size.y());
+    glyph_area += size.x() * size.y();
+  }
+
+  // Serialize the atlas.
+  auto width = atlas.get_size().x();
+  flatbuffers::FlatBufferBuilder builder;
+  auto image = builder.CreateVector(atlas.get_buffer(),
+                                    static_cast<size_t>(width) * image_height);
+  auto glyphs_offset = builder.CreateVectorOfStructs(atlas_glyphs);
+  flatui::FinishGlyphAtlasBuffer(
+      builder, flatui::CreateGlyphAtlas(builder, width, atlas.get_size().y(),
+                                        image_height, image, glyphs_offset));
+
+  auto file = fopen(output.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "Can't open %s\n", output.c_str());
+    return 1;
+  }
+  auto written = fwrite(builder.GetBufferPointer(), 1, builder.GetSize(), file);
+  fclose(file);
+  if (written != builder.GetSize()) {
+    fprintf(stderr, "Can't write %s\n", output.c_str());
+    return 1;
+  }
+
+  // Report occupancy.
+  auto cache_area = static_cast<double>(width) * atlas.get_size().y();
+  printf("%s: %d glyphs, %d fonts, %d sizes, %d texts\n", output.c_str(),
+         static_cast<int>(atlas_glyphs.size()), static_cast<int>(fonts.size()),
+         static_cast<int>(sizes.size()), static_cast<int>(texts.size()));
+  printf("Cache: %dx%d, pinned rows: %d px (%.1f%% of the cache)\n", width,
+         atlas.get_size().y(), image_height,
+         100.0 * image_height / atlas.get_size().y());
+  printf("Glyph pixels: %.1f%% of the pinned rows, %.1f%% of the cache\n",
+         image_height ? 100.0 * glyph_area / (width * image_height) : 0.0,
+         100.0 * glyph_area / cache_area);
+  return 0;
+}
@@ -0,0 +1,962 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// flatui_font_subsetter subsets fonts to the glyphs the strings of a title
+// need, at build time.
+//
+// The string corpus uses the format of the flatui_layout_benchmark corpus:
+// each line is <locale> TAB <font file> TAB <text>. For each font, the glyphs
+// the strings map to are collected with the font's cmap, along with the
+// glyphs of their canonical decompositions, and closed over all the GSUB
+// lookups of the font with HarfBuzz, so that the subset shapes the strings
+// the same whatever locale and features they are laid out with. Outlines of
+// composite glyphs pull in their components.
+//
+// Subset fonts keep the glyph ids of the full fonts, so the cmap, metrics and
+// layout tables are kept as they are. The outlines of the other glyphs are
+// emptied, which is where CJK fonts hold most of their bytes: the CharStrings
+// of CFF fonts, or the glyf table of TrueType fonts.
+//
+// Each subset font is then verified against the full font: the outlines of
+// the kept glyphs are compared with FreeType, and the strings are laid out
+// with a FontManager per font, whose glyphs, positions and carets have to be
+// identical.
+//
+// Font files are relative to the directory the tool runs in, e.g. the assets
+// directory:
+//   flatui_font_subsetter -c strings.tsv -o ../subset_assets/fonts
+// Fonts that can't be loaded, subset or verified fail the tool.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#include <hb.h>
+#include <hb-ft.h>
+#include <hb-ot.h>
+
+#include "flatui/font_manager.h"
+#include "fplbase/utilities.h"
+
+using flatui::FontBuffer;
+using flatui::FontBufferParameters;
+using flatui::FontManager;
+using mathfu::vec2i;
+
+// Size of the glyph caches of the FontManagers verifying the subsets.
+static const int32_t kCacheSize = 2048;
+
+// Table tags.
+static const uint32_t kTagCff = 0x43464620;   // 'CFF '
+static const uint32_t kTagDsig = 0x44534947;  // 'DSIG'
+static const uint32_t kTagGlyf = 0x676c7966;  // 'glyf'
+static const uint32_t kTagHead = 0x68656164;  // 'head'
+static const uint32_t kTagLoca = 0x6c6f6361;  // 'loca'
+static const uint32_t kTagMaxp = 0x6d617870;  // 'maxp'
+
+// Outline of the glyphs that aren't kept in CFF fonts: a lone endchar.
+static const char kEmptyCharString = 14;
+
+// A string of the corpus.
+struct CorpusString {
+  std::string locale;
+  std::string text;
+};
+
+// A table of an sfnt font.
+struct SfntTable {
+  uint32_t tag;
+  std::string data;
+};
+
+static void PrintUsage() {
+  printf(
+      "Usage: flatui_font_subsetter [options] -c <corpus.tsv> -o <dir>\n"
+      "Options:\n"
+      "  -c, --corpus <file>      Corpus file. Each line is\n"
+      "                           <locale> TAB <font file> TAB <text>.\n"
+      "                           Lines starting with # are ignored. Can be\n"
+      "                           given more than once.\n"
+      "  -o, --output <dir>       Directory the subset fonts are written to,\n"
+      "                           with the file names of the full fonts.\n"
+      "  -k, --keep <text>        Characters kept in all the fonts, e.g. the\n"
+      "                           digits of texts built at runtime.\n"
+      "  -s, --size <pixels>      Font size the strings are verified with\n"
+      "                           (default: 32).\n"
+      "  -w, --width <pixels>     Width of the layout box the strings are\n"
+      "                           verified with. 0 lays out texts in a\n"
+      "                           single line (default: 0).\n");
+}
+
+// Load a corpus, grouping the strings by font.
+static bool LoadCorpus(
+    const char *file_name,
+    std::map<std::string, std::vector<CorpusString>> *fonts) {
+  std::string data;
+  if (!fplbase::LoadFile(file_name, &data)) {
+    fprintf(stderr, "Can't load %s\n", file_name);
+    return false;
+  }
+  size_t start = 0;
+  int line_number = 0;
+  while (start < data.size()) {
+    auto end = data.find('\n', start);
+    if (end == std::string::npos) end = data.size();
+    auto line = data.substr(start, end - start);
+    start = end + 1;
+    line_number++;
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (line.empty() || line[0] == '#') continue;
+
+    auto locale_end = line.find('\t');
+    auto font_end = locale_end == std::string::npos
+                        ? std::string::npos
+                        : line.find('\t', locale_end + 1);
+    if (font_end == std::string::npos) {
+      fprintf(stderr, "%s:%d: expected <locale> TAB <font> TAB <text>\n",
+              file_name, line_number);
+      return false;
+    }
+    CorpusString string;
+    string.locale = line.substr(0, locale_end);
+    string.text = line.substr(font_end + 1);
+    (*fonts)[line.substr(locale_end + 1, font_end - locale_end - 1)]
+        .push_back(string);
+  }
+  return true;
+}
+
+// Decode a UTF-8 string. Invalid bytes are skipped.
+static void DecodeUtf8(const std::string &text,
+                       std::vector<uint32_t> *code_points) {
+  for (size_t i = 0; i < text.size();) {
+    auto c = static_cast<uint8_t>(text[i]);
+    size_t count = 4;
+    if (c < 0x80) {
+      count = 1;
+    } else if (c < 0xc0) {
+      count = 0;
+    } else if (c < 0xe0) {
+      count = 2;
+    } else if (c < 0xf0) {
+      count = 3;
+    }
+    if (count == 0 || i + count > text.size()) {
+      i++;
+      continue;
+    }
+    uint32_t code_point = count == 1 ? c : c & (0xff >> (count + 1));
+    for (size_t j = 1; j < count; ++j) {
+      code_point = code_point << 6 | (text[i + j] & 0x3f);
+    }
+    code_points->push_back(code_point);
+    i += count;
+  }
+}
+
+static uint16_t ReadU16(const std::string &data, size_t offset) {
+  return static_cast<uint16_t>(static_cast<uint8_t>(data[offset]) << 8 |
+                               static_cast<uint8_t>(data[offset + 1]));
+}
+
+static uint32_t ReadU32(const std::string &data, size_t offset) {
+  return static_cast<uint32_t>(ReadU16(data, offset)) << 16 |
+         ReadU16(data, offset + 2);
+}
+
+static uint32_t ReadOffset(const std::string &data, size_t offset,
+                           uint32_t size) {
+  uint32_t value = 0;
+  for (uint32_t i = 0; i < size; ++i) {
+    value = value << 8 | static_cast<uint8_t>(data[offset + i]);
+  }
+  return value;
+}
+
+static void AppendU16(uint32_t value, std::string *data) {
+  data->push_back(static_cast<char>(value >> 8));
+  data->push_back(static_cast<char>(value));
+}
+
+static void AppendU32(uint32_t value, std::string *data) {
+  AppendU16(value >> 16, data);
+  AppendU16(value & 0xffff, data);
+}
+
+static void WriteU16(uint32_t value, size_t offset, std::string *data) {
+  (*data)[offset] = static_cast<char>(value >> 8);
+  (*data)[offset + 1] = static_cast<char>(value);
+}
+
+static void WriteU32(uint32_t value, size_t offset, std::string *data) {
+  WriteU16(value >> 16, offset, data);
+  WriteU16(value & 0xffff, offset + 2, data);
+}
+
+static SfntTable *FindTable(std::vector<SfntTable> *tables, uint32_t tag) {
+  for (auto it = tables->begin(); it != tables->end(); ++it) {
+    if (it->tag == tag) return &*it;
+  }
+  return nullptr;
+}
+
+static bool ParseSfnt(const std::string &font, uint32_t *version,
+                      std::vector<SfntTable> *tables) {
+  if (font.size() < 12) return false;
+  *version = ReadU32(font, 0);
+  auto count = ReadU16(font, 4);
+  if (font.size() < 12 + count * 16u) return false;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto record = 12 + i * 16;
+    auto offset = ReadU32(font, record + 8);
+    auto length = ReadU32(font, record + 12);
+    if (offset > font.size() || length > font.size() - offset) return false;
+    SfntTable table;
+    table.tag = ReadU32(font, record);
+    table.data = font.substr(offset, length);
+    tables->push_back(table);
+  }
+  return true;
+}
+
+static uint32_t Checksum(const std::string &data, size_t offset,
+                         size_t length) {
+  uint32_t sum = 0;
+  for (size_t i = 0; i < length; i += 4) {
+    uint32_t word = 0;
+    for (size_t j = 0; j < 4; ++j) {
+      word = word << 8 |
+             (i + j < length ? static_cast<uint8_t>(data[offset + i + j]) : 0);
+    }
+    sum += word;
+  }
+  return sum;
+}
+
+// Write an sfnt font with its tables sorted by tag, and recompute the
+// checksums.
+static std::string WriteSfnt(uint32_t version,
+                             std::vector<SfntTable> tables) {
+  std::sort(tables.begin(), tables.end(),
+            [](const SfntTable &a, const SfntTable &b) {
+              return a.tag < b.tag;
+            });
+  auto count = static_cast<uint32_t>(tables.size());
+  uint32_t selector = 0;
+  while ((2u << selector) <= count) selector++;
+  std::string font;
+  AppendU32(version, &font);
+  AppendU16(count, &font);
+  AppendU16(16 << selector, &font);
+  AppendU16(selector, &font);
+  AppendU16(count * 16 - (16 << selector), &font);
+  font.resize(12 + count * 16);
+
+  size_t head_offset = 0;
+  for (uint32_t i = 0; i < count; ++i) {
+    auto &table = tables[i];
+    if (table.tag == kTagHead && table.data.size() >= 12) {
+      // checkSumAdjustment is computed once the font is complete.
+      WriteU32(0, 8, &table.data);
+      head_offset = font.size();
+    }
+    auto record = 12 + i * 16;
+    WriteU32(table.tag, record, &font);
+    WriteU32(Checksum(table.data, 0, table.data.size()), record + 4, &font);
+    WriteU32(static_cast<uint32_t>(font.size()), record + 8, &font);
+    WriteU32(static_cast<uint32_t>(table.data.size()), record + 12, &font);
+    font.append(table.data);
+    font.resize((font.size() + 3) & ~static_cast<size_t>(3));
+  }
+  if (head_offset) {
+    WriteU32(0xb1b0afba - Checksum(font, 0, font.size()), head_offset + 8,
+             &font);
+  }
+  return font;
+}
+
+// Collect the glyphs of the texts and their GSUB closure.
+static void CollectGlyphs(hb_font_t *font,
+                          const std::vector<std::string> &texts,
+                          std::vector<bool> *keep) {
+  auto glyphs = hb_set_create();
+  // .notdef and the space, which HarfBuzz substitutes for missing spaces.
+  hb_set_add(glyphs, 0);
+  std::vector<uint32_t> code_points(1, ' ');
+  for (auto it = texts.begin(); it != texts.end(); ++it) {
+    DecodeUtf8(*it, &code_points);
+  }
+
+  auto unicode = hb_unicode_funcs_get_default();
+  for (size_t i = 0; i < code_points.size(); ++i) {
+    auto code_point = code_points[i];
+    hb_codepoint_t glyph;
+    if (hb_font_get_glyph(font, code_point, 0, &glyph)) {
+      hb_set_add(glyphs, glyph);
+    }
+    // Glyphs of variation sequences.
+    if (i + 1 < code_points.size() &&
+        hb_font_get_glyph(font, code_point, code_points[i + 1], &glyph)) {
+      hb_set_add(glyphs, glyph);
+    }
+    // Characters the text may be normalized into when shaped. They are
+    // decomposed in turn.
+    hb_codepoint_t a, b;
+    if (hb_unicode_decompose(unicode, code_point, &a, &b)) {
+      code_points.push_back(a);
+      if (b) code_points.push_back(b);
+    }
+  }
+
+  // Close the glyphs over all the lookups, until substituted glyphs don't
+  // lead to more substitutions.
+  auto face = hb_font_get_face(font);
+  auto lookups = hb_set_create();
+  hb_ot_layout_collect_lookups(face, HB_OT_TAG_GSUB, nullptr, nullptr,
+                               nullptr, lookups);
+  for (;;) {
+    auto population = hb_set_get_population(glyphs);
+    hb_codepoint_t lookup = HB_SET_VALUE_INVALID;
+    while (hb_set_next(lookups, &lookup)) {
+      hb_ot_layout_lookup_substitute_closure(face, lookup, glyphs);
+    }
+    if (hb_set_get_population(glyphs) == population) break;
+  }
+  hb_set_destroy(lookups);
+
+  hb_codepoint_t glyph = HB_SET_VALUE_INVALID;
+  while (hb_set_next(glyphs, &glyph)) {
+    if (glyph < keep->size()) (*keep)[glyph] = true;
+  }
+  hb_set_destroy(glyphs);
+}
+
+// A parsed CFF INDEX.
+struct CffIndex {
+  uint32_t start;
+  uint32_t end;
+  std::vector<uint32_t> offsets;
+
+  uint32_t get_count() const {
+    return offsets.empty() ? 0 : static_cast<uint32_t>(offsets.size() - 1);
+  }
+};
+
+static bool ParseCffIndex(const std::string &cff, uint32_t start,
+                          CffIndex *index) {
+  index->start = start;
+  index->offsets.clear();
+  if (start + 2 > cff.size()) return false;
+  auto count = ReadU16(cff, start);
+  if (!count) {
+    index->end = start + 2;
+    return true;
+  }
+  if (start + 3 > cff.size()) return false;
+  uint32_t offset_size = static_cast<uint8_t>(cff[start + 2]);
+  auto offsets = start + 3;
+  if (offset_size < 1 || offset_size > 4 ||
+      offsets + (count + 1) * offset_size > cff.size()) {
+    return false;
+  }
+  // Offsets are relative to the byte preceding the data.
+  auto data = offsets + (count + 1) * offset_size - 1;
+  for (uint32_t i = 0; i <= count; ++i) {
+    auto offset = data + ReadOffset(cff, offsets + i * offset_size,
+                                    offset_size);
+    if (offset > cff.size()) return false;
+    index->offsets.push_back(offset);
+  }
+  index->end = index->offsets.back();
+  return true;
+}
+
+static std::string WriteCffIndex(const std::vector<std::string> &entries) {
+  std::string index;
+  AppendU16(static_cast<uint32_t>(entries.size()), &index);
+  if (entries.empty()) return index;
+  uint32_t data_size = 0;
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    data_size += static_cast<uint32_t>(it->size());
+  }
+  uint32_t offset_size = 1;
+  while (offset_size < 4 && (data_size + 1) >> (offset_size * 8)) {
+    offset_size++;
+  }
+  index.push_back(static_cast<char>(offset_size));
+  uint32_t offset = 1;
+  for (size_t i = 0; i <= entries.size(); ++i) {
+    for (uint32_t j = offset_size; j > 0; --j) {
+      index.push_back(static_cast<char>(offset >> ((j - 1) * 8)));
+    }
+    if (i < entries.size()) offset += static_cast<uint32_t>(entries[i].size());
+  }
+  for (auto it = entries.begin(); it != entries.end(); ++it) {
+    index.append(*it);
+  }
+  return index;
+}
+
+// An integer operand of a CFF DICT, and where it's encoded.
+struct CffOperand {
+  int32_t value;
+  uint32_t position;
+  uint32_t size;
+};
+
+// Parse the integer operands of a CFF DICT, keyed by operator. Escaped
+// operators are keyed by 1200 + their second byte. Real operands are
+// skipped.
+static bool ParseCffDict(const std::string &cff, uint32_t start, uint32_t end,
+                         std::map<int32_t, std::vector<CffOperand>> *dict) {
+  std::vector<CffOperand> operands;
+  for (auto i = start; i < end;) {
+    auto b0 = static_cast<uint8_t>(cff[i]);
+    CffOperand operand;
+    operand.position = i;
+    if (b0 <= 21) {
+      auto op = static_cast<int32_t>(b0);
+      if (b0 == 12) {
+        if (i + 1 >= end) return false;
+        op = 1200 + static_cast<uint8_t>(cff[i + 1]);
+        i++;
+      }
+      i++;
+      (*dict)[op] = operands;
+      operands.clear();
+      continue;
+    } else if (b0 == 28) {
+      if (i + 3 > end) return false;
+      operand.value = static_cast<int16_t>(ReadU16(cff, i + 1));
+      operand.size = 3;
+    } else if (b0 == 29) {
+      if (i + 5 > end) return false;
+      operand.value = static_cast<int32_t>(ReadU32(cff, i + 1));
+      operand.size = 5;
+    } else if (b0 == 30) {
+      // A real, made of nibbles up to a 0xf nibble.
+      auto j = i + 1;
+      while (j < end && (cff[j] & 0x0f) != 0x0f && (cff[j] & 0xf0) != 0xf0) {
+        j++;
+      }
+      if (j >= end) return false;
+      operand.value = 0;
+      operand.size = j + 1 - i;
+    } else if (b0 >= 32 && b0 <= 246) {
+      operand.value = b0 - 139;
+      operand.size = 1;
+    } else if (b0 >= 247 && b0 <= 254) {
+      if (i + 2 > end) return false;
+      auto b1 = static_cast<uint8_t>(cff[i + 1]);
+      operand.value = b0 <= 250 ? (b0 - 247) * 256 + b1 + 108
+                                : -(b0 - 251) * 256 - b1 - 108;
+      operand.size = 2;
+    } else {
+      return false;
+    }
+    i += operand.size;
+    operands.push_back(operand);
+  }
+  return true;
+}
+
+// Re-encode an operand in place, with the same number of bytes, so that the
+// structures following it don't move.
+static bool PatchCffOperand(const CffOperand &operand, int32_t value,
+                            std::string *cff) {
+  auto position = operand.position;
+  switch (operand.size) {
+    case 1:
+      if (value < -107 || value > 107) return false;
+      (*cff)[position] = static_cast<char>(value + 139);
+      return true;
+    case 2:
+      if (value >= 108 && value <= 1131) {
+        (*cff)[position] = static_cast<char>((value - 108) / 256 + 247);
+        (*cff)[position + 1] = static_cast<char>((value - 108) % 256);
+        return true;
+      }
+      if (value >= -1131 && value <= -108) {
+        (*cff)[position] = static_cast<char>((-value - 108) / 256 + 251);
+        (*cff)[position + 1] = static_cast<char>((-value - 108) % 256);
+        return true;
+      }
+      return false;
+    case 3:
+      if (value < -32768 || value > 32767) return false;
+      WriteU16(static_cast<uint16_t>(value), position + 1, cff);
+      return true;
+    case 5:
+      WriteU32(static_cast<uint32_t>(value), position + 1, cff);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Move the offset operand `index` of an operator by `delta` if it points
+// after `threshold`.
+static bool ShiftCffOffset(
+    const std::map<int32_t, std::vector<CffOperand>> &dict, int32_t op,
+    size_t index, int32_t minimum, uint32_t threshold, int32_t delta,
+    std::string *cff) {
+  auto it = dict.find(op);
+  if (it == dict.end()) return true;
+  if (index >= it->second.size()) return false;
+  auto &operand = it->second[index];
+  if (operand.value < minimum || static_cast<uint32_t>(operand.value) <
+                                     threshold) {
+    return true;
+  }
+  return PatchCffOperand(operand, operand.value - delta, cff);
+}
+
+// Empty the CharStrings of the glyphs that aren't kept. The CharStrings
+// INDEX is rewritten in place, and the offsets of the structures following it
+// are moved.
+static bool SubsetCff(const std::vector<bool> &keep, std::string *cff) {
+  auto &data = *cff;
+  if (data.size() < 4 || data[0] != 1) return false;
+  CffIndex names, top_dicts;
+  if (!ParseCffIndex(data, static_cast<uint8_t>(data[2]), &names) ||
+      !ParseCffIndex(data, names.end, &top_dicts) ||
+      top_dicts.get_count() != 1) {
+    return false;
+  }
+  std::map<int32_t, std::vector<CffOperand>> top_dict;
+  if (!ParseCffDict(data, top_dicts.offsets[0], top_dicts.offsets[1],
+                    &top_dict)) {
+    return false;
+  }
+  auto char_strings_operands = top_dict.find(17);
+  if (char_strings_operands == top_dict.end() ||
+      char_strings_operands->second.size() != 1) {
+    return false;
+  }
+  CffIndex char_strings;
+  if (!ParseCffIndex(data, char_strings_operands->second[0].value,
+                     &char_strings) ||
+      char_strings.get_count() != keep.size()) {
+    return false;
+  }
+
+  std::vector<std::string> outlines(keep.size());
+  for (size_t i = 0; i < keep.size(); ++i) {
+    if (keep[i]) {
+      auto start = char_strings.offsets[i];
+      outlines[i] = data.substr(start, char_strings.offsets[i + 1] - start);
+    } else {
+      outlines[i].assign(1, kEmptyCharString);
+    }
+  }
+  auto index = WriteCffIndex(outlines);
+  auto delta =
+      static_cast<int32_t>(char_strings.end - char_strings.start) -
+      static_cast<int32_t>(index.size());
+  auto threshold = char_strings.end;
+  data = data.substr(0, char_strings.start) + index +
+         data.substr(char_strings.end);
+
+  // Offsets of the Top DICT: charset, Encoding, Private, FDArray, FDSelect.
+  // The Top DICT precedes the CharStrings, it doesn't move.
+  if (!ShiftCffOffset(top_dict, 15, 0, 3, threshold, delta, cff) ||
+      !ShiftCffOffset(top_dict, 16, 0, 2, threshold, delta, cff) ||
+      !ShiftCffOffset(top_dict, 18, 1, 0, threshold, delta, cff) ||
+      !ShiftCffOffset(top_dict, 1236, 0, 0, threshold, delta, cff) ||
+      !ShiftCffOffset(top_dict, 1237, 0, 0, threshold, delta, cff)) {
+    return false;
+  }
+
+  // Private DICTs of CID-keyed fonts, referenced by the Font DICTs of the
+  // FDArray.
+  auto fd_array = top_dict.find(1236);
+  if (fd_array != top_dict.end()) {
+    auto fd_array_offset = static_cast<uint32_t>(fd_array->second[0].value);
+    if (fd_array_offset >= threshold) fd_array_offset -= delta;
+    CffIndex font_dicts;
+    if (!ParseCffIndex(data, fd_array_offset, &font_dicts)) return false;
+    for (uint32_t i = 0; i < font_dicts.get_count(); ++i) {
+      std::map<int32_t, std::vector<CffOperand>> font_dict;
+      if (!ParseCffDict(data, font_dicts.offsets[i], font_dicts.offsets[i + 1],
+                        &font_dict) ||
+          !ShiftCffOffset(font_dict, 18, 1, 0, threshold, delta, cff)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Outline data of a TrueType glyph.
+static bool GetGlyfRange(const std::string &loca, bool long_offsets,
+                         uint32_t glyph, uint32_t *start, uint32_t *end) {
+  auto size = long_offsets ? 4 : 2;
+  if ((glyph + 2) * size > loca.size()) return false;
+  *start = long_offsets ? ReadU32(loca, glyph * 4)
+                        : ReadU16(loca, glyph * 2) * 2u;
+  *end = long_offsets ? ReadU32(loca, glyph * 4 + 4)
+                      : ReadU16(loca, glyph * 2 + 2) * 2u;
+  return *start <= *end;
+}
+
+// Keep the components of the composite glyphs that are kept.
+static void CloseComposites(const std::string &glyf, const std::string &loca,
+                            bool long_offsets, std::vector<bool> *keep) {
+  // Flags of composite glyph components.
+  static const uint16_t kArgsAreWords = 0x0001;
+  static const uint16_t kHaveScale = 0x0008;
+  static const uint16_t kMoreComponents = 0x0020;
+  static const uint16_t kHaveXYScale = 0x0040;
+  static const uint16_t kHaveTwoByTwo = 0x0080;
+
+  std::vector<uint32_t> pending;
+  for (uint32_t i = 0; i < keep->size(); ++i) {
+    if ((*keep)[i]) pending.push_back(i);
+  }
+  while (!pending.empty()) {
+    auto glyph = pending.back();
+    pending.pop_back();
+    uint32_t start, end;
+    if (!GetGlyfRange(loca, long_offsets, glyph, &start, &end) ||
+        end - start < 10 || end > glyf.size() ||
+        static_cast<int16_t>(ReadU16(glyf, start)) >= 0) {
+      continue;
+    }
+    uint16_t flags = kMoreComponents;
+    for (auto i = start + 10; flags & kMoreComponents && i + 4 <= end;) {
+      flags = ReadU16(glyf, i);
+      auto component = ReadU16(glyf, i + 2);
+      if (component < keep->size() && !(*keep)[component]) {
+        (*keep)[component] = true;
+        pending.push_back(component);
+      }
+      i += 4 + (flags & kArgsAreWords ? 4 : 2);
+      i += flags & kHaveScale ? 2 : flags & kHaveXYScale
+                                        ? 4
+                                        : flags & kHaveTwoByTwo ? 8 : 0;
+    }
+  }
+}
+
+// Empty the glyf entries of the glyphs that aren't kept.
+static bool SubsetGlyf(const std::vector<bool> &keep, bool long_offsets,
+                       std::string *glyf, std::string *loca) {
+  std::string subset_glyf, subset_loca;
+  for (uint32_t i = 0; i <= keep.size(); ++i) {
+    auto offset = static_cast<uint32_t>(subset_glyf.size());
+    if (long_offsets) {
+      AppendU32(offset, &subset_loca);
+    } else {
+      AppendU16(offset / 2, &subset_loca);
+    }
+    if (i == keep.size() || !keep[i]) continue;
+    uint32_t start, end;
+    if (!GetGlyfRange(*loca, long_offsets, i, &start, &end) ||
+        end > glyf->size()) {
+      return false;
+    }
+    subset_glyf.append(*glyf, start, end - start);
+    if (!long_offsets && subset_glyf.size() % 2) subset_glyf.push_back(0);
+  }
+  glyf->swap(subset_glyf);
+  loca->swap(subset_loca);
+  return true;
+}
+
+// Subset a font to the glyphs needed by the texts.
+static bool SubsetFont(const std::string &font,
+                       const std::vector<std::string> &texts,
+                       std::string *subset, uint32_t *glyph_count,
+                       uint32_t *kept_count) {
+  uint32_t version;
+  std::vector<SfntTable> tables;
+  if (!ParseSfnt(font, &version, &tables)) {
+    fprintf(stderr, "Not an OpenType font\n");
+    return false;
+  }
+  auto maxp = FindTable(&tables, kTagMaxp);
+  auto head = FindTable(&tables, kTagHead);
+  if (maxp == nullptr || maxp->data.size() < 6 || head == nullptr ||
+      head->data.size() < 54) {
+    fprintf(stderr, "Missing maxp or head table\n");
+    return false;
+  }
+  *glyph_count = ReadU16(maxp->data, 4);
+
+  // Collect the glyphs with HarfBuzz, on a face created like the faces of
+  // FontManager.
+  std::vector<bool> keep(*glyph_count, false);
+  FT_Library library;
+  FT_Init_FreeType(&library);
+  FT_Face face;
+  if (FT_New_Memory_Face(library,
+                         reinterpret_cast<const FT_Byte *>(font.data()),
+                         static_cast<FT_Long>(font.size()), 0, &face)) {
+    fprintf(stderr, "Can't open the font with FreeType\n");
+    FT_Done_FreeType(library);
+    return false;
+  }
+  auto harfbuzz_font = hb_ft_font_create(face, nullptr);
+  CollectGlyphs(harfbuzz_font, texts, &keep);
+  hb_font_destroy(harfbuzz_font);
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+
+  auto cff = FindTable(&tables, kTagCff);
+  auto glyf = FindTable(&tables, kTagGlyf);
+  auto loca = FindTable(&tables, kTagLoca);
+  if (glyf != nullptr && loca != nullptr) {
+    auto long_offsets = ReadU16(head->data, 50) != 0;
+    CloseComposites(glyf->data, loca->data, long_offsets, &keep);
+    if (!SubsetGlyf(keep, long_offsets, &glyf->data, &loca->data)) {
+      fprintf(stderr, "Invalid glyf table\n");
+      return false;
+    }
+  } else if (cff != nullptr) {
+    if (!SubsetCff(keep, &cff->data)) {
+      fprintf(stderr, "Unsupported CFF table\n");
+      return false;
+    }
+  } else {
+    fprintf(stderr, "No glyf or CFF outlines\n");
+    return false;
+  }
+  *kept_count = static_cast<uint32_t>(std::count(keep.begin(), keep.end(),
+                                                 true));
+
+  // The signature of the full font doesn't hold for the subset.
+  tables.erase(std::remove_if(tables.begin(), tables.end(),
+                              [](const SfntTable &table) {
+                                return table.tag == kTagDsig;
+                              }),
+               tables.end());
+  *subset = WriteSfnt(version, tables);
+  return true;
+}
+
+// Compare the outlines of the glyphs of the subset with the full font's.
+// Emptied glyphs have no points.
+static bool OutlinesMatch(const std::string &font, const std::string &subset) {
+  FT_Library library;
+  FT_Init_FreeType(&library);
+  FT_Face faces[2] = {nullptr, nullptr};
+  const std::string *data[2] = {&font, &subset};
+  bool matches = true;
+  for (int i = 0; i < 2 && matches; ++i) {
+    matches = !FT_New_Memory_Face(
+        library, reinterpret_cast<const FT_Byte *>(data[i]->data()),
+        static_cast<FT_Long>(data[i]->size()), 0, &faces[i]);
+  }
+  for (FT_Long glyph = 0; matches && glyph < faces[0]->num_glyphs; ++glyph) {
+    FT_Outline outlines[2];
+    for (int i = 0; i < 2 && matches; ++i) {
+      matches = !FT_Load_Glyph(faces[i], static_cast<FT_UInt>(glyph),
+                               FT_LOAD_NO_SCALE | FT_LOAD_NO_HINTING);
+      outlines[i] = faces[i]->glyph->outline;
+    }
+    if (!matches || outlines[1].n_points == 0) continue;
+    auto &a = outlines[0];
+    auto &b = outlines[1];
+    matches =
+        a.n_points == b.n_points && a.n_contours == b.n_contours &&
+        !memcmp(a.points, b.points, a.n_points * sizeof(FT_Vector)) &&
+        !memcmp(a.tags, b.tags, a.n_points) &&
+        !memcmp(a.contours, b.contours, a.n_contours * sizeof(*a.contours));
+    if (!matches) fprintf(stderr, "Outline of glyph %ld differs\n", glyph);
+  }
+  for (int i = 0; i < 2; ++i) {
+    if (faces[i] != nullptr) FT_Done_Face(faces[i]);
+  }
+  FT_Done_FreeType(library);
+  return matches;
+}
+
+// Check that a string is laid out the same with both fonts.
+static bool LayoutsMatch(FontManager *font_manager, FontManager *subset_manager,
+                         const CorpusString &string, int32_t size,
+                         int32_t width) {
+  FontManager *managers[2] = {font_manager, subset_manager};
+  FontBuffer *buffers[2];
+  for (int i = 0; i < 2; ++i) {
+    managers[i]->SetLocale(string.locale.c_str());
+    FontBufferParameters parameters(
+        managers[i]->GetCurrentFace()->font_id_,
+        flatui::HashId(string.text.c_str()), static_cast<float>(size),
+        vec2i(width, width ? 0 : size));
+    managers[i]->StartLayoutPass();
+    buffers[i] = managers[i]->GetBuffer(string.text.c_str(),
+                                        string.text.size(), parameters);
+    if (buffers[i] == nullptr) return false;
+  }
+  auto a = buffers[0];
+  auto b = buffers[1];
+  if (a->get_glyph_count() != b->get_glyph_count() ||
+      a->get_size() != b->get_size() ||
+      a->get_line_count() != b->get_line_count() ||
+      a->GetCaretPositionCount() != b->GetCaretPositionCount()) {
+    return false;
+  }
+  for (size_t i = 0; i < a->get_glyph_count(); ++i) {
+    if (a->get_code_points()[i] != b->get_code_points()[i]) return false;
+  }
+  for (size_t i = 0; i < a->get_vertex_count(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (a->get_vertices()[i].position_.data[j] !=
+          b->get_vertices()[i].position_.data[j]) {
+        return false;
+      }
+    }
+  }
+  for (size_t i = 0; i < a->get_line_count(); ++i) {
+    if (a->get_line_starts()[i] != b->get_line_starts()[i]) return false;
+  }
+  for (size_t i = 0; i < a->GetCaretPositionCount(); ++i) {
+    if (a->GetCaretPosition(i) != b->GetCaretPosition(i)) return false;
+  }
+  return true;
+}
+
+static double MilliSeconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+// Open a font in a new FontManager, returning the time it took.
+static double OpenFont(const std::string &file_name,
+                       std::unique_ptr<FontManager> *font_manager) {
+  font_manager->reset(new FontManager(vec2i(kCacheSize, kCacheSize)));
+  auto start = std::chrono::steady_clock::now();
+  if (!(*font_manager)->Open(file_name.c_str())) return -1.0;
+  return MilliSeconds(std::chrono::steady_clock::now() - start);
+}
+
+int main(int argc, char **argv) {
+  std::map<std::string, std::vector<CorpusString>> fonts;
+  std::string output;
+  std::string keep;
+  int32_t size = 32;
+  int32_t width = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-c" || arg == "--corpus") {
+      if (!LoadCorpus(value, &fonts)) return 1;
+    } else if (arg == "-o" || arg == "--output") {
+      output = value;
+    } else if (arg == "-k" || arg == "--keep") {
+      keep = value;
+    } else if (arg == "-s" || arg == "--size") {
+      size = std::max(atoi(value), 1);
+    } else if (arg == "-w" || arg == "--width") {
+      width = std::max(atoi(value), 0);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (fonts.empty() || output.empty()) {
+    PrintUsage();
+    return 1;
+  }
+
+  bool failed = false;
+  printf("%-40s %8s %8s %10s %10s %9s %9s\n", "font", "glyphs", "kept",
+         "bytes", "subset", "open ms", "subset");
+  for (auto it = fonts.begin(); it != fonts.end(); ++it) {
+    auto &file_name = it->first;
+    std::string font;
+    if (!fplbase::LoadFile(file_name.c_str(), &font)) {
+      fprintf(stderr, "Can't load %s\n", file_name.c_str());
+      failed = true;
+      continue;
+    }
+    std::vector<std::string> texts(1, keep);
+    for (auto string = it->second.begin(); string != it->second.end();
+         ++string) {
+      texts.push_back(string->text);
+    }
+    std::string subset;
+    uint32_t glyph_count, kept_count;
+    if (!SubsetFont(font, texts, &subset, &glyph_count, &kept_count)) {
+      fprintf(stderr, "Can't subset %s\n", file_name.c_str());
+      failed = true;
+      continue;
+    }
+
+    auto separator = file_name.find_last_of("/\\");
+    auto subset_name =
+        output + "/" + (separator == std::string::npos
+                            ? file_name
+                            : file_name.substr(separator + 1));
+    auto file = fopen(subset_name.c_str(), "wb");
+    if (file == nullptr ||
+        fwrite(subset.data(), 1, subset.size(), file) != subset.size()) {
+      fprintf(stderr, "Can't write %s\n", subset_name.c_str());
+      if (file != nullptr) fclose(file);
+      failed = true;
+      continue;
+    }
+    fclose(file);
+
+    // Verify the subset.
+    if (!OutlinesMatch(font, subset)) {
+      fprintf(stderr, "Outlines of %s differ\n", subset_name.c_str());
+      failed = true;
+    }
+    std::unique_ptr<FontManager> font_manager, subset_manager;
+    auto open_ms = OpenFont(file_name, &font_manager);
+    auto subset_open_ms = OpenFont(subset_name, &subset_manager);
+    if (open_ms < 0.0 || subset_open_ms < 0.0) {
+      fprintf(stderr, "Can't open %s\n", subset_name.c_str());
+      failed = true;
+      continue;
+    }
+    for (auto string = it->second.begin(); string != it->second.end();
+         ++string) {
+      if (!LayoutsMatch(font_manager.get(), subset_manager.get(), *string,
+                        size, width)) {
+        fprintf(stderr, "Layout of '%s' (%s) differs with %s\n",
+                string->text.c_str(), string->locale.c_str(),
+                subset_name.c_str());
+        failed = true;
+      }
+    }
+    printf("%-40s %8u %8u %10u %10u %9.2f %9.2f\n", file_name.c_str(),
+           glyph_count, kept_count, static_cast<uint32_t>(font.size()),
+           static_cast<uint32_t>(subset.size()), open_ms, subset_open_ms);
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,221 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// flatui_input_replay replays recorded pointer samples against a simulated
+// frame clock, and measures how closely drags follow the pointer.
+//
+// Each frame gets the samples received since the previous frame, and is
+// displayed a given latency after it starts. The dragged position a frame
+// shows is compared to where the pointer actually is at its display time, for
+// two ways of consuming the input:
+// - snapshot: the latest sample, like the single position per frame of the
+//   InputSystem.
+// - predicted: the position PredictPointerPosition() extrapolates to the
+//   display time, which SetPointerSamples() makes drags use.
+//
+// The effective latency of a frame is its error divided by the pointer speed.
+//
+// Recordings are text files with a "<seconds> <x> <y>" sample per line, lines
+// starting with '#' are ignored. Without a recording, a synthetic drag
+// sampled at 240Hz is replayed.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "flatui/flatui.h"
+
+using flatui::PointerSample;
+using mathfu::vec2;
+using mathfu::vec2i;
+
+// Frames where the pointer moves slower than this (pixels per second) are
+// left out of the latency figures.
+static const double kMinimumSpeed = 50.0;
+
+// Synthetic drag: back and forth strokes over 800 pixels, sampled at 240Hz.
+static const double kSyntheticDuration = 4.0;
+static const double kSyntheticStroke = 0.4;
+static const double kSyntheticDistance = 800.0;
+static const double kSyntheticRate = 240.0;
+static const double kPi = 3.14159265358979323846;
+
+// Error statistics of one way of consuming the input.
+struct Stats {
+  Stats() : frames(0), error(0.0), max_error(0.0), latency(0.0) {}
+  void Add(double frame_error, double speed) {
+    frames++;
+    error += frame_error;
+    max_error = std::max(max_error, frame_error);
+    latency += frame_error / speed;
+  }
+  void Print(const char *name) const {
+    if (!frames) return;
+    printf("%-10s %8.2f %10.2f %15.2f\n", name, error / frames, max_error,
+           latency / frames * 1000.0);
+  }
+  int frames;
+  double error;
+  double max_error;
+  double latency;
+};
+
+static void PrintUsage() {
+  printf(
+      "Usage: flatui_input_replay [options] [recording]\n"
+      "Options:\n"
+      "  -r, --rate <hz>          Frame rate (default: 60).\n"
+      "  -l, --latency <ms>       Time from the start of a frame to its\n"
+      "                           display (default: one frame).\n");
+}
+
+static bool LoadRecording(const char *file_name,
+                          std::vector<PointerSample> *samples) {
+  auto file = fopen(file_name, "r");
+  if (!file) return false;
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#') continue;
+    double time, x, y;
+    if (sscanf(line, "%lf %lf %lf", &time, &x, &y) != 3) continue;
+    PointerSample sample;
+    sample.position = vec2i(static_cast<int>(x), static_cast<int>(y));
+    sample.time = time;
+    samples->push_back(sample);
+  }
+  fclose(file);
+  return true;
+}
+
+static double SyntheticPosition(double time) {
+  auto stroke = static_cast<int>(time / kSyntheticStroke);
+  auto phase = (time - stroke * kSyntheticStroke) / kSyntheticStroke;
+  auto eased = (1.0 - cos(phase * kPi)) / 2.0;
+  return kSyntheticDistance * (stroke % 2 ? 1.0 - eased : eased);
+}
+
+static void SynthesizeRecording(std::vector<PointerSample> *samples) {
+  auto count = static_cast<int>(kSyntheticDuration * kSyntheticRate);
+  for (int i = 0; i < count; ++i) {
+    PointerSample sample;
+    sample.time = i / kSyntheticRate;
+    sample.position = vec2i(
+        100, static_cast<int>(SyntheticPosition(sample.time) + 0.5) + 100);
+    samples->push_back(sample);
+  }
+}
+
+// Position of the pointer at a given time, interpolated between samples.
+static vec2 Interpolate(const std::vector<PointerSample> &samples,
+                        double time) {
+  auto it = std::lower_bound(samples.begin(), samples.end(), time,
+                             [](const PointerSample &sample, double t) {
+                               return sample.time < t;
+                             });
+  if (it == samples.begin()) return vec2(it->position);
+  if (it == samples.end()) return vec2(samples.back().position);
+  auto &prev = *(it - 1);
+  auto t = static_cast<float>((time - prev.time) / (it->time - prev.time));
+  return vec2(prev.position) + vec2(it->position - prev.position) * t;
+}
+
+int main(int argc, char **argv) {
+  std::string recording;
+  double rate = 60.0;
+  double latency = -1.0;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (arg[0] != '-') {
+      recording = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-r" || arg == "--rate") {
+      rate = std::max(atof(value), 1.0);
+    } else if (arg == "-l" || arg == "--latency") {
+      latency = std::max(atof(value), 0.0) / 1000.0;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (latency < 0.0) latency = 1.0 / rate;
+
+  std::vector<PointerSample> samples;
+  if (recording.empty()) {
+    SynthesizeRecording(&samples);
+  } else if (!LoadRecording(recording.c_str(), &samples)) {
+    fprintf(stderr, "Can't load recording %s\n", recording.c_str());
+    return 1;
+  }
+  if (samples.size() < 2) {
+    fprintf(stderr, "The recording needs at least 2 samples\n");
+    return 1;
+  }
+
+  // Replay the samples frame by frame.
+  Stats snapshot_stats, predicted_stats;
+  auto start = samples.front().time;
+  auto end = samples.back().time;
+  size_t first = 0;
+  for (int frame = 1;; ++frame) {
+    auto frame_time = start + frame / rate;
+    if (frame_time + latency > end) break;
+
+    // Samples received since the previous frame.
+    auto last = first;
+    while (last < samples.size() && samples[last].time <= frame_time) last++;
+    if (last == first) continue;
+    auto display_time = frame_time + latency;
+
+    auto snapshot = vec2(samples[last - 1].position);
+    auto predicted = flatui::PredictPointerPosition(
+        &samples[first], last - first, display_time);
+    first = last;
+
+    // Where the pointer is when the frame is displayed.
+    auto actual = Interpolate(samples, display_time);
+    auto speed = (Interpolate(samples, display_time + 0.001) -
+                  Interpolate(samples, display_time - 0.001)).Length() /
+                 0.002;
+    if (speed < kMinimumSpeed) continue;
+    snapshot_stats.Add((snapshot - actual).Length(), speed);
+    predicted_stats.Add((vec2(vec2i(predicted + 0.5f)) - actual).Length(),
+                        speed);
+  }
+
+  printf("%d samples over %.2fs, %.0fHz frames displayed after %.1fms\n",
+         static_cast<int>(samples.size()), end - start, rate,
+         latency * 1000.0);
+  printf("%d frames with the pointer moving\n", snapshot_stats.frames);
+  printf("%-10s %8s %10s %15s\n", "", "error", "max error",
+         "latency (ms)");
+  snapshot_stats.Print("snapshot");
+  predicted_stats.Print("predicted");
+  return 0;
+}
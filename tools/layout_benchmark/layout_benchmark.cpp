@@ -0,0 +1,623 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// flatui_layout_benchmark measures FontManager layout performance per script.
+//
+// The corpus lists sample strings with the locale and the font they are laid
+// out with. The locale is applied with FontManager::SetLocale(), so the script
+// and layout direction come from the script table the same way as at runtime.
+// For each string, the benchmark measures:
+// - cold GetBuffer() latency, with empty layout and glyph caches,
+// - warm GetBuffer() latency, hitting the FontBuffer cache,
+// - glyphs rasterized and glyph cache bytes used by the cold layout,
+// - FontBuffer storage bytes,
+// - layouts while the box grows a pixel at a time, like an animated panel.
+//   Box sizes that don't change the line breaks reuse the layout.
+// For each group, it also measures the latency of appending a line to a log
+// made of the group's strings, which resumes the layout of the previous log,
+// and the cold latency of a large document made of them, laid out serially and
+// in paragraphs on a thread pool. The two layouts are checked to match.
+// Finally, it counts the bytes sent to the driver per frame to render the
+// group's strings, streamed from client arrays and with retained meshes,
+// using a stand-in mesh factory.
+// Results are written as JSON, so that they can be checked against per-script
+// budgets.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flatui/font_manager.h"
+#include "flatui/internal/glyph_cache.h"
+#include "flatui/task_scheduler.h"
+#include "fplbase/utilities.h"
+
+using flatui::FontBufferParameters;
+using flatui::FontManager;
+using flatui::GlyphCacheEntry;
+using flatui::GlyphKey;
+using flatui::TextCost;
+using mathfu::vec2i;
+
+// Size of the glyph cache. Large enough that the cold layout of a string never
+// flushes it.
+static const int32_t kCacheSize = 2048;
+
+// Number of box widths the resize measurement steps through.
+static const int32_t kResizeSteps = 64;
+
+// Size of the log before the appends are timed, in bytes, and number of timed
+// appends. The log has more glyphs than a FontBuffer renders in one batch.
+// Texts that don't fit a single line wrap in a box of kLogWidth pixels when no
+// width is given.
+static const size_t kLogBytes = 64 * 1024;
+static const int kLogAppends = 64;
+static const int32_t kLogWidth = 1024;
+
+// Size of the document, in bytes. It's laid out in a box of kLogWidth pixels
+// as well.
+static const size_t kDocumentBytes = 1024 * 1024;
+
+// Frames the uploads are counted over. The first one uploads the meshes.
+static const int kUploadFrames = 16;
+
+// Sample strings sharing a locale and a font.
+struct CorpusGroup {
+  std::string locale;
+  std::string font;
+  std::vector<std::string> texts;
+};
+
+// Measurements of a string.
+struct TextResult {
+  TextResult()
+      : glyphs(0),
+        cold_us(0.0),
+        warm_us(0.0),
+        warm_min_us(0.0),
+        glyphs_rasterized(0),
+        atlas_bytes(0),
+        buffer_bytes(0),
+        resize_layouts(0) {}
+
+  std::string text;
+  size_t glyphs;
+  double cold_us;
+  double warm_us;
+  double warm_min_us;
+  uint32_t glyphs_rasterized;
+  size_t atlas_bytes;
+  size_t buffer_bytes;
+  uint32_t resize_layouts;
+};
+
+static void PrintUsage() {
+  printf(
+      "Usage: flatui_layout_benchmark [options] -c <corpus.tsv>\n"
+      "Options:\n"
+      "  -c, --corpus <file>      Corpus file. Each line is\n"
+      "                           <locale> TAB <font file> TAB <text>.\n"
+      "                           Lines starting with # are ignored.\n"
+      "  -s, --size <pixels>      Font size (default: 32).\n"
+      "  -w, --width <pixels>     Width of the layout box. 0 lays out texts\n"
+      "                           in a single line (default: 0).\n"
+      "  -n, --iterations <count> Warm GetBuffer() calls per string\n"
+      "                           (default: 100).\n"
+      "  -o, --output <file>      JSON file to write (default: stdout).\n");
+}
+
+// Load the corpus, grouping consecutive lines with the same locale and font.
+static bool LoadCorpus(const char *file_name,
+                       std::vector<CorpusGroup> *groups) {
+  std::string data;
+  if (!fplbase::LoadFile(file_name, &data)) {
+    fprintf(stderr, "Can't load %s\n", file_name);
+    return false;
+  }
+  size_t start = 0;
+  int line_number = 0;
+  while (start < data.size()) {
+    auto end = data.find('\n', start);
+    if (end == std::string::npos) end = data.size();
+    auto line = data.substr(start, end - start);
+    start = end + 1;
+    line_number++;
+    if (!line.empty() && line[line.size() - 1] == '\r') {
+      line.erase(line.size() - 1);
+    }
+    if (line.empty() || line[0] == '#') continue;
+
+    auto locale_end = line.find('\t');
+    auto font_end = locale_end == std::string::npos
+                        ? std::string::npos
+                        : line.find('\t', locale_end + 1);
+    if (font_end == std::string::npos) {
+      fprintf(stderr, "%s:%d: expected <locale> TAB <font> TAB <text>\n",
+              file_name, line_number);
+      return false;
+    }
+    auto locale = line.substr(0, locale_end);
+    auto font = line.substr(locale_end + 1, font_end - locale_end - 1);
+    if (groups->empty() || groups->back().locale != locale ||
+        groups->back().font != font) {
+      CorpusGroup group;
+      group.locale = locale;
+      group.font = font;
+      groups->push_back(group);
+    }
+    groups->back().texts.push_back(line.substr(font_end + 1));
+  }
+  return true;
+}
+
+static double MicroSeconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// Bytes of the glyph images in the glyph cache.
+static size_t GlyphCacheBytes(const FontManager &font_manager) {
+  size_t bytes = 0;
+  font_manager.GetGlyphCache()->Enumerate(
+      [&bytes](const GlyphKey &, const GlyphCacheEntry &entry, const vec2i &) {
+        bytes += entry.get_size().x() * entry.get_size().y();
+      });
+  return bytes;
+}
+
+static bool MeasureText(FontManager *font_manager, const std::string &text,
+                        int32_t size, int32_t width, int iterations,
+                        TextResult *result) {
+  FontBufferParameters parameters(
+      font_manager->GetCurrentFace()->font_id_, flatui::HashId(text.c_str()),
+      static_cast<float>(size), vec2i(width, width ? 0 : size));
+
+  // Cold: empty layout and glyph caches.
+  font_manager->FlushLayout();
+  font_manager->FlushAndUpdate();
+  font_manager->StartLayoutPass();
+  font_manager->ResetCostReport();
+  auto start = std::chrono::steady_clock::now();
+  auto buffer =
+      font_manager->GetBuffer(text.c_str(), text.size(), parameters);
+  result->cold_us = MicroSeconds(std::chrono::steady_clock::now() - start);
+  if (buffer == nullptr) return false;
+
+  std::vector<TextCost> costs;
+  font_manager->GetCostReport(&costs);
+  result->text = text;
+  result->glyphs = buffer->get_glyph_count();
+  result->glyphs_rasterized = costs.empty() ? 0 : costs[0].glyphs_rasterized;
+  result->atlas_bytes = GlyphCacheBytes(*font_manager);
+  result->buffer_bytes = buffer->get_storage_size();
+
+  // Warm: FontBuffer cache hits.
+  double total = 0.0;
+  double min = 0.0;
+  for (int i = 0; i < iterations; ++i) {
+    start = std::chrono::steady_clock::now();
+    font_manager->GetBuffer(text.c_str(), text.size(), parameters);
+    auto elapsed = MicroSeconds(std::chrono::steady_clock::now() - start);
+    total += elapsed;
+    min = i ? std::min(min, elapsed) : elapsed;
+  }
+  result->warm_us = iterations ? total / iterations : 0.0;
+  result->warm_min_us = min;
+
+  // Resize: widen the box a pixel per request.
+  font_manager->ResetCostReport();
+  for (int32_t i = 1; i <= kResizeSteps; ++i) {
+    FontBufferParameters resized(
+        parameters.get_font_id(), parameters.get_text_id(),
+        parameters.get_font_size(),
+        vec2i(width + i, parameters.get_size().y()));
+    font_manager->GetBuffer(text.c_str(), text.size(), resized);
+  }
+  font_manager->GetCostReport(&costs);
+  for (auto it = costs.begin(); it != costs.end(); ++it) {
+    result->resize_layouts += it->layouts;
+  }
+  return true;
+}
+
+// Append a JSON string literal.
+static void AppendJsonString(const std::string &value, std::string *json) {
+  json->push_back('"');
+  for (auto it = value.begin(); it != value.end(); ++it) {
+    auto c = static_cast<unsigned char>(*it);
+    if (c == '"' || c == '\\') {
+      json->push_back('\\');
+      json->push_back(*it);
+    } else if (c < 0x20) {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      json->append(escaped);
+    } else {
+      json->push_back(*it);
+    }
+  }
+  json->push_back('"');
+}
+
+static void AppendJsonNumber(const char *name, double value, bool last,
+                             std::string *json) {
+  char number[64];
+  snprintf(number, sizeof(number), "\"%s\": %.3f%s", name, value,
+           last ? "" : ", ");
+  json->append(number);
+}
+
+// Stand-in of a renderer's mesh factory, counting the bytes uploaded. Like
+// renderers with 16 bit index buffers, it can't create meshes of more than
+// 65536 vertices.
+class CountingMeshFactory : public flatui::TextMeshFactory {
+ public:
+  CountingMeshFactory() : bytes(0) {}
+
+  virtual std::unique_ptr<flatui::TextMesh> CreateMesh(
+      const flatui::FontVertex * /*vertices*/, size_t vertex_count,
+      const uint16_t * /*indices*/, size_t index_count) {
+    if (vertex_count > 0x10000) return nullptr;
+    bytes += vertex_count * sizeof(flatui::FontVertex) +
+             index_count * sizeof(uint16_t);
+    return std::unique_ptr<flatui::TextMesh>(new Mesh(this));
+  }
+
+  size_t bytes;
+
+ private:
+  class Mesh : public flatui::TextMesh {
+   public:
+    explicit Mesh(CountingMeshFactory *factory) : factory_(factory) {}
+    virtual void Render(fplbase::Renderer & /*renderer*/) {}
+    virtual bool UpdateVertices(const flatui::FontVertex * /*vertices*/,
+                                size_t vertex_count) {
+      factory_->bytes += vertex_count * sizeof(flatui::FontVertex);
+      return true;
+    }
+
+   private:
+    CountingMeshFactory *factory_;
+  };
+};
+
+// Bytes sent to the driver per frame to render the strings of a group, once
+// their layouts are cached. `streamed` counts the vertices and indices sent
+// from client arrays, `uploaded` the bytes uploaded to retained meshes.
+static void MeasureUploads(FontManager *font_manager,
+                           const CorpusGroup &group, int32_t size,
+                           int32_t width, double *streamed,
+                           double *uploaded) {
+  font_manager->FlushLayout();
+  CountingMeshFactory factory;
+  size_t streamed_bytes = 0;
+  size_t uploaded_bytes = 0;
+  for (int frame = 0; frame < kUploadFrames; ++frame) {
+    font_manager->StartLayoutPass();
+    factory.bytes = 0;
+    for (auto text = group.texts.begin(); text != group.texts.end(); ++text) {
+      FontBufferParameters parameters(
+          font_manager->GetCurrentFace()->font_id_,
+          flatui::HashId(text->c_str()), static_cast<float>(size),
+          vec2i(width, width ? 0 : size));
+      auto buffer =
+          font_manager->GetBuffer(text->c_str(), text->size(), parameters);
+      if (buffer == nullptr) continue;
+      buffer->GetMesh(&factory);
+      if (frame) {
+        streamed_bytes += buffer->get_vertex_count() *
+                              sizeof(flatui::FontVertex) +
+                          buffer->get_index_count() * sizeof(uint16_t);
+      }
+    }
+    if (frame) uploaded_bytes += factory.bytes;
+  }
+  *streamed = static_cast<double>(streamed_bytes) / (kUploadFrames - 1);
+  *uploaded = static_cast<double>(uploaded_bytes) / (kUploadFrames - 1);
+  font_manager->FlushLayout();
+}
+
+// Average latency of appending a line to a log. `batches` receives the number
+// of draw calls the final log is rendered with.
+static double MeasureLog(FontManager *font_manager, const CorpusGroup &group,
+                         int32_t size, int32_t width, size_t *batches) {
+  font_manager->FlushLayout();
+  std::string log;
+  size_t line = 0;
+  while (log.size() < kLogBytes) {
+    log.append(group.texts[line++ % group.texts.size()]);
+    log.push_back('\n');
+  }
+  double total = 0.0;
+  const flatui::FontBuffer *buffer = nullptr;
+  for (int i = 0; i <= kLogAppends; ++i) {
+    if (i) {
+      log.append(group.texts[line++ % group.texts.size()]);
+      log.push_back('\n');
+    }
+    // An append per frame, the previous logs are dropped.
+    font_manager->StartLayoutPass();
+    FontBufferParameters parameters(
+        font_manager->GetCurrentFace()->font_id_, flatui::HashId(log.c_str()),
+        static_cast<float>(size), vec2i(width ? width : kLogWidth, 0));
+    auto start = std::chrono::steady_clock::now();
+    buffer = font_manager->GetBuffer(log.c_str(), log.size(), parameters);
+    if (buffer == nullptr) break;
+    // The first layout of the log isn't an append.
+    if (i) total += MicroSeconds(std::chrono::steady_clock::now() - start);
+  }
+  *batches = buffer != nullptr ? buffer->get_batch_count() : 0;
+  // The logs aren't used anymore.
+  font_manager->FlushLayout();
+  return buffer != nullptr ? total / kLogAppends : -1.0;
+}
+
+// Cold latency of laying out a document with a scheduler. A FontManager of its
+// own keeps the shaping results of the other layouts out. `vertices` receives
+// the glyph quads of the layout, and `batches` the number of draw calls it's
+// rendered with. The document is longer than 16 bit indices can address, its
+// mesh is created a batch at a time.
+static double MeasureDocument(const CorpusGroup &group,
+                              const std::string &document, int32_t size,
+                              int32_t width, flatui::TaskScheduler *scheduler,
+                              std::vector<flatui::FontVertex> *vertices,
+                              vec2i *layout_size, size_t *batches) {
+  FontManager font_manager(vec2i(kCacheSize, kCacheSize));
+  if (!font_manager.Open(group.font.c_str())) return -1.0;
+  font_manager.SetLocale(group.locale.c_str());
+  font_manager.SetTaskScheduler(scheduler);
+  FontBufferParameters parameters(
+      font_manager.GetCurrentFace()->font_id_,
+      flatui::HashId(document.c_str()), static_cast<float>(size),
+      vec2i(width ? width : kLogWidth, 0));
+  font_manager.StartLayoutPass();
+  auto start = std::chrono::steady_clock::now();
+  auto buffer =
+      font_manager.GetBuffer(document.c_str(), document.size(), parameters);
+  auto elapsed = MicroSeconds(std::chrono::steady_clock::now() - start);
+  if (buffer == nullptr) return -1.0;
+  auto count =
+      buffer->get_glyph_count() * flatui::FontBuffer::kVerticesPerCodePoint;
+  vertices->assign(buffer->get_vertices(), buffer->get_vertices() + count);
+  *layout_size = buffer->get_size();
+
+  // Every vertex is uploaded once, with the indices of each batch.
+  CountingMeshFactory factory;
+  if (buffer->GetMesh(&factory) == nullptr) return -1.0;
+  *batches = buffer->get_batch_count();
+  auto expected_bytes = count * sizeof(flatui::FontVertex);
+  for (size_t i = 0; i < *batches; ++i) {
+    expected_bytes += buffer->get_batch_index_count(i) * sizeof(uint16_t);
+  }
+  if (factory.bytes != expected_bytes) return -1.0;
+  return elapsed;
+}
+
+// Check that the paragraphs laid out in parallel are placed like the serial
+// layout places them.
+static bool LayoutsMatch(const std::vector<flatui::FontVertex> &serial,
+                         const std::vector<flatui::FontVertex> &parallel) {
+  if (serial.size() != parallel.size()) return false;
+  for (size_t i = 0; i < serial.size(); ++i) {
+    for (int j = 0; j < 3; ++j) {
+      if (std::abs(serial[i].position_.data[j] -
+                   parallel[i].position_.data[j]) > 0.01f) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  std::vector<CorpusGroup> groups;
+  int32_t size = 32;
+  int32_t width = 0;
+  int iterations = 100;
+  std::string output;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-c" || arg == "--corpus") {
+      if (!LoadCorpus(value, &groups)) return 1;
+    } else if (arg == "-s" || arg == "--size") {
+      size = std::max(atoi(value), 1);
+    } else if (arg == "-w" || arg == "--width") {
+      width = std::max(atoi(value), 0);
+    } else if (arg == "-n" || arg == "--iterations") {
+      iterations = std::max(atoi(value), 0);
+    } else if (arg == "-o" || arg == "--output") {
+      output = value;
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (groups.empty()) {
+    PrintUsage();
+    return 1;
+  }
+
+  std::string json;
+  char header[128];
+  snprintf(header, sizeof(header),
+           "{\n  \"size\": %d,\n  \"width\": %d,\n  \"iterations\": %d,\n"
+           "  \"groups\": [",
+           size, width, iterations);
+  json.append(header);
+
+  bool failed = false;
+  flatui::ThreadPoolScheduler thread_pool(0);
+  for (auto group = groups.begin(); group != groups.end(); ++group) {
+    json.append(group == groups.begin() ? "\n" : ",\n");
+    json.append("    {\"locale\": ");
+    AppendJsonString(group->locale, &json);
+    json.append(", \"font\": ");
+    AppendJsonString(group->font, &json);
+
+    // Each group gets its own FontManager, so that caches don't carry over.
+    std::unique_ptr<FontManager> font_manager(
+        new FontManager(vec2i(kCacheSize, kCacheSize)));
+    if (!font_manager->Open(group->font.c_str())) {
+      // Fonts of some scripts are not shipped with the assets.
+      fprintf(stderr, "Skipping %s: can't open font %s\n",
+              group->locale.c_str(), group->font.c_str());
+      json.append(", \"skipped\": true}");
+      continue;
+    }
+    font_manager->SetLocale(group->locale.c_str());
+    font_manager->EnableCostReport(true);
+
+    json.append(", \"language\": ");
+    AppendJsonString(font_manager->GetLanguage(), &json);
+    json.append(", \"direction\": ");
+    AppendJsonString(font_manager->GetLayoutDirection() ==
+                             flatui::TextLayoutDirectionRTL
+                         ? "rtl"
+                         : "ltr",
+                     &json);
+    json.append(", \"texts\": [");
+
+    TextResult total;
+    for (auto text = group->texts.begin(); text != group->texts.end();
+         ++text) {
+      TextResult result;
+      if (!MeasureText(font_manager.get(), *text, size, width, iterations,
+                       &result)) {
+        fprintf(stderr, "Can't lay out '%s' (%s)\n", text->c_str(),
+                group->locale.c_str());
+        failed = true;
+        continue;
+      }
+      total.glyphs += result.glyphs;
+      total.cold_us += result.cold_us;
+      total.warm_us += result.warm_us;
+      total.glyphs_rasterized += result.glyphs_rasterized;
+      total.atlas_bytes += result.atlas_bytes;
+      total.buffer_bytes += result.buffer_bytes;
+      total.resize_layouts += result.resize_layouts;
+
+      json.append(text == group->texts.begin() ? "\n" : ",\n");
+      json.append("      {\"text\": ");
+      AppendJsonString(result.text, &json);
+      json.append(", ");
+      AppendJsonNumber("glyphs", static_cast<double>(result.glyphs), false,
+                       &json);
+      AppendJsonNumber("cold_us", result.cold_us, false, &json);
+      AppendJsonNumber("warm_us", result.warm_us, false, &json);
+      AppendJsonNumber("warm_min_us", result.warm_min_us, false, &json);
+      AppendJsonNumber("glyphs_rasterized",
+                       static_cast<double>(result.glyphs_rasterized), false,
+                       &json);
+      AppendJsonNumber("atlas_bytes", static_cast<double>(result.atlas_bytes),
+                       false, &json);
+      AppendJsonNumber("buffer_bytes",
+                       static_cast<double>(result.buffer_bytes), false, &json);
+      AppendJsonNumber("resize_layouts",
+                       static_cast<double>(result.resize_layouts), true,
+                       &json);
+      json.append("}");
+    }
+    json.append("\n    ], \"total\": {");
+    AppendJsonNumber("glyphs", static_cast<double>(total.glyphs), false,
+                     &json);
+    AppendJsonNumber("cold_us", total.cold_us, false, &json);
+    AppendJsonNumber("warm_us", total.warm_us, false, &json);
+    AppendJsonNumber("glyphs_rasterized",
+                     static_cast<double>(total.glyphs_rasterized), false,
+                     &json);
+    AppendJsonNumber("atlas_bytes", static_cast<double>(total.atlas_bytes),
+                     false, &json);
+    AppendJsonNumber("buffer_bytes", static_cast<double>(total.buffer_bytes),
+                     false, &json);
+    AppendJsonNumber("resize_layouts",
+                     static_cast<double>(total.resize_layouts), true, &json);
+    json.append("}, ");
+    size_t log_batches = 0;
+    auto log_us =
+        MeasureLog(font_manager.get(), *group, size, width, &log_batches);
+    if (log_us < 0.0) {
+      fprintf(stderr, "Can't append to the log (%s)\n",
+              group->locale.c_str());
+      failed = true;
+    }
+    AppendJsonNumber("log_append_us", log_us, false, &json);
+    AppendJsonNumber("log_batches", static_cast<double>(log_batches), false,
+                     &json);
+
+    std::string document;
+    for (size_t i = 0; document.size() < kDocumentBytes; ++i) {
+      document.append(group->texts[i % group->texts.size()]);
+      document.push_back('\n');
+    }
+    std::vector<flatui::FontVertex> serial_vertices, parallel_vertices;
+    vec2i serial_size, parallel_size;
+    size_t batches = 0;
+    auto serial_us = MeasureDocument(*group, document, size, width, nullptr,
+                                     &serial_vertices, &serial_size, &batches);
+    auto parallel_us =
+        MeasureDocument(*group, document, size, width, &thread_pool,
+                        &parallel_vertices, &parallel_size, &batches);
+    if (serial_us < 0.0 || parallel_us < 0.0) {
+      fprintf(stderr, "Can't lay out the document (%s)\n",
+              group->locale.c_str());
+      failed = true;
+    } else if (serial_size != parallel_size ||
+               !LayoutsMatch(serial_vertices, parallel_vertices)) {
+      fprintf(stderr, "Parallel layout of the document differs (%s)\n",
+              group->locale.c_str());
+      failed = true;
+    }
+    AppendJsonNumber("document_serial_us", serial_us, false, &json);
+    AppendJsonNumber("document_parallel_us", parallel_us, false, &json);
+    AppendJsonNumber("document_batches", static_cast<double>(batches), false,
+                     &json);
+
+    double streamed, uploaded;
+    MeasureUploads(font_manager.get(), *group, size, width, &streamed,
+                   &uploaded);
+    AppendJsonNumber("stream_bytes_per_frame", streamed, false, &json);
+    AppendJsonNumber("upload_bytes_per_frame", uploaded, true, &json);
+    json.append("}");
+  }
+  json.append("\n  ]\n}\n");
+
+  auto file = output.empty() ? stdout : fopen(output.c_str(), "wb");
+  if (file == nullptr) {
+    fprintf(stderr, "Can't open %s\n", output.c_str());
+    return 1;
+  }
+  auto written = fwrite(json.c_str(), 1, json.size(), file);
+  if (file != stdout) fclose(file);
+  if (written != json.size()) {
+    fprintf(stderr, "Can't write %s\n", output.c_str());
+    return 1;
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,376 @@
+// Copyright 2015 Google Inc. All rights reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// flatui_rasterizer_benchmark validates the in-tree GlyphRasterizer against
+// FreeType's renderer and compares their speed.
+//
+// Every glyph of the font (or the first N glyphs) is rendered with
+// FT_LOAD_RENDER and with FT_LOAD_NO_BITMAP + GlyphRasterizer, the two paths
+// FontManager can take. A glyph fails validation when the bounds of the images
+// differ or a pixel differs by more than the tolerance.
+//
+// Throughput is then measured the way the glyph cache is filled on glyph
+// misses: each glyph is either rendered into a separate image and copied into
+// an atlas, or rendered straight into its atlas slot. The bytes the copies
+// move are reported along with glyphs per second.
+//
+// FreeType flattens curves more coarsely than GlyphRasterizer (up to an eighth
+// of a pixel), so antialiased pixels along curves differ by up to a quarter of
+// the coverage range. The default tolerance allows for it.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Freetype2 header
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#include FT_OUTLINE_H
+
+#include "flatui/internal/glyph_rasterizer.h"
+
+using flatui::GlyphRasterizer;
+using mathfu::vec2i;
+
+// Size of the atlas the glyphs are stored to, like the default glyph cache.
+static const int32_t kAtlasSize = 1024;
+
+// A rendered glyph image.
+struct GlyphImage {
+  vec2i size;
+  vec2i offset;
+  std::vector<uint8_t> pixels;
+};
+
+// Atlas packing glyphs in rows, starting over from the top when it's full.
+struct Atlas {
+  Atlas()
+      : pixels(kAtlasSize * kAtlasSize),
+        cursor(mathfu::kZeros2i),
+        row_height(0),
+        bytes_copied(0) {}
+
+  // Reserve a region and return its top-left pixel. Rows are kAtlasSize bytes
+  // apart.
+  uint8_t *Reserve(const vec2i &size) {
+    if (cursor.x() + size.x() > kAtlasSize) {
+      cursor = vec2i(0, cursor.y() + row_height);
+      row_height = 0;
+    }
+    if (cursor.y() + size.y() > kAtlasSize) {
+      cursor = mathfu::kZeros2i;
+      row_height = 0;
+    }
+    auto region = &pixels[cursor.y() * kAtlasSize + cursor.x()];
+    cursor.x() += size.x();
+    row_height = std::max(row_height, size.y());
+    return region;
+  }
+
+  // Reserve a region and copy an image with a pitch of its width into it.
+  void Store(const uint8_t *image, const vec2i &size) {
+    auto region = Reserve(size);
+    for (int32_t y = 0; y < size.y(); ++y) {
+      std::copy(image + y * size.x(), image + (y + 1) * size.x(),
+                region + y * kAtlasSize);
+    }
+    bytes_copied += size.x() * size.y();
+  }
+
+  std::vector<uint8_t> pixels;
+  vec2i cursor;
+  int32_t row_height;
+  size_t bytes_copied;
+};
+
+static void PrintUsage() {
+  printf(
+      "Usage: flatui_rasterizer_benchmark [options] <font file>\n"
+      "Options:\n"
+      "  -s, --size <pixels>      Font size (default: 32).\n"
+      "  -n, --glyphs <count>     Number of glyphs to render, 0 for all\n"
+      "                           glyphs of the font (default: 0).\n"
+      "  -r, --repeat <count>     Timed passes over the glyphs. The fastest\n"
+      "                           pass is reported (default: 3).\n"
+      "  -t, --tolerance <value>  Largest pixel difference accepted, from 0\n"
+      "                           to 255 (default: 64).\n");
+}
+
+static double Seconds(std::chrono::steady_clock::duration duration) {
+  return std::chrono::duration<double>(duration).count();
+}
+
+static bool RenderFreeType(FT_Face face, FT_UInt glyph, GlyphImage *image) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_RENDER)) return false;
+  auto slot = face->glyph;
+  image->size = vec2i(slot->bitmap.width, slot->bitmap.rows);
+  image->offset = vec2i(slot->bitmap_left, slot->bitmap_top);
+  image->pixels.resize(slot->bitmap.width * slot->bitmap.rows);
+  for (unsigned int y = 0; y < slot->bitmap.rows; ++y) {
+    auto row = slot->bitmap.buffer + y * slot->bitmap.pitch;
+    std::copy(row, row + slot->bitmap.width,
+              &image->pixels[y * slot->bitmap.width]);
+  }
+  return true;
+}
+
+static bool RenderInTree(FT_Face face, FT_UInt glyph,
+                         GlyphRasterizer *rasterizer, GlyphImage *image) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_NO_BITMAP)) return false;
+  if (face->glyph->format != FT_GLYPH_FORMAT_OUTLINE) return false;
+  vec2i size, offset;
+  auto pixels = rasterizer->Rasterize(face->glyph->outline, &size, &offset);
+  image->size = size;
+  image->offset = offset;
+  image->pixels.assign(pixels, pixels + size.x() * size.y());
+  return true;
+}
+
+// Render with FreeType into a glyph slot, then copy to the atlas.
+static void StoreFreeType(FT_Face face, FT_UInt glyph, Atlas *atlas) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_RENDER)) return;
+  auto &bitmap = face->glyph->bitmap;
+  atlas->Store(bitmap.buffer, vec2i(bitmap.width, bitmap.rows));
+}
+
+// Render with FreeType straight into an atlas slot.
+static void StoreFreeTypeDirect(FT_Library library, FT_Face face, FT_UInt glyph,
+                                Atlas *atlas) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_NO_BITMAP)) return;
+  auto &outline = face->glyph->outline;
+  vec2i size, offset;
+  GlyphRasterizer::GetBounds(outline, &size, &offset);
+  auto region = atlas->Reserve(size);
+  if (!size.x() || !size.y()) return;
+  for (int32_t y = 0; y < size.y(); ++y) {
+    memset(region + y * kAtlasSize, 0, size.x());
+  }
+  FT_Bitmap bitmap;
+  memset(&bitmap, 0, sizeof(bitmap));
+  bitmap.rows = size.y();
+  bitmap.width = size.x();
+  bitmap.pitch = kAtlasSize;
+  bitmap.buffer = region;
+  bitmap.num_grays = 256;
+  bitmap.pixel_mode = FT_PIXEL_MODE_GRAY;
+  // The bottom-left corner of the image is the origin of the bitmap.
+  FT_Outline_Translate(&outline, -offset.x() * 64,
+                       (size.y() - offset.y()) * 64);
+  FT_Outline_Get_Bitmap(library, &outline, &bitmap);
+}
+
+// Render with GlyphRasterizer into its own image, then copy to the atlas.
+static void StoreInTree(FT_Face face, FT_UInt glyph,
+                        GlyphRasterizer *rasterizer, Atlas *atlas) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_NO_BITMAP)) return;
+  vec2i size, offset;
+  auto image = rasterizer->Rasterize(face->glyph->outline, &size, &offset);
+  atlas->Store(image, size);
+}
+
+// Render with GlyphRasterizer straight into an atlas slot.
+static void StoreInTreeDirect(FT_Face face, FT_UInt glyph,
+                              GlyphRasterizer *rasterizer, Atlas *atlas) {
+  if (FT_Load_Glyph(face, glyph, FT_LOAD_NO_BITMAP)) return;
+  auto &outline = face->glyph->outline;
+  vec2i size, offset;
+  GlyphRasterizer::GetBounds(outline, &size, &offset);
+  rasterizer->Rasterize(outline, atlas->Reserve(size), kAtlasSize);
+}
+
+// Largest pixel difference of two images, compared over their union.
+static int CompareImages(const GlyphImage &a, const GlyphImage &b) {
+  // Offsets are the left and top bearings, with y going up.
+  auto left = std::min(a.offset.x(), b.offset.x());
+  auto top = std::max(a.offset.y(), b.offset.y());
+  auto right =
+      std::max(a.offset.x() + a.size.x(), b.offset.x() + b.size.x());
+  auto bottom =
+      std::min(a.offset.y() - a.size.y(), b.offset.y() - b.size.y());
+  auto pixel = [](const GlyphImage &image, int x, int y) {
+    auto ix = x - image.offset.x();
+    auto iy = image.offset.y() - y;
+    if (ix < 0 || iy < 0 || ix >= image.size.x() || iy >= image.size.y()) {
+      return 0;
+    }
+    return static_cast<int>(image.pixels[iy * image.size.x() + ix]);
+  };
+  int largest = 0;
+  for (int y = top; y > bottom; --y) {
+    for (int x = left; x < right; ++x) {
+      largest = std::max(largest, std::abs(pixel(a, x, y) - pixel(b, x, y)));
+    }
+  }
+  return largest;
+}
+
+int main(int argc, char **argv) {
+  std::string font;
+  int32_t size = 32;
+  int glyph_limit = 0;
+  int repeat = 3;
+  int tolerance = 64;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "-h" || arg == "--help") {
+      PrintUsage();
+      return 0;
+    }
+    if (arg[0] != '-') {
+      font = arg;
+      continue;
+    }
+    if (i + 1 >= argc) {
+      fprintf(stderr, "Missing value of %s\n", argv[i]);
+      PrintUsage();
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "-s" || arg == "--size") {
+      size = std::max(atoi(value), 1);
+    } else if (arg == "-n" || arg == "--glyphs") {
+      glyph_limit = std::max(atoi(value), 0);
+    } else if (arg == "-r" || arg == "--repeat") {
+      repeat = std::max(atoi(value), 1);
+    } else if (arg == "-t" || arg == "--tolerance") {
+      tolerance = std::max(atoi(value), 0);
+    } else {
+      fprintf(stderr, "Unknown option %s\n", argv[i - 1]);
+      PrintUsage();
+      return 1;
+    }
+  }
+  if (font.empty()) {
+    PrintUsage();
+    return 1;
+  }
+
+  FT_Library library;
+  FT_Face face;
+  if (FT_Init_FreeType(&library)) {
+    fprintf(stderr, "Can't initialize FreeType\n");
+    return 1;
+  }
+  if (FT_New_Face(library, font.c_str(), 0, &face)) {
+    fprintf(stderr, "Can't open font %s\n", font.c_str());
+    FT_Done_FreeType(library);
+    return 1;
+  }
+  FT_Set_Pixel_Sizes(face, 0, size);
+  auto glyph_count = static_cast<FT_UInt>(face->num_glyphs);
+  if (glyph_limit) {
+    glyph_count = std::min(glyph_count, static_cast<FT_UInt>(glyph_limit));
+  }
+
+  // Validation.
+  GlyphRasterizer rasterizer;
+  GlyphImage reference, image;
+  int failures = 0;
+  int worst = 0;
+  FT_UInt worst_glyph = 0;
+  std::unique_ptr<Atlas> atlas(new Atlas());
+  for (FT_UInt glyph = 0; glyph < glyph_count; ++glyph) {
+    if (!RenderFreeType(face, glyph, &reference)) continue;
+    if (!RenderInTree(face, glyph, &rasterizer, &image)) continue;
+    auto difference = CompareImages(reference, image);
+    bool bounds = reference.size.x() == image.size.x() &&
+                  reference.size.y() == image.size.y() &&
+                  reference.offset.x() == image.offset.x() &&
+                  reference.offset.y() == image.offset.y();
+
+    // Images rendered into the atlas need to match the ones that are copied.
+    atlas->cursor = mathfu::kZeros2i;
+    StoreFreeTypeDirect(library, face, glyph, atlas.get());
+    StoreInTreeDirect(face, glyph, &rasterizer, atlas.get());
+    auto width = image.size.x();
+    for (int32_t y = 0; bounds && y < image.size.y(); ++y) {
+      auto row = &atlas->pixels[y * kAtlasSize];
+      if (!std::equal(row, row + width, &reference.pixels[y * width]) ||
+          !std::equal(row + width, row + width * 2, &image.pixels[y * width])) {
+        fprintf(stderr, "Glyph %u: image rendered into the atlas differs\n",
+                glyph);
+        failures++;
+        break;
+      }
+    }
+
+    if (!bounds || difference > tolerance) {
+      if (failures < 10) {
+        fprintf(stderr,
+                "Glyph %u: size %dx%d/%dx%d offset %d,%d/%d,%d "
+                "max difference %d\n",
+                glyph, reference.size.x(), reference.size.y(), image.size.x(),
+                image.size.y(), reference.offset.x(), reference.offset.y(),
+                image.offset.x(), image.offset.y(), difference);
+      }
+      failures++;
+    }
+    if (difference > worst) {
+      worst = difference;
+      worst_glyph = glyph;
+    }
+  }
+
+  // Throughput of filling the atlas, loading the glyphs the way FontManager
+  // does. The fastest pass of each path is kept.
+  enum { kFreeType, kFreeTypeDirect, kInTree, kInTreeDirect, kPathCount };
+  double times[kPathCount] = {};
+  size_t bytes_copied = 0;
+  for (int pass = 0; pass < repeat; ++pass) {
+    for (int path = 0; path < kPathCount; ++path) {
+      atlas->bytes_copied = 0;
+      auto start = std::chrono::steady_clock::now();
+      for (FT_UInt glyph = 0; glyph < glyph_count; ++glyph) {
+        switch (path) {
+          case kFreeType:
+            StoreFreeType(face, glyph, atlas.get());
+            break;
+          case kFreeTypeDirect:
+            StoreFreeTypeDirect(library, face, glyph, atlas.get());
+            break;
+          case kInTree:
+            StoreInTree(face, glyph, &rasterizer, atlas.get());
+            break;
+          case kInTreeDirect:
+            StoreInTreeDirect(face, glyph, &rasterizer, atlas.get());
+            break;
+        }
+      }
+      auto elapsed = Seconds(std::chrono::steady_clock::now() - start);
+      times[path] = pass ? std::min(times[path], elapsed) : elapsed;
+      if (path == kFreeType) bytes_copied = atlas->bytes_copied;
+    }
+  }
+
+  printf("Font: %s, size: %d, glyphs: %u\n", font.c_str(), size, glyph_count);
+  printf("Atlas fill (glyphs/s)   copy      direct\n");
+  printf("FreeType:        %10.0f  %10.0f\n", glyph_count / times[kFreeType],
+         glyph_count / times[kFreeTypeDirect]);
+  printf("GlyphRasterizer: %10.0f  %10.0f\n", glyph_count / times[kInTree],
+         glyph_count / times[kInTreeDirect]);
+  printf("Bytes copied per pass: %zu (%.0f per glyph), 0 when direct\n",
+         bytes_copied, static_cast<double>(bytes_copied) / glyph_count);
+  printf("Largest difference: %d (glyph %u), failures: %d\n", worst,
+         worst_glyph, failures);
+
+  FT_Done_Face(face);
+  FT_Done_FreeType(library);
+  return failures ? 1 : 0;
+}